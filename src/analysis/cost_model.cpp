@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/cost_model.hpp>
+
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/ast/ast.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+// Rough per-operation weights, modelled on the instructions the wasm backend emits.
+constexpr std::uint64_t simpleCost = 1;
+constexpr std::uint64_t multiplyCost = 3;
+constexpr std::uint64_t constantDivisionCost = 6;
+constexpr std::uint64_t divisionCost = 25;
+constexpr std::uint64_t callCost = 5;
+// Compare, branch and counter increment per iteration.
+constexpr std::uint64_t loopIterationCost = 4;
+constexpr std::uint64_t branchCost = 2;
+// Arms costing more than this are cheaper to skip with a branch than to always evaluate.
+constexpr std::uint64_t maxSelectArmCost = 8;
+
+Cost operator+(Cost const& lhs, Cost const& rhs)
+{
+	std::uint64_t const sum = lhs.instructions > std::numeric_limits<std::uint64_t>::max() - rhs.instructions
+								? std::numeric_limits<std::uint64_t>::max()
+								: lhs.instructions + rhs.instructions;
+	return { sum, lhs.unbounded || rhs.unbounded };
+}
+
+Cost operator*(Cost const& cost, std::uint64_t times)
+{
+	std::uint64_t const product = times != 0 && cost.instructions > std::numeric_limits<std::uint64_t>::max() / times
+									? std::numeric_limits<std::uint64_t>::max()
+									: cost.instructions * times;
+	return { product, cost.unbounded };
+}
+
+Cost max(Cost const& lhs, Cost const& rhs)
+{
+	return { std::max(lhs.instructions, rhs.instructions), lhs.unbounded || rhs.unbounded };
+}
+
+// Literal divisors other than 0 and -1 are the only divisions that can not trap.
+bool canSpeculate(Expression const& expression)// NOLINT(misc-no-recursion)
+{
+	if (std::holds_alternative<Literal>(expression.expr) || std::holds_alternative<VarExpression>(expression.expr))
+	{
+		return true;
+	}
+	if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
+	{
+		if (binaryOp->op == BinaryOperator::divide || binaryOp->op == BinaryOperator::modulo)
+		{
+			auto const* divisor = std::get_if<Literal>(&binaryOp->rhs->expr);
+			if (divisor == nullptr || divisor->value == 0 || divisor->value == -1)
+			{
+				return false;
+			}
+		}
+		return canSpeculate(*binaryOp->lhs) && canSpeculate(*binaryOp->rhs);
+	}
+	if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+	{
+		return canSpeculate(*conditional->condition) && canSpeculate(*conditional->whenTrue)
+			&& canSpeculate(*conditional->whenFalse);
+	}
+	return false;
+}
+
+std::uint64_t operatorCost(BinaryOpExpression const& binaryOp)
+{
+	switch (binaryOp.op)
+	{
+	case BinaryOperator::multiply:
+		return multiplyCost;
+	case BinaryOperator::divide:
+	case BinaryOperator::modulo:
+		return std::holds_alternative<Literal>(binaryOp.rhs->expr) ? constantDivisionCost : divisionCost;
+	default:
+		return simpleCost;
+	}
+}
+
+template<typename CalleeCost>
+Cost expressionCost(Expression const& expression, CalleeCost const& calleeCost)// NOLINT(misc-no-recursion)
+{
+	if (auto const* initAssignment = std::get_if<InitAssignment>(&expression.expr))
+	{
+		return Cost{ simpleCost } + expressionCost(*initAssignment->value, calleeCost);
+	}
+	if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
+	{
+		return Cost{ operatorCost(*binaryOp) } + expressionCost(*binaryOp->lhs, calleeCost)
+			 + expressionCost(*binaryOp->rhs, calleeCost);
+	}
+	if (auto const* functionCall = std::get_if<FunctionCall>(&expression.expr))
+	{
+		Cost cost = Cost{ callCost } + calleeCost(functionCall->functionName);
+		for (auto const& argument : functionCall->arguments)
+		{
+			cost = cost + expressionCost(argument.expr, calleeCost);
+		}
+		return cost;
+	}
+	if (auto const* loop = std::get_if<LoopExpression>(&expression.expr))
+	{
+		Cost const setup = expressionCost(*loop->from, calleeCost) + expressionCost(*loop->to, calleeCost)
+						 + expressionCost(*loop->initial, calleeCost);
+		Cost const iteration = Cost{ loopIterationCost } + expressionCost(*loop->body, calleeCost);
+		auto const* from = std::get_if<Literal>(&loop->from->expr);
+		auto const* to = std::get_if<Literal>(&loop->to->expr);
+		if (from == nullptr || to == nullptr)
+		{
+			return setup + iteration + Cost{ 0, true };
+		}
+		// The difference of extreme i64 bounds does not fit an i64, but always fits unsigned.
+		std::uint64_t const trips = to->value > from->value
+									  ? static_cast<std::uint64_t>(to->value) - static_cast<std::uint64_t>(from->value)
+									  : 0;
+		return setup + Cost{ loopIterationCost } + iteration * trips;
+	}
+	if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+	{
+		Cost const condition = expressionCost(*conditional->condition, calleeCost);
+		Cost const whenTrue = expressionCost(*conditional->whenTrue, calleeCost);
+		Cost const whenFalse = expressionCost(*conditional->whenFalse, calleeCost);
+		if (prefersSelect(*conditional))
+		{
+			return Cost{ simpleCost } + condition + whenTrue + whenFalse;
+		}
+		return Cost{ branchCost } + condition + max(whenTrue, whenFalse);
+	}
+	if (auto const* let = std::get_if<LetExpression>(&expression.expr))
+	{
+		// Reserving and releasing the array, plus a store per element.
+		std::uint64_t const length = std::get<ArrayType>(let->type->t).length;
+		Cost cost = Cost{ 2 * simpleCost + length * simpleCost } + expressionCost(*let->body, calleeCost);
+		for (auto const& element : let->elements)
+		{
+			cost = cost + expressionCost(*element, calleeCost);
+		}
+		if (let->generator)
+		{
+			cost = cost + (Cost{ loopIterationCost } + expressionCost(*let->generator, calleeCost)) * length;
+		}
+		return cost;
+	}
+	if (auto const* index = std::get_if<IndexExpression>(&expression.expr))
+	{
+		return Cost{ 2 * simpleCost } + expressionCost(*index->index, calleeCost);
+	}
+	return Cost{ simpleCost };
+}
+
+class CostEstimator
+{
+public:
+	explicit CostEstimator(Program const& estimatedProgram)
+		: program(estimatedProgram)
+	{
+		for (std::size_t i = 0; i < program.functions.size(); ++i)
+		{
+			indices.try_emplace(program.functions[i]->name, i);
+		}
+		states.resize(program.functions.size(), VisitState::unvisited);
+		model.functions.resize(program.functions.size());
+	}
+
+	CostModel run()
+	{
+		for (std::size_t i = 0; i < program.functions.size(); ++i)
+		{
+			FunctionCost& functionCost = model.functions[i];
+			functionCost.function = program.functions[i].get();
+			functionCost.self = expressionCost(functionCost.function->expression, [](std::string const&) {
+				return Cost{};
+			});
+			functionCost.recursive = reachesCall(i, [&](FunctionCall const& callSite) {
+				auto calleeIt = indices.find(callSite.functionName);
+				return calleeIt != indices.end() && calleeIt->second == i;
+			});
+			functionCost.callsHost = reachesCall(i, [this](FunctionCall const& callSite) {
+				return program.findHostFunction(callSite.functionName) != nullptr;
+			});
+		}
+
+		for (std::size_t i = 0; i < program.functions.size(); ++i)
+		{
+			inclusiveCost(i);
+		}
+		return std::move(model);
+	}
+
+private:
+	enum struct VisitState
+	{
+		unvisited,
+		visiting,
+		done,
+	};
+
+	Program const& program;
+	std::map<std::string, std::size_t, std::less<>> indices;
+	std::vector<VisitState> states;
+	CostModel model;
+
+	/// Whether a call site matching the predicate is in the given function or in any function it calls.
+	template<typename Predicate>
+	bool reachesCall(std::size_t from, Predicate const& matches) const
+	{
+		std::vector<std::size_t> pending{ from };
+		std::vector<bool> visited(program.functions.size(), false);
+		while (!pending.empty())
+		{
+			std::size_t const current = pending.back();
+			pending.pop_back();
+			for (FunctionCall const* callSite : collectCallSites(*program.functions[current]))
+			{
+				if (matches(*callSite))
+				{
+					return true;
+				}
+				auto calleeIt = indices.find(callSite->functionName);
+				if (calleeIt == indices.end())
+				{
+					continue;
+				}
+				if (!visited[calleeIt->second])
+				{
+					visited[calleeIt->second] = true;
+					pending.push_back(calleeIt->second);
+				}
+			}
+		}
+		return false;
+	}
+
+	Cost inclusiveCost(std::size_t index)// NOLINT(misc-no-recursion)
+	{
+		switch (states[index])
+		{
+		case VisitState::done:
+			return model.functions[index].inclusive;
+		case VisitState::visiting:
+			// Reached through recursion, the number of iterations is unknown.
+			return Cost{ 0, true };
+		case VisitState::unvisited:
+		default:
+			break;
+		}
+
+		states[index] = VisitState::visiting;
+		Cost const inclusive
+			= expressionCost(program.functions[index]->expression, [this](std::string const& calleeName) {
+				  auto calleeIt = indices.find(calleeName);
+				  return calleeIt != indices.end() ? inclusiveCost(calleeIt->second) : Cost{};
+			  });
+		model.functions[index].inclusive = inclusive;
+		states[index] = VisitState::done;
+		return inclusive;
+	}
+};
+}
+
+FunctionCost const* CostModel::find(std::string_view functionName) const
+{
+	auto functionIt = std::ranges::find_if(
+		functions, [&](FunctionCost const& functionCost) { return functionCost.function->name == functionName; });
+	return functionIt != functions.end() ? &*functionIt : nullptr;
+}
+
+Cost CostModel::costOf(Expression const& expression) const
+{
+	return expressionCost(expression, [this](std::string const& calleeName) {
+		FunctionCost const* callee = find(calleeName);
+		return callee != nullptr ? callee->inclusive : Cost{};
+	});
+}
+
+CostModel estimateCosts(Program const& program)
+{
+	return CostEstimator(program).run();
+}
+
+bool prefersSelect(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+{
+	auto const isCheapArm = [](Expression const& arm) {
+		return canSpeculate(arm)
+			&& expressionCost(arm, [](std::string const&) { return Cost{}; }).instructions <= maxSelectArmCost;
+	};
+	return isCheapArm(*conditional.whenTrue) && isCheapArm(*conditional.whenFalse);
+}
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/division.hpp>
+
+#include <bit>
+#include <cstdint>
+
+namespace jereq
+{
+namespace
+{
+struct MagicNumber
+{
+	std::int32_t multiplier;
+	std::uint32_t shift;
+};
+
+// Hacker's Delight, 2nd ed., figure 10-1. Valid for 2 <= |divisor|, excluding powers of two which are handled
+// separately.
+MagicNumber computeMagicNumber(std::int32_t divisor)
+{
+	constexpr std::uint32_t two31 = 0x8000'0000U;
+	constexpr std::uint32_t signShift = 31;
+
+	auto const unsignedDivisor = static_cast<std::uint32_t>(divisor);
+	std::uint32_t const absDivisor = divisor < 0 ? 0U - unsignedDivisor : unsignedDivisor;
+	std::uint32_t const t = two31 + (unsignedDivisor >> signShift);
+	std::uint32_t const absNc = t - 1 - t % absDivisor;
+
+	std::uint32_t p = signShift;
+	std::uint32_t q1 = two31 / absNc;
+	std::uint32_t r1 = two31 - q1 * absNc;
+	std::uint32_t q2 = two31 / absDivisor;
+	std::uint32_t r2 = two31 - q2 * absDivisor;
+	std::uint32_t delta = 0;
+	do
+	{
+		++p;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= absNc)
+		{
+			++q1;
+			r1 -= absNc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= absDivisor)
+		{
+			++q2;
+			r2 -= absDivisor;
+		}
+		delta = absDivisor - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	std::uint32_t const magic = q2 + 1;
+	return { static_cast<std::int32_t>(divisor < 0 ? 0U - magic : magic), p - 32 };
+}
+}
+
+SignedDivisor analyzeDivisor(std::int32_t divisor)
+{
+	SignedDivisor result;
+	result.divisor = divisor;
+
+	// Division by 0 must keep its trap and -1 its overflow behaviour for INT32_MIN, so leave those to the hardware.
+	if (divisor == 0 || divisor == -1)
+	{
+		result.strategy = DivisionStrategy::hardware;
+		return result;
+	}
+
+	if (divisor == 1)
+	{
+		result.strategy = DivisionStrategy::identity;
+		return result;
+	}
+
+	auto const unsignedDivisor = static_cast<std::uint32_t>(divisor);
+	std::uint32_t const absDivisor = divisor < 0 ? 0U - unsignedDivisor : unsignedDivisor;
+	if (std::has_single_bit(absDivisor))
+	{
+		result.strategy = DivisionStrategy::powerOfTwo;
+		result.shift = static_cast<std::uint32_t>(std::countr_zero(absDivisor));
+		return result;
+	}
+
+	constexpr std::int64_t two32 = std::int64_t{ 1 } << 32;
+	auto const [multiplier, shift] = computeMagicNumber(divisor);
+	result.strategy = DivisionStrategy::multiplyHigh;
+	result.wideMultiplier = multiplier;
+	if (divisor > 0 && multiplier < 0)
+	{
+		result.wideMultiplier += two32;
+	}
+	else if (divisor < 0 && multiplier > 0)
+	{
+		result.wideMultiplier -= two32;
+	}
+	result.shift = 32 + shift;
+	return result;
+}
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string_view>
+#include <vector>
+
+namespace jereq
+{
+/// Estimated number of machine-level instructions. Unbounded costs come from recursion and from loops with bounds that
+/// are not literals, where the number of iterations is unknown.
+struct Cost
+{
+	std::uint64_t instructions = 0;
+	bool unbounded = false;
+
+	friend bool operator==(Cost const& lhs, Cost const& rhs) noexcept = default;
+};
+
+struct FunctionCost
+{
+	Function const* function = nullptr;
+	/// Cost of the function body itself, counting each call as the call overhead only.
+	Cost self;
+	/// Cost of one call including everything it calls.
+	Cost inclusive;
+	bool recursive = false;
+	/// Whether the function calls a host function, directly or through the functions it calls.
+	bool callsHost = false;
+};
+
+struct CostModel
+{
+	std::vector<FunctionCost> functions;
+
+	[[nodiscard]] FunctionCost const* find(std::string_view functionName) const;
+	/// Inclusive cost of evaluating an expression once.
+	[[nodiscard]] Cost costOf(Expression const& expression) const;
+};
+
+CostModel estimateCosts(Program const& program);
+
+/// Whether both arms of a conditional are cheap and can never trap, so evaluating both and picking one without a branch
+/// is cheaper than risking a misprediction.
+bool prefersSelect(ConditionalExpression const& conditional);
+}
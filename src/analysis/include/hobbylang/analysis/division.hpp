@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <cstdint>
+
+namespace jereq
+{
+enum struct DivisionStrategy
+{
+	hardware,
+	identity,
+	powerOfTwo,
+	multiplyHigh,
+};
+
+/// Precomputed replacement for a signed, truncating division by a constant.
+///
+/// For multiplyHigh the quotient is ((n * wideMultiplier) >> shift) computed in 64 bits, plus one if that is negative.
+/// The wide multiplier already includes the +/- n correction of the 32-bit magic number, so the sequence maps directly
+/// onto i64 arithmetic in the backends. For powerOfTwo the shift is log2(|divisor|).
+struct SignedDivisor
+{
+	DivisionStrategy strategy = DivisionStrategy::hardware;
+	std::int32_t divisor = 0;
+	std::int64_t wideMultiplier = 0;
+	std::uint32_t shift = 0;
+};
+
+SignedDivisor analyzeDivisor(std::int32_t divisor);
+
+[[nodiscard]] constexpr std::int32_t powerOfTwoBias(std::int32_t dividend, std::uint32_t shift)
+{
+	constexpr std::uint32_t signShift = 31;
+	auto const signMask = static_cast<std::uint32_t>(dividend >> signShift);
+	return static_cast<std::int32_t>(signMask >> (32 - shift));
+}
+
+[[nodiscard]] constexpr std::int32_t divideByConstant(std::int32_t dividend, SignedDivisor const& divisor)
+{
+	constexpr std::uint32_t signShift = 31;
+	switch (divisor.strategy)
+	{
+	case DivisionStrategy::identity:
+		return dividend;
+	case DivisionStrategy::powerOfTwo:
+	{
+		std::int32_t const quotient = (dividend + powerOfTwoBias(dividend, divisor.shift)) >> divisor.shift;
+		return divisor.divisor < 0 ? -quotient : quotient;
+	}
+	case DivisionStrategy::multiplyHigh:
+	{
+		auto const quotient = static_cast<std::int32_t>(
+			(static_cast<std::int64_t>(dividend) * divisor.wideMultiplier) >> divisor.shift);
+		return quotient + static_cast<std::int32_t>(static_cast<std::uint32_t>(quotient) >> signShift);
+	}
+	case DivisionStrategy::hardware:
+	default:
+		return dividend / divisor.divisor;
+	}
+}
+
+[[nodiscard]] constexpr std::int32_t remainderByConstant(std::int32_t dividend, SignedDivisor const& divisor)
+{
+	switch (divisor.strategy)
+	{
+	case DivisionStrategy::identity:
+		return 0;
+	case DivisionStrategy::powerOfTwo:
+	{
+		auto const mask = static_cast<std::int32_t>(~((1U << divisor.shift) - 1U));
+		return dividend - ((dividend + powerOfTwoBias(dividend, divisor.shift)) & mask);
+	}
+	case DivisionStrategy::multiplyHigh:
+		return dividend - divideByConstant(dividend, divisor) * divisor.divisor;
+	case DivisionStrategy::hardware:
+	default:
+		return dividend % divisor.divisor;
+	}
+}
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <compare>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace jereq
+{
+struct ArgumentProfile
+{
+	std::int32_t firstValue = 0;
+	bool constant = true;
+};
+
+struct CallSiteProfile
+{
+	std::string callee;
+	std::uint64_t count = 0;
+	std::map<std::string, ArgumentProfile> arguments;
+
+	void recordArgument(std::string const& name, std::int32_t value);
+};
+
+/// A call site is identified by its caller and the pre-order position of the call within the caller's body, see
+/// collectCallSites. This stays stable between runs as long as the source is unchanged.
+struct CallSiteId
+{
+	std::string caller;
+	std::uint32_t index = 0;
+
+	friend auto operator<=>(CallSiteId const& lhs, CallSiteId const& rhs) = default;
+};
+
+struct Profile
+{
+	std::map<std::string, std::uint64_t> functionCalls;
+	std::map<CallSiteId, CallSiteProfile> callSites;
+
+	[[nodiscard]] std::uint64_t callCount(std::string const& function) const;
+	[[nodiscard]] std::uint64_t totalCalls() const;
+	[[nodiscard]] CallSiteProfile const* findCallSite(std::string const& caller, std::uint32_t index) const;
+};
+
+void writeProfile(std::ostream& out, Profile const& profile);
+Profile readProfile(std::istream& input);
+
+std::vector<FunctionCall const*> collectCallSites(Function const& function);
+}
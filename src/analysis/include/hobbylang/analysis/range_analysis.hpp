@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace jereq
+{
+struct Interval
+{
+	std::int32_t min = 1;
+	std::int32_t max = 0;
+
+	[[nodiscard]] static constexpr Interval empty() { return {}; }
+	[[nodiscard]] static constexpr Interval full()
+	{
+		return { std::numeric_limits<std::int32_t>::min(), std::numeric_limits<std::int32_t>::max() };
+	}
+	[[nodiscard]] static constexpr Interval constant(std::int32_t value) { return { value, value }; }
+
+	[[nodiscard]] constexpr bool isEmpty() const { return min > max; }
+	[[nodiscard]] constexpr bool contains(std::int32_t value) const { return min <= value && value <= max; }
+
+	friend bool operator==(Interval const& lhs, Interval const& rhs) noexcept = default;
+};
+
+Interval join(Interval const& lhs, Interval const& rhs);
+
+struct RangeAnalysis
+{
+	std::unordered_map<Expression const*, Interval> ranges;
+	std::size_t divisionCount = 0;
+	std::size_t eliminatedDivisionChecks = 0;
+	/// Array accesses whose index is proven to be within the array.
+	std::unordered_set<IndexExpression const*> inBoundsIndices;
+	std::size_t indexCount = 0;
+
+	/// Range of the value produced by an expression, or the full range if it was not analyzed.
+	[[nodiscard]] Interval rangeOf(Expression const& expression) const;
+	/// Whether a division or modulo may divide by zero or overflow (INT32_MIN / -1).
+	[[nodiscard]] bool needsDivisionChecks(BinaryOpExpression const& division) const;
+	/// Whether an array access may be out of bounds.
+	[[nodiscard]] bool needsBoundsCheck(IndexExpression const& index) const;
+};
+
+/// Interval analysis over all functions. Parameters of entry points may take any value, while parameters of other
+/// functions are bounded by the arguments at their call sites.
+RangeAnalysis analyzeRanges(Program const& program, std::vector<Function const*> const& entryPoints);
+/// Same as above, with the main function as the only entry point.
+RangeAnalysis analyzeRanges(Program const& program);
+}
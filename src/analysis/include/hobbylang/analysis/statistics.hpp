@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace jereq
+{
+/// Counts events of a pass over the whole run, such as functions inlined or constants folded. Declare one at namespace
+/// scope in the translation unit that counts, with string literals for the names. Each thread counts into a fixed array
+/// of its own with relaxed loads and stores, so counting takes no locks or atomic read-modify-writes and is cheap enough
+/// for hot paths. The counts of all threads are merged by collectStatistics.
+class Statistic
+{
+public:
+	/// Maximum number of statistics declared in the program.
+	static constexpr std::size_t capacity = 64;
+
+	Statistic(std::string_view pass, std::string_view description);
+	Statistic(Statistic const&) = delete;
+	Statistic(Statistic&&) = delete;
+	Statistic& operator=(Statistic const&) = delete;
+	Statistic& operator=(Statistic&&) = delete;
+	~Statistic() = default;
+
+	Statistic& operator++()
+	{
+		*this += 1;
+		return *this;
+	}
+
+	Statistic& operator+=(std::uint64_t count);
+
+	[[nodiscard]] std::string_view pass() const { return passName; }
+	[[nodiscard]] std::string_view description() const { return descriptionText; }
+
+private:
+	std::string_view passName;
+	std::string_view descriptionText;
+	/// Position of this statistic's count in the counts of each thread.
+	std::size_t index;
+};
+
+struct StatisticValue
+{
+	std::string_view pass;
+	std::string_view description;
+	std::uint64_t value = 0;
+};
+
+/// Values of every declared statistic, summed over all threads and ordered by pass and description. Threads that are
+/// still counting may add to the values after they have been read.
+std::vector<StatisticValue> collectStatistics();
+}
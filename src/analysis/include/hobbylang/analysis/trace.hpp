@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jereq
+{
+/// Records timed spans of work on every thread that takes part in compiling or executing a program, and writes them as
+/// Chrome trace events, which chrome://tracing and Perfetto show as one timeline per thread. Each thread appends to a
+/// buffer of its own, so recording only takes a lock the first time a thread records a span. The buffers are merged
+/// when the trace is written.
+class Tracer
+{
+public:
+	Tracer();
+	Tracer(Tracer const&) = delete;
+	Tracer(Tracer&&) = delete;
+	Tracer& operator=(Tracer const&) = delete;
+	Tracer& operator=(Tracer&&) = delete;
+	~Tracer();
+
+	/// Records the time from construction to destruction as a span on the calling thread. Spans on the same thread
+	/// nest. Does nothing without a tracer.
+	class Span
+	{
+	public:
+		Span(Tracer* activeTracer, std::string_view spanCategory, std::string_view spanName);
+		Span(Span const&) = delete;
+		Span(Span&&) = delete;
+		Span& operator=(Span const&) = delete;
+		Span& operator=(Span&&) = delete;
+		~Span();
+
+	private:
+		Tracer* tracer;
+		std::string_view category;
+		std::string name;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	/// Writes the spans of every thread as a JSON trace. Call once the traced work has finished on all threads.
+	void writeTraceEvents(std::ostream& out) const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Event
+	{
+		std::string_view category;
+		std::string name;
+		Clock::duration start;
+		Clock::duration duration;
+	};
+
+	struct ThreadBuffer
+	{
+		std::uint32_t threadIndex = 0;
+		std::vector<Event> events;
+	};
+
+	/// Distinguishes tracers in the per-thread cache, which must not mistake a new tracer for a destroyed one at the
+	/// same address.
+	std::uint64_t id;
+	Clock::time_point origin = Clock::now();
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+	ThreadBuffer& threadBuffer();
+};
+}
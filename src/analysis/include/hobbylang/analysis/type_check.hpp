@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <unordered_map>
+
+namespace jereq
+{
+struct TypeInfo
+{
+	std::unordered_map<Expression const*, ValueType> types;
+
+	/// Type of the value produced by an expression. Expressions that were not checked are assumed to be i32.
+	[[nodiscard]] ValueType typeOf(Expression const& expression) const;
+};
+
+/// Infers the value type of every expression and checks that operands, arms, arguments and assignments agree,
+/// throwing on the first mismatch. Names that can not be resolved are assumed to be i32 and left for the backends to
+/// report.
+TypeInfo checkTypes(Program const& program);
+}
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/profile.hpp>
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <charconv>
+#include <cstdint>
+#include <istream>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+constexpr std::string_view profileHeader = "hobby-profile";
+constexpr int profileVersion = 1;
+
+void collectCallSites(Expression const& expression, std::vector<FunctionCall const*>& callSites)// NOLINT(misc-no-recursion)
+{
+	if (auto const* initAssignment = std::get_if<InitAssignment>(&expression.expr))
+	{
+		collectCallSites(*initAssignment->value, callSites);
+	}
+	else if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
+	{
+		collectCallSites(*binaryOp->lhs, callSites);
+		collectCallSites(*binaryOp->rhs, callSites);
+	}
+	else if (auto const* functionCall = std::get_if<FunctionCall>(&expression.expr))
+	{
+		callSites.push_back(functionCall);
+		for (auto const& argument : functionCall->arguments)
+		{
+			collectCallSites(argument.expr, callSites);
+		}
+	}
+	else if (auto const* loop = std::get_if<LoopExpression>(&expression.expr))
+	{
+		collectCallSites(*loop->from, callSites);
+		collectCallSites(*loop->to, callSites);
+		collectCallSites(*loop->initial, callSites);
+		collectCallSites(*loop->body, callSites);
+	}
+	else if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+	{
+		collectCallSites(*conditional->condition, callSites);
+		collectCallSites(*conditional->whenTrue, callSites);
+		collectCallSites(*conditional->whenFalse, callSites);
+	}
+	else if (auto const* let = std::get_if<LetExpression>(&expression.expr))
+	{
+		for (auto const& element : let->elements)
+		{
+			collectCallSites(*element, callSites);
+		}
+		if (let->generator)
+		{
+			collectCallSites(*let->generator, callSites);
+		}
+		collectCallSites(*let->body, callSites);
+	}
+	else if (auto const* index = std::get_if<IndexExpression>(&expression.expr))
+	{
+		collectCallSites(*index->index, callSites);
+	}
+}
+
+[[noreturn]] void malformedProfile(std::string_view line)
+{
+	throw std::runtime_error("Malformed profile line: " + std::string(line));
+}
+}
+
+void CallSiteProfile::recordArgument(std::string const& name, std::int32_t value)
+{
+	auto [argumentIt, inserted] = arguments.try_emplace(name, ArgumentProfile{ value, true });
+	if (!inserted && argumentIt->second.firstValue != value)
+	{
+		argumentIt->second.constant = false;
+	}
+}
+
+std::uint64_t Profile::callCount(std::string const& function) const
+{
+	auto callsIt = functionCalls.find(function);
+	return callsIt != functionCalls.end() ? callsIt->second : 0;
+}
+
+std::uint64_t Profile::totalCalls() const
+{
+	return std::accumulate(functionCalls.begin(),
+		functionCalls.end(),
+		std::uint64_t{ 0 },
+		[](std::uint64_t sum, auto const& functionCall) { return sum + functionCall.second; });
+}
+
+CallSiteProfile const* Profile::findCallSite(std::string const& caller, std::uint32_t index) const
+{
+	auto callSiteIt = callSites.find(CallSiteId{ caller, index });
+	return callSiteIt != callSites.end() ? &callSiteIt->second : nullptr;
+}
+
+void writeProfile(std::ostream& out, Profile const& profile)
+{
+	out << profileHeader << ' ' << profileVersion << '\n';
+	for (auto const& [function, count] : profile.functionCalls)
+	{
+		out << "function " << function << ' ' << count << '\n';
+	}
+	for (auto const& [id, callSite] : profile.callSites)
+	{
+		out << "callsite " << id.caller << ' ' << id.index << ' ' << callSite.callee << ' ' << callSite.count;
+		for (auto const& [name, argument] : callSite.arguments)
+		{
+			out << ' ' << name << '=';
+			if (argument.constant)
+			{
+				out << argument.firstValue;
+			}
+			else
+			{
+				out << '*';
+			}
+		}
+		out << '\n';
+	}
+}
+
+Profile readProfile(std::istream& input)
+{
+	Profile profile;
+
+	std::string line;
+	if (!std::getline(input, line) || line != std::string(profileHeader) + " " + std::to_string(profileVersion))
+	{
+		throw std::runtime_error("Unsupported profile format");
+	}
+
+	while (std::getline(input, line))
+	{
+		std::istringstream lineInput(line);
+		std::string kind;
+		if (!(lineInput >> kind))
+		{
+			continue;
+		}
+
+		if (kind == "function")
+		{
+			std::string function;
+			std::uint64_t count = 0;
+			if (!(lineInput >> function >> count))
+			{
+				malformedProfile(line);
+			}
+			profile.functionCalls[function] += count;
+		}
+		else if (kind == "callsite")
+		{
+			CallSiteId id;
+			CallSiteProfile callSite;
+			if (!(lineInput >> id.caller >> id.index >> callSite.callee >> callSite.count))
+			{
+				malformedProfile(line);
+			}
+
+			std::string argument;
+			while (lineInput >> argument)
+			{
+				auto separator = argument.find('=');
+				if (separator == std::string::npos || separator + 1 == argument.size())
+				{
+					malformedProfile(line);
+				}
+
+				std::string const value = argument.substr(separator + 1);
+				ArgumentProfile& argumentProfile = callSite.arguments[argument.substr(0, separator)];
+				if (value == "*")
+				{
+					argumentProfile.constant = false;
+				}
+				else
+				{
+					char const* const end = value.data() + value.size();
+					auto const [parsedEnd, error] = std::from_chars(value.data(), end, argumentProfile.firstValue);
+					if (error != std::errc() || parsedEnd != end)
+					{
+						malformedProfile(line);
+					}
+				}
+			}
+			profile.callSites[id] = std::move(callSite);
+		}
+		else
+		{
+			malformedProfile(line);
+		}
+	}
+
+	return profile;
+}
+
+std::vector<FunctionCall const*> collectCallSites(Function const& function)
+{
+	std::vector<FunctionCall const*> callSites;
+	collectCallSites(function.expression, callSites);
+	return callSites;
+}
+}
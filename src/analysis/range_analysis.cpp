@@ -0,0 +1,632 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/range_analysis.hpp>
+
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/type_check.hpp>
+#include <hobbylang/ast/ast.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+Statistic divisionsAnalyzed("range analysis", "Divisions analyzed");
+Statistic divisionChecksEliminated("range analysis", "Division checks eliminated");
+Statistic indicesAnalyzed("range analysis", "Array indices analyzed");
+Statistic boundsChecksEliminated("range analysis", "Bounds checks eliminated");
+
+constexpr std::int64_t int32Min = std::numeric_limits<std::int32_t>::min();
+constexpr std::int64_t int32Max = std::numeric_limits<std::int32_t>::max();
+
+// Results outside of i32 wrap around, so anything that may overflow covers the full range.
+Interval fromWide(std::initializer_list<std::int64_t> candidates)
+{
+	auto [min, max] = std::ranges::minmax(candidates);
+	if (min < int32Min || int32Max < max)
+	{
+		return Interval::full();
+	}
+	return { static_cast<std::int32_t>(min), static_cast<std::int32_t>(max) };
+}
+
+Interval divideIntervals(Interval const& dividend, Interval const& divisor)
+{
+	Interval result = Interval::empty();
+	auto divideByPart = [&](std::int64_t divisorMin, std::int64_t divisorMax) {
+		std::int64_t const a = dividend.min;
+		std::int64_t const b = dividend.max;
+		auto [min, max] = std::ranges::minmax({ a / divisorMin, a / divisorMax, b / divisorMin, b / divisorMax });
+		// Only INT32_MIN / -1 is out of range, and that traps instead of producing a value.
+		result = join(result,
+			Interval{ static_cast<std::int32_t>(std::clamp(min, int32Min, int32Max)),
+				static_cast<std::int32_t>(std::clamp(max, int32Min, int32Max)) });
+	};
+
+	if (divisor.min < 0)
+	{
+		divideByPart(divisor.min, std::min<std::int64_t>(divisor.max, -1));
+	}
+	if (divisor.max > 0)
+	{
+		divideByPart(std::max<std::int64_t>(divisor.min, 1), divisor.max);
+	}
+	return result;
+}
+
+Interval remainderIntervals(Interval const& dividend, Interval const& divisor)
+{
+	if (divisor == Interval::constant(0))
+	{
+		return Interval::empty();
+	}
+
+	std::int64_t const maxAbsDivisor = std::max(-static_cast<std::int64_t>(divisor.min), std::int64_t{ divisor.max });
+	std::int64_t const min = dividend.min < 0 ? std::max<std::int64_t>(dividend.min, 1 - maxAbsDivisor) : 0;
+	std::int64_t const max = dividend.max > 0 ? std::min<std::int64_t>(dividend.max, maxAbsDivisor - 1) : 0;
+	return { static_cast<std::int32_t>(min), static_cast<std::int32_t>(max) };
+}
+
+BinaryOperator negate(BinaryOperator comparison)
+{
+	switch (comparison)
+	{
+	case BinaryOperator::equal:
+		return BinaryOperator::notEqual;
+	case BinaryOperator::notEqual:
+		return BinaryOperator::equal;
+	case BinaryOperator::less:
+		return BinaryOperator::greaterEqual;
+	case BinaryOperator::lessEqual:
+		return BinaryOperator::greater;
+	case BinaryOperator::greater:
+		return BinaryOperator::lessEqual;
+	case BinaryOperator::greaterEqual:
+	default:
+		return BinaryOperator::less;
+	}
+}
+
+// Whether `lhs op rhs` holds for every pair of values in the intervals.
+bool alwaysHolds(BinaryOperator op, Interval const& lhs, Interval const& rhs)
+{
+	switch (op)
+	{
+	case BinaryOperator::equal:
+		return lhs.min == lhs.max && rhs.min == rhs.max && lhs.min == rhs.min;
+	case BinaryOperator::notEqual:
+		return lhs.max < rhs.min || rhs.max < lhs.min;
+	case BinaryOperator::less:
+		return lhs.max < rhs.min;
+	case BinaryOperator::lessEqual:
+		return lhs.max <= rhs.min;
+	case BinaryOperator::greater:
+		return lhs.min > rhs.max;
+	case BinaryOperator::greaterEqual:
+		return lhs.min >= rhs.max;
+	default:
+		return false;
+	}
+}
+
+Interval compareIntervals(BinaryOperator op, Interval const& lhs, Interval const& rhs)
+{
+	if (alwaysHolds(op, lhs, rhs))
+	{
+		return Interval::constant(1);
+	}
+	if (alwaysHolds(negate(op), lhs, rhs))
+	{
+		return Interval::constant(0);
+	}
+	return { 0, 1 };
+}
+
+// Values of the variable for which `variable op bound` can hold.
+Interval narrow(Interval variable, BinaryOperator op, Interval const& bound)
+{
+	if (variable.isEmpty() || bound.isEmpty())
+	{
+		return Interval::empty();
+	}
+
+	std::int64_t min = variable.min;
+	std::int64_t max = variable.max;
+	switch (op)
+	{
+	case BinaryOperator::equal:
+		min = std::max<std::int64_t>(min, bound.min);
+		max = std::min<std::int64_t>(max, bound.max);
+		break;
+	case BinaryOperator::notEqual:
+		if (bound.min == bound.max)
+		{
+			min += min == bound.min ? 1 : 0;
+			max -= max == bound.min ? 1 : 0;
+		}
+		break;
+	case BinaryOperator::less:
+		max = std::min<std::int64_t>(max, std::int64_t{ bound.max } - 1);
+		break;
+	case BinaryOperator::lessEqual:
+		max = std::min<std::int64_t>(max, bound.max);
+		break;
+	case BinaryOperator::greater:
+		min = std::max<std::int64_t>(min, std::int64_t{ bound.min } + 1);
+		break;
+	case BinaryOperator::greaterEqual:
+		min = std::max<std::int64_t>(min, bound.min);
+		break;
+	default:
+		break;
+	}
+
+	if (min > max)
+	{
+		return Interval::empty();
+	}
+	return { static_cast<std::int32_t>(min), static_cast<std::int32_t>(max) };
+}
+
+Interval applyBinaryOperator(BinaryOperator op, Interval const& lhs, Interval const& rhs)
+{
+	if (lhs.isEmpty() || rhs.isEmpty())
+	{
+		return Interval::empty();
+	}
+
+	std::int64_t const a = lhs.min;
+	std::int64_t const b = lhs.max;
+	std::int64_t const c = rhs.min;
+	std::int64_t const d = rhs.max;
+	switch (op)
+	{
+	case BinaryOperator::add:
+		return fromWide({ a + c, b + d });
+	case BinaryOperator::subtract:
+		return fromWide({ a - d, b - c });
+	case BinaryOperator::multiply:
+		return fromWide({ a * c, a * d, b * c, b * d });
+	case BinaryOperator::divide:
+		return divideIntervals(lhs, rhs);
+	case BinaryOperator::modulo:
+		return remainderIntervals(lhs, rhs);
+	case BinaryOperator::equal:
+	case BinaryOperator::notEqual:
+	case BinaryOperator::less:
+	case BinaryOperator::lessEqual:
+	case BinaryOperator::greater:
+	case BinaryOperator::greaterEqual:
+		return compareIntervals(op, lhs, rhs);
+	default:
+		return Interval::full();
+	}
+}
+
+struct ScopedArray
+{
+	std::string name;
+	std::size_t length = 0;
+	/// Join of the ranges of all elements.
+	Interval elements;
+};
+
+class RangeAnalyzer
+{
+public:
+	RangeAnalyzer(Program const& analyzedProgram, std::vector<Function const*> const& analyzedEntryPoints)
+		: program(analyzedProgram)
+		, entryPoints(analyzedEntryPoints)
+		, types(checkTypes(analyzedProgram))
+	{
+	}
+
+	RangeAnalysis run()
+	{
+		for (Function const* entryPoint : entryPoints)
+		{
+			for (auto const& parameter : std::get<FuncType>(entryPoint->type->t).parameters)
+			{
+				parameters[{ entryPoint, parameter.name }] = Interval::full();
+			}
+		}
+
+		do
+		{
+			changed = false;
+			for (auto const& function : program.functions)
+			{
+				analyzeFunction(*function);
+			}
+			++iteration;
+		} while (changed);
+
+		recording = &result;
+		for (auto const& function : program.functions)
+		{
+			analyzeFunction(*function);
+		}
+		return std::move(result);
+	}
+
+private:
+	// After this many rounds, bounds that keep moving are widened to the end of the range to guarantee termination.
+	static constexpr int widenAfterIterations = 8;
+
+	Program const& program;
+	std::vector<Function const*> const& entryPoints;
+	TypeInfo types;
+	std::map<std::pair<Function const*, std::string>, Interval> parameters;
+	std::map<Function const*, Interval> results;
+	/// Ranges of loop counters and accumulators, and of variables narrowed by enclosing conditions, innermost last.
+	std::vector<std::pair<std::string, Interval>> scopedVariables;
+	/// Arrays bound by enclosing let expressions, innermost last.
+	std::vector<ScopedArray> scopedArrays;
+	RangeAnalysis* recording = nullptr;
+	RangeAnalysis result;
+	int iteration = 0;
+	bool changed = false;
+
+	void update(Interval& slot, Interval const& value)
+	{
+		Interval joined = join(slot, value);
+		if (joined == slot)
+		{
+			return;
+		}
+
+		if (iteration >= widenAfterIterations && !slot.isEmpty())
+		{
+			if (joined.min < slot.min)
+			{
+				joined.min = Interval::full().min;
+			}
+			if (joined.max > slot.max)
+			{
+				joined.max = Interval::full().max;
+			}
+		}
+		slot = joined;
+		changed = true;
+	}
+
+	void analyzeFunction(Function const& function)
+	{
+		Interval const value = evaluate(function, function.expression);
+		update(results[&function], value);
+	}
+
+	// Only i32 values are tracked. Anything wider covers the full range, which keeps every check it is involved in.
+	Interval record(Expression const& expression, Interval const& range)
+	{
+		Interval const typedRange = types.typeOf(expression) == ValueType::i64 ? Interval::full() : range;
+		if (recording != nullptr)
+		{
+			recording->ranges[&expression] = typedRange;
+		}
+		return typedRange;
+	}
+
+	Interval evaluate(Function const& function, Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		if (auto const* literal = std::get_if<Literal>(&expression.expr))
+		{
+			return record(expression,
+				literal->type == ValueType::i32 ? Interval::constant(static_cast<std::int32_t>(literal->value))
+												: Interval::full());
+		}
+		if (auto const* initAssignment = std::get_if<InitAssignment>(&expression.expr))
+		{
+			return record(expression, evaluate(function, *initAssignment->value));
+		}
+		if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
+		{
+			Interval const lhs = evaluate(function, *binaryOp->lhs);
+			Interval const rhs = evaluate(function, *binaryOp->rhs);
+			if (recording != nullptr
+				&& (binaryOp->op == BinaryOperator::divide || binaryOp->op == BinaryOperator::modulo))
+			{
+				++recording->divisionCount;
+				if (!recording->needsDivisionChecks(*binaryOp))
+				{
+					++recording->eliminatedDivisionChecks;
+				}
+			}
+			return record(expression, applyBinaryOperator(binaryOp->op, lhs, rhs));
+		}
+		if (auto const* functionCall = std::get_if<FunctionCall>(&expression.expr))
+		{
+			return record(expression, evaluateCall(function, *functionCall));
+		}
+		if (auto const* varExpression = std::get_if<VarExpression>(&expression.expr))
+		{
+			return record(expression, variableRange(function, varExpression->varName));
+		}
+		if (auto const* loop = std::get_if<LoopExpression>(&expression.expr))
+		{
+			return record(expression, evaluateLoop(function, *loop));
+		}
+		if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+		{
+			return record(expression, evaluateConditional(function, *conditional));
+		}
+		if (auto const* let = std::get_if<LetExpression>(&expression.expr))
+		{
+			return record(expression, evaluateLet(function, *let));
+		}
+		if (auto const* index = std::get_if<IndexExpression>(&expression.expr))
+		{
+			return record(expression, evaluateIndex(function, *index));
+		}
+		return record(expression, Interval::full());
+	}
+
+	// The accumulator is iterated to a fixed point over the body, widened like everything else if it keeps growing.
+	// The body is only recorded once the accumulator range is final.
+	Interval evaluateLoop(Function const& function, LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		Interval const from = evaluate(function, *loop.from);
+		Interval const to = evaluate(function, *loop.to);
+		Interval accumulator = evaluate(function, *loop.initial);
+
+		Interval counter = Interval::empty();
+		if (!from.isEmpty() && !to.isEmpty() && std::int64_t{ from.min } < std::int64_t{ to.max })
+		{
+			counter = { from.min, to.max - 1 };
+		}
+
+		RangeAnalysis* const outerRecording = std::exchange(recording, nullptr);
+		for (int loopIteration = 0; !counter.isEmpty(); ++loopIteration)
+		{
+			Interval const next = join(accumulator, evaluateBody(function, loop, counter, accumulator));
+			if (next == accumulator)
+			{
+				break;
+			}
+			accumulator = loopIteration >= widenAfterIterations ? Interval::full() : next;
+		}
+		recording = outerRecording;
+
+		// A body that never runs is left unrecorded, so lookups into it fall back to the full range.
+		if (!counter.isEmpty())
+		{
+			evaluateBody(function, loop, counter, accumulator);
+		}
+		return accumulator;
+	}
+
+	Interval evaluateBody(Function const& function,// NOLINT(misc-no-recursion)
+		LoopExpression const& loop,
+		Interval const& counter,
+		Interval const& accumulator)
+	{
+		scopedVariables.emplace_back(loop.counter, counter);
+		scopedVariables.emplace_back(loop.accumulator, accumulator);
+		Interval const body = evaluate(function, *loop.body);
+		scopedVariables.resize(scopedVariables.size() - 2);
+		return body;
+	}
+
+	// Arms that the condition rules out are not evaluated, and a variable compared in the condition is narrowed inside
+	// each arm. `if d > 0i32 then x / d else 0i32` thus needs no division checks.
+	Interval evaluateConditional(Function const& function,// NOLINT(misc-no-recursion)
+		ConditionalExpression const& conditional)
+	{
+		Interval const condition = evaluate(function, *conditional.condition);
+		Interval range = Interval::empty();
+		if (condition.isEmpty())
+		{
+			return range;
+		}
+		if (condition != Interval::constant(0))
+		{
+			range = join(range, evaluateArm(function, *conditional.condition, true, *conditional.whenTrue));
+		}
+		if (condition.contains(0))
+		{
+			range = join(range, evaluateArm(function, *conditional.condition, false, *conditional.whenFalse));
+		}
+		return range;
+	}
+
+	Interval evaluateArm(Function const& function,// NOLINT(misc-no-recursion)
+		Expression const& condition,
+		bool conditionHolds,
+		Expression const& arm)
+	{
+		auto const* comparison = std::get_if<BinaryOpExpression>(&condition.expr);
+		auto const* variable = comparison != nullptr ? std::get_if<VarExpression>(&comparison->lhs->expr) : nullptr;
+		if (variable == nullptr || !isComparison(comparison->op))
+		{
+			return evaluate(function, arm);
+		}
+
+		// Only evaluated for the narrowing, so nothing is recorded.
+		RangeAnalysis* const outerRecording = std::exchange(recording, nullptr);
+		Interval const bound = evaluate(function, *comparison->rhs);
+		recording = outerRecording;
+
+		BinaryOperator const op = conditionHolds ? comparison->op : negate(comparison->op);
+		Interval const narrowed = narrow(variableRange(function, variable->varName), op, bound);
+		if (narrowed.isEmpty())
+		{
+			return Interval::empty();
+		}
+
+		scopedVariables.emplace_back(variable->varName, narrowed);
+		Interval const armRange = evaluate(function, arm);
+		scopedVariables.pop_back();
+		return armRange;
+	}
+
+	Interval evaluateLet(Function const& function, LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		std::size_t const length = std::get<ArrayType>(let.type->t).length;
+		Interval elements = Interval::empty();
+		for (auto const& element : let.elements)
+		{
+			elements = join(elements, evaluate(function, *element));
+		}
+		if (let.generator)
+		{
+			scopedVariables.emplace_back(let.generatorIndex, Interval{ 0, static_cast<std::int32_t>(length - 1) });
+			elements = evaluate(function, *let.generator);
+			scopedVariables.pop_back();
+		}
+
+		scopedArrays.push_back({ let.name, length, elements });
+		Interval const body = evaluate(function, *let.body);
+		scopedArrays.pop_back();
+		return body;
+	}
+
+	Interval evaluateIndex(Function const& function, IndexExpression const& index)// NOLINT(misc-no-recursion)
+	{
+		Interval const position = evaluate(function, *index.index);
+		auto arrayIt = std::ranges::find(scopedArrays | std::views::reverse, index.arrayName, &ScopedArray::name);
+		if (arrayIt == scopedArrays.rend())
+		{
+			return Interval::full();
+		}
+
+		if (recording != nullptr)
+		{
+			++recording->indexCount;
+			if (position.isEmpty()
+				|| (position.min >= 0 && static_cast<std::size_t>(position.max) < arrayIt->length))
+			{
+				recording->inBoundsIndices.insert(&index);
+			}
+		}
+		return position.isEmpty() ? Interval::empty() : arrayIt->elements;
+	}
+
+	Interval variableRange(Function const& function, std::string const& name) const
+	{
+		auto scopedIt = std::ranges::find(
+			scopedVariables | std::views::reverse, name, &std::pair<std::string, Interval>::first);
+		if (scopedIt != scopedVariables.rend())
+		{
+			return scopedIt->second;
+		}
+		return parameterRange(function, name);
+	}
+
+	// Parameters of functions that have not been called yet start out empty and grow with each call site.
+	Interval parameterRange(Function const& function, std::string const& name) const
+	{
+		auto const& funcParameters = std::get<FuncType>(function.type->t).parameters;
+		bool const isInParameter = std::ranges::any_of(funcParameters, [&](FuncParameter const& parameter) {
+			return parameter.name == name && parameter.direction == ParameterDirection::in;
+		});
+		if (!isInParameter)
+		{
+			return Interval::full();
+		}
+
+		auto parameterIt = parameters.find({ &function, name });
+		return parameterIt != parameters.end() ? parameterIt->second : Interval::empty();
+	}
+
+	Interval evaluateCall(Function const& caller, FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		auto funcIt = std::ranges::find_if(program.functions,
+			[&](std::shared_ptr<Function> const& func) { return func->name == functionCall.functionName; });
+
+		Interval argumentsRange = Interval::constant(0);
+		for (auto const& argument : functionCall.arguments)
+		{
+			Interval const argumentRange = evaluate(caller, argument.expr);
+			if (argumentRange.isEmpty())
+			{
+				argumentsRange = Interval::empty();
+			}
+			if (funcIt != program.functions.end())
+			{
+				update(parameters[{ funcIt->get(), argument.name }], argumentRange);
+			}
+		}
+
+		if (funcIt == program.functions.end())
+		{
+			return Interval::full();
+		}
+		if (argumentsRange.isEmpty())
+		{
+			return Interval::empty();
+		}
+		return results[funcIt->get()];
+	}
+};
+}
+
+Interval join(Interval const& lhs, Interval const& rhs)
+{
+	if (lhs.isEmpty())
+	{
+		return rhs;
+	}
+	if (rhs.isEmpty())
+	{
+		return lhs;
+	}
+	return { std::min(lhs.min, rhs.min), std::max(lhs.max, rhs.max) };
+}
+
+Interval RangeAnalysis::rangeOf(Expression const& expression) const
+{
+	auto rangeIt = ranges.find(&expression);
+	return rangeIt != ranges.end() ? rangeIt->second : Interval::full();
+}
+
+bool RangeAnalysis::needsDivisionChecks(BinaryOpExpression const& division) const
+{
+	Interval const divisor = rangeOf(*division.rhs);
+	if (divisor.isEmpty())
+	{
+		return false;
+	}
+	if (divisor.contains(0))
+	{
+		return true;
+	}
+	return divisor.contains(-1) && rangeOf(*division.lhs).contains(std::numeric_limits<std::int32_t>::min());
+}
+
+bool RangeAnalysis::needsBoundsCheck(IndexExpression const& index) const
+{
+	return !inBoundsIndices.contains(&index);
+}
+
+RangeAnalysis analyzeRanges(Program const& program, std::vector<Function const*> const& entryPoints)
+{
+	RangeAnalysis ranges = RangeAnalyzer(program, entryPoints).run();
+	divisionsAnalyzed += ranges.divisionCount;
+	divisionChecksEliminated += ranges.eliminatedDivisionChecks;
+	indicesAnalyzed += ranges.indexCount;
+	boundsChecksEliminated += ranges.inBoundsIndices.size();
+	return ranges;
+}
+
+RangeAnalysis analyzeRanges(Program const& program)
+{
+	std::vector<Function const*> entryPoints;
+	if (program.mainFunction)
+	{
+		entryPoints.push_back(program.mainFunction.get());
+	}
+	return analyzeRanges(program, entryPoints);
+}
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/statistics.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+struct ThreadCounts;
+
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<Statistic const*> statistics;
+	/// Counts of the threads that have exited.
+	std::array<std::uint64_t, Statistic::capacity> retired{};
+	std::vector<ThreadCounts const*> threads;
+};
+
+// Constructed on first use, as statistics register themselves during static initialization of other translation
+// units. Never destroyed, so that threads exiting after main returns can still retire their counts.
+Registry& registry()
+{
+	static auto* instance = new Registry();// NOLINT(cppcoreguidelines-owning-memory)
+	return *instance;
+}
+
+/// Only the owning thread writes its counts, so it can increment them with a plain load and store. They are atomic so
+/// that collectStatistics can read them while the thread is counting.
+struct ThreadCounts
+{
+	std::array<std::atomic<std::uint64_t>, Statistic::capacity> values{};
+
+	ThreadCounts()
+	{
+		Registry& state = registry();
+		std::scoped_lock const lock(state.mutex);
+		state.threads.push_back(this);
+	}
+	ThreadCounts(ThreadCounts const&) = delete;
+	ThreadCounts(ThreadCounts&&) = delete;
+	ThreadCounts& operator=(ThreadCounts const&) = delete;
+	ThreadCounts& operator=(ThreadCounts&&) = delete;
+
+	~ThreadCounts()
+	{
+		Registry& state = registry();
+		std::scoped_lock const lock(state.mutex);
+		for (std::size_t index = 0; index < values.size(); ++index)
+		{
+			state.retired[index] += values[index].load(std::memory_order_relaxed);
+		}
+		std::erase(state.threads, this);
+	}
+};
+
+thread_local ThreadCounts threadCounts;
+}
+
+Statistic::Statistic(std::string_view pass, std::string_view description)
+	: passName(pass)
+	, descriptionText(description)
+{
+	Registry& state = registry();
+	std::scoped_lock const lock(state.mutex);
+	if (state.statistics.size() == capacity)
+	{
+		throw std::runtime_error("Too many statistics declared, increase Statistic::capacity");
+	}
+	index = state.statistics.size();
+	state.statistics.push_back(this);
+}
+
+Statistic& Statistic::operator+=(std::uint64_t count)
+{
+	std::atomic<std::uint64_t>& value = threadCounts.values[index];
+	value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	return *this;
+}
+
+std::vector<StatisticValue> collectStatistics()
+{
+	Registry& state = registry();
+	std::scoped_lock const lock(state.mutex);
+
+	std::vector<StatisticValue> result;
+	for (std::size_t index = 0; index < state.statistics.size(); ++index)
+	{
+		StatisticValue value{
+			state.statistics[index]->pass(), state.statistics[index]->description(), state.retired[index]
+		};
+		for (ThreadCounts const* thread : state.threads)
+		{
+			value.value += thread->values[index].load(std::memory_order_relaxed);
+		}
+		result.push_back(value);
+	}
+
+	std::ranges::sort(result, [](StatisticValue const& lhs, StatisticValue const& rhs) {
+		return std::tie(lhs.pass, lhs.description) < std::tie(rhs.pass, rhs.description);
+	});
+	return result;
+}
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/trace.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace jereq
+{
+namespace
+{
+std::atomic<std::uint64_t> nextTracerId = 1;
+
+/// The buffer this thread last recorded into, and the tracer it belongs to.
+struct CachedBuffer
+{
+	std::uint64_t tracerId = 0;
+	void* buffer = nullptr;
+};
+thread_local CachedBuffer cachedBuffer;
+
+void writeJsonString(std::ostream& out, std::string_view str)
+{
+	out << '"';
+	for (char const c : str)
+	{
+		switch (c)
+		{
+		case '"':
+			out << "\\\"";
+			break;
+		case '\\':
+			out << "\\\\";
+			break;
+		case '\n':
+			out << "\\n";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+			{
+				std::array<char, 7> escaped{};
+				std::snprintf(escaped.data(), escaped.size(), "\\u%04x", static_cast<unsigned>(c));
+				out << escaped.data();
+			}
+			else
+			{
+				out << c;
+			}
+		}
+	}
+	out << '"';
+}
+
+// Trace event timestamps are in microseconds, written with three decimals to keep nanosecond resolution.
+void writeMicroseconds(std::ostream& out, std::chrono::steady_clock::duration duration)
+{
+	auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	std::array<char, 32> formatted{};
+	std::snprintf(formatted.data(), formatted.size(), "%lld.%03lld",
+		static_cast<long long>(nanoseconds / 1000),
+		static_cast<long long>(nanoseconds % 1000));
+	out << formatted.data();
+}
+}
+
+Tracer::Tracer()
+	: id(nextTracerId.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+Tracer::~Tracer() = default;
+
+Tracer::Span::Span(Tracer* activeTracer, std::string_view spanCategory, std::string_view spanName)
+	: tracer(activeTracer)
+	, category(spanCategory)
+	, name(activeTracer != nullptr ? spanName : std::string_view{})
+	, start(activeTracer != nullptr ? Clock::now() : Clock::time_point{})
+{
+	if (tracer != nullptr)
+	{
+		// Threads are numbered in the order they start their first span, rather than finish it.
+		tracer->threadBuffer();
+	}
+}
+
+Tracer::Span::~Span()
+{
+	if (tracer != nullptr)
+	{
+		Clock::time_point const end = Clock::now();
+		tracer->threadBuffer().events.push_back({ category, std::move(name), start - tracer->origin, end - start });
+	}
+}
+
+Tracer::ThreadBuffer& Tracer::threadBuffer()
+{
+	if (cachedBuffer.tracerId != id)
+	{
+		std::scoped_lock const lock(mutex);
+		auto& buffer = buffers.emplace_back(std::make_unique<ThreadBuffer>());
+		buffer->threadIndex = static_cast<std::uint32_t>(buffers.size());
+		cachedBuffer = { id, buffer.get() };
+	}
+	return *static_cast<ThreadBuffer*>(cachedBuffer.buffer);
+}
+
+void Tracer::writeTraceEvents(std::ostream& out) const
+{
+	std::scoped_lock const lock(mutex);
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	auto const separate = [&] {
+		out << (first ? "\n" : ",\n");
+		first = false;
+	};
+
+	for (auto const& buffer : buffers)
+	{
+		separate();
+		out << R"({"ph":"M","name":"thread_name","pid":1,"tid":)" << buffer->threadIndex
+			<< R"(,"args":{"name":)";
+		writeJsonString(out, "thread " + std::to_string(buffer->threadIndex));
+		out << "}}";
+
+		for (Event const& event : buffer->events)
+		{
+			separate();
+			out << R"({"ph":"X","pid":1,"tid":)" << buffer->threadIndex << R"(,"cat":)";
+			writeJsonString(out, event.category);
+			out << R"(,"name":)";
+			writeJsonString(out, event.name);
+			out << R"(,"ts":)";
+			writeMicroseconds(out, event.start);
+			out << R"(,"dur":)";
+			writeMicroseconds(out, event.duration);
+			out << '}';
+		}
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+}
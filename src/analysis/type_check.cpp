@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/analysis/type_check.hpp>
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+class TypeChecker
+{
+public:
+	explicit TypeChecker(Program const& checkedProgram)
+		: program(checkedProgram)
+	{
+	}
+
+	TypeInfo run()
+	{
+		for (auto const& function : program.functions)
+		{
+			current = function.get();
+			check(function->expression);
+		}
+		return std::move(result);
+	}
+
+private:
+	Program const& program;
+	Function const* current = nullptr;
+	/// Loop variables, generator indices and arrays in scope, innermost last. Arrays have no value type.
+	std::vector<std::pair<std::string, ValueType>> scopedVariables;
+	TypeInfo result;
+
+	// Assignments and calls without out parameters have no value, which the backends report where it is used.
+	static void expectSame(ValueType lhs, ValueType rhs, Expression const& expression)
+	{
+		if (lhs != ValueType::none && rhs != ValueType::none && lhs != rhs)
+		{
+			throw std::runtime_error("Type mismatch in \"" + expression.rep + "\": " + std::string(toString(lhs))
+									 + " and " + std::string(toString(rhs)));
+		}
+	}
+
+	static void expectI32(ValueType type, Expression const& expression, std::string_view what)
+	{
+		if (type == ValueType::i64)
+		{
+			throw std::runtime_error(std::string(what) + " must be i32: \"" + expression.rep + "\"");
+		}
+	}
+
+	ValueType record(Expression const& expression, ValueType type)
+	{
+		result.types[&expression] = type;
+		return type;
+	}
+
+	/// Type of the named function in the program, or of the host function with that name.
+	[[nodiscard]] Type const* findFunctionType(std::string const& name) const
+	{
+		auto functionIt = std::ranges::find_if(
+			program.functions, [&](std::shared_ptr<Function> const& function) { return function->name == name; });
+		if (functionIt != program.functions.end())
+		{
+			return (*functionIt)->type.get();
+		}
+		HostFunction const* hostFunction = program.findHostFunction(name);
+		return hostFunction != nullptr ? hostFunction->type.get() : nullptr;
+	}
+
+	[[nodiscard]] static FuncParameter const* findParameter(Type const& functionType, std::string const& name)
+	{
+		auto const& parameters = std::get<FuncType>(functionType.t).parameters;
+		auto parameterIt = std::ranges::find(parameters, name, &FuncParameter::name);
+		return parameterIt != parameters.end() ? &*parameterIt : nullptr;
+	}
+
+	[[nodiscard]] ValueType variableType(std::string const& name) const
+	{
+		auto scopedIt = std::ranges::find(
+			scopedVariables | std::views::reverse, name, &std::pair<std::string, ValueType>::first);
+		if (scopedIt != scopedVariables.rend())
+		{
+			return scopedIt->second;
+		}
+		FuncParameter const* parameter = findParameter(*current->type, name);
+		return parameter != nullptr ? valueTypeOf(*parameter->type) : ValueType::i32;
+	}
+
+	ValueType check(Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		return record(expression, std::visit([&](auto const& expr) { return check(expression, expr); }, expression.expr));
+	}
+
+	static ValueType check(Expression const& /*expression*/, Literal const& literal) { return literal.type; }
+
+	ValueType check(Expression const& expression, InitAssignment const& initAssignment)// NOLINT(misc-no-recursion)
+	{
+		ValueType const value = check(*initAssignment.value);
+		if (FuncParameter const* target = findParameter(*current->type, initAssignment.var))
+		{
+			expectSame(valueTypeOf(*target->type), value, expression);
+		}
+		return ValueType::none;
+	}
+
+	ValueType check(Expression const& expression, BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		ValueType const lhs = check(*binaryOp.lhs);
+		ValueType const rhs = check(*binaryOp.rhs);
+		expectSame(lhs, rhs, expression);
+		return isComparison(binaryOp.op) ? ValueType::i32 : lhs;
+	}
+
+	ValueType check(Expression const& expression, FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		Type const* callee = findFunctionType(functionCall.functionName);
+		for (auto const& argument : functionCall.arguments)
+		{
+			ValueType const type = check(argument.expr);
+			FuncParameter const* parameter = callee != nullptr ? findParameter(*callee, argument.name) : nullptr;
+			if (parameter != nullptr)
+			{
+				expectSame(valueTypeOf(*parameter->type), type, expression);
+			}
+		}
+
+		if (callee == nullptr)
+		{
+			return ValueType::i32;
+		}
+		auto const& parameters = std::get<FuncType>(callee->t).parameters;
+		auto outIt = std::ranges::find(parameters, ParameterDirection::out, &FuncParameter::direction);
+		return outIt != parameters.end() ? valueTypeOf(*outIt->type) : ValueType::none;
+	}
+
+	ValueType check(Expression const& /*expression*/, VarExpression const& varExpression) const
+	{
+		return variableType(varExpression.varName);
+	}
+
+	// The counter has the type of the bounds, and the accumulator the type of its initial value.
+	ValueType check(Expression const& expression, LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		ValueType const from = check(*loop.from);
+		ValueType const to = check(*loop.to);
+		expectSame(from, to, expression);
+		ValueType const initial = check(*loop.initial);
+
+		scopedVariables.emplace_back(loop.counter, from);
+		scopedVariables.emplace_back(loop.accumulator, initial);
+		ValueType const body = check(*loop.body);
+		scopedVariables.resize(scopedVariables.size() - 2);
+
+		expectSame(initial, body, expression);
+		return initial;
+	}
+
+	ValueType check(Expression const& expression, ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		expectI32(check(*conditional.condition), expression, "Conditions");
+		ValueType const whenTrue = check(*conditional.whenTrue);
+		ValueType const whenFalse = check(*conditional.whenFalse);
+		expectSame(whenTrue, whenFalse, expression);
+		return whenTrue;
+	}
+
+	ValueType check(Expression const& expression, LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& element : let.elements)
+		{
+			expectI32(check(*element), expression, "Array elements");
+		}
+		if (let.generator)
+		{
+			scopedVariables.emplace_back(let.generatorIndex, ValueType::i32);
+			expectI32(check(*let.generator), expression, "Array elements");
+			scopedVariables.pop_back();
+		}
+
+		scopedVariables.emplace_back(let.name, ValueType::none);
+		ValueType const body = check(*let.body);
+		scopedVariables.pop_back();
+		return body;
+	}
+
+	ValueType check(Expression const& expression, IndexExpression const& index)// NOLINT(misc-no-recursion)
+	{
+		expectI32(check(*index.index), expression, "Array indices");
+		return ValueType::i32;
+	}
+};
+}
+
+ValueType TypeInfo::typeOf(Expression const& expression) const
+{
+	auto typeIt = types.find(&expression);
+	return typeIt != types.end() ? typeIt->second : ValueType::i32;
+}
+
+TypeInfo checkTypes(Program const& program)
+{
+	return TypeChecker(program).run();
+}
+}
@@ -2,9 +2,16 @@
 // Copyright © 2022 Sebastian Larsson
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -43,19 +50,67 @@ struct BuiltInType
 	friend bool operator==(BuiltInType const& lhs, BuiltInType const& rhs) noexcept = default;
 };
 
+/// Fixed-length array, written `[N]i32`.
+struct ArrayType
+{
+	std::size_t length = 0;
+	std::shared_ptr<Type> element;
+
+	friend bool operator==(ArrayType const& lhs, ArrayType const& rhs) noexcept = default;
+};
+
 struct Type
 {
 	std::string rep;// TODO: Replace
-	std::variant<BuiltInType, FuncType> t;
+	std::variant<BuiltInType, FuncType, ArrayType> t;
 
 	friend bool operator==(Type const& lhs, Type const& rhs) noexcept = default;
 };
 
+/// Types of the values expressions produce. Expressions without a value, like assignments, have the type none.
+enum struct ValueType
+{
+	none,
+	i32,
+	i64,
+};
+
+constexpr std::string_view toString(ValueType type)
+{
+	switch (type)
+	{
+	case ValueType::i32:
+		return "i32";
+	case ValueType::i64:
+		return "i64";
+	case ValueType::none:
+	default:
+		return "none";
+	}
+}
+
+/// Value type of a built-in type, or none for anything else.
+inline ValueType valueTypeOf(Type const& type)
+{
+	auto const* builtInType = std::get_if<BuiltInType>(&type.t);
+	if (builtInType == nullptr)
+	{
+		return ValueType::none;
+	}
+	if (builtInType->name == "i32")
+	{
+		return ValueType::i32;
+	}
+	return builtInType->name == "i64" ? ValueType::i64 : ValueType::none;
+}
+
 struct Expression;
 
 struct Literal
 {
-	std::int32_t value;
+	/// Always within the range of the type, so i32 values can be narrowed without loss.
+	std::int64_t value;
+	ValueType type = ValueType::i32;
 };
 
 struct InitAssignment
@@ -71,13 +126,28 @@ enum struct BinaryOperator
 	multiply,
 	divide,
 	modulo,
+	// Comparisons are signed and produce 1 when true and 0 when false.
+	equal,
+	notEqual,
+	less,
+	lessEqual,
+	greater,
+	greaterEqual,
 };
 
+constexpr bool isComparison(BinaryOperator op)
+{
+	return op >= BinaryOperator::equal;
+}
+
 struct BinaryOpExpression
 {
 	BinaryOperator op;
 	std::unique_ptr<Expression> lhs;
 	std::unique_ptr<Expression> rhs;
+	/// Position among the binary operators of the program, numbered by the parser, so that passes can keep data about
+	/// each operator in a dense table instead of a map.
+	std::size_t index = 0;
 };
 
 struct FuncArgument;
@@ -95,10 +165,59 @@ struct VarExpression
 	// TODO: scope
 };
 
+/// Counted loop: the accumulator starts at initial and is replaced by body for each counter value in [from, to). The
+/// loop evaluates to the final accumulator. Counter and accumulator are only visible inside the body.
+struct LoopExpression
+{
+	std::string counter;
+	std::unique_ptr<Expression> from;
+	std::unique_ptr<Expression> to;
+	std::string accumulator;
+	std::unique_ptr<Expression> initial;
+	std::unique_ptr<Expression> body;
+};
+
+/// Evaluates to whenTrue if the condition is non-zero and to whenFalse otherwise.
+struct ConditionalExpression
+{
+	std::unique_ptr<Expression> condition;
+	std::unique_ptr<Expression> whenTrue;
+	std::unique_ptr<Expression> whenFalse;
+};
+
+/// Binds an array for the duration of body. The elements are either listed, or computed by evaluating the generator
+/// once per position with generatorIndex bound to that position. Arrays can only be indexed, not used as values.
+struct LetExpression
+{
+	std::string name;
+	std::shared_ptr<Type> type;
+	std::vector<std::unique_ptr<Expression>> elements;
+	std::string generatorIndex;
+	std::unique_ptr<Expression> generator;
+	std::unique_ptr<Expression> body;
+};
+
+struct IndexExpression
+{
+	std::string arrayName;
+	std::unique_ptr<Expression> index;
+};
+
 struct Expression
 {
 	std::string rep;// TODO: Replace
-	std::variant<Literal, InitAssignment, BinaryOpExpression, FunctionCall, VarExpression> expr;
+	/// Byte offset in the source where the expression starts. Unset for expressions that were not parsed.
+	std::optional<std::size_t> sourceOffset;
+	std::variant<Literal,
+		InitAssignment,
+		BinaryOpExpression,
+		FunctionCall,
+		VarExpression,
+		LoopExpression,
+		ConditionalExpression,
+		LetExpression,
+		IndexExpression>
+		expr;
 };
 
 struct FuncArgument
@@ -116,10 +235,74 @@ struct Function
 	Expression expression;
 };
 
+/// Called with the in arguments widened to 64 bits, in declaration order, returning the out value if there is one.
+using HostCallback = std::int64_t (*)(void* userData, std::int64_t const* arguments);
+
+/// Most in parameters a host function can take, so the interpreters can pass the arguments in a fixed-size buffer.
+constexpr std::size_t maxHostArguments = 8;
+
+/// A function provided by the embedding application. Calls resolve to it by name, like calls to functions in the program.
+struct HostFunction
+{
+	std::string name;
+	/// Module the wasm backend imports the function from.
+	std::string module;
+	std::shared_ptr<Type> type;
+	/// Null when the function is only available to compiled wasm modules.
+	HostCallback callback = nullptr;
+	void* userData = nullptr;
+};
+
+/// Where each line of a source starts, to find the line and column of byte offsets without rescanning the source.
+struct LineIndex
+{
+	std::vector<std::size_t> lineStarts{ 0 };
+
+	explicit LineIndex(std::string_view source = {})
+	{
+		for (std::size_t offset = 0; offset < source.size(); ++offset)
+		{
+			if (source[offset] == '\n')
+			{
+				lineStarts.push_back(offset + 1);
+			}
+		}
+	}
+
+	/// One-based line and column of a byte offset.
+	[[nodiscard]] std::pair<std::size_t, std::size_t> locate(std::size_t offset) const
+	{
+		auto const line = static_cast<std::size_t>(std::ranges::upper_bound(lineStarts, offset) - lineStarts.begin());
+		return { line, offset - lineStarts[line - 1] + 1 };
+	}
+};
+
 struct Program
 {
+	/// Name of the source the program was parsed from, and the lines of it.
+	std::string sourceName;
+	LineIndex lines;
 	std::vector<std::shared_ptr<Type>> types;
 	std::vector<std::shared_ptr<Function>> functions;
 	std::shared_ptr<Function> mainFunction;
+	/// Values of `def name = <expr>;` constants. They are folded while parsing, and later uses of the name are replaced
+	/// by literals, so the backends never see them.
+	std::map<std::string, Literal, std::less<>> constants;
+	std::vector<HostFunction> hostFunctions;
+	/// Number of binary operators numbered by the parser. Operators with an index beyond it, or sharing an index with
+	/// another operator, are not in the tables of the passes and take their slower generic paths.
+	std::size_t binaryOperatorCount = 0;
+
+	[[nodiscard]] HostFunction const* findHostFunction(std::string_view name) const
+	{
+		for (auto const& hostFunction : hostFunctions)
+		{
+			if (hostFunction.name == name)
+			{
+				return &hostFunction;
+			}
+		}
+		return nullptr;
+	}
 };
 }
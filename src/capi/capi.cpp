@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/capi/hobby.h>
+
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/parser/parser.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct hobby_program
+{
+	jereq::CompiledProgram compiled;
+};
+
+namespace
+{
+thread_local std::string lastError;
+
+hobby_status fail(hobby_status status, char const* message)
+{
+	try
+	{
+		lastError = message;
+	}
+	catch (...)
+	{
+		lastError.clear();
+	}
+	return status;
+}
+
+// Runs the body, turning every exception into the given status so none escapes to the C caller.
+template<typename Body>
+hobby_status guarded(hobby_status onError, Body const& body) noexcept
+{
+	try
+	{
+		return body();
+	}
+	catch (std::bad_alloc const&)
+	{
+		return fail(HOBBY_OUT_OF_MEMORY, "Out of memory");
+	}
+	catch (std::exception const& e)
+	{
+		return fail(onError, e.what());
+	}
+	catch (...)
+	{
+		return fail(onError, "Unknown error");
+	}
+}
+}
+
+extern "C" {
+hobby_status hobby_compile(char const* source, size_t sourceLength, hobby_program** program)
+{
+	return hobby_compile_with_host_functions(source, sourceLength, nullptr, 0, program);
+}
+
+hobby_status hobby_compile_with_host_functions(char const* source,
+	size_t sourceLength,
+	hobby_host_function const* hostFunctions,
+	size_t hostFunctionCount,
+	hobby_program** program)
+{
+	if (source == nullptr || program == nullptr || (hostFunctions == nullptr && hostFunctionCount > 0))
+	{
+		return fail(HOBBY_INVALID_ARGUMENT, "Source, program and non-empty host functions must not be null");
+	}
+	*program = nullptr;
+	return guarded(HOBBY_COMPILE_ERROR, [&] {
+		std::vector<jereq::HostFunctionDeclaration> declarations;
+		for (auto const& hostFunction : std::span(hostFunctions, hostFunctionCount))
+		{
+			if (hostFunction.name == nullptr || hostFunction.signature == nullptr)
+			{
+				return fail(HOBBY_INVALID_ARGUMENT, "Host function names and signatures must not be null");
+			}
+			declarations.push_back(
+				{ hostFunction.name, hostFunction.signature, hostFunction.callback, hostFunction.userData });
+		}
+
+		jereq::Program parsed = jereq::parse(std::string_view(source, sourceLength), "embedded", declarations);
+		*program = new hobby_program{ jereq::CompiledProgram(std::move(parsed)) };// NOLINT(cppcoreguidelines-owning-memory)
+		return HOBBY_OK;
+	});
+}
+
+void hobby_release(hobby_program* program)
+{
+	delete program;// NOLINT(cppcoreguidelines-owning-memory)
+}
+
+hobby_status hobby_find_function(hobby_program const* program,
+	char const* name,
+	uint32_t* function,
+	size_t* inCount,
+	size_t* outCount)
+{
+	if (program == nullptr || name == nullptr)
+	{
+		return fail(HOBBY_INVALID_ARGUMENT, "Program and name must not be null");
+	}
+	return guarded(HOBBY_UNKNOWN_FUNCTION, [&] {
+		std::optional<std::size_t> const index = program->compiled.findFunction(name);
+		if (!index)
+		{
+			return fail(HOBBY_UNKNOWN_FUNCTION, "Couldn't find function");
+		}
+		if (function != nullptr)
+		{
+			*function = static_cast<uint32_t>(*index);
+		}
+		if (inCount != nullptr)
+		{
+			*inCount = program->compiled.inCount(*index);
+		}
+		if (outCount != nullptr)
+		{
+			*outCount = program->compiled.outCount(*index);
+		}
+		return HOBBY_OK;
+	});
+}
+
+hobby_status hobby_call(hobby_program const* program,
+	uint32_t function,
+	int64_t const* inValues,
+	size_t inCount,
+	int64_t* outValues,
+	size_t outCount)
+{
+	if (program == nullptr || (inValues == nullptr && inCount > 0) || (outValues == nullptr && outCount > 0))
+	{
+		return fail(HOBBY_INVALID_ARGUMENT, "Program and non-empty buffers must not be null");
+	}
+	jereq::CompiledProgram const& compiled = program->compiled;
+	if (function >= compiled.functionCount())
+	{
+		return fail(HOBBY_UNKNOWN_FUNCTION, "Function index out of range");
+	}
+	if (compiled.inCount(function) != inCount || compiled.outCount(function) != outCount)
+	{
+		return fail(HOBBY_INVALID_ARGUMENT, "Buffer sizes don't match the parameter counts");
+	}
+	return guarded(HOBBY_RUNTIME_ERROR, [&] {
+		compiled.call(function, std::span(inValues, inCount), std::span(outValues, outCount));
+		return HOBBY_OK;
+	});
+}
+
+char const* hobby_last_error()
+{
+	return lastError.c_str();
+}
+}
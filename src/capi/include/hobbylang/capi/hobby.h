@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright © 2023 Sebastian Larsson */
+#ifndef HOBBYLANG_CAPI_HOBBY_H
+#define HOBBYLANG_CAPI_HOBBY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Stable C interface for embedding hobby-lang. No function throws across this boundary; failures are reported through
+ * the returned status, with a description available from hobby_last_error on the same thread. */
+
+typedef struct hobby_program hobby_program;
+
+typedef enum hobby_status
+{
+	HOBBY_OK = 0,
+	/* A null pointer, or buffer sizes that do not match the function's parameters. */
+	HOBBY_INVALID_ARGUMENT = 1,
+	/* The source could not be parsed or failed the type check. */
+	HOBBY_COMPILE_ERROR = 2,
+	HOBBY_UNKNOWN_FUNCTION = 3,
+	/* Evaluation failed, for example on division by zero or an array index out of bounds. */
+	HOBBY_RUNTIME_ERROR = 4,
+	HOBBY_OUT_OF_MEMORY = 5,
+} hobby_status;
+
+/* Called with the in arguments widened to 64 bits, in declaration order, returning the out value if there is one. */
+typedef int64_t (*hobby_host_callback)(void* userData, int64_t const* arguments);
+
+/* A function the program may call, imported from the "env" module when compiled to wasm. */
+typedef struct hobby_host_function
+{
+	char const* name;
+	/* Written like a function type, e.g. "fun(in key: i32, out value: i64)". */
+	char const* signature;
+	hobby_host_callback callback;
+	void* userData;
+} hobby_host_function;
+
+/* Parses and prepares a program. On success *program receives a handle that must be released with hobby_release. */
+hobby_status hobby_compile(char const* source, size_t sourceLength, hobby_program** program);
+/* Same as above, with host functions the program can call. Calls go straight to the callbacks, which must not throw. */
+hobby_status hobby_compile_with_host_functions(char const* source,
+	size_t sourceLength,
+	hobby_host_function const* hostFunctions,
+	size_t hostFunctionCount,
+	hobby_program** program);
+void hobby_release(hobby_program* program);
+
+/* Looks up a function by name, giving its index and the number of in and out parameters. Any of the out pointers may be
+ * null. */
+hobby_status hobby_find_function(hobby_program const* program,
+	char const* name,
+	uint32_t* function,
+	size_t* inCount,
+	size_t* outCount);
+
+/* Calls a function. In parameters are read from inValues and out parameters written to outValues, both caller-owned
+ * and in declaration order, with i32 values widened to 64 bits. Calls on one program may run concurrently. */
+hobby_status hobby_call(hobby_program const* program,
+	uint32_t function,
+	int64_t const* inValues,
+	size_t inCount,
+	int64_t* outValues,
+	size_t outCount);
+
+/* Description of the last failure on the calling thread, valid until the next failing call on that thread. */
+char const* hobby_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
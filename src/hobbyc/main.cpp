@@ -3,18 +3,28 @@
 
 #include <internal_use_only/config.hpp>
 
+#include <hobbylang/analysis/cost_model.hpp>
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/trace.hpp>
 #include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/execution_trace.hpp>
 #include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/interpreter/sampling_profiler.hpp>
 #include <hobbylang/parser/parser.hpp>
 #include <hobbylang/wasm/wasm.hpp>
 
 #include <CLI/CLI.hpp>
 #include <spdlog/spdlog.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -30,6 +40,52 @@ try
 	app.set_version_flag("-v,--version", std::string(hobby_lang::cmake::project_version));
 	bool execute = false;
 	app.add_flag("-x,--execute", execute, "Execute the program instead of generating a compiled output");
+	std::optional<std::filesystem::path> profileOutputPath;
+	app.add_option("--profile-out", profileOutputPath, "Write an execution profile to FILE when executing.")
+		->option_text("FILE");
+	std::optional<std::filesystem::path> samplesOutputPath;
+	app.add_option("--samples-out", samplesOutputPath, "Write call stacks sampled while executing to FILE, as folded stacks.")
+		->option_text("FILE");
+	std::size_t lastEvents = 0;
+	app.add_option("--last-events", lastEvents, "Keep the last N calls and evaluations when executing, and print them on failure.")
+		->option_text("N");
+	std::optional<std::filesystem::path> profileInputPath;
+	app.add_option("--profile-in", profileInputPath, "Use the execution profile in FILE to guide compilation.")
+		->option_text("FILE")
+		->check(CLI::ExistingFile);
+	std::string engine = "tree";
+	app.add_option("--engine", engine, "Interpreter used when executing: tree or closures. Defaults to tree.")
+		->option_text("NAME")
+		->check(CLI::IsMember({ "tree", "closures" }));
+	std::size_t parallelWorkers = 0;
+	app.add_option("--parallel", parallelWorkers, "Evaluate expensive independent calls on N worker threads when executing.")
+		->option_text("N");
+	std::vector<std::string> exportedFunctions;
+	app.add_option("--export", exportedFunctions, "Export the function NAME from the compiled module.")
+		->option_text("NAME");
+	bool batchEntryPoints = false;
+	app.add_flag("--batch", batchEntryPoints, "Also export a batch_NAME entry point for each exported function");
+	std::vector<std::string> mappedFunctions;
+	app.add_option("--map", mappedFunctions, "Export a map_NAME loop applying the function NAME to arrays in memory.")
+		->option_text("NAME");
+	std::vector<std::string> importedFunctions;
+	app.add_option("--import",
+		   importedFunctions,
+		   "Declare a host function imported from the env module, e.g. 'lookup=fun(in key: i32, out value: i32)'.")
+		->option_text("NAME=SIGNATURE");
+	std::optional<std::uint32_t> initialMemoryPages;
+	app.add_option("--memory-pages", initialMemoryPages, "Initial size of the linear memory in 64 KiB pages.")
+		->option_text("N");
+	std::optional<std::uint32_t> maximumMemoryPages;
+	app.add_option("--max-memory-pages", maximumMemoryPages, "Maximum size of the linear memory in 64 KiB pages.")
+		->option_text("N");
+	bool debugLines = false;
+	app.add_flag("-g,--debug-lines", debugLines, "Map code offsets to source lines in DWARF sections of the compiled output");
+	bool printStatistics = false;
+	app.add_flag("--stats", printStatistics, "Print statistics from the analysis passes");
+	std::optional<std::filesystem::path> traceOutputPath;
+	app.add_option("--trace", traceOutputPath, "Write the time spent per file, phase and function to FILE as trace events.")
+		->option_text("FILE");
 
 	std::vector<std::filesystem::path> inputFiles;
 	app.add_option("files", inputFiles, "Input files")->check(CLI::ExistingFile);
@@ -48,31 +104,144 @@ try
 		return EXIT_FAILURE;
 	}
 
+	std::vector<jereq::HostFunctionDeclaration> hostFunctions;
+	for (std::string const& importedFunction : importedFunctions)
+	{
+		std::size_t const separator = importedFunction.find('=');
+		if (separator == std::string::npos)
+		{
+			fmt::print("Expected NAME=SIGNATURE for --import: {}\n", importedFunction);
+			return EXIT_FAILURE;
+		}
+		hostFunctions.push_back({ importedFunction.substr(0, separator), importedFunction.substr(separator + 1) });
+	}
+
+	std::optional<jereq::Tracer> tracer;
+	if (traceOutputPath)
+	{
+		tracer.emplace();
+	}
+	jereq::Tracer* const activeTracer = tracer ? &*tracer : nullptr;
+
 	auto absPath = std::filesystem::absolute(inputFiles.at(0));
+	std::optional<jereq::Tracer::Span> fileSpan;
+	fileSpan.emplace(activeTracer, "file", absPath.string());
+	std::optional<jereq::Tracer::Span> phase;
+	phase.emplace(activeTracer, "phase", "parse");
 	std::ifstream input(absPath, std::ifstream::binary);
-	jereq::Program parsedProgram = jereq::parse(input, absPath.string());
+	std::string const source{ std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>() };
+	jereq::Program parsedProgram = jereq::parse(source, absPath.string(), hostFunctions);
+	phase.emplace(activeTracer, "phase", "analyze");
 
 	fmt::print("Types:\n");
 	for (auto const& type : parsedProgram.types)
 	{
 		fmt::print("  {}\n", type->rep);
 	}
+	fmt::print("Constants:\n");
+	for (auto const& [name, constant] : parsedProgram.constants)
+	{
+		fmt::print("  {}: {} = {}\n", name, jereq::toString(constant.type), constant.value);
+	}
 	fmt::print("Functions:\n");
 	for (auto const& func : parsedProgram.functions)
 	{
 		fmt::print("  {}: {} {{ {} }}\n", func->name, func->type->rep, func->expression.rep);
 	}
 	fmt::print("Main function: {}\n", parsedProgram.mainFunction->name);
+	fmt::print("Costs:\n");
+	for (auto const& functionCost : jereq::estimateCosts(parsedProgram).functions)
+	{
+		if (functionCost.inclusive.unbounded)
+		{
+			fmt::print("  {}: self {}, inclusive unbounded{}\n",
+				functionCost.function->name,
+				functionCost.self.instructions,
+				functionCost.recursive ? " (recursive)" : "");
+		}
+		else
+		{
+			fmt::print("  {}: self {}, inclusive {}\n",
+				functionCost.function->name,
+				functionCost.self.instructions,
+				functionCost.inclusive.instructions);
+		}
+	}
 
 	if (execute)
 	{
-		std::int32_t executionResult = jereq::execute(parsedProgram);
+		phase.emplace(activeTracer, "phase", "execute");
+		jereq::Profile profile;
+		jereq::ExecuteOptions executeOptions;
+		executeOptions.tracer = activeTracer;
+		executeOptions.parallelWorkers = parallelWorkers;
+		executeOptions.engine = engine == "closures" ? jereq::InterpreterEngine::closures
+													 : jereq::InterpreterEngine::treeWalker;
+		if (profileOutputPath)
+		{
+			executeOptions.profile = &profile;
+		}
+		std::optional<jereq::SamplingProfiler> sampler;
+		if (samplesOutputPath)
+		{
+			executeOptions.sampler = &sampler.emplace();
+		}
+
+		std::optional<jereq::ExecutionTrace> trace;
+		if (lastEvents > 0)
+		{
+			executeOptions.trace = &trace.emplace(lastEvents);
+		}
+
+		std::int32_t executionResult = 0;
+		try
+		{
+			executionResult = jereq::execute(parsedProgram, executeOptions);
+		}
+		catch (std::exception const&)
+		{
+			if (trace)
+			{
+				std::ostringstream events;
+				trace->write(events, parsedProgram);
+				fmt::print(stderr, "Last events before the failure:\n{}", events.str());
+			}
+			throw;
+		}
 		fmt::print("\nResult from execution: {}\n", executionResult);
+
+		if (profileOutputPath)
+		{
+			std::ofstream profileOutput(*profileOutputPath);
+			jereq::writeProfile(profileOutput, profile);
+		}
+		if (samplesOutputPath)
+		{
+			std::ofstream samplesOutput(*samplesOutputPath);
+			sampler->writeFoldedStacks(samplesOutput);
+		}
 	}
 	else
 	{
+		phase.emplace(activeTracer, "phase", "compile");
+		jereq::Profile profile;
+		jereq::CompileOptions compileOptions;
+		compileOptions.tracer = activeTracer;
+		compileOptions.exportedFunctions = exportedFunctions;
+		compileOptions.batchEntryPoints = batchEntryPoints;
+		compileOptions.mappedFunctions = mappedFunctions;
+		compileOptions.initialMemoryPages = initialMemoryPages;
+		compileOptions.maximumMemoryPages = maximumMemoryPages;
+		compileOptions.debugLines = debugLines;
+		if (profileInputPath)
+		{
+			std::ifstream profileInput(*profileInputPath);
+			profile = jereq::readProfile(profileInput);
+			compileOptions.profile = &profile;
+		}
+
 		std::ofstream output(outputPath, std::ofstream::binary);
-		if (jereq::compile(parsedProgram, output))
+		if (jereq::compile(parsedProgram, output, compileOptions))
 		{
 			spdlog::info("Successfully compiled program: {}", outputPath.string());
 		}
@@ -82,6 +251,27 @@ try
 		}
 	}
 
+	if (printStatistics)
+	{
+		// Figures of the analysis passes come from the runs made by compile or execute, with their own entry points.
+		fmt::print("Statistics:\n");
+		for (auto const& statistic : jereq::collectStatistics())
+		{
+			if (statistic.value != 0)
+			{
+				fmt::print("  {}: {}: {}\n", statistic.pass, statistic.description, statistic.value);
+			}
+		}
+	}
+
+	if (traceOutputPath)
+	{
+		phase.reset();
+		fileSpan.reset();
+		std::ofstream traceOutput(*traceOutputPath);
+		tracer->writeTraceEvents(traceOutput);
+	}
+
 	return EXIT_SUCCESS;
 }
 catch (const std::exception& e)
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/interpreter/execution_trace.hpp>
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace jereq
+{
+ExecutionTrace::ExecutionTrace(std::size_t capacity)
+	: events(std::bit_ceil(std::max<std::size_t>(capacity, 1)))
+	, mask(events.size() - 1)
+{
+}
+
+std::vector<ExecutionTrace::Event> ExecutionTrace::recentEvents() const
+{
+	std::uint64_t const count = std::min<std::uint64_t>(written, events.size());
+	std::vector<Event> recent;
+	recent.reserve(count);
+	for (std::uint64_t index = written - count; index < written; ++index)
+	{
+		recent.push_back(events[index & mask]);
+	}
+	return recent;
+}
+
+void ExecutionTrace::write(std::ostream& out, Program const& program) const
+{
+	for (Event const& event : recentEvents())
+	{
+		std::string_view const functionName = event.function != nullptr ? event.function->name : "?";
+		switch (event.kind)
+		{
+		case EventKind::call:
+			out << "call " << functionName << " with " << event.value;
+			break;
+		case EventKind::evaluation:
+			out << "evaluate in " << functionName << " = " << event.value;
+			break;
+		case EventKind::ret:
+			out << "return from " << functionName << " with " << event.value;
+			break;
+		}
+
+		if (event.expression != nullptr && event.expression->sourceOffset)
+		{
+			auto const [line, column] = program.lines.locate(*event.expression->sourceOffset);
+			out << " at " << program.sourceName << ':' << line << ':' << column;
+		}
+		out << '\n';
+	}
+}
+}
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace jereq
+{
+/// Remembers the most recent calls, returns and expression evaluations of an execution in a fixed-size ring buffer, so
+/// that the events leading up to an error, or to the current point, can be inspected afterwards. Recording writes one
+/// slot of preallocated memory and never allocates. A trace belongs to one execution at a time.
+class ExecutionTrace
+{
+public:
+	enum struct EventKind : std::uint8_t
+	{
+		call,
+		evaluation,
+		ret,
+	};
+
+	struct Event
+	{
+		EventKind kind = EventKind::call;
+		Function const* function = nullptr;
+		/// The evaluated expression, or the body of the called or returning function.
+		Expression const* expression = nullptr;
+		/// The first in argument of a call, the result of an evaluation or the first out parameter of a return.
+		std::int64_t value = 0;
+	};
+
+	/// The capacity is rounded up to a power of two.
+	explicit ExecutionTrace(std::size_t capacity = 1'024);
+
+	void record(Event const& event)
+	{
+		events[written & mask] = event;
+		++written;
+	}
+
+	/// Number of events recorded, including those overwritten since.
+	[[nodiscard]] std::uint64_t recordedCount() const { return written; }
+
+	/// Events still in the buffer, oldest first.
+	[[nodiscard]] std::vector<Event> recentEvents() const;
+
+	/// Writes the events still in the buffer, oldest first, with the source positions of their expressions in the
+	/// program they were recorded from.
+	void write(std::ostream& out, Program const& program) const;
+
+private:
+	std::vector<Event> events;
+	std::uint64_t mask;
+	std::uint64_t written = 0;
+};
+}
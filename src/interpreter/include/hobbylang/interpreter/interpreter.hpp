@@ -2,11 +2,109 @@
 // Copyright © 2022 Sebastian Larsson
 #pragma once
 
+#include <hobbylang/analysis/profile.hpp>
 #include <hobbylang/ast/ast.hpp>
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
 
 namespace jereq
 {
+class ExecutionTrace;
+class SamplingProfiler;
+class Tracer;
+
+enum struct InterpreterEngine
+{
+	/// Walks the AST directly on every evaluation.
+	treeWalker,
+	/// Translates each function once into pre-bound closures with slot-indexed locals.
+	closures,
+};
+
+struct ExecuteOptions
+{
+	/// When set, call counts and observed arguments are recorded into this profile. Profiling always uses the tree walker.
+	Profile* profile = nullptr;
+	/// When set, the call stack is sampled into this profiler while executing, with either engine.
+	SamplingProfiler* sampler = nullptr;
+	/// When set, the most recent calls and returns are recorded into this trace, and so are expression evaluations with
+	/// the tree walker. The trace holds the events leading up to an error after execute throws.
+	ExecutionTrace* trace = nullptr;
+	/// When set, preparing and running the program are recorded as spans, as are parallel operands on the workers.
+	Tracer* tracer = nullptr;
+	/// Worker threads used by the tree walker to evaluate the two call operands of a binary operator concurrently. Zero
+	/// evaluates everything serially. Ignored while recording a profile or an execution trace. Calls that may reach a
+	/// host function always run on the calling thread.
+	std::size_t parallelWorkers = 0;
+	/// Minimum estimated cost of each call operand before the pair is evaluated in parallel.
+	std::uint64_t parallelCostThreshold = 10'000;
+	InterpreterEngine engine = InterpreterEngine::treeWalker;
+};
+
 std::int32_t execute(Program const& program);
+std::int32_t execute(Program const& program, ExecuteOptions const& options);
+
+/// A program translated once by the closure engine, so the host can call any of its functions repeatedly. Every
+/// function is treated as an entry point, so no checks are elided based on the arguments of its callers. Calls only
+/// read the program and may run concurrently.
+class CompiledProgram
+{
+public:
+	explicit CompiledProgram(Program program);
+	CompiledProgram(CompiledProgram const&) = delete;
+	CompiledProgram(CompiledProgram&&) noexcept;
+	CompiledProgram& operator=(CompiledProgram const&) = delete;
+	CompiledProgram& operator=(CompiledProgram&&) noexcept;
+	~CompiledProgram();
+
+	[[nodiscard]] std::size_t functionCount() const;
+	/// Index of the named function, in declaration order.
+	[[nodiscard]] std::optional<std::size_t> findFunction(std::string_view name) const;
+	[[nodiscard]] std::size_t inCount(std::size_t function) const;
+	[[nodiscard]] std::size_t outCount(std::size_t function) const;
+
+	/// Calls a function with its in parameters and receives its out parameters, each in declaration order and widened to
+	/// 64 bits. Frames of up to eight parameters and locals live on the native stack, so such calls do not allocate.
+	void call(std::size_t function, std::span<std::int64_t const> inValues, std::span<std::int64_t> outValues) const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
+
+/// Runs many executions of main functions on the calling thread, round-robin, so that a long one does not hold up the
+/// rest. Each execution is a coroutine over the tree walker that yields once it has used a slice of fuel, where every
+/// loop iteration and call costs one unit.
+class Scheduler
+{
+public:
+	explicit Scheduler(std::uint64_t fuelPerSlice = 1'000);
+	Scheduler(Scheduler const&) = delete;
+	Scheduler(Scheduler&&) noexcept;
+	Scheduler& operator=(Scheduler const&) = delete;
+	Scheduler& operator=(Scheduler&&) noexcept;
+	~Scheduler();
+
+	/// Queues an execution of the main function of a program, which must outlive the scheduler. Programs are prepared
+	/// once, on their first submission. Returns an id to query the execution with.
+	std::size_t submit(Program const& program);
+	/// Runs a slice of the execution at the front of the queue, then queues it again unless it finished. Returns the id
+	/// of the execution, or nothing when the queue is empty.
+	std::optional<std::size_t> step();
+	/// Steps until every queued execution has finished.
+	void run();
+
+	[[nodiscard]] bool finished(std::size_t execution) const;
+	/// Exit code of a finished execution, rethrowing the error it failed with.
+	[[nodiscard]] std::int32_t result(std::size_t execution) const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
 }
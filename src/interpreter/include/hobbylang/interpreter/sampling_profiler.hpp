@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace jereq
+{
+/// Samples the call stacks of executing programs at a fixed rate, without instrumenting every call for counting. A
+/// background thread requests a sample on every tick, and the interpreters take it at their next call or loop
+/// iteration, where the stack of functions executing on that thread is exact. Samples go to a fixed-size lock-free ring
+/// buffer that overwrites the oldest ones once full.
+class SamplingProfiler
+{
+public:
+	/// Deeper stacks keep their innermost functions.
+	static constexpr std::size_t maxDepth = 32;
+
+	explicit SamplingProfiler(std::chrono::microseconds interval = std::chrono::milliseconds(1),
+		std::size_t capacity = 16'384);
+	SamplingProfiler(SamplingProfiler const&) = delete;
+	SamplingProfiler(SamplingProfiler&&) = delete;
+	SamplingProfiler& operator=(SamplingProfiler const&) = delete;
+	SamplingProfiler& operator=(SamplingProfiler&&) = delete;
+	~SamplingProfiler();
+
+	/// Marks a function as executing on this thread while in scope, taking a sample first if one is due. Does nothing
+	/// without a profiler.
+	class Call
+	{
+	public:
+		Call(SamplingProfiler* activeProfiler, Function const& function);
+		Call(Call const&) = delete;
+		Call(Call&&) = delete;
+		Call& operator=(Call const&) = delete;
+		Call& operator=(Call&&) = delete;
+		~Call();
+
+	private:
+		SamplingProfiler* profiler;
+	};
+
+	/// Takes a sample of this thread if one is due. Called by the interpreters on every loop iteration.
+	void poll()
+	{
+		if (requested.load(std::memory_order_relaxed) && requested.exchange(false, std::memory_order_relaxed))
+		{
+			record();
+		}
+	}
+
+	/// Number of samples taken, including those overwritten since.
+	[[nodiscard]] std::uint64_t sampleCount() const;
+
+	/// Writes the samples in the buffer as folded stacks, one "outer;inner count" line per distinct stack. Call once the
+	/// profiled executions have finished.
+	void writeFoldedStacks(std::ostream& out) const;
+
+private:
+	struct Sample
+	{
+		std::size_t depth = 0;
+		std::array<Function const*, maxDepth> functions{};
+	};
+
+	std::atomic<bool> requested = false;
+	std::atomic<std::uint64_t> written = 0;
+	std::vector<Sample> samples;
+	std::jthread ticker;
+
+	void record();
+};
+}
@@ -1,266 +1,2674 @@
 // SPDX-License-Identifier: MIT
 // Copyright © 2022 Sebastian Larsson
 #include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/interpreter/execution_trace.hpp>
+#include <hobbylang/interpreter/sampling_profiler.hpp>
 
+#include "task.hpp"
+#include "work_stealing_pool.hpp"
+
+#include <hobbylang/analysis/cost_model.hpp>
+#include <hobbylang/analysis/division.hpp>
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/analysis/range_analysis.hpp>
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/trace.hpp>
+#include <hobbylang/analysis/type_check.hpp>
 #include <hobbylang/ast/ast.hpp>
 
 #include <fmt/core.h>
 
 #include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace jereq
 {
+namespace
+{
+Statistic evaluatedExpressions("interpreter", "Expressions evaluated by the tree walker");
+}
+
+// Values of every type are stored widened to 64 bits. i32 values are kept sign-extended, so narrowing them is lossless.
 struct Local
 {
 	std::string name;
-	std::int32_t value = 0;
+	std::int64_t value = 0;
+	ValueType type = ValueType::i32;
+	/// Set on the first element of an array, with the rest of the elements in the following unnamed locals.
+	std::size_t arrayLength = 0;
 };
 
 struct ParameterValue
 {
 	std::string name;
-	std::int32_t value = 0;
+	std::int64_t value = 0;
+	ValueType type = ValueType::i32;
 };
 
 struct Frame
 {
+	Function const* function = nullptr;
 	std::vector<Local> locals;
 };
 
 struct ExpressionResult
 {
-	std::string type;// TODO: Replace
-	std::int32_t value;
+	ValueType type;
+	std::int64_t value;
 };
 
-struct State
+template<typename T>
+constexpr ValueType valueTypeFor()
 {
-	Program const* program;
-
-	struct ExpressionVisitor
-	{
-		State* self;
-		Frame* frame;
+	return std::is_same_v<T, std::int64_t> ? ValueType::i64 : ValueType::i32;
+}
 
-		ExpressionResult operator()(Literal const& literal) { return { "i32", literal.value }; }
+struct PreparedDivision
+{
+	SignedDivisor divisor;
+	bool needsChecks = true;
+};
 
-		ExpressionResult operator()(InitAssignment const& initAssignment)
+// Divisions by constants are only strength reduced for i32, so i64 divisions always use the hardware instruction.
+template<typename T>
+T divideOrRemainder(BinaryOperator op, PreparedDivision const& prepared, T lhsValue, T rhsValue)
+{
+	bool const isDivide = op == BinaryOperator::divide;
+	if (prepared.needsChecks)
+	{
+		if (rhsValue == 0)
 		{
-			auto localIt
-				= std::ranges::find(frame->locals, initAssignment.var, [](Local const& local) { return local.name; });
-			if (localIt == frame->locals.end())
+			throw std::runtime_error("Integer division by zero");
+		}
+		if (rhsValue == -1)
+		{
+			if (!isDivide)
 			{
-				throw std::runtime_error("Undeclared variable: " + initAssignment.var);
+				return 0;
 			}
-
-			ExpressionResult const& expressionResult = self->evaluateExpression(*frame, *initAssignment.value);
-			if (expressionResult.type != "i32")
+			if (lhsValue == std::numeric_limits<T>::min())
 			{
-				throw std::runtime_error("Unexpected expression result type: " + expressionResult.type);
+				throw std::runtime_error("Integer overflow in division");
 			}
-			localIt->value = expressionResult.value;
-			return { "", 0 };
 		}
+	}
 
-		ExpressionResult operator()(BinaryOpExpression const& binaryOp)
+	if constexpr (std::is_same_v<T, std::int32_t>)
+	{
+		if (prepared.divisor.strategy != DivisionStrategy::hardware)
 		{
-			auto [lhsType, lhsValue] = self->evaluateExpression(*frame, *binaryOp.lhs);
-			auto [rhsType, rhsValue] = self->evaluateExpression(*frame, *binaryOp.rhs);
+			return isDivide ? divideByConstant(lhsValue, prepared.divisor)
+							: remainderByConstant(lhsValue, prepared.divisor);
+		}
+	}
+	return isDivide ? lhsValue / rhsValue : lhsValue % rhsValue;
+}
 
-			if (lhsType != "i32" || rhsType != "i32")
-			{
-				throw std::runtime_error("Unexpected types for addition: " + lhsType + ", " + rhsType);
-			}
+// Arithmetic wraps around at the width of T, like the compiled code and constant folding. In place of std::plus and
+// friends, it is computed on the unsigned type, where overflow is defined, and converted back.
+template<typename T>
+struct WrappingPlus
+{
+	using Unsigned = std::make_unsigned_t<T>;
+	constexpr T operator()(T lhs, T rhs) const
+	{
+		return static_cast<T>(static_cast<Unsigned>(static_cast<Unsigned>(lhs) + static_cast<Unsigned>(rhs)));
+	}
+};
+
+template<typename T>
+struct WrappingMinus
+{
+	using Unsigned = std::make_unsigned_t<T>;
+	constexpr T operator()(T lhs, T rhs) const
+	{
+		return static_cast<T>(static_cast<Unsigned>(static_cast<Unsigned>(lhs) - static_cast<Unsigned>(rhs)));
+	}
+};
+
+template<typename T>
+struct WrappingMultiplies
+{
+	using Unsigned = std::make_unsigned_t<T>;
+	constexpr T operator()(T lhs, T rhs) const
+	{
+		return static_cast<T>(static_cast<Unsigned>(static_cast<Unsigned>(lhs) * static_cast<Unsigned>(rhs)));
+	}
+};
+
+template<typename T>
+constexpr std::int32_t compare(BinaryOperator op, T lhsValue, T rhsValue)
+{
+	switch (op)
+	{
+	case BinaryOperator::equal:
+		return lhsValue == rhsValue ? 1 : 0;
+	case BinaryOperator::notEqual:
+		return lhsValue != rhsValue ? 1 : 0;
+	case BinaryOperator::less:
+		return lhsValue < rhsValue ? 1 : 0;
+	case BinaryOperator::lessEqual:
+		return lhsValue <= rhsValue ? 1 : 0;
+	case BinaryOperator::greater:
+		return lhsValue > rhsValue ? 1 : 0;
+	case BinaryOperator::greaterEqual:
+	default:
+		return lhsValue >= rhsValue ? 1 : 0;
+	}
+}
+
+/// Picks one of two already evaluated values by masking, so data-dependent conditions cost no branch.
+constexpr std::int64_t select(std::int64_t condition, std::int64_t whenTrue, std::int64_t whenFalse)
+{
+	std::uint64_t const mask = 0U - static_cast<std::uint64_t>(condition != 0);
+	return static_cast<std::int64_t>(
+		(static_cast<std::uint64_t>(whenTrue) & mask) | (static_cast<std::uint64_t>(whenFalse) & ~mask));
+}
+
+/// Applies an operator at the width of T to values stored widened to 64 bits.
+template<typename T>
+std::int64_t applyTyped(BinaryOperator op, PreparedDivision const& prepared, std::int64_t lhs, std::int64_t rhs)
+{
+	auto const lhsValue = static_cast<T>(lhs);
+	auto const rhsValue = static_cast<T>(rhs);
+	switch (op)
+	{
+	case BinaryOperator::add:
+		return WrappingPlus<T>{}(lhsValue, rhsValue);
+	case BinaryOperator::subtract:
+		return WrappingMinus<T>{}(lhsValue, rhsValue);
+	case BinaryOperator::multiply:
+		return WrappingMultiplies<T>{}(lhsValue, rhsValue);
+	case BinaryOperator::divide:
+	case BinaryOperator::modulo:
+		return divideOrRemainder(op, prepared, lhsValue, rhsValue);
+	case BinaryOperator::equal:
+	case BinaryOperator::notEqual:
+	case BinaryOperator::less:
+	case BinaryOperator::lessEqual:
+	case BinaryOperator::greater:
+	case BinaryOperator::greaterEqual:
+		return compare(op, lhsValue, rhsValue);
+	default:
+		throw std::runtime_error("Unexpected binary operator: "
+								 + std::to_string(static_cast<std::underlying_type_t<BinaryOperator>>(op)));
+	}
+}
+
+struct DivisionCollector
+{
+	RangeAnalysis const* ranges;
+	std::unordered_map<BinaryOpExpression const*, PreparedDivision>* divisions;
+
+	void operator()(Literal const& /*literal*/) {}
+
+	void operator()(InitAssignment const& initAssignment) { std::visit(*this, initAssignment.value->expr); }
 
-			std::int32_t result = -1;
-			switch (binaryOp.op)
+	void operator()(BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, binaryOp.lhs->expr);
+		std::visit(*this, binaryOp.rhs->expr);
+
+		if (binaryOp.op == BinaryOperator::divide || binaryOp.op == BinaryOperator::modulo)
+		{
+			PreparedDivision prepared;
+			prepared.needsChecks = ranges->needsDivisionChecks(binaryOp);
+			auto const* divisor = std::get_if<Literal>(&binaryOp.rhs->expr);
+			if (divisor != nullptr && divisor->type == ValueType::i32)
 			{
-			case BinaryOperator::add:
-				result = lhsValue + rhsValue;
-				break;
-			case BinaryOperator::subtract:
-				result = lhsValue - rhsValue;
-				break;
-			case BinaryOperator::multiply:
-				result = lhsValue * rhsValue;
-				break;
-			case BinaryOperator::divide:
-				result = lhsValue / rhsValue;
-				break;
-			case BinaryOperator::modulo:
-				result = lhsValue % rhsValue;
-				break;
-			default:
-				throw std::runtime_error(
-					"Unexpected binary operator: "
-					+ std::to_string(static_cast<std::underlying_type_t<BinaryOperator>>(binaryOp.op)));
+				prepared.divisor = analyzeDivisor(static_cast<std::int32_t>(divisor->value));
 			}
-			return { lhsType, result };
+			divisions->try_emplace(&binaryOp, prepared);
 		}
+	}
 
-		ExpressionResult operator()(FunctionCall const& functionCall)
+	void operator()(FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& arg : functionCall.arguments)
 		{
-			auto funcIt = std::ranges::find_if(self->program->functions,
-				[&](std::shared_ptr<Function> const& func) { return func->name == functionCall.functionName; });
-			if (funcIt == self->program->functions.cend())
-			{
-				throw std::runtime_error(fmt::format("Couldn't find function {}", functionCall.functionName));
-			}
-			std::shared_ptr<Function> const& function = *funcIt;
+			std::visit(*this, arg.expr.expr);
+		}
+	}
 
-			std::vector<ParameterValue> inArgs;
-			for (auto const& arg : functionCall.arguments)
-			{
-				if (arg.direction == ParameterDirection::in)
-				{
-					auto [argType, argValue] = self->evaluateExpression(*frame, arg.expr);
-					if (argType != "i32")
-					{
-						throw std::runtime_error("Only i32 is implemented");
-					}
-					inArgs.push_back(ParameterValue{ arg.name, argValue });
-				}
-				else if (arg.direction == ParameterDirection::out)
-				{
-					throw std::runtime_error("Named output arguments not implemented");
-				}
-				else
-				{
-					throw std::runtime_error("Unknown direction (inout?) when calling function not implemented");
-				}
-			}
+	void operator()(LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, loop.from->expr);
+		std::visit(*this, loop.to->expr);
+		std::visit(*this, loop.initial->expr);
+		std::visit(*this, loop.body->expr);
+	}
 
-			std::vector<ParameterValue> outArgs;
-			for (auto const& param : std::get<FuncType>(function->type->t).parameters)
-			{
-				if (param.direction == ParameterDirection::out)
-				{
-					outArgs.push_back(ParameterValue{ param.name, 0 });
-				}
-			}
+	void operator()(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, conditional.condition->expr);
+		std::visit(*this, conditional.whenTrue->expr);
+		std::visit(*this, conditional.whenFalse->expr);
+	}
 
-			self->executeFunction(*function, inArgs, outArgs);
+	void operator()(LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& element : let.elements)
+		{
+			std::visit(*this, element->expr);
+		}
+		if (let.generator)
+		{
+			std::visit(*this, let.generator->expr);
+		}
+		std::visit(*this, let.body->expr);
+	}
 
-			if (outArgs.empty())
-			{
-				return { "", 0 };
-			}
-			else if (outArgs.size() == 1)
-			{
-				return { "i32", outArgs[0].value };
-			}
-			else
-			{
-				throw std::runtime_error("Multiple out args not implemented");
-			}
+	void operator()(IndexExpression const& index) { std::visit(*this, index.index->expr); }
+
+	void operator()(VarExpression const& /*varExpression*/) {}
+};
+
+/// Finds binary operators whose operands are two expensive calls that can run concurrently. Such calls only read the
+/// caller's frame, so they are independent as long as no argument assigns to a local, runs a loop or binds an array.
+/// Calls that may reach a host function stay on the calling thread, as host callbacks need not be thread-safe.
+struct ParallelCollector
+{
+	CostModel const* costs;
+	std::uint64_t costThreshold;
+	std::unordered_set<BinaryOpExpression const*>* parallelOperands;
+
+	static bool assigns(Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		// Loops and arrays push locals onto the frame.
+		if (std::holds_alternative<InitAssignment>(expression.expr)
+			|| std::holds_alternative<LoopExpression>(expression.expr)
+			|| std::holds_alternative<LetExpression>(expression.expr))
+		{
+			return true;
+		}
+		if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
+		{
+			return assigns(*binaryOp->lhs) || assigns(*binaryOp->rhs);
+		}
+		if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+		{
+			return assigns(*conditional->condition) || assigns(*conditional->whenTrue)
+				|| assigns(*conditional->whenFalse);
+		}
+		if (auto const* index = std::get_if<IndexExpression>(&expression.expr))
+		{
+			return assigns(*index->index);
+		}
+		if (auto const* functionCall = std::get_if<FunctionCall>(&expression.expr))
+		{
+			return std::ranges::any_of(
+				functionCall->arguments, [](FuncArgument const& arg) { return assigns(arg.expr); });
 		}
+		return false;
+	}
 
-		ExpressionResult operator()(VarExpression const& varExpression)
+	/// Whether evaluating an expression that does not assign may call a host function. Calls to anything but a
+	/// program function are host calls.
+	bool callsHost(Expression const& expression) const// NOLINT(misc-no-recursion)
+	{
+		if (auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr))
 		{
-			auto localIt = std::ranges::find_if(
-				frame->locals, [&](Local const& local) { return local.name == varExpression.varName; });
-			if (localIt == frame->locals.end())
-			{
-				throw std::runtime_error(fmt::format("Local \"{}\" not found", varExpression.varName));
-			}
+			return callsHost(*binaryOp->lhs) || callsHost(*binaryOp->rhs);
+		}
+		if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+		{
+			return callsHost(*conditional->condition) || callsHost(*conditional->whenTrue)
+				|| callsHost(*conditional->whenFalse);
+		}
+		if (auto const* index = std::get_if<IndexExpression>(&expression.expr))
+		{
+			return callsHost(*index->index);
+		}
+		if (auto const* functionCall = std::get_if<FunctionCall>(&expression.expr))
+		{
+			FunctionCost const* callee = costs->find(functionCall->functionName);
+			return callee == nullptr || callee->callsHost
+				|| std::ranges::any_of(
+					functionCall->arguments, [this](FuncArgument const& arg) { return callsHost(arg.expr); });
+		}
+		return false;
+	}
 
-			return { "i32", localIt->value };
+	bool isExpensiveCall(Expression const& expression) const
+	{
+		auto const* functionCall = std::get_if<FunctionCall>(&expression.expr);
+		if (functionCall == nullptr || costs->find(functionCall->functionName) == nullptr || assigns(expression)
+			|| callsHost(expression))
+		{
+			return false;
 		}
-	};
+		Cost const cost = costs->costOf(expression);
+		return cost.unbounded || cost.instructions >= costThreshold;
+	}
 
-	ExpressionResult evaluateExpression(Frame& frame, Expression const& expr)// NOLINT(misc-no-recursion)
+	void operator()(Literal const& /*literal*/) {}
+
+	void operator()(InitAssignment const& initAssignment) { std::visit(*this, initAssignment.value->expr); }
+
+	void operator()(BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
 	{
-		return std::visit(ExpressionVisitor{ this, &frame }, expr.expr);
+		std::visit(*this, binaryOp.lhs->expr);
+		std::visit(*this, binaryOp.rhs->expr);
+
+		if (isExpensiveCall(*binaryOp.lhs) && isExpensiveCall(*binaryOp.rhs))
+		{
+			parallelOperands->insert(&binaryOp);
+		}
 	}
 
-	void executeFunction(Function const& func,// NOLINT(misc-no-recursion)
-		std::vector<ParameterValue> const& inArgs,
-		std::vector<ParameterValue>& outArgs)
+	void operator()(FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& arg : functionCall.arguments)
+		{
+			std::visit(*this, arg.expr.expr);
+		}
+	}
+
+	void operator()(LoopExpression const& loop)// NOLINT(misc-no-recursion)
 	{
-		Frame frame;
+		std::visit(*this, loop.from->expr);
+		std::visit(*this, loop.to->expr);
+		std::visit(*this, loop.initial->expr);
+		std::visit(*this, loop.body->expr);
+	}
 
-		auto const& funcType = std::get<FuncType>(func.type->t);
-		for (auto const& funcParam : funcType.parameters)
+	void operator()(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, conditional.condition->expr);
+		std::visit(*this, conditional.whenTrue->expr);
+		std::visit(*this, conditional.whenFalse->expr);
+	}
+
+	void operator()(LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& element : let.elements)
 		{
-			if (!std::holds_alternative<BuiltInType>(funcParam.type->t))
-			{
-				throw std::runtime_error("Only built in types supported as parameter types: " + funcType.rep);
-			}
-			auto const& paramType = std::get<BuiltInType>(funcParam.type->t);
-			if (paramType.name != "i32")
-			{
-				throw std::runtime_error("Only i32 support is implemented: " + funcType.rep);
-			}
+			std::visit(*this, element->expr);
+		}
+		if (let.generator)
+		{
+			std::visit(*this, let.generator->expr);
+		}
+		std::visit(*this, let.body->expr);
+	}
 
-			switch (funcParam.direction)
-			{
-			case ParameterDirection::in:
+	void operator()(IndexExpression const& index) { std::visit(*this, index.index->expr); }
+
+	void operator()(VarExpression const& /*varExpression*/) {}
+};
+
+enum struct OperandKind
+{
+	literal,
+	local,
+	subexpression,
+};
+
+constexpr std::size_t operandKindCount = 3;
+
+struct PreparedOperand
+{
+	OperandKind kind = OperandKind::subexpression;
+	std::int64_t literal = 0;
+	std::size_t local = 0;
+};
+
+struct State;
+struct PreparedBinary;
+using BinaryKernel = ExpressionResult (*)(State&, Frame&, BinaryOpExpression const&, PreparedBinary const&);
+
+/// A binary operator resolved at preparation time, with a kernel specialized for its operator and operand kinds.
+struct PreparedBinary
+{
+	/// The operator this entry was prepared for, to tell it apart from operators sharing its index.
+	BinaryOpExpression const* expression = nullptr;
+	BinaryKernel kernel = nullptr;
+	PreparedOperand lhs;
+	PreparedOperand rhs;
+	PreparedDivision division;
+};
+
+BinaryKernel selectKernel(BinaryOperator op, ValueType type, OperandKind lhsKind, OperandKind rhsKind);
+
+struct KernelCollector
+{
+	Function const* function;
+	TypeInfo const* types;
+	std::unordered_map<BinaryOpExpression const*, PreparedDivision> const* divisions;
+	/// Indexed by BinaryOpExpression::index.
+	std::vector<PreparedBinary>* binaryKernels;
+	/// Mirrors the locals that enclosing loops and arrays push onto the frame after the parameters.
+	std::vector<Local> scopedLocals;
+
+	PreparedOperand prepareOperand(Expression const& operand) const
+	{
+		if (auto const* literal = std::get_if<Literal>(&operand.expr))
+		{
+			return { OperandKind::literal, literal->value, 0 };
+		}
+		if (auto const* varExpression = std::get_if<VarExpression>(&operand.expr))
+		{
+			// Frames hold the parameters in declaration order, followed by the locals of enclosing loops and arrays.
+			// The innermost one shadows everything else. Arrays are left to the visitor, which reports the misuse.
+			auto const& parameters = std::get<FuncType>(function->type->t).parameters;
+			auto scopedIt = std::ranges::find(scopedLocals | std::views::reverse, varExpression->varName, &Local::name);
+			if (scopedIt != scopedLocals.rend())
 			{
-				auto argIt
-					= std::ranges::find_if(inArgs, [&](ParameterValue const& arg) { return arg.name == funcParam.name; });
-				if (argIt == inArgs.cend())
+				if (scopedIt->arrayLength > 0)
 				{
-					throw std::runtime_error(fmt::format("No arg provided for param  \"{}\"", funcParam.name));
+					return {};
 				}
-				frame.locals.push_back(Local{ funcParam.name, argIt->value });
-				break;
+				return { OperandKind::local,
+					0,
+					parameters.size() + static_cast<std::size_t>(scopedLocals.rend() - scopedIt) - 1 };
 			}
-			case ParameterDirection::out:
+
+			auto paramIt = std::ranges::find(parameters, varExpression->varName, &FuncParameter::name);
+			if (paramIt != parameters.end())
 			{
-				auto argIt
-					= std::ranges::find_if(outArgs, [&](ParameterValue const& arg) { return arg.name == funcParam.name; });
-				if (argIt == outArgs.cend())
-				{
-					throw std::runtime_error(fmt::format("No arg provided for param  \"{}\"", funcParam.name));
-				}
-				frame.locals.push_back(Local{ funcParam.name, 0 });
-				break;
-			}
-			default:
-				throw std::runtime_error("Unknown (inout?) parameter direction not implemented");
+				return { OperandKind::local, 0, static_cast<std::size_t>(paramIt - parameters.begin()) };
 			}
 		}
-		if (funcType.parameters.size() != frame.locals.size())
+		return {};
+	}
+
+	void operator()(Literal const& /*literal*/) {}
+
+	void operator()(InitAssignment const& initAssignment) { std::visit(*this, initAssignment.value->expr); }
+
+	void operator()(BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, binaryOp.lhs->expr);
+		std::visit(*this, binaryOp.rhs->expr);
+
+		if (binaryOp.index >= binaryKernels->size() || (*binaryKernels)[binaryOp.index].expression != nullptr)
 		{
-			throw std::runtime_error("Arg count doesn't match parameter count");
+			return;
 		}
 
-		auto [exprType, _] = evaluateExpression(frame, func.expression);
-		if (!exprType.empty())
+		PreparedBinary prepared;
+		prepared.expression = &binaryOp;
+		prepared.lhs = prepareOperand(*binaryOp.lhs);
+		prepared.rhs = prepareOperand(*binaryOp.rhs);
+		prepared.kernel = selectKernel(binaryOp.op, types->typeOf(*binaryOp.lhs), prepared.lhs.kind, prepared.rhs.kind);
+		if (auto divisionIt = divisions->find(&binaryOp); divisionIt != divisions->end())
 		{
-			throw std::runtime_error("Function expression should not return a value");
+			prepared.division = divisionIt->second;
 		}
+		if (prepared.kernel != nullptr)
+		{
+			(*binaryKernels)[binaryOp.index] = prepared;
+		}
+	}
 
-		for (auto& outArg : outArgs)
+	void operator()(FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& arg : functionCall.arguments)
 		{
-			auto localIt
-				= std::ranges::find_if(frame.locals, [&](Local const& local) { return local.name == outArg.name; });
-			if (localIt == frame.locals.end())
+			std::visit(*this, arg.expr.expr);
+		}
+	}
+
+	void operator()(LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, loop.from->expr);
+		std::visit(*this, loop.to->expr);
+		std::visit(*this, loop.initial->expr);
+
+		scopedLocals.push_back(Local{ loop.counter });
+		scopedLocals.push_back(Local{ loop.accumulator });
+		std::visit(*this, loop.body->expr);
+		scopedLocals.resize(scopedLocals.size() - 2);
+	}
+
+	void operator()(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		std::visit(*this, conditional.condition->expr);
+		std::visit(*this, conditional.whenTrue->expr);
+		std::visit(*this, conditional.whenFalse->expr);
+	}
+
+	void operator()(LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& element : let.elements)
+		{
+			std::visit(*this, element->expr);
+		}
+		if (let.generator)
+		{
+			scopedLocals.push_back(Local{ let.generatorIndex });
+			std::visit(*this, let.generator->expr);
+			scopedLocals.pop_back();
+		}
+
+		std::size_t const length = std::get<ArrayType>(let.type->t).length;
+		scopedLocals.push_back(Local{ let.name, 0, ValueType::none, length });
+		scopedLocals.resize(scopedLocals.size() + length - 1);
+		std::visit(*this, let.body->expr);
+		scopedLocals.resize(scopedLocals.size() - length);
+	}
+
+	void operator()(IndexExpression const& index) { std::visit(*this, index.index->expr); }
+
+	void operator()(VarExpression const& /*varExpression*/) {}
+};
+
+/// A call to a host function, with its arguments resolved to declaration order ahead of time.
+struct PreparedHostCall
+{
+	HostFunction const* function = nullptr;
+	std::vector<Expression const*> arguments;
+	ValueType result = ValueType::none;
+	/// Reported when the call is evaluated, like the errors of calls to functions in the program.
+	std::string error;
+};
+
+PreparedHostCall prepareHostCall(HostFunction const& hostFunction, FunctionCall const& functionCall)
+{
+	PreparedHostCall prepared{ &hostFunction, {}, ValueType::none, {} };
+	if (hostFunction.callback == nullptr)
+	{
+		prepared.error = fmt::format("Host function {} has no callback", hostFunction.name);
+		return prepared;
+	}
+	for (auto const& param : std::get<FuncType>(hostFunction.type->t).parameters)
+	{
+		if (param.direction == ParameterDirection::out)
+		{
+			prepared.result = valueTypeOf(*param.type);
+			continue;
+		}
+
+		auto argumentIt = std::ranges::find(functionCall.arguments, param.name, &FuncArgument::name);
+		if (argumentIt == functionCall.arguments.end() || argumentIt->direction != ParameterDirection::in)
+		{
+			prepared.error = fmt::format("No arg provided for param  \"{}\"", param.name);
+			return prepared;
+		}
+		prepared.arguments.push_back(&argumentIt->expr);
+	}
+	if (prepared.arguments.size() != functionCall.arguments.size())
+	{
+		prepared.error = "Arg count doesn't match parameter count";
+	}
+	return prepared;
+}
+
+/// Host functions return their value widened to 64 bits, so i32 results are narrowed to what wasm would see.
+std::int64_t callHost(HostFunction const& hostFunction, ValueType result, std::int64_t const* arguments)
+{
+	std::int64_t const value = hostFunction.callback(hostFunction.userData, arguments);
+	return result == ValueType::i32 ? static_cast<std::int32_t>(value) : value;
+}
+
+struct State
+{
+	Program const* program;
+	Profile* profile = nullptr;
+	SamplingProfiler* sampler = nullptr;
+	ExecutionTrace* trace = nullptr;
+	Tracer* tracer = nullptr;
+	WorkStealingPool* pool = nullptr;
+	std::uint64_t parallelCostThreshold = 0;
+	std::unordered_map<BinaryOpExpression const*, PreparedDivision> divisions;
+	std::unordered_map<FunctionCall const*, CallSiteId> callSiteIds;
+	std::unordered_set<BinaryOpExpression const*> parallelOperands;
+	/// Indexed by BinaryOpExpression::index.
+	std::vector<PreparedBinary> binaryKernels;
+	std::unordered_set<IndexExpression const*> inBoundsIndices;
+	TypeInfo types;
+	/// Functions the host may call with any arguments. When empty, only the main function is.
+	std::vector<Function const*> entryPoints;
+	std::unordered_map<FunctionCall const*, PreparedHostCall> hostCalls;
+
+	void prepare()
+	{
+		types = checkTypes(*program);
+		RangeAnalysis ranges = entryPoints.empty() ? analyzeRanges(*program) : analyzeRanges(*program, entryPoints);
+		inBoundsIndices = std::move(ranges.inBoundsIndices);
+		binaryKernels.resize(program->binaryOperatorCount);
+		std::optional<CostModel> costs;
+		if (pool != nullptr)
+		{
+			costs = estimateCosts(*program);
+		}
+
+		for (auto const& function : program->functions)
+		{
+			std::visit(DivisionCollector{ &ranges, &divisions }, function->expression.expr);
+			std::visit(KernelCollector{ function.get(), &types, &divisions, &binaryKernels, {} },
+				function->expression.expr);
+
+			for (FunctionCall const* callSite : collectCallSites(*function))
+			{
+				if (HostFunction const* hostFunction = program->findHostFunction(callSite->functionName))
+				{
+					hostCalls.try_emplace(callSite, prepareHostCall(*hostFunction, *callSite));
+				}
+			}
+
+			if (costs)
+			{
+				std::visit(ParallelCollector{ &*costs, parallelCostThreshold, &parallelOperands },
+					function->expression.expr);
+			}
+
+			if (profile != nullptr)
+			{
+				std::vector<FunctionCall const*> const callSites = collectCallSites(*function);
+				for (std::uint32_t callSiteIndex = 0; callSiteIndex < callSites.size(); ++callSiteIndex)
+				{
+					callSiteIds.try_emplace(callSites[callSiteIndex], CallSiteId{ function->name, callSiteIndex });
+				}
+			}
+		}
+	}
+
+	void recordCall(FunctionCall const& functionCall, std::vector<ParameterValue> const& inArgs)
+	{
+		auto callSiteIt = callSiteIds.find(&functionCall);
+		if (callSiteIt == callSiteIds.end())
+		{
+			return;
+		}
+
+		CallSiteProfile& callSite = profile->callSites[callSiteIt->second];
+		callSite.callee = functionCall.functionName;
+		++callSite.count;
+		// Only i32 arguments are specialized on, so wider values are not recorded.
+		for (auto const& inArg : inArgs)
+		{
+			if (inArg.type == ValueType::i32)
+			{
+				callSite.recordArgument(inArg.name, static_cast<std::int32_t>(inArg.value));
+			}
+		}
+	}
+
+	ExpressionResult evaluateHostCall(Frame& frame, PreparedHostCall const& call)// NOLINT(misc-no-recursion)
+	{
+		if (!call.error.empty())
+		{
+			throw std::runtime_error(call.error);
+		}
+
+		std::array<std::int64_t, maxHostArguments> arguments{};
+		for (std::size_t i = 0; i < call.arguments.size(); ++i)
+		{
+			auto [argType, argValue] = evaluateExpression(frame, *call.arguments[i]);
+			if (argType == ValueType::none)
+			{
+				throw std::runtime_error("Only i32 and i64 are implemented");
+			}
+			arguments.at(i) = argValue;
+		}
+		return { call.result, callHost(*call.function, call.result, arguments.data()) };
+	}
+
+	[[nodiscard]] PreparedDivision findDivision(BinaryOpExpression const& binaryOp) const
+	{
+		auto preparedIt = divisions.find(&binaryOp);
+		return preparedIt != divisions.end() ? preparedIt->second : PreparedDivision{};
+	}
+
+	struct ExpressionVisitor
+	{
+		State* self;
+		Frame* frame;
+
+		ExpressionResult operator()(Literal const& literal) { return { literal.type, literal.value }; }
+
+		ExpressionResult operator()(InitAssignment const& initAssignment)
+		{
+			auto localIt
+				= std::ranges::find(frame->locals, initAssignment.var, [](Local const& local) { return local.name; });
+			if (localIt == frame->locals.end())
+			{
+				throw std::runtime_error("Undeclared variable: " + initAssignment.var);
+			}
+
+			// Loops in the value push locals, which may reallocate, so the local is kept by index.
+			auto const localIndex = static_cast<std::size_t>(localIt - frame->locals.begin());
+			ExpressionResult const& expressionResult = self->evaluateExpression(*frame, *initAssignment.value);
+			if (expressionResult.type == ValueType::none)
+			{
+				throw std::runtime_error(
+					"Unexpected expression result type: " + std::string(toString(expressionResult.type)));
+			}
+			frame->locals[localIndex].value = expressionResult.value;
+			return { ValueType::none, 0 };
+		}
+
+		ExpressionResult operator()(BinaryOpExpression const& binaryOp)
+		{
+			if (binaryOp.index < self->binaryKernels.size())
+			{
+				PreparedBinary const& prepared = self->binaryKernels[binaryOp.index];
+				if (prepared.expression == &binaryOp)
+				{
+					return prepared.kernel(*self, *frame, binaryOp, prepared);
+				}
+			}
+
+			auto [lhsResult, rhsResult] = self->evaluateOperands(*frame, binaryOp);
+			auto [lhsType, lhsValue] = std::move(lhsResult);
+			auto [rhsType, rhsValue] = std::move(rhsResult);
+
+			if (lhsType == ValueType::none || lhsType != rhsType)
+			{
+				throw std::runtime_error("Unexpected types for addition: " + std::string(toString(lhsType)) + ", "
+										 + std::string(toString(rhsType)));
+			}
+
+			PreparedDivision const prepared = self->findDivision(binaryOp);
+			std::int64_t const result = lhsType == ValueType::i64
+										  ? applyTyped<std::int64_t>(binaryOp.op, prepared, lhsValue, rhsValue)
+										  : applyTyped<std::int32_t>(binaryOp.op, prepared, lhsValue, rhsValue);
+			return { isComparison(binaryOp.op) ? ValueType::i32 : lhsType, result };
+		}
+
+		ExpressionResult operator()(FunctionCall const& functionCall)
+		{
+			if (auto hostIt = self->hostCalls.find(&functionCall); hostIt != self->hostCalls.end())
+			{
+				return self->evaluateHostCall(*frame, hostIt->second);
+			}
+
+			auto funcIt = std::ranges::find_if(self->program->functions,
+				[&](std::shared_ptr<Function> const& func) { return func->name == functionCall.functionName; });
+			if (funcIt == self->program->functions.cend())
+			{
+				throw std::runtime_error(fmt::format("Couldn't find function {}", functionCall.functionName));
+			}
+			std::shared_ptr<Function> const& function = *funcIt;
+
+			std::vector<ParameterValue> inArgs;
+			for (auto const& arg : functionCall.arguments)
+			{
+				if (arg.direction == ParameterDirection::in)
+				{
+					auto [argType, argValue] = self->evaluateExpression(*frame, arg.expr);
+					if (argType == ValueType::none)
+					{
+						throw std::runtime_error("Only i32 and i64 are implemented");
+					}
+					inArgs.push_back(ParameterValue{ arg.name, argValue, argType });
+				}
+				else if (arg.direction == ParameterDirection::out)
+				{
+					throw std::runtime_error("Named output arguments not implemented");
+				}
+				else
+				{
+					throw std::runtime_error("Unknown direction (inout?) when calling function not implemented");
+				}
+			}
+
+			if (self->profile != nullptr)
+			{
+				self->recordCall(functionCall, inArgs);
+			}
+
+			std::vector<ParameterValue> outArgs;
+			for (auto const& param : std::get<FuncType>(function->type->t).parameters)
+			{
+				if (param.direction == ParameterDirection::out)
+				{
+					outArgs.push_back(ParameterValue{ param.name, 0, valueTypeOf(*param.type) });
+				}
+			}
+
+			self->executeFunction(*function, inArgs, outArgs);
+
+			if (outArgs.empty())
+			{
+				return { ValueType::none, 0 };
+			}
+			else if (outArgs.size() == 1)
+			{
+				return { outArgs[0].type, outArgs[0].value };
+			}
+			else
+			{
+				throw std::runtime_error("Multiple out args not implemented");
+			}
+		}
+
+		ExpressionResult operator()(VarExpression const& varExpression)
+		{
+			// Searched from the back, so loop variables shadow parameters.
+			auto localIt = std::ranges::find_if(frame->locals | std::views::reverse,
+				[&](Local const& local) { return local.name == varExpression.varName; });
+			if (localIt == frame->locals.rend())
+			{
+				throw std::runtime_error(fmt::format("Local \"{}\" not found", varExpression.varName));
+			}
+			if (localIt->arrayLength > 0)
+			{
+				throw std::runtime_error(fmt::format("Array \"{}\" can only be indexed", varExpression.varName));
+			}
+
+			return { localIt->type, localIt->value };
+		}
+
+		ExpressionResult evaluateLoopPart(Expression const& expression)// NOLINT(misc-no-recursion)
+		{
+			ExpressionResult result = self->evaluateExpression(*frame, expression);
+			if (result.type == ValueType::none)
+			{
+				throw std::runtime_error(
+					"Loop expressions must be i32 or i64, got: " + std::string(toString(result.type)));
+			}
+			return result;
+		}
+
+		ExpressionResult operator()(LetExpression const& let)// NOLINT(misc-no-recursion)
+		{
+			std::size_t const length = std::get<ArrayType>(let.type->t).length;
+			std::vector<std::int64_t> elements;
+			elements.reserve(length);
+			for (auto const& element : let.elements)
+			{
+				elements.push_back(evaluateArrayPart(*element));
+			}
+			if (let.generator)
+			{
+				std::size_t const indexLocal = frame->locals.size();
+				frame->locals.push_back(Local{ let.generatorIndex });
+				for (std::size_t position = 0; position < length; ++position)
+				{
+					frame->locals[indexLocal].value = static_cast<std::int64_t>(position);
+					elements.push_back(evaluateArrayPart(*let.generator));
+				}
+				frame->locals.resize(indexLocal);
+			}
+
+			std::size_t const arrayLocal = frame->locals.size();
+			for (std::int64_t const element : elements)
+			{
+				frame->locals.push_back(Local{ {}, element });
+			}
+			frame->locals[arrayLocal].name = let.name;
+			frame->locals[arrayLocal].arrayLength = length;
+
+			ExpressionResult result = self->evaluateExpression(*frame, *let.body);
+			frame->locals.resize(arrayLocal);
+			return result;
+		}
+
+		ExpressionResult operator()(IndexExpression const& index)// NOLINT(misc-no-recursion)
+		{
+			auto arrayIt = std::ranges::find(frame->locals | std::views::reverse, index.arrayName, &Local::name);
+			if (arrayIt == frame->locals.rend() || arrayIt->arrayLength == 0)
+			{
+				throw std::runtime_error(fmt::format("Array \"{}\" not found", index.arrayName));
+			}
+			auto const arrayLocal = static_cast<std::size_t>(frame->locals.rend() - arrayIt) - 1;
+			std::size_t const length = arrayIt->arrayLength;
+
+			std::int64_t const position = evaluateArrayPart(*index.index);
+			if (self->inBoundsIndices.contains(&index))
+			{
+				return { ValueType::i32, frame->locals[arrayLocal + static_cast<std::size_t>(position)].value };
+			}
+			if (position < 0 || static_cast<std::size_t>(position) >= length)
+			{
+				throw std::runtime_error(fmt::format("Index {} out of bounds for array \"{}\"", position, index.arrayName));
+			}
+			return { ValueType::i32, frame->locals[arrayLocal + static_cast<std::size_t>(position)].value };
+		}
+
+		std::int64_t evaluateArrayPart(Expression const& expression)// NOLINT(misc-no-recursion)
+		{
+			auto [type, value] = self->evaluateExpression(*frame, expression);
+			if (type != ValueType::i32)
+			{
+				throw std::runtime_error("Array elements and indices must be i32, got: " + std::string(toString(type)));
+			}
+			return value;
+		}
+
+		ExpressionResult operator()(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+		{
+			auto [type, value] = self->evaluateExpression(*frame, *conditional.condition);
+			if (type != ValueType::i32)
+			{
+				throw std::runtime_error("Condition must be i32, got: " + std::string(toString(type)));
+			}
+			return self->evaluateExpression(*frame, value != 0 ? *conditional.whenTrue : *conditional.whenFalse);
+		}
+
+		ExpressionResult operator()(LoopExpression const& loop)// NOLINT(misc-no-recursion)
+		{
+			// Counters of both widths fit the widened representation, so one loop serves them all.
+			auto const [fromType, from] = evaluateLoopPart(*loop.from);
+			std::int64_t const to = evaluateLoopPart(*loop.to).value;
+			auto const [accumulatorType, initial] = evaluateLoopPart(*loop.initial);
+
+			std::size_t const counterIndex = frame->locals.size();
+			frame->locals.push_back(Local{ loop.counter, from, fromType });
+			frame->locals.push_back(Local{ loop.accumulator, initial, accumulatorType });
+			for (std::int64_t counter = from; counter < to; ++counter)
+			{
+				if (self->sampler != nullptr)
+				{
+					self->sampler->poll();
+				}
+				frame->locals[counterIndex].value = counter;
+				std::int64_t const accumulator = evaluateLoopPart(*loop.body).value;
+				frame->locals[counterIndex + 1].value = accumulator;
+			}
+
+			std::int64_t const result = frame->locals[counterIndex + 1].value;
+			frame->locals.resize(counterIndex);
+			return { accumulatorType, result };
+		}
+	};
+
+	ExpressionResult evaluateExpression(Frame& frame, Expression const& expr)// NOLINT(misc-no-recursion)
+	{
+		ExpressionResult const result = std::visit(ExpressionVisitor{ this, &frame }, expr.expr);
+		recordEvaluation(frame, expr, result.value);
+		return result;
+	}
+
+	/// Counts an evaluation, and traces it if tracing. Kernels call this for the operands they read directly, so that
+	/// they show up the same as operands evaluated through evaluateExpression.
+	void recordEvaluation(Frame const& frame, Expression const& expr, std::int64_t value)
+	{
+		++evaluatedExpressions;
+		if (trace != nullptr)
+		{
+			trace->record({ ExecutionTrace::EventKind::evaluation, frame.function, &expr, value });
+		}
+	}
+
+	std::pair<ExpressionResult, ExpressionResult> evaluateOperands(Frame& frame,// NOLINT(misc-no-recursion)
+		BinaryOpExpression const& binaryOp)
+	{
+		if (pool == nullptr || !parallelOperands.contains(&binaryOp))
+		{
+			ExpressionResult lhs = evaluateExpression(frame, *binaryOp.lhs);
+			return { std::move(lhs), evaluateExpression(frame, *binaryOp.rhs) };
+		}
+
+		// The rhs is offered to other workers while this thread evaluates the lhs. Errors are reported in the same
+		// order as a serial evaluation would, so the result does not depend on scheduling.
+		ExpressionResult rhs{};
+		auto rhsTask = pool->submit([&] {
+			auto const* call = std::get_if<FunctionCall>(&binaryOp.rhs->expr);
+			Tracer::Span const span(tracer, "execute", call != nullptr ? call->functionName : "parallel operand");
+			rhs = evaluateExpression(frame, *binaryOp.rhs);
+		});
+
+		ExpressionResult lhs{};
+		std::exception_ptr lhsError;
+		try
+		{
+			lhs = evaluateExpression(frame, *binaryOp.lhs);
+		}
+		catch (...)
+		{
+			lhsError = std::current_exception();
+		}
+
+		try
+		{
+			pool->wait(rhsTask);
+		}
+		catch (...)
+		{
+			if (!lhsError)
+			{
+				throw;
+			}
+		}
+		if (lhsError)
+		{
+			std::rethrow_exception(lhsError);
+		}
+		return { std::move(lhs), std::move(rhs) };
+	}
+
+	void executeFunction(Function const& func,// NOLINT(misc-no-recursion)
+		std::vector<ParameterValue> const& inArgs,
+		std::vector<ParameterValue>& outArgs)
+	{
+		if (profile != nullptr)
+		{
+			++profile->functionCalls[func.name];
+		}
+
+		SamplingProfiler::Call const sampledCall(sampler, func);
+		Frame frame = enterFunction(func, inArgs, outArgs);
+		if (trace != nullptr)
+		{
+			trace->record(
+				{ ExecutionTrace::EventKind::call, &func, &func.expression, inArgs.empty() ? 0 : inArgs.front().value });
+		}
+		auto [exprType, _] = evaluateExpression(frame, func.expression);
+		leaveFunction(frame, exprType, outArgs);
+		if (trace != nullptr)
+		{
+			trace->record(
+				{ ExecutionTrace::EventKind::ret, &func, &func.expression, outArgs.empty() ? 0 : outArgs.front().value });
+		}
+	}
+
+	/// Binds the arguments of a call to a new frame, checking them against the parameters of the function.
+	static Frame enterFunction(Function const& func,
+		std::vector<ParameterValue> const& inArgs,
+		std::vector<ParameterValue> const& outArgs)
+	{
+		Frame frame{ &func, {} };
+
+		auto const& funcType = std::get<FuncType>(func.type->t);
+		for (auto const& funcParam : funcType.parameters)
+		{
+			if (!std::holds_alternative<BuiltInType>(funcParam.type->t))
+			{
+				throw std::runtime_error("Only built in types supported as parameter types: " + funcType.rep);
+			}
+			ValueType const paramType = valueTypeOf(*funcParam.type);
+			if (paramType == ValueType::none)
+			{
+				throw std::runtime_error("Only i32 and i64 support is implemented: " + funcType.rep);
+			}
+
+			switch (funcParam.direction)
+			{
+			case ParameterDirection::in:
+			{
+				auto argIt
+					= std::ranges::find_if(inArgs, [&](ParameterValue const& arg) { return arg.name == funcParam.name; });
+				if (argIt == inArgs.cend())
+				{
+					throw std::runtime_error(fmt::format("No arg provided for param  \"{}\"", funcParam.name));
+				}
+				frame.locals.push_back(Local{ funcParam.name, argIt->value, paramType });
+				break;
+			}
+			case ParameterDirection::out:
+			{
+				auto argIt
+					= std::ranges::find_if(outArgs, [&](ParameterValue const& arg) { return arg.name == funcParam.name; });
+				if (argIt == outArgs.cend())
+				{
+					throw std::runtime_error(fmt::format("No arg provided for param  \"{}\"", funcParam.name));
+				}
+				frame.locals.push_back(Local{ funcParam.name, 0, paramType });
+				break;
+			}
+			default:
+				throw std::runtime_error("Unknown (inout?) parameter direction not implemented");
+			}
+		}
+		if (funcType.parameters.size() != frame.locals.size())
+		{
+			throw std::runtime_error("Arg count doesn't match parameter count");
+		}
+		return frame;
+	}
+
+	/// Copies the out parameters of a finished call from its frame.
+	static void leaveFunction(Frame const& frame, ValueType exprType, std::vector<ParameterValue>& outArgs)
+	{
+		if (exprType != ValueType::none)
+		{
+			throw std::runtime_error("Function expression should not return a value");
+		}
+
+		for (auto& outArg : outArgs)
+		{
+			auto localIt
+				= std::ranges::find_if(frame.locals, [&](Local const& local) { return local.name == outArg.name; });
+			if (localIt == frame.locals.end())
+			{
+				throw std::runtime_error(fmt::format("Local \"{}\" missing", outArg.name));
+			}
+			outArg.value = localIt->value;
+		}
+	}
+};
+
+template<OperandKind kind>
+auto loadOperand(State& state, Frame& frame, Expression const& expression, PreparedOperand const& prepared)
+{
+	if constexpr (kind == OperandKind::subexpression)
+	{
+		return state.evaluateExpression(frame, expression);
+	}
+	else
+	{
+		std::int64_t const value = kind == OperandKind::literal ? prepared.literal : frame.locals[prepared.local].value;
+		state.recordEvaluation(frame, expression, value);
+		return value;
+	}
+}
+
+template<typename T>
+constexpr ValueType typeOf(std::int64_t /*value*/)
+{
+	return valueTypeFor<T>();
+}
+
+template<typename T>
+ValueType typeOf(ExpressionResult const& result)
+{
+	return result.type;
+}
+
+constexpr std::int64_t valueOf(std::int64_t value)
+{
+	return value;
+}
+
+constexpr std::int64_t valueOf(ExpressionResult const& result)
+{
+	return result.value;
+}
+
+template<BinaryOperator op, typename T>
+std::int64_t applyOperator(PreparedBinary const& prepared, std::int64_t lhs, std::int64_t rhs)
+{
+	auto const lhsValue = static_cast<T>(lhs);
+	auto const rhsValue = static_cast<T>(rhs);
+	if constexpr (op == BinaryOperator::add)
+	{
+		return WrappingPlus<T>{}(lhsValue, rhsValue);
+	}
+	else if constexpr (op == BinaryOperator::subtract)
+	{
+		return WrappingMinus<T>{}(lhsValue, rhsValue);
+	}
+	else if constexpr (op == BinaryOperator::multiply)
+	{
+		return WrappingMultiplies<T>{}(lhsValue, rhsValue);
+	}
+	else if constexpr (isComparison(op))
+	{
+		return compare(op, lhsValue, rhsValue);
+	}
+	else
+	{
+		return divideOrRemainder(op, prepared.division, lhsValue, rhsValue);
+	}
+}
+
+template<BinaryOperator op, typename T, OperandKind lhsKind, OperandKind rhsKind>
+ExpressionResult binaryKernel(State& state, Frame& frame, BinaryOpExpression const& binaryOp, PreparedBinary const& prepared)
+{
+	auto apply = [&](auto const& lhs, auto const& rhs) -> ExpressionResult {
+		if (typeOf<T>(lhs) != valueTypeFor<T>() || typeOf<T>(rhs) != valueTypeFor<T>())
+		{
+			throw std::runtime_error("Unexpected types for addition: " + std::string(toString(typeOf<T>(lhs))) + ", "
+									 + std::string(toString(typeOf<T>(rhs))));
+		}
+		return { isComparison(op) ? ValueType::i32 : valueTypeFor<T>(),
+			applyOperator<op, T>(prepared, valueOf(lhs), valueOf(rhs)) };
+	};
+
+	if constexpr (lhsKind == OperandKind::subexpression && rhsKind == OperandKind::subexpression)
+	{
+		// Two subexpressions may be evaluated in parallel.
+		auto const [lhs, rhs] = state.evaluateOperands(frame, binaryOp);
+		return apply(lhs, rhs);
+	}
+	else
+	{
+		auto const lhs = loadOperand<lhsKind>(state, frame, *binaryOp.lhs, prepared.lhs);
+		auto const rhs = loadOperand<rhsKind>(state, frame, *binaryOp.rhs, prepared.rhs);
+		return apply(lhs, rhs);
+	}
+}
+
+template<BinaryOperator op, typename T, OperandKind lhsKind>
+constexpr std::array<BinaryKernel, operandKindCount> kernelsWithLhs()
+{
+	return { &binaryKernel<op, T, lhsKind, OperandKind::literal>,
+		&binaryKernel<op, T, lhsKind, OperandKind::local>,
+		&binaryKernel<op, T, lhsKind, OperandKind::subexpression> };
+}
+
+template<BinaryOperator op, typename T>
+constexpr std::array<std::array<BinaryKernel, operandKindCount>, operandKindCount> kernelsForType()
+{
+	return { kernelsWithLhs<op, T, OperandKind::literal>(),
+		kernelsWithLhs<op, T, OperandKind::local>(),
+		kernelsWithLhs<op, T, OperandKind::subexpression>() };
+}
+
+template<BinaryOperator op>
+BinaryKernel kernelFor(ValueType type, std::size_t lhsIndex, std::size_t rhsIndex)
+{
+	if (type == ValueType::i64)
+	{
+		return kernelsForType<op, std::int64_t>()[lhsIndex][rhsIndex];
+	}
+	return kernelsForType<op, std::int32_t>()[lhsIndex][rhsIndex];
+}
+
+BinaryKernel selectKernel(BinaryOperator op, ValueType type, OperandKind lhsKind, OperandKind rhsKind)
+{
+	auto const lhsIndex = static_cast<std::size_t>(lhsKind);
+	auto const rhsIndex = static_cast<std::size_t>(rhsKind);
+	switch (op)
+	{
+	case BinaryOperator::add:
+		return kernelFor<BinaryOperator::add>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::subtract:
+		return kernelFor<BinaryOperator::subtract>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::multiply:
+		return kernelFor<BinaryOperator::multiply>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::divide:
+		return kernelFor<BinaryOperator::divide>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::modulo:
+		return kernelFor<BinaryOperator::modulo>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::equal:
+		return kernelFor<BinaryOperator::equal>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::notEqual:
+		return kernelFor<BinaryOperator::notEqual>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::less:
+		return kernelFor<BinaryOperator::less>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::lessEqual:
+		return kernelFor<BinaryOperator::lessEqual>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::greater:
+		return kernelFor<BinaryOperator::greater>(type, lhsIndex, rhsIndex);
+	case BinaryOperator::greaterEqual:
+		return kernelFor<BinaryOperator::greaterEqual>(type, lhsIndex, rhsIndex);
+	default:
+		return nullptr;
+	}
+}
+
+/// Closure engine: every function body is translated once into a tree of function objects specialized on operator and
+/// operand kind. Locals live in fixed slots, and calls are bound to their callee ahead of time, so evaluation does no
+/// variant dispatch or name lookups. Errors are raised when the failing expression is evaluated, like the tree walker.
+using Slots = std::int64_t*;
+using Closure = std::function<std::int64_t(Slots)>;
+
+struct ConstantOperand
+{
+	std::int64_t value;
+};
+
+struct SlotOperand
+{
+	std::size_t slot;
+};
+
+using Operand = std::variant<ConstantOperand, SlotOperand, Closure>;
+
+std::int64_t load(ConstantOperand const& operand, Slots /*slots*/)
+{
+	return operand.value;
+}
+
+std::int64_t load(SlotOperand const& operand, Slots slots)
+{
+	return slots[operand.slot];// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+std::int64_t load(Closure const& operand, Slots slots)
+{
+	return operand(slots);
+}
+
+Closure toClosure(Operand operand)
+{
+	return std::visit(
+		[](auto concrete) -> Closure {
+			return [concrete = std::move(concrete)](Slots slots) { return load(concrete, slots); };
+		},
+		std::move(operand));
+}
+
+Closure throwing(std::string message)
+{
+	return [message = std::move(message)](Slots /*slots*/) -> std::int64_t { throw std::runtime_error(message); };
+}
+
+/// Evaluates a closure for its side effects and then fails, keeping the evaluation order of the tree walker.
+Closure throwingAfter(Closure closure, std::string message)
+{
+	return [closure = std::move(closure), message = std::move(message)](Slots slots) -> std::int64_t {
+		closure(slots);
+		throw std::runtime_error(message);
+	};
+}
+
+template<typename Operation>
+Closure bindBinary(Operand lhs, Operand rhs, Operation operation)
+{
+	return std::visit(
+		[&](auto lhsOperand, auto rhsOperand) -> Closure {
+			return [lhsOperand = std::move(lhsOperand), rhsOperand = std::move(rhsOperand), operation](Slots slots) {
+				std::int64_t const lhsValue = load(lhsOperand, slots);
+				std::int64_t const rhsValue = load(rhsOperand, slots);
+				return operation(lhsValue, rhsValue);
+			};
+		},
+		std::move(lhs),
+		std::move(rhs));
+}
+
+/// Binds an operation on T, narrowing the widened operands first.
+template<typename T, typename Operation>
+Closure bindTyped(Operand lhs, Operand rhs, Operation operation)
+{
+	return bindBinary(std::move(lhs), std::move(rhs), [operation](std::int64_t lhsValue, std::int64_t rhsValue) {
+		return static_cast<std::int64_t>(operation(static_cast<T>(lhsValue), static_cast<T>(rhsValue)));
+	});
+}
+
+/// Small frames are kept on the native stack; larger ones fall back to the heap.
+class SlotBuffer
+{
+public:
+	explicit SlotBuffer(std::size_t slotCount)
+	{
+		if (slotCount > inlineSlots.size())
+		{
+			heapSlots.resize(slotCount, 0);
+			slots = heapSlots.data();
+		}
+	}
+
+	SlotBuffer(SlotBuffer const&) = delete;
+	SlotBuffer(SlotBuffer&&) = delete;
+	SlotBuffer& operator=(SlotBuffer const&) = delete;
+	SlotBuffer& operator=(SlotBuffer&&) = delete;
+	~SlotBuffer() = default;
+
+	[[nodiscard]] Slots data() const { return slots; }
+
+private:
+	std::array<std::int64_t, 8> inlineSlots{};
+	std::vector<std::int64_t> heapSlots;
+	Slots slots = inlineSlots.data();
+};
+
+struct CompiledFunction
+{
+	Function const* function = nullptr;
+	std::vector<std::string> slotNames;
+	std::size_t outCount = 0;
+	std::size_t resultSlot = 0;
+	/// Slots and types of the in parameters, and slots of the out parameters, in declaration order.
+	std::vector<std::size_t> inSlots;
+	std::vector<ValueType> inTypes;
+	std::vector<std::size_t> outSlots;
+	Closure body;
+
+	[[nodiscard]] std::optional<std::size_t> findSlot(std::string const& name) const
+	{
+		auto slotIt = std::ranges::find(slotNames, name);
+		if (slotIt == slotNames.end())
+		{
+			return std::nullopt;
+		}
+		return static_cast<std::size_t>(slotIt - slotNames.begin());
+	}
+};
+
+struct CompiledExpression
+{
+	Operand operand;
+	bool hasValue = true;
+};
+
+/// Mirrors the parameter checks the tree walker does when entering a function, returning the first error.
+template<typename HasInArg, typename HasOutArg>
+std::string findBindingError(Function const& function, HasInArg const& hasInArg, HasOutArg const& hasOutArg)
+{
+	auto const& funcType = std::get<FuncType>(function.type->t);
+	for (auto const& funcParam : funcType.parameters)
+	{
+		if (!std::holds_alternative<BuiltInType>(funcParam.type->t))
+		{
+			return "Only built in types supported as parameter types: " + funcType.rep;
+		}
+		if (valueTypeOf(*funcParam.type) == ValueType::none)
+		{
+			return "Only i32 and i64 support is implemented: " + funcType.rep;
+		}
+
+		switch (funcParam.direction)
+		{
+		case ParameterDirection::in:
+			if (!hasInArg(funcParam.name))
 			{
-				throw std::runtime_error(fmt::format("Local \"{}\" missing", outArg.name));
+				return fmt::format("No arg provided for param  \"{}\"", funcParam.name);
 			}
-			outArg.value = localIt->value;
+			break;
+		case ParameterDirection::out:
+			if (!hasOutArg(funcParam.name))
+			{
+				return fmt::format("No arg provided for param  \"{}\"", funcParam.name);
+			}
+			break;
+		default:
+			return "Unknown (inout?) parameter direction not implemented";
+		}
+	}
+	return {};
+}
+
+struct ScopedSlot
+{
+	std::string name;
+	std::size_t slot = 0;
+	/// Non-zero for arrays, whose elements occupy the slots following slot.
+	std::size_t arrayLength = 0;
+};
+
+class ClosureProgram
+{
+public:
+	explicit ClosureProgram(State const& preparedState)
+		: state(preparedState)
+	{
+		// Allocate every function before compiling bodies, so calls can bind directly to their callee.
+		for (auto const& function : state.program->functions)
+		{
+			auto& compiled = functions.emplace_back(std::make_unique<CompiledFunction>());
+			compiled->function = function.get();
+			for (auto const& param : std::get<FuncType>(function->type->t).parameters)
+			{
+				if (param.direction == ParameterDirection::out)
+				{
+					if (compiled->outCount == 0)
+					{
+						compiled->resultSlot = compiled->slotNames.size();
+					}
+					++compiled->outCount;
+					compiled->outSlots.push_back(compiled->slotNames.size());
+				}
+				else
+				{
+					compiled->inSlots.push_back(compiled->slotNames.size());
+					compiled->inTypes.push_back(valueTypeOf(*param.type));
+				}
+				compiled->slotNames.push_back(param.name);
+			}
+		}
+
+		for (auto& compiled : functions)
+		{
+			current = compiled.get();
+			CompiledExpression body = compile(compiled->function->expression);
+			compiled->body = body.hasValue
+								 ? throwingAfter(toClosure(std::move(body.operand)),
+									 "Function expression should not return a value")
+								 : toClosure(std::move(body.operand));
+		}
+	}
+
+	std::int32_t runMain() const
+	{
+		Function const& mainFunction = *state.program->mainFunction;
+		std::string const error = findBindingError(
+			mainFunction,
+			[](std::string const& /*name*/) { return false; },
+			[](std::string const& name) { return name == "exitCode"; });
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+
+		CompiledFunction const& compiled = *find(mainFunction.name);
+		SlotBuffer slots(compiled.slotNames.size());
+		SamplingProfiler::Call const sampledCall(state.sampler, mainFunction);
+		if (state.trace != nullptr)
+		{
+			state.trace->record({ ExecutionTrace::EventKind::call, &mainFunction, &mainFunction.expression, 0 });
+		}
+		compiled.body(slots.data());
+
+		std::optional<std::size_t> const exitCodeSlot = compiled.findSlot("exitCode");
+		if (!exitCodeSlot)
+		{
+			throw std::runtime_error("Local \"exitCode\" missing");
+		}
+		std::int64_t const exitCode = load(SlotOperand{ *exitCodeSlot }, slots.data());
+		if (state.trace != nullptr)
+		{
+			state.trace->record({ ExecutionTrace::EventKind::ret, &mainFunction, &mainFunction.expression, exitCode });
+		}
+		return static_cast<std::int32_t>(exitCode);
+	}
+
+	[[nodiscard]] std::optional<std::size_t> findFunction(std::string_view name) const
+	{
+		auto functionIt = std::ranges::find_if(
+			functions, [&](auto const& compiled) { return compiled->function->name == name; });
+		if (functionIt == functions.end())
+		{
+			return std::nullopt;
+		}
+		return static_cast<std::size_t>(functionIt - functions.begin());
+	}
+
+	[[nodiscard]] CompiledFunction const& function(std::size_t functionIndex) const
+	{
+		return *functions.at(functionIndex);
+	}
+
+	/// Copies the in values straight into the callee's frame and its out parameters straight back out.
+	void call(std::size_t functionIndex, std::span<std::int64_t const> inValues, std::span<std::int64_t> outValues) const
+	{
+		CompiledFunction const& compiled = function(functionIndex);
+		if (inValues.size() != compiled.inSlots.size() || outValues.size() != compiled.outSlots.size())
+		{
+			throw std::runtime_error("Arg count doesn't match parameter count");
+		}
+		std::string const error = findBindingError(
+			*compiled.function,
+			[](std::string const& /*name*/) { return true; },
+			[](std::string const& /*name*/) { return true; });
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+
+		SlotBuffer slots(compiled.slotNames.size());
+		// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		for (std::size_t i = 0; i < inValues.size(); ++i)
+		{
+			// i32 parameters are narrowed, so every slot holds the value the function would see in wasm.
+			slots.data()[compiled.inSlots[i]] = compiled.inTypes[i] == ValueType::i64
+													? inValues[i]
+													: static_cast<std::int32_t>(inValues[i]);
+		}
+		compiled.body(slots.data());
+		for (std::size_t i = 0; i < outValues.size(); ++i)
+		{
+			outValues[i] = slots.data()[compiled.outSlots[i]];
+		}
+		// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+	}
+
+private:
+	struct CallArgument
+	{
+		Closure value;
+		std::optional<std::size_t> slot;
+	};
+
+	State const& state;
+	std::vector<std::unique_ptr<CompiledFunction>> functions;
+	CompiledFunction* current = nullptr;
+	/// Loop variables, generator indices and arrays in scope, innermost last.
+	std::vector<ScopedSlot> scopedSlots;
+
+	[[nodiscard]] ScopedSlot const* findScoped(std::string const& name) const
+	{
+		auto scopedIt = std::ranges::find(scopedSlots | std::views::reverse, name, &ScopedSlot::name);
+		return scopedIt != scopedSlots.rend() ? &*scopedIt : nullptr;
+	}
+
+	[[nodiscard]] std::optional<std::size_t> findSlot(std::string const& name) const
+	{
+		if (ScopedSlot const* scoped = findScoped(name))
+		{
+			return scoped->slot;
+		}
+		return current->findSlot(name);
+	}
+
+	/// Reserves fresh slots in the current function, so nested and sibling scopes never share them.
+	std::size_t allocateSlots(std::size_t count)
+	{
+		std::size_t const first = current->slotNames.size();
+		current->slotNames.resize(first + count);
+		return first;
+	}
+
+	[[nodiscard]] CompiledFunction const* find(std::string const& name) const
+	{
+		auto functionIt = std::ranges::find_if(
+			functions, [&](auto const& compiled) { return compiled->function->name == name; });
+		return functionIt != functions.end() ? functionIt->get() : nullptr;
+	}
+
+	CompiledExpression compile(Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		return std::visit([this](auto const& expr) { return compile(expr); }, expression.expr);
+	}
+
+	CompiledExpression compile(Literal const& literal) { return { ConstantOperand{ literal.value } }; }
+
+	CompiledExpression compile(VarExpression const& varExpression) const
+	{
+		if (ScopedSlot const* scoped = findScoped(varExpression.varName); scoped != nullptr && scoped->arrayLength > 0)
+		{
+			return { throwing(fmt::format("Array \"{}\" can only be indexed", varExpression.varName)) };
+		}
+		std::optional<std::size_t> const slot = findSlot(varExpression.varName);
+		if (!slot)
+		{
+			return { throwing(fmt::format("Local \"{}\" not found", varExpression.varName)) };
 		}
+		return { SlotOperand{ *slot } };
+	}
+
+	CompiledExpression compile(InitAssignment const& initAssignment)// NOLINT(misc-no-recursion)
+	{
+		std::optional<std::size_t> const slot = current->findSlot(initAssignment.var);
+		if (!slot)
+		{
+			return { throwing("Undeclared variable: " + initAssignment.var), false };
+		}
+
+		CompiledExpression value = compile(*initAssignment.value);
+		if (!value.hasValue)
+		{
+			return { throwingAfter(toClosure(std::move(value.operand)),
+						 "Unexpected expression result type: " + std::string(toString(ValueType::none))),
+				false };
+		}
+
+		Closure assignment = std::visit(
+			[target = *slot](auto operand) -> Closure {
+				return [target, operand = std::move(operand)](Slots slots) {
+					slots[target] = load(operand, slots);// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					return 0;
+				};
+			},
+			std::move(value.operand));
+		return { std::move(assignment), false };
+	}
+
+	/// Compiles a subexpression that must produce a value, failing with the message and the missing type after
+	/// evaluating it otherwise.
+	Closure compilePart(Expression const& expression, std::string message)// NOLINT(misc-no-recursion)
+	{
+		CompiledExpression part = compile(expression);
+		if (!part.hasValue)
+		{
+			return throwingAfter(
+				toClosure(std::move(part.operand)), std::move(message) + std::string(toString(ValueType::none)));
+		}
+		return toClosure(std::move(part.operand));
+	}
+
+	Closure compileLoopPart(Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		return compilePart(expression, "Loop expressions must be i32 or i64, got: ");
+	}
+
+	CompiledExpression compile(LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		Closure from = compileLoopPart(*loop.from);
+		Closure to = compileLoopPart(*loop.to);
+		Closure initial = compileLoopPart(*loop.initial);
+
+		// Every loop gets its own pair of slots after the parameters.
+		std::size_t const counterSlot = allocateSlots(2);
+		std::size_t const accumulatorSlot = counterSlot + 1;
+
+		scopedSlots.push_back({ loop.counter, counterSlot });
+		scopedSlots.push_back({ loop.accumulator, accumulatorSlot });
+		Closure body = compileLoopPart(*loop.body);
+		scopedSlots.resize(scopedSlots.size() - 2);
+
+		return { [from = std::move(from),
+					 to = std::move(to),
+					 initial = std::move(initial),
+					 body = std::move(body),
+					 counterSlot,
+					 accumulatorSlot,
+					 sampler = state.sampler](Slots slots) {
+			// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			std::int64_t const first = from(slots);
+			std::int64_t const last = to(slots);
+			slots[accumulatorSlot] = initial(slots);
+			for (std::int64_t counter = first; counter < last; ++counter)
+			{
+				if (sampler != nullptr)
+				{
+					sampler->poll();
+				}
+				slots[counterSlot] = counter;
+				slots[accumulatorSlot] = body(slots);
+			}
+			return slots[accumulatorSlot];
+			// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+		} };
+	}
+
+	CompiledExpression compile(LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		std::size_t const length = std::get<ArrayType>(let.type->t).length;
+		std::vector<Closure> elements;
+		for (auto const& element : let.elements)
+		{
+			elements.push_back(compilePart(*element, "Array elements and indices must be i32, got: "));
+		}
+
+		Closure generator;
+		std::size_t indexSlot = 0;
+		if (let.generator)
+		{
+			indexSlot = allocateSlots(1);
+			scopedSlots.push_back({ let.generatorIndex, indexSlot });
+			generator = compilePart(*let.generator, "Array elements and indices must be i32, got: ");
+			scopedSlots.pop_back();
+		}
+
+		std::size_t const arraySlot = allocateSlots(length);
+		scopedSlots.push_back({ let.name, arraySlot, length });
+		CompiledExpression body = compile(*let.body);
+		scopedSlots.pop_back();
+
+		return { [elements = std::move(elements),
+					 generator = std::move(generator),
+					 indexSlot,
+					 arraySlot,
+					 length,
+					 body = toClosure(std::move(body.operand))](Slots slots) {
+					// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					for (std::size_t position = 0; position < elements.size(); ++position)
+					{
+						slots[arraySlot + position] = elements[position](slots);
+					}
+					if (generator)
+					{
+						for (std::size_t position = 0; position < length; ++position)
+						{
+							slots[indexSlot] = static_cast<std::int64_t>(position);
+							slots[arraySlot + position] = generator(slots);
+						}
+					}
+					// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+					return body(slots);
+				},
+			body.hasValue };
+	}
+
+	/// Constant indices become plain slot reads, and indices proven to be in range skip the bounds check.
+	CompiledExpression compile(IndexExpression const& index)// NOLINT(misc-no-recursion)
+	{
+		ScopedSlot const* array = findScoped(index.arrayName);
+		if (array == nullptr || array->arrayLength == 0)
+		{
+			return { throwing(fmt::format("Array \"{}\" not found", index.arrayName)) };
+		}
+		std::size_t const arraySlot = array->slot;
+		std::size_t const length = array->arrayLength;
+
+		CompiledExpression position = compile(*index.index);
+		if (!position.hasValue)
+		{
+			return { throwingAfter(toClosure(std::move(position.operand)),
+				"Array elements and indices must be i32, got: " + std::string(toString(ValueType::none))) };
+		}
+		if (auto const* constant = std::get_if<ConstantOperand>(&position.operand);
+			constant != nullptr && constant->value >= 0 && static_cast<std::size_t>(constant->value) < length)
+		{
+			return { SlotOperand{ arraySlot + static_cast<std::size_t>(constant->value) } };
+		}
+
+		Closure positionClosure = toClosure(std::move(position.operand));
+		if (state.inBoundsIndices.contains(&index))
+		{
+			return { [positionClosure = std::move(positionClosure), arraySlot](Slots slots) {
+				// NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+				return slots[arraySlot + static_cast<std::size_t>(positionClosure(slots))];
+			} };
+		}
+		return { [positionClosure = std::move(positionClosure), arraySlot, length, name = index.arrayName](
+					 Slots slots) {
+			std::int64_t const value = positionClosure(slots);
+			if (value < 0 || static_cast<std::size_t>(value) >= length)
+			{
+				throw std::runtime_error(fmt::format("Index {} out of bounds for array \"{}\"", value, name));
+			}
+			// NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+			return slots[arraySlot + static_cast<std::size_t>(value)];
+		} };
+	}
+
+	/// Cheap arms that can not trap are both evaluated and combined with a branchless select.
+	CompiledExpression compile(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		Closure condition = compilePart(*conditional.condition, "Condition must be i32, got: ");
+		Closure whenTrue = compilePart(*conditional.whenTrue, "Unexpected expression result type: ");
+		Closure whenFalse = compilePart(*conditional.whenFalse, "Unexpected expression result type: ");
+
+		if (prefersSelect(conditional))
+		{
+			return { [condition = std::move(condition), whenTrue = std::move(whenTrue), whenFalse = std::move(whenFalse)](
+						 Slots slots) { return select(condition(slots), whenTrue(slots), whenFalse(slots)); } };
+		}
+		return { [condition = std::move(condition), whenTrue = std::move(whenTrue), whenFalse = std::move(whenFalse)](
+					 Slots slots) { return condition(slots) != 0 ? whenTrue(slots) : whenFalse(slots); } };
+	}
+
+	CompiledExpression compile(BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		CompiledExpression lhs = compile(*binaryOp.lhs);
+		CompiledExpression rhs = compile(*binaryOp.rhs);
+		if (!lhs.hasValue || !rhs.hasValue)
+		{
+			std::string const lhsType(toString(lhs.hasValue ? state.types.typeOf(*binaryOp.lhs) : ValueType::none));
+			std::string const rhsType(toString(rhs.hasValue ? state.types.typeOf(*binaryOp.rhs) : ValueType::none));
+			return { bindBinary(std::move(lhs.operand),
+				std::move(rhs.operand),
+				[message = "Unexpected types for addition: " + lhsType + ", " + rhsType](
+					std::int64_t /*lhsValue*/, std::int64_t /*rhsValue*/) -> std::int64_t {
+					throw std::runtime_error(message);
+				}) };
+		}
+
+		if (state.types.typeOf(*binaryOp.lhs) == ValueType::i64)
+		{
+			return { compileOperator<std::int64_t>(binaryOp, std::move(lhs.operand), std::move(rhs.operand)) };
+		}
+		return { compileOperator<std::int32_t>(binaryOp, std::move(lhs.operand), std::move(rhs.operand)) };
+	}
+
+	template<typename T>
+	Closure compileOperator(BinaryOpExpression const& binaryOp, Operand lhs, Operand rhs) const
+	{
+		switch (binaryOp.op)
+		{
+		case BinaryOperator::add:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), WrappingPlus<T>{});
+		case BinaryOperator::subtract:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), WrappingMinus<T>{});
+		case BinaryOperator::multiply:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), WrappingMultiplies<T>{});
+		case BinaryOperator::divide:
+		case BinaryOperator::modulo:
+			return compileDivision<T>(binaryOp, std::move(lhs), std::move(rhs));
+		case BinaryOperator::equal:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::equal_to<T>{});
+		case BinaryOperator::notEqual:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::not_equal_to<T>{});
+		case BinaryOperator::less:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::less<T>{});
+		case BinaryOperator::lessEqual:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::less_equal<T>{});
+		case BinaryOperator::greater:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::greater<T>{});
+		case BinaryOperator::greaterEqual:
+			return bindTyped<T>(std::move(lhs), std::move(rhs), std::greater_equal<T>{});
+		default:
+			return throwing("Unexpected binary operator: "
+							+ std::to_string(static_cast<std::underlying_type_t<BinaryOperator>>(binaryOp.op)));
+		}
+	}
+
+	/// Only i32 divisions are analyzed, so constant divisor strategies never apply to wider types.
+	template<typename T>
+	Closure compileDivision(BinaryOpExpression const& division, Operand lhs, Operand rhs) const
+	{
+		auto preparedIt = state.divisions.find(&division);
+		PreparedDivision const prepared = preparedIt != state.divisions.end() ? preparedIt->second : PreparedDivision{};
+
+		// Constant divisors other than 0 and -1 can never fail, so they skip the checks entirely.
+		if (prepared.divisor.strategy != DivisionStrategy::hardware)
+		{
+			SignedDivisor const divisor = prepared.divisor;
+			if (division.op == BinaryOperator::divide)
+			{
+				return bindTyped<std::int32_t>(std::move(lhs), std::move(rhs), [divisor](std::int32_t lhsValue, std::int32_t) {
+					return divideByConstant(lhsValue, divisor);
+				});
+			}
+			return bindTyped<std::int32_t>(std::move(lhs), std::move(rhs), [divisor](std::int32_t lhsValue, std::int32_t) {
+				return remainderByConstant(lhsValue, divisor);
+			});
+		}
+
+		return bindTyped<T>(std::move(lhs), std::move(rhs), [op = division.op, prepared](T lhsValue, T rhsValue) {
+			return divideOrRemainder(op, prepared, lhsValue, rhsValue);
+		});
+	}
+
+	/// Arguments are evaluated into a buffer on the native stack and passed straight to the pre-bound callback.
+	CompiledExpression compileHostCall(PreparedHostCall const& call)// NOLINT(misc-no-recursion)
+	{
+		bool const hasValue = call.result != ValueType::none;
+		if (!call.error.empty())
+		{
+			return { throwing(call.error), hasValue };
+		}
+
+		std::vector<Closure> arguments;
+		for (Expression const* argument : call.arguments)
+		{
+			arguments.push_back(compilePart(*argument, "Only i32 and i64 are implemented"));
+		}
+		return { [arguments = std::move(arguments), function = call.function, result = call.result](Slots slots) {
+					std::array<std::int64_t, maxHostArguments> values{};
+					for (std::size_t i = 0; i < arguments.size(); ++i)
+					{
+						values.at(i) = arguments[i](slots);
+					}
+					return callHost(*function, result, values.data());
+				},
+			hasValue };
+	}
+
+	CompiledExpression compile(FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		if (auto hostIt = state.hostCalls.find(&functionCall); hostIt != state.hostCalls.end())
+		{
+			return compileHostCall(hostIt->second);
+		}
+
+		CompiledFunction const* callee = find(functionCall.functionName);
+		if (callee == nullptr)
+		{
+			return { throwing(fmt::format("Couldn't find function {}", functionCall.functionName)) };
+		}
+
+		std::vector<CallArgument> arguments;
+		std::vector<std::string> inNames;
+		for (auto const& arg : functionCall.arguments)
+		{
+			if (arg.direction == ParameterDirection::in)
+			{
+				CompiledExpression value = compile(arg.expr);
+				if (!value.hasValue)
+				{
+					arguments.push_back({ throwingAfter(toClosure(std::move(value.operand)), "Only i32 and i64 are implemented"), std::nullopt });
+					break;
+				}
+
+				CallArgument& argument = arguments.emplace_back(CallArgument{ toClosure(std::move(value.operand)), std::nullopt });
+				if (std::ranges::find(inNames, arg.name) == inNames.end())
+				{
+					argument.slot = callee->findSlot(arg.name);
+				}
+				inNames.push_back(arg.name);
+			}
+			else if (arg.direction == ParameterDirection::out)
+			{
+				arguments.push_back({ throwing("Named output arguments not implemented"), std::nullopt });
+				break;
+			}
+			else
+			{
+				arguments.push_back({ throwing("Unknown direction (inout?) when calling function not implemented"), std::nullopt });
+				break;
+			}
+		}
+
+		std::string bindingError = findBindingError(
+			*callee->function,
+			[&](std::string const& name) { return std::ranges::find(inNames, name) != inNames.end(); },
+			[](std::string const& /*name*/) { return true; });
+
+		// The callee's body is only compiled after this call site, so it is read through the callee when called.
+		return { [callee,
+					 arguments = std::move(arguments),
+					 bindingError = std::move(bindingError),
+					 sampler = state.sampler,
+					 trace = state.trace](Slots slots) -> std::int64_t {
+					SlotBuffer calleeSlots(callee->slotNames.size());
+					std::int64_t firstArgument = 0;
+					for (auto const& argument : arguments)
+					{
+						std::int64_t const value = argument.value(slots);
+						if (&argument == &arguments.front())
+						{
+							firstArgument = value;
+						}
+						if (argument.slot)
+						{
+							calleeSlots.data()[*argument.slot] = value;// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+						}
+					}
+					if (!bindingError.empty())
+					{
+						throw std::runtime_error(bindingError);
+					}
+
+					Function const& function = *callee->function;
+					SamplingProfiler::Call const sampledCall(sampler, function);
+					if (trace != nullptr)
+					{
+						trace->record({ ExecutionTrace::EventKind::call, &function, &function.expression, firstArgument });
+					}
+					callee->body(calleeSlots.data());
+					if (callee->outCount > 1)
+					{
+						throw std::runtime_error("Multiple out args not implemented");
+					}
+					std::int64_t const result
+						= callee->outCount == 1 ? load(SlotOperand{ callee->resultSlot }, calleeSlots.data()) : 0;
+					if (trace != nullptr)
+					{
+						trace->record({ ExecutionTrace::EventKind::ret, &function, &function.expression, result });
+					}
+					return result;
+				},
+			callee->outCount > 0 };
 	}
 };
 
 std::int32_t execute(Program const& program)
 {
-	State programState{ &program };
+	return execute(program, {});
+}
+
+std::int32_t execute(Program const& program, ExecuteOptions const& options)
+{
 	if (!program.mainFunction)
 	{
 		throw std::runtime_error("Missing main function");
 	}
 
+	std::optional<WorkStealingPool> pool;
+	if (options.parallelWorkers > 0 && options.profile == nullptr && options.trace == nullptr)
+	{
+		pool.emplace(options.parallelWorkers);
+	}
+
+	State programState{ &program,
+		options.profile,
+		options.sampler,
+		options.trace,
+		options.tracer,
+		pool ? &*pool : nullptr,
+		options.parallelCostThreshold,
+		{},
+		{},
+		{},
+		{},
+		{},
+		{},
+		{},
+		{} };
+	std::optional<Tracer::Span> phase;
+	phase.emplace(options.tracer, "execute", "prepare");
+	programState.prepare();
+
+	if (options.engine == InterpreterEngine::closures && options.profile == nullptr)
+	{
+		phase.emplace(options.tracer, "execute", "translate");
+		ClosureProgram const closures(programState);
+		phase.emplace(options.tracer, "execute", "run");
+		return closures.runMain();
+	}
+
+	phase.emplace(options.tracer, "execute", "run");
+
 	std::vector<ParameterValue> outArgs;
 	outArgs.push_back(ParameterValue{ "exitCode" });
 	programState.executeFunction(*program.mainFunction, {}, outArgs);
 
-	return outArgs.front().value;
+	return static_cast<std::int32_t>(outArgs.front().value);
+}
+
+struct CompiledProgram::Impl
+{
+	Program program;
+	State state;
+	std::optional<ClosureProgram> closures;
+};
+
+CompiledProgram::CompiledProgram(Program program)
+	: impl(std::make_unique<Impl>(Impl{ std::move(program), {}, std::nullopt }))
+{
+	impl->state.program = &impl->program;
+	for (auto const& function : impl->program.functions)
+	{
+		impl->state.entryPoints.push_back(function.get());
+	}
+	impl->state.prepare();
+	impl->closures.emplace(impl->state);
+}
+
+CompiledProgram::CompiledProgram(CompiledProgram&&) noexcept = default;
+CompiledProgram& CompiledProgram::operator=(CompiledProgram&&) noexcept = default;
+CompiledProgram::~CompiledProgram() = default;
+
+std::size_t CompiledProgram::functionCount() const
+{
+	return impl->program.functions.size();
+}
+
+std::optional<std::size_t> CompiledProgram::findFunction(std::string_view name) const
+{
+	return impl->closures->findFunction(name);
+}
+
+std::size_t CompiledProgram::inCount(std::size_t function) const
+{
+	return impl->closures->function(function).inSlots.size();
+}
+
+std::size_t CompiledProgram::outCount(std::size_t function) const
+{
+	return impl->closures->function(function).outSlots.size();
+}
+
+void CompiledProgram::call(std::size_t function,
+	std::span<std::int64_t const> inValues,
+	std::span<std::int64_t> outValues) const
+{
+	impl->closures->call(function, inValues, outValues);
+}
+
+/// Marks the expressions that contain calls or loops. Those are where an execution can run for long, so they cost fuel
+/// and are evaluated as coroutines. Everything else is bounded by its size and left to the tree walker.
+struct ResumableCollector
+{
+	std::unordered_set<Expression const*>* resumable;
+
+	bool mark(Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		bool const isResumable = std::visit(*this, expression.expr);
+		if (isResumable)
+		{
+			resumable->insert(&expression);
+		}
+		return isResumable;
+	}
+
+	bool operator()(Literal const& /*literal*/) { return false; }
+
+	bool operator()(InitAssignment const& initAssignment) { return mark(*initAssignment.value); }
+
+	bool operator()(BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		bool const lhs = mark(*binaryOp.lhs);
+		return mark(*binaryOp.rhs) || lhs;
+	}
+
+	bool operator()(FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		for (auto const& arg : functionCall.arguments)
+		{
+			mark(arg.expr);
+		}
+		return true;
+	}
+
+	bool operator()(LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		mark(*loop.from);
+		mark(*loop.to);
+		mark(*loop.initial);
+		mark(*loop.body);
+		return true;
+	}
+
+	bool operator()(ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		bool const condition = mark(*conditional.condition);
+		bool const whenTrue = mark(*conditional.whenTrue);
+		return mark(*conditional.whenFalse) || condition || whenTrue;
+	}
+
+	bool operator()(LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		bool parts = false;
+		for (auto const& element : let.elements)
+		{
+			parts = mark(*element) || parts;
+		}
+		if (let.generator)
+		{
+			parts = mark(*let.generator) || parts;
+		}
+		return mark(*let.body) || parts;
+	}
+
+	bool operator()(IndexExpression const& index) { return mark(*index.index); }
+
+	bool operator()(VarExpression const& /*varExpression*/) { return false; }
+};
+
+/// A program prepared for the tree walker, along with the expressions its coroutines evaluate.
+struct ResumableProgram
+{
+	State state;
+	std::unordered_set<Expression const*> resumable;
+};
+
+/// Evaluates one execution as a tree of coroutines, mirroring the tree walker, and suspends all of them when its slice
+/// of fuel runs out. The innermost one is left as the point to resume from.
+struct ResumableExecution
+{
+	ResumableProgram* program = nullptr;
+	std::uint64_t fuel = 0;
+	/// Trampoline slot of the coroutines, see runCoroutines.
+	std::coroutine_handle<> next;
+	std::coroutine_handle<> resumePoint;
+
+	/// Awaitable value of a subexpression, evaluated right away unless it is resumable.
+	struct Evaluation
+	{
+		std::optional<Task<ExpressionResult>> task;
+		ExpressionResult result{};
+
+		[[nodiscard]] bool await_ready() const noexcept { return !task; }
+		template<typename Promise>
+		void await_suspend(std::coroutine_handle<Promise> awaiting) noexcept
+		{
+			task->await_suspend(awaiting);
+		}
+		ExpressionResult await_resume() { return task ? task->await_resume() : result; }
+	};
+
+	auto consumeFuel()
+	{
+		struct FuelAwaiter
+		{
+			ResumableExecution* execution;
+			bool suspended = false;
+
+			[[nodiscard]] bool await_ready() const noexcept
+			{
+				if (execution->fuel == 0)
+				{
+					return false;
+				}
+				--execution->fuel;
+				return true;
+			}
+			void await_suspend(std::coroutine_handle<> handle) noexcept
+			{
+				execution->resumePoint = handle;
+				suspended = true;
+			}
+			void await_resume() const noexcept
+			{
+				// The slice was refilled before resuming, so the unit this waited for is taken from the new one.
+				if (suspended)
+				{
+					--execution->fuel;
+				}
+			}
+		};
+		return FuelAwaiter{ this };
+	}
+
+	Task<std::int64_t> runMain()
+	{
+		Function const& main = *program->state.program->mainFunction;
+		std::vector<ParameterValue> outArgs;
+		outArgs.push_back(ParameterValue{ "exitCode" });
+		Frame frame = State::enterFunction(main, {}, outArgs);
+		ExpressionResult const result = co_await evaluate(frame, main.expression);
+		State::leaveFunction(frame, result.type, outArgs);
+		co_return outArgs.front().value;
+	}
+
+	Evaluation evaluate(Frame& frame, Expression const& expression)// NOLINT(misc-no-recursion)
+	{
+		if (!program->resumable.contains(&expression))
+		{
+			return { std::nullopt, program->state.evaluateExpression(frame, expression) };
+		}
+		return { std::visit([&](auto const& expr) { return resume(frame, expr); }, expression.expr), {} };
+	}
+
+	static ExpressionResult checkLoopPart(ExpressionResult result)
+	{
+		if (result.type == ValueType::none)
+		{
+			throw std::runtime_error("Loop expressions must be i32 or i64, got: " + std::string(toString(result.type)));
+		}
+		return result;
+	}
+
+	static std::int64_t checkArrayPart(ExpressionResult result)
+	{
+		if (result.type != ValueType::i32)
+		{
+			throw std::runtime_error("Array elements and indices must be i32, got: " + std::string(toString(result.type)));
+		}
+		return result.value;
+	}
+
+	// Literals and variables neither call nor loop, so they are never resumable. This only completes the visitor.
+	template<typename Leaf>
+	static Task<ExpressionResult> resume(Frame& /*frame*/, Leaf const& /*leaf*/)
+	{
+		throw std::runtime_error("Only expressions with calls or loops can be resumed");
+		co_return ExpressionResult{};
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, InitAssignment const& initAssignment)// NOLINT(misc-no-recursion)
+	{
+		auto localIt = std::ranges::find(frame.locals, initAssignment.var, &Local::name);
+		if (localIt == frame.locals.end())
+		{
+			throw std::runtime_error("Undeclared variable: " + initAssignment.var);
+		}
+
+		auto const localIndex = static_cast<std::size_t>(localIt - frame.locals.begin());
+		ExpressionResult const value = co_await evaluate(frame, *initAssignment.value);
+		if (value.type == ValueType::none)
+		{
+			throw std::runtime_error("Unexpected expression result type: " + std::string(toString(value.type)));
+		}
+		frame.locals[localIndex].value = value.value;
+		co_return ExpressionResult{ ValueType::none, 0 };
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, BinaryOpExpression const& binaryOp)// NOLINT(misc-no-recursion)
+	{
+		ExpressionResult const lhs = co_await evaluate(frame, *binaryOp.lhs);
+		ExpressionResult const rhs = co_await evaluate(frame, *binaryOp.rhs);
+		if (lhs.type == ValueType::none || lhs.type != rhs.type)
+		{
+			throw std::runtime_error("Unexpected types for addition: " + std::string(toString(lhs.type)) + ", "
+									 + std::string(toString(rhs.type)));
+		}
+
+		PreparedDivision const prepared = program->state.findDivision(binaryOp);
+		std::int64_t const result = lhs.type == ValueType::i64
+									  ? applyTyped<std::int64_t>(binaryOp.op, prepared, lhs.value, rhs.value)
+									  : applyTyped<std::int32_t>(binaryOp.op, prepared, lhs.value, rhs.value);
+		co_return ExpressionResult{ isComparison(binaryOp.op) ? ValueType::i32 : lhs.type, result };
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, FunctionCall const& functionCall)// NOLINT(misc-no-recursion)
+	{
+		co_await consumeFuel();
+
+		State const& state = program->state;
+		if (auto hostIt = state.hostCalls.find(&functionCall); hostIt != state.hostCalls.end())
+		{
+			PreparedHostCall const& call = hostIt->second;
+			if (!call.error.empty())
+			{
+				throw std::runtime_error(call.error);
+			}
+
+			std::array<std::int64_t, maxHostArguments> arguments{};
+			for (std::size_t i = 0; i < call.arguments.size(); ++i)
+			{
+				ExpressionResult const argument = co_await evaluate(frame, *call.arguments[i]);
+				if (argument.type == ValueType::none)
+				{
+					throw std::runtime_error("Only i32 and i64 are implemented");
+				}
+				arguments.at(i) = argument.value;
+			}
+			co_return ExpressionResult{ call.result, callHost(*call.function, call.result, arguments.data()) };
+		}
+
+		auto funcIt = std::ranges::find(state.program->functions, functionCall.functionName, &Function::name);
+		if (funcIt == state.program->functions.cend())
+		{
+			throw std::runtime_error(fmt::format("Couldn't find function {}", functionCall.functionName));
+		}
+		Function const& function = **funcIt;
+
+		std::vector<ParameterValue> inArgs;
+		for (auto const& arg : functionCall.arguments)
+		{
+			if (arg.direction != ParameterDirection::in)
+			{
+				throw std::runtime_error(arg.direction == ParameterDirection::out
+											 ? "Named output arguments not implemented"
+											 : "Unknown direction (inout?) when calling function not implemented");
+			}
+			ExpressionResult const argument = co_await evaluate(frame, arg.expr);
+			if (argument.type == ValueType::none)
+			{
+				throw std::runtime_error("Only i32 and i64 are implemented");
+			}
+			inArgs.push_back(ParameterValue{ arg.name, argument.value, argument.type });
+		}
+
+		std::vector<ParameterValue> outArgs;
+		for (auto const& param : std::get<FuncType>(function.type->t).parameters)
+		{
+			if (param.direction == ParameterDirection::out)
+			{
+				outArgs.push_back(ParameterValue{ param.name, 0, valueTypeOf(*param.type) });
+			}
+		}
+
+		Frame calleeFrame = State::enterFunction(function, inArgs, outArgs);
+		ExpressionResult const result = co_await evaluate(calleeFrame, function.expression);
+		State::leaveFunction(calleeFrame, result.type, outArgs);
+
+		if (outArgs.size() > 1)
+		{
+			throw std::runtime_error("Multiple out args not implemented");
+		}
+		co_return outArgs.empty() ? ExpressionResult{ ValueType::none, 0 }
+								  : ExpressionResult{ outArgs[0].type, outArgs[0].value };
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, LoopExpression const& loop)// NOLINT(misc-no-recursion)
+	{
+		auto const [fromType, from] = checkLoopPart(co_await evaluate(frame, *loop.from));
+		std::int64_t const to = checkLoopPart(co_await evaluate(frame, *loop.to)).value;
+		auto const [accumulatorType, initial] = checkLoopPart(co_await evaluate(frame, *loop.initial));
+
+		std::size_t const counterIndex = frame.locals.size();
+		frame.locals.push_back(Local{ loop.counter, from, fromType });
+		frame.locals.push_back(Local{ loop.accumulator, initial, accumulatorType });
+		for (std::int64_t counter = from; counter < to; ++counter)
+		{
+			co_await consumeFuel();
+			frame.locals[counterIndex].value = counter;
+			std::int64_t const accumulator = checkLoopPart(co_await evaluate(frame, *loop.body)).value;
+			frame.locals[counterIndex + 1].value = accumulator;
+		}
+
+		std::int64_t const result = frame.locals[counterIndex + 1].value;
+		frame.locals.resize(counterIndex);
+		co_return ExpressionResult{ accumulatorType, result };
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, ConditionalExpression const& conditional)// NOLINT(misc-no-recursion)
+	{
+		auto const [type, value] = co_await evaluate(frame, *conditional.condition);
+		if (type != ValueType::i32)
+		{
+			throw std::runtime_error("Condition must be i32, got: " + std::string(toString(type)));
+		}
+		co_return co_await evaluate(frame, value != 0 ? *conditional.whenTrue : *conditional.whenFalse);
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, LetExpression const& let)// NOLINT(misc-no-recursion)
+	{
+		std::size_t const length = std::get<ArrayType>(let.type->t).length;
+		std::vector<std::int64_t> elements;
+		elements.reserve(length);
+		for (auto const& element : let.elements)
+		{
+			elements.push_back(checkArrayPart(co_await evaluate(frame, *element)));
+		}
+		if (let.generator)
+		{
+			std::size_t const indexLocal = frame.locals.size();
+			frame.locals.push_back(Local{ let.generatorIndex });
+			for (std::size_t position = 0; position < length; ++position)
+			{
+				frame.locals[indexLocal].value = static_cast<std::int64_t>(position);
+				elements.push_back(checkArrayPart(co_await evaluate(frame, *let.generator)));
+			}
+			frame.locals.resize(indexLocal);
+		}
+
+		std::size_t const arrayLocal = frame.locals.size();
+		for (std::int64_t const element : elements)
+		{
+			frame.locals.push_back(Local{ {}, element });
+		}
+		frame.locals[arrayLocal].name = let.name;
+		frame.locals[arrayLocal].arrayLength = length;
+
+		ExpressionResult const result = co_await evaluate(frame, *let.body);
+		frame.locals.resize(arrayLocal);
+		co_return result;
+	}
+
+	Task<ExpressionResult> resume(Frame& frame, IndexExpression const& index)// NOLINT(misc-no-recursion)
+	{
+		auto arrayIt = std::ranges::find(frame.locals | std::views::reverse, index.arrayName, &Local::name);
+		if (arrayIt == frame.locals.rend() || arrayIt->arrayLength == 0)
+		{
+			throw std::runtime_error(fmt::format("Array \"{}\" not found", index.arrayName));
+		}
+		auto const arrayLocal = static_cast<std::size_t>(frame.locals.rend() - arrayIt) - 1;
+		std::size_t const length = arrayIt->arrayLength;
+
+		std::int64_t const position = checkArrayPart(co_await evaluate(frame, *index.index));
+		if (!program->state.inBoundsIndices.contains(&index)
+			&& (position < 0 || static_cast<std::size_t>(position) >= length))
+		{
+			throw std::runtime_error(fmt::format("Index {} out of bounds for array \"{}\"", position, index.arrayName));
+		}
+		co_return ExpressionResult{ ValueType::i32, frame.locals[arrayLocal + static_cast<std::size_t>(position)].value };
+	}
+};
+
+struct Scheduler::Impl
+{
+	struct Execution
+	{
+		ResumableExecution coroutines;
+		/// Reset once the execution has finished.
+		std::optional<Task<std::int64_t>> task;
+		std::int32_t result = 0;
+		std::exception_ptr error;
+	};
+
+	std::uint64_t fuelPerSlice;
+	std::unordered_map<Program const*, std::unique_ptr<ResumableProgram>> programs;
+	/// Indexed by execution id. Coroutines point into their execution, so it must not move.
+	std::vector<std::unique_ptr<Execution>> executions;
+	std::deque<std::size_t> queue;
+
+	[[nodiscard]] Execution const& finishedExecution(std::size_t execution) const
+	{
+		Execution const& found = *executions.at(execution);
+		if (found.task)
+		{
+			throw std::runtime_error(fmt::format("Execution {} has not finished", execution));
+		}
+		return found;
+	}
+};
+
+Scheduler::Scheduler(std::uint64_t fuelPerSlice)
+	: impl(std::make_unique<Impl>(Impl{ fuelPerSlice, {}, {}, {} }))
+{
+	if (fuelPerSlice == 0)
+	{
+		throw std::runtime_error("Slices must have at least one unit of fuel");
+	}
+}
+
+Scheduler::Scheduler(Scheduler&&) noexcept = default;
+Scheduler& Scheduler::operator=(Scheduler&&) noexcept = default;
+Scheduler::~Scheduler() = default;
+
+std::size_t Scheduler::submit(Program const& program)
+{
+	if (!program.mainFunction)
+	{
+		throw std::runtime_error("Missing main function");
+	}
+
+	auto programIt = impl->programs.find(&program);
+	if (programIt == impl->programs.end())
+	{
+		auto prepared = std::make_unique<ResumableProgram>();
+		prepared->state.program = &program;
+		prepared->state.prepare();
+		for (auto const& function : program.functions)
+		{
+			ResumableCollector{ &prepared->resumable }.mark(function->expression);
+		}
+		programIt = impl->programs.emplace(&program, std::move(prepared)).first;
+	}
+
+	auto execution = std::make_unique<Impl::Execution>();
+	execution->coroutines.program = programIt->second.get();
+	execution->task.emplace(execution->coroutines.runMain());
+	execution->coroutines.resumePoint = execution->task->bind(execution->coroutines.next);
+
+	std::size_t const id = impl->executions.size();
+	impl->executions.push_back(std::move(execution));
+	impl->queue.push_back(id);
+	return id;
+}
+
+std::optional<std::size_t> Scheduler::step()
+{
+	if (impl->queue.empty())
+	{
+		return std::nullopt;
+	}
+	std::size_t const id = impl->queue.front();
+	impl->queue.pop_front();
+
+	Impl::Execution& execution = *impl->executions[id];
+	execution.coroutines.fuel = impl->fuelPerSlice;
+	execution.coroutines.next = std::exchange(execution.coroutines.resumePoint, {});
+	runCoroutines(execution.coroutines.next);
+	if (!execution.task->done())
+	{
+		impl->queue.push_back(id);
+		return id;
+	}
+
+	try
+	{
+		execution.result = static_cast<std::int32_t>(execution.task->result());
+	}
+	catch (...)
+	{
+		execution.error = std::current_exception();
+	}
+	execution.task.reset();
+	return id;
+}
+
+void Scheduler::run()
+{
+	while (step())
+	{
+	}
+}
+
+bool Scheduler::finished(std::size_t execution) const
+{
+	return !impl->executions.at(execution)->task;
+}
+
+std::int32_t Scheduler::result(std::size_t execution) const
+{
+	Impl::Execution const& finished = impl->finishedExecution(execution);
+	if (finished.error)
+	{
+		std::rethrow_exception(finished.error);
+	}
+	return finished.result;
 }
 }
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/interpreter/sampling_profiler.hpp>
+
+#include <hobbylang/ast/ast.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+namespace jereq
+{
+namespace
+{
+/// Functions executing on this thread, outermost first, while a profiler is attached.
+thread_local std::vector<Function const*> callStack;
+}
+
+SamplingProfiler::SamplingProfiler(std::chrono::microseconds interval, std::size_t capacity)
+	: samples(std::max<std::size_t>(capacity, 1))
+	, ticker([this, interval](std::stop_token const& stopToken) {
+		std::mutex mutex;
+		std::condition_variable_any tick;
+		std::unique_lock lock(mutex);
+		while (!stopToken.stop_requested())
+		{
+			tick.wait_for(lock, stopToken, interval, [] { return false; });
+			requested.store(true, std::memory_order_relaxed);
+		}
+	})
+{
+}
+
+SamplingProfiler::~SamplingProfiler() = default;
+
+SamplingProfiler::Call::Call(SamplingProfiler* activeProfiler, Function const& function)
+	: profiler(activeProfiler)
+{
+	if (profiler != nullptr)
+	{
+		callStack.push_back(&function);
+		profiler->poll();
+	}
+}
+
+SamplingProfiler::Call::~Call()
+{
+	if (profiler != nullptr)
+	{
+		callStack.pop_back();
+	}
+}
+
+std::uint64_t SamplingProfiler::sampleCount() const
+{
+	return written.load(std::memory_order_relaxed);
+}
+
+// Each sample claims its own slot, so threads that take samples at the same time never write to the same one until
+// the buffer wraps around.
+void SamplingProfiler::record()
+{
+	std::uint64_t const index = written.fetch_add(1, std::memory_order_relaxed);
+	Sample& sample = samples[index % samples.size()];
+	sample.depth = std::min(callStack.size(), maxDepth);
+	std::copy(callStack.end() - static_cast<std::ptrdiff_t>(sample.depth), callStack.end(), sample.functions.begin());
+}
+
+void SamplingProfiler::writeFoldedStacks(std::ostream& out) const
+{
+	std::uint64_t const count = std::min<std::uint64_t>(written.load(std::memory_order_acquire), samples.size());
+	std::map<std::string, std::uint64_t> stacks;
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		Sample const& sample = samples[i];
+		if (sample.depth == 0)
+		{
+			continue;
+		}
+
+		std::string stack;
+		for (std::size_t frame = 0; frame < sample.depth; ++frame)
+		{
+			if (frame > 0)
+			{
+				stack += ';';
+			}
+			stack += sample.functions.at(frame)->name;
+		}
+		++stacks[stack];
+	}
+
+	for (auto const& [stack, samplesOfStack] : stacks)
+	{
+		out << stack << ' ' << samplesOfStack << '\n';
+	}
+}
+}
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace jereq
+{
+/// Lazily started coroutine producing a T. Awaiting a task, or finishing one, does not resume the next coroutine
+/// directly but hands it to a trampoline, see runCoroutines. Compilers only turn symmetric transfer into a tail call
+/// when optimizing, so this keeps long loops and deep call chains from growing the native stack in every build.
+template<typename T>
+class Task
+{
+public:
+	struct promise_type
+	{
+		T value{};
+		std::exception_ptr error;
+		std::coroutine_handle<> continuation;
+		/// The trampoline slot shared by every task of a chain.
+		std::coroutine_handle<>* next = nullptr;
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		auto final_suspend() noexcept
+		{
+			struct FinalAwaiter
+			{
+				[[nodiscard]] bool await_ready() const noexcept { return false; }
+				void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+				{
+					*handle.promise().next = handle.promise().continuation;
+				}
+				void await_resume() const noexcept {}
+			};
+			return FinalAwaiter{};
+		}
+
+		void return_value(T result) { value = std::move(result); }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	Task(Task const&) = delete;
+	Task(Task&& other) noexcept
+		: handle(std::exchange(other.handle, {}))
+	{
+	}
+	Task& operator=(Task const&) = delete;
+	Task& operator=(Task&& other) noexcept
+	{
+		std::swap(handle, other.handle);
+		return *this;
+	}
+	~Task()
+	{
+		if (handle)
+		{
+			handle.destroy();
+		}
+	}
+
+	[[nodiscard]] bool await_ready() const noexcept { return false; }
+	template<typename Promise>
+	void await_suspend(std::coroutine_handle<Promise> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		handle.promise().next = awaiting.promise().next;
+		*handle.promise().next = handle;
+	}
+	T await_resume() { return result(); }
+
+	/// Makes this task, and every task it awaits, hand the coroutine to resume next to the given trampoline slot.
+	/// Returns the coroutine that starts the task.
+	std::coroutine_handle<> bind(std::coroutine_handle<>& next)
+	{
+		handle.promise().next = &next;
+		return handle;
+	}
+
+	[[nodiscard]] bool done() const { return handle.done(); }
+
+	/// Value of a finished task, rethrowing the exception it finished with.
+	T result()
+	{
+		if (handle.promise().error)
+		{
+			std::rethrow_exception(handle.promise().error);
+		}
+		return std::move(handle.promise().value);
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> coroutine)
+		: handle(coroutine)
+	{
+	}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/// Resumes the coroutines handed to a trampoline slot until none is left, which is when the outermost task has
+/// finished or a coroutine suspended without handing over to another.
+inline void runCoroutines(std::coroutine_handle<>& next)
+{
+	while (next)
+	{
+		std::exchange(next, {}).resume();
+	}
+}
+}
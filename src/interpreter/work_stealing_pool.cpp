@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "work_stealing_pool.hpp"
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace jereq
+{
+namespace
+{
+thread_local WorkStealingPool const* currentPool = nullptr;
+thread_local std::size_t currentWorkerQueue = 0;
+}
+
+WorkStealingPool::WorkStealingPool(std::size_t workerCount)
+{
+	// The last queue is shared by all threads that are not part of the pool.
+	for (std::size_t i = 0; i < workerCount + 1; ++i)
+	{
+		queues.push_back(std::make_unique<Queue>());
+	}
+
+	workers.reserve(workerCount);
+	for (std::size_t i = 0; i < workerCount; ++i)
+	{
+		workers.emplace_back([this, i] { workerLoop(i); });
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::scoped_lock lock(sleepMutex);
+		stopping = true;
+	}
+	sleepCondition.notify_all();
+	workers.clear();
+}
+
+WorkStealingPool::TaskHandle WorkStealingPool::submit(std::function<void()> work)
+{
+	auto task = std::make_shared<Task>();
+	task->work = std::move(work);
+
+	Queue& queue = *queues[currentQueue()];
+	{
+		std::scoped_lock lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+
+	{
+		std::scoped_lock lock(sleepMutex);
+		++queuedTasks;
+	}
+	sleepCondition.notify_one();
+	return task;
+}
+
+void WorkStealingPool::wait(TaskHandle const& task)
+{
+	std::size_t const queueIndex = currentQueue();
+	while (!task->finished.load(std::memory_order_acquire))
+	{
+		if (TaskHandle other = findTask(queueIndex))
+		{
+			run(*other);
+		}
+		else
+		{
+			// The task is running on another thread and there is nothing left to help with, so sleep until it has
+			// finished instead of spinning for the rest of it.
+			task->finished.wait(false, std::memory_order_acquire);
+		}
+	}
+
+	if (task->error)
+	{
+		std::rethrow_exception(task->error);
+	}
+}
+
+std::size_t WorkStealingPool::currentQueue() const
+{
+	return currentPool == this ? currentWorkerQueue : queues.size() - 1;
+}
+
+WorkStealingPool::TaskHandle WorkStealingPool::findTask(std::size_t queueIndex)
+{
+	{
+		Queue& own = *queues[queueIndex];
+		std::scoped_lock lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			TaskHandle task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			--queuedTasks;
+			return task;
+		}
+	}
+
+	for (std::size_t offset = 1; offset < queues.size(); ++offset)
+	{
+		Queue& victim = *queues[(queueIndex + offset) % queues.size()];
+		std::scoped_lock lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			TaskHandle task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			--queuedTasks;
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
+void WorkStealingPool::workerLoop(std::size_t queueIndex)
+{
+	currentPool = this;
+	currentWorkerQueue = queueIndex;
+
+	while (true)
+	{
+		if (TaskHandle task = findTask(queueIndex))
+		{
+			run(*task);
+			continue;
+		}
+
+		std::unique_lock lock(sleepMutex);
+		sleepCondition.wait(lock, [this] { return stopping || queuedTasks > 0; });
+		if (stopping && queuedTasks == 0)
+		{
+			return;
+		}
+	}
+}
+
+void WorkStealingPool::run(Task& task)
+{
+	try
+	{
+		task.work();
+	}
+	catch (...)
+	{
+		task.error = std::current_exception();
+	}
+	task.finished.store(true, std::memory_order_release);
+	task.finished.notify_all();
+}
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jereq
+{
+/// Thread pool where each worker owns a deque. Workers take their own newest task first and steal the oldest task from
+/// other queues when they run dry. Threads outside the pool submit to a shared queue.
+class WorkStealingPool
+{
+public:
+	class Task
+	{
+		friend class WorkStealingPool;
+
+		std::function<void()> work;
+		std::atomic<bool> finished = false;
+		std::exception_ptr error;
+	};
+	using TaskHandle = std::shared_ptr<Task>;
+
+	explicit WorkStealingPool(std::size_t workerCount);
+	~WorkStealingPool();
+
+	WorkStealingPool(WorkStealingPool const&) = delete;
+	WorkStealingPool(WorkStealingPool&&) = delete;
+	WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+	WorkStealingPool& operator=(WorkStealingPool&&) = delete;
+
+	TaskHandle submit(std::function<void()> work);
+	/// Runs other queued tasks until the task has finished, or sleeps until it has once there are none, then rethrows any
+	/// exception it threw.
+	void wait(TaskHandle const& task);
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<TaskHandle> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::atomic<std::size_t> queuedTasks = 0;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+	bool stopping = false;
+	std::vector<std::jthread> workers;
+
+	[[nodiscard]] std::size_t currentQueue() const;
+	TaskHandle findTask(std::size_t queueIndex);
+	void workerLoop(std::size_t queueIndex);
+	static void run(Task& task);
+};
+}
@@ -5,10 +5,25 @@
 #include <hobbylang/ast/ast.hpp>
 
 #include <istream>
+#include <span>
+#include <string>
 #include <string_view>
 
 namespace jereq
 {
+/// A host function the program may call. The signature is written like a function type, e.g.
+/// `fun(in key: i32, out value: i64)`, with i32 and i64 parameters and at most one out parameter. Declarations without
+/// a callback can only be compiled to wasm imports.
+struct HostFunctionDeclaration
+{
+	std::string name;
+	std::string signature;
+	HostCallback callback = nullptr;
+	void* userData = nullptr;
+	std::string module = "env";
+};
+
 Program parse(std::string_view input, std::string_view name);
+Program parse(std::string_view input, std::string_view name, std::span<HostFunctionDeclaration const> hostFunctions);
 Program parse(std::istream& input, std::string_view name);
 }
@@ -2,22 +2,32 @@
 // Copyright © 2022 Sebastian Larsson
 #include <hobbylang/parser/parser.hpp>
 
+#include <hobbylang/analysis/statistics.hpp>
 #include <hobbylang/ast/ast.hpp>
 
 #include <fmt/core.h>
 
 #include <algorithm>
+#include <array>
 #include <charconv>
 #include <istream>
+#include <limits>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 
 namespace jereq
 {
+namespace
+{
+Statistic foldedConstants("parser", "Constant definitions folded");
+}
+
 struct Location
 {
 	std::size_t lineNumber;
@@ -52,6 +62,8 @@ Location locate(std::string_view substring, std::string_view original)
 	return result;
 }
 
+constexpr std::size_t maxArrayLength = 65536;
+
 struct ParseInput
 {
 	std::string_view current;
@@ -71,6 +83,13 @@ struct ParseInput
 		"{}({}:{}): {}", errorLocation.sourceFileName, location.lineNumber, location.columnNumber, description));
 }
 
+// Expressions keep their source text, and where it starts for the debug information of compiled modules.
+void setSource(Expression& expression, std::string_view rep, ParseInput const& input)
+{
+	expression.rep = rep;
+	expression.sourceOffset = static_cast<std::size_t>(rep.data() - input.full.data());
+}
+
 template<typename Result>
 struct ParseResult
 {
@@ -176,6 +195,15 @@ ParseResult<ParameterDirection> parseParameterDirection(ParseInput const& input)
 
 ParseResult<std::shared_ptr<Type>> parseType(Program& program, ParseInput const& input);
 
+// Constants are replaced while parsing, so a local with the same name would silently be ignored.
+void expectNotConstant(Program const& program, ParseResult<std::string_view> const& name, ParseInput const& input)
+{
+	if (program.constants.contains(name.result))
+	{
+		unrecoverableError(fmt::format("\"{}\" is already defined as a constant", name.result), input);
+	}
+}
+
 ParseResult<FuncParameter> parseFuncTypeParameter(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
 {
 	auto direction = parseParameterDirection(input);
@@ -195,6 +223,7 @@ ParseResult<FuncParameter> parseFuncTypeParameter(Program& program, ParseInput c
 	{
 		unrecoverableError("Expected parameter name", directionWhitespace.remaining);
 	}
+	expectNotConstant(program, parameterName, directionWhitespace.remaining);
 	auto parameterWRemInput = skipWhitespace(parameterName.remaining);
 
 	auto colonLiteral = parseLiteral(parameterWRemInput, ":");
@@ -289,7 +318,7 @@ std::shared_ptr<Type> findOrAddType(Program& program, Type&& maybeNewType)
 	return program.types.emplace_back(std::make_shared<Type>(std::move(maybeNewType)));
 }
 
-ParseResult<std::unique_ptr<Expression>> parseVarExpression(ParseInput const& input)
+ParseResult<std::unique_ptr<Expression>> parseVarExpression(Program const& program, ParseInput const& input)
 {
 	auto varIdentifier = parseIdentifier(input);
 	if (!varIdentifier.ok)
@@ -298,14 +327,19 @@ ParseResult<std::unique_ptr<Expression>> parseVarExpression(ParseInput const& in
 	}
 
 	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
-	expression->rep = varIdentifier.result;
+	setSource(*expression, varIdentifier.result, input);
+	if (auto constantIt = program.constants.find(varIdentifier.result); constantIt != program.constants.end())
+	{
+		expression->expr = constantIt->second;
+		return { true, skipWhitespace(varIdentifier.remaining), std::move(expression) };
+	}
 	expression->expr = VarExpression{ std::string(varIdentifier.result) };
 	return { true, skipWhitespace(varIdentifier.remaining), std::move(expression) };
 }
 
 ParseResult<std::unique_ptr<Expression>> parseNumberWithType(ParseInput const& input)
 {
-	std::int32_t value = -1;
+	std::int64_t value = -1;
 	auto [ptr, ec] = std::from_chars(input.current.data(), input.current.data() + input.current.size(), value);
 	if (ec != std::errc())
 	{
@@ -313,20 +347,34 @@ ParseResult<std::unique_ptr<Expression>> parseNumberWithType(ParseInput const& i
 	}
 
 	auto afterNumber = input.consume(ptr - input.current.data());
-	if (!afterNumber.current.starts_with("i32"))
+	ValueType type = ValueType::none;
+	if (afterNumber.current.starts_with("i32"))
+	{
+		type = ValueType::i32;
+		if (value < std::numeric_limits<std::int32_t>::min() || std::numeric_limits<std::int32_t>::max() < value)
+		{
+			unrecoverableError("Value out of range for i32", input);
+		}
+	}
+	else if (afterNumber.current.starts_with("i64"))
+	{
+		type = ValueType::i64;
+	}
+	else
 	{
 		unrecoverableError("Expected type after value", afterNumber);
 	}
 
 	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
-	expression->rep = input.current.substr(0, ptr - input.current.data() + 3);
-	expression->expr = Literal{ value };
+	setSource(*expression, input.current.substr(0, ptr - input.current.data() + 3), input);
+	expression->expr = Literal{ value, type };
 	return { true, afterNumber.consume(3), std::move(expression) };
 }
 
-ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(ParseInput const& input);
+ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(Program& program, ParseInput const& input);
+ParseResult<std::shared_ptr<Type>> parseType(Program& program, ParseInput const& input);
 
-ParseResult<std::unique_ptr<Expression>> parseFunctionCall(ParseInput const& input) // NOLINT(misc-no-recursion)
+ParseResult<std::unique_ptr<Expression>> parseFunctionCall(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
 {
 	auto funcName = parseIdentifier(input);
 	if (!funcName.ok)
@@ -345,73 +393,329 @@ ParseResult<std::unique_ptr<Expression>> parseFunctionCall(ParseInput const& inp
 	if (emptyParLiteral.ok)
 	{
 		std::unique_ptr<Expression> expression = std::make_unique<Expression>();
-		expression->rep = std::string_view(input.current.data(), emptyParLiteral.remaining.current.data());
+		setSource(*expression,
+			std::string_view(input.current.data(), emptyParLiteral.remaining.current.data()),
+			input);
 		expression->expr = FunctionCall{ std::string(funcName.result), {} };
 		return { true, skipWhitespace(emptyParLiteral.remaining), std::move(expression) };
 	}
 
-	auto direction = parseParameterDirection(parStartWRemInput);
-	if (!direction.ok)
+	std::vector<FuncArgument> arguments;
+	ParseInput argumentInput = parStartWRemInput;
+	while (true)
 	{
-		unrecoverableError("Expected parameter direction", parStartWRemInput);
+		auto direction = parseParameterDirection(argumentInput);
+		if (!direction.ok)
+		{
+			unrecoverableError("Expected parameter direction", argumentInput);
+		}
+
+		auto directionWhitespace = parseWhitespace(direction.remaining);
+		if (!directionWhitespace.ok)
+		{
+			unrecoverableError("Expected parameter direction followed by whitespace", direction.remaining);
+		}
+
+		auto parameterName = parseIdentifier(directionWhitespace.remaining);
+		if (!parameterName.ok)
+		{
+			unrecoverableError("Expected parameter name", directionWhitespace.remaining);
+		}
+		expectNotConstant(program, parameterName, directionWhitespace.remaining);
+		if (std::ranges::find(arguments, parameterName.result, &FuncArgument::name) != arguments.end())
+		{
+			unrecoverableError(
+				fmt::format("Argument \"{}\" given more than once", parameterName.result), directionWhitespace.remaining);
+		}
+		auto parameterWRemInput = skipWhitespace(parameterName.remaining);
+
+		auto colonLiteral = parseLiteral(parameterWRemInput, ":");
+		if (!colonLiteral.ok)
+		{
+			unrecoverableError("Expected colon between parameter name and value", parameterWRemInput);
+		}
+		auto colonLiteralWRemInput = skipWhitespace(colonLiteral.remaining);
+
+		auto argumentExpr = parseExpressionTerms(program, colonLiteralWRemInput);
+		if (!argumentExpr.ok)
+		{
+			unrecoverableError("Expected argument expression", colonLiteralWRemInput);
+		}
+
+		FuncArgument& arg = arguments.emplace_back();
+		arg.name = parameterName.result;
+		arg.direction = direction.result;
+		arg.expr = std::move(*argumentExpr.result);
+
+		auto additionalParametersLiteral = parseLiteral(argumentExpr.remaining, ",");
+		if (!additionalParametersLiteral.ok)
+		{
+			argumentInput = argumentExpr.remaining;
+			break;
+		}
+		argumentInput = skipWhitespace(additionalParametersLiteral.remaining);
 	}
 
-	auto directionWhitespace = parseWhitespace(direction.remaining);
-	if (!directionWhitespace.ok)
+	auto closeParLiteral = parseLiteral(argumentInput, ")");
+	if (!closeParLiteral.ok)
 	{
-		unrecoverableError("Expected parameter direction followed by whitespace", direction.remaining);
+		unrecoverableError("Expected closing parenthesis", argumentInput);
 	}
 
-	auto parameterName = parseIdentifier(directionWhitespace.remaining);
-	if (!parameterName.ok)
+	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
+	setSource(*expression,
+		std::string_view(input.current.data(), closeParLiteral.remaining.current.data()),
+		input);
+	expression->expr = FunctionCall{ std::string(funcName.result), std::move(arguments) };
+	return { true, skipWhitespace(closeParLiteral.remaining), std::move(expression) };
+}
+
+ParseResult<std::string_view> parseKeyword(ParseInput const& input, std::string_view keyword)
+{
+	auto keywordLiteral = parseLiteral(input, keyword);
+	if (!keywordLiteral.ok)
 	{
-		unrecoverableError("Expected parameter name", directionWhitespace.remaining);
+		return {};
 	}
-	auto parameterWRemInput = skipWhitespace(parameterName.remaining);
 
-	auto colonLiteral = parseLiteral(parameterWRemInput, ":");
+	auto keywordWhitespace = parseWhitespace(keywordLiteral.remaining);
+	if (!keywordWhitespace.ok)
+	{
+		return {};
+	}
+	return { true, keywordWhitespace.remaining, keywordLiteral.result };
+}
+
+ParseResult<std::string_view> expectIdentifier(ParseInput const& input, std::string_view description)
+{
+	auto identifier = parseIdentifier(input);
+	if (!identifier.ok)
+	{
+		unrecoverableError(fmt::format("Expected {}", description), input);
+	}
+	return { true, skipWhitespace(identifier.remaining), identifier.result };
+}
+
+ParseResult<std::string_view> expectBindingName(Program const& program,
+	ParseInput const& input,
+	std::string_view description)
+{
+	auto name = expectIdentifier(input, description);
+	expectNotConstant(program, name, input);
+	return name;
+}
+
+ParseInput expectKeyword(ParseInput const& input, std::string_view keyword)
+{
+	auto keywordResult = parseKeyword(input, keyword);
+	if (!keywordResult.ok)
+	{
+		unrecoverableError(fmt::format("Expected '{}'", keyword), input);
+	}
+	return keywordResult.remaining;
+}
+
+std::unique_ptr<Expression> expectExpressionTerms(Program& program, ParseInput& input, std::string_view description) // NOLINT(misc-no-recursion)
+{
+	auto expression = parseExpressionTerms(program, input);
+	if (!expression.ok)
+	{
+		unrecoverableError(fmt::format("Expected {}", description), input);
+	}
+	input = skipWhitespace(expression.remaining);
+	return std::move(expression.result);
+}
+
+// loop <counter> from <expr> to <expr> with <accumulator> = <expr> { <expr> }
+ParseResult<std::unique_ptr<Expression>> parseLoop(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
+{
+	auto loopKeyword = parseKeyword(input, "loop");
+	if (!loopKeyword.ok)
+	{
+		return {};
+	}
+
+	LoopExpression loop;
+	auto counter = expectBindingName(program, loopKeyword.remaining, "loop counter name");
+	loop.counter = counter.result;
+
+	ParseInput remaining = expectKeyword(counter.remaining, "from");
+	loop.from = expectExpressionTerms(program, remaining, "loop start expression");
+	remaining = expectKeyword(remaining, "to");
+	loop.to = expectExpressionTerms(program, remaining, "loop end expression");
+	remaining = expectKeyword(remaining, "with");
+
+	auto accumulator = expectBindingName(program, remaining, "loop accumulator name");
+	loop.accumulator = accumulator.result;
+	auto assignmentLiteral = parseLiteral(accumulator.remaining, "=");
+	if (!assignmentLiteral.ok)
+	{
+		unrecoverableError("Expected initial value for loop accumulator", accumulator.remaining);
+	}
+	remaining = skipWhitespace(assignmentLiteral.remaining);
+	loop.initial = expectExpressionTerms(program, remaining, "initial accumulator expression");
+
+	auto bodyStart = parseLiteral(remaining, "{");
+	if (!bodyStart.ok)
+	{
+		unrecoverableError("Missing '{' at start of loop body", remaining);
+	}
+	remaining = skipWhitespace(bodyStart.remaining);
+	loop.body = expectExpressionTerms(program, remaining, "loop body expression");
+
+	auto bodyEnd = parseLiteral(remaining, "}");
+	if (!bodyEnd.ok)
+	{
+		unrecoverableError("Missing '}' at end of loop body", remaining);
+	}
+
+	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
+	setSource(*expression, std::string_view(input.current.data(), bodyEnd.remaining.current.data()), input);
+	expression->expr = std::move(loop);
+	return { true, bodyEnd.remaining, std::move(expression) };
+}
+
+// if <expr> then <expr> else <expr>
+ParseResult<std::unique_ptr<Expression>> parseConditional(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
+{
+	auto ifKeyword = parseKeyword(input, "if");
+	if (!ifKeyword.ok)
+	{
+		return {};
+	}
+
+	ConditionalExpression conditional;
+	ParseInput remaining = ifKeyword.remaining;
+	conditional.condition = expectExpressionTerms(program, remaining, "condition expression");
+	remaining = expectKeyword(remaining, "then");
+	conditional.whenTrue = expectExpressionTerms(program, remaining, "expression after 'then'");
+	remaining = expectKeyword(remaining, "else");
+	conditional.whenFalse = expectExpressionTerms(program, remaining, "expression after 'else'");
+
+	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
+	setSource(*expression, trim(std::string_view(input.current.data(), remaining.current.data())), input);
+	expression->expr = std::move(conditional);
+	return { true, remaining, std::move(expression) };
+}
+
+// let <name>: [N]i32 = [<expr>, ...] in <expr>
+// let <name>: [N]i32 = [for <index>: <expr>] in <expr>
+ParseResult<std::unique_ptr<Expression>> parseLet(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
+{
+	auto letKeyword = parseKeyword(input, "let");
+	if (!letKeyword.ok)
+	{
+		return {};
+	}
+
+	LetExpression let;
+	auto name = expectBindingName(program, letKeyword.remaining, "array name");
+	let.name = name.result;
+
+	auto colonLiteral = parseLiteral(name.remaining, ":");
 	if (!colonLiteral.ok)
 	{
-		unrecoverableError("Expected colon between parameter name and value", parameterWRemInput);
+		unrecoverableError("Expected ':' followed by the array type", name.remaining);
+	}
+	auto type = parseType(program, skipWhitespace(colonLiteral.remaining));
+	if (!std::holds_alternative<ArrayType>(type.result->t))
+	{
+		unrecoverableError("Only arrays can be bound with let", colonLiteral.remaining);
 	}
-	auto colonLiteralWRemInput = skipWhitespace(colonLiteral.remaining);
+	let.type = type.result;
+	std::size_t const length = std::get<ArrayType>(let.type->t).length;
 
-	auto argumentExpr = parseExpressionTerms(colonLiteralWRemInput);
-	if (!argumentExpr.ok)
+	auto assignmentLiteral = parseLiteral(type.remaining, "=");
+	if (!assignmentLiteral.ok)
+	{
+		unrecoverableError("Expected '=' followed by the array elements", type.remaining);
+	}
+	auto elementsStart = parseLiteral(skipWhitespace(assignmentLiteral.remaining), "[");
+	if (!elementsStart.ok)
 	{
-		unrecoverableError("Expected argument expression", colonLiteralWRemInput);
+		unrecoverableError("Expected '[' at start of array elements", assignmentLiteral.remaining);
 	}
 
-	auto additionalParametersLiteral = parseLiteral(argumentExpr.remaining, ",");
-	if (additionalParametersLiteral.ok)
+	ParseInput remaining = skipWhitespace(elementsStart.remaining);
+	auto forKeyword = parseKeyword(remaining, "for");
+	if (forKeyword.ok)
 	{
-		unrecoverableError("Multiple arguments not implemented", argumentExpr.remaining);
+		auto index = expectBindingName(program, forKeyword.remaining, "generator index name");
+		let.generatorIndex = index.result;
+		auto indexColon = parseLiteral(index.remaining, ":");
+		if (!indexColon.ok)
+		{
+			unrecoverableError("Expected ':' after generator index", index.remaining);
+		}
+		remaining = skipWhitespace(indexColon.remaining);
+		let.generator = expectExpressionTerms(program, remaining, "generator expression");
+	}
+	else
+	{
+		let.elements.push_back(expectExpressionTerms(program, remaining, "array element"));
+		for (auto comma = parseLiteral(remaining, ","); comma.ok; comma = parseLiteral(remaining, ","))
+		{
+			remaining = skipWhitespace(comma.remaining);
+			let.elements.push_back(expectExpressionTerms(program, remaining, "array element"));
+		}
+		if (let.elements.size() != length)
+		{
+			unrecoverableError(
+				fmt::format("Expected {} array elements, got {}", length, let.elements.size()), elementsStart.remaining);
+		}
 	}
 
-	auto closeParLiteral = parseLiteral(argumentExpr.remaining, ")");
-	if (!closeParLiteral.ok)
+	auto elementsEnd = parseLiteral(remaining, "]");
+	if (!elementsEnd.ok)
 	{
-		unrecoverableError("Expected closing parenthesis", argumentExpr.remaining);
+		unrecoverableError("Expected ']' at end of array elements", remaining);
 	}
+	remaining = expectKeyword(skipWhitespace(elementsEnd.remaining), "in");
+	let.body = expectExpressionTerms(program, remaining, "expression after 'in'");
 
-	std::vector<FuncArgument> arguments;
-	FuncArgument& arg = arguments.emplace_back();
-	arg.name = parameterName.result;
-	arg.direction = direction.result;
-	arg.expr = std::move(*argumentExpr.result);
+	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
+	setSource(*expression, trim(std::string_view(input.current.data(), remaining.current.data())), input);
+	expression->expr = std::move(let);
+	return { true, remaining, std::move(expression) };
+}
+
+// <name>[<expr>]
+ParseResult<std::unique_ptr<Expression>> parseIndex(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
+{
+	auto arrayName = parseIdentifier(input);
+	if (!arrayName.ok)
+	{
+		return {};
+	}
+	auto indexStart = parseLiteral(arrayName.remaining, "[");
+	if (!indexStart.ok)
+	{
+		return {};
+	}
+
+	IndexExpression index;
+	index.arrayName = arrayName.result;
+	ParseInput remaining = skipWhitespace(indexStart.remaining);
+	index.index = expectExpressionTerms(program, remaining, "index expression");
+
+	auto indexEnd = parseLiteral(remaining, "]");
+	if (!indexEnd.ok)
+	{
+		unrecoverableError("Expected ']' after index", remaining);
+	}
 
 	std::unique_ptr<Expression> expression = std::make_unique<Expression>();
-	expression->rep = std::string_view(input.current.data(), closeParLiteral.remaining.current.data());
-	expression->expr = FunctionCall{ std::string(funcName.result), std::move(arguments) };
-	return { true, skipWhitespace(closeParLiteral.remaining), std::move(expression) };
+	setSource(*expression, std::string_view(input.current.data(), indexEnd.remaining.current.data()), input);
+	expression->expr = std::move(index);
+	return { true, indexEnd.remaining, std::move(expression) };
 }
 
-ParseResult<std::unique_ptr<Expression>> parseTerm(ParseInput const& input) // NOLINT(misc-no-recursion)
+ParseResult<std::unique_ptr<Expression>> parseTerm(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
 {
 	auto parStart = parseLiteral(input, "(");
 	if (parStart.ok)
 	{
-		auto innerExpr = parseExpressionTerms(skipWhitespace(parStart.remaining));
+		auto innerExpr = parseExpressionTerms(program, skipWhitespace(parStart.remaining));
 		if (!innerExpr.ok)
 		{
 			unrecoverableError("Expected inner expression", parStart.remaining);
@@ -426,13 +730,37 @@ ParseResult<std::unique_ptr<Expression>> parseTerm(ParseInput const& input) // N
 		return { true, parEnd.remaining, std::move(innerExpr.result) };
 	}
 
-	auto functionCallExpr = parseFunctionCall(input);
+	auto loopExpr = parseLoop(program, input);
+	if (loopExpr.ok)
+	{
+		return loopExpr;
+	}
+
+	auto conditionalExpr = parseConditional(program, input);
+	if (conditionalExpr.ok)
+	{
+		return conditionalExpr;
+	}
+
+	auto letExpr = parseLet(program, input);
+	if (letExpr.ok)
+	{
+		return letExpr;
+	}
+
+	auto functionCallExpr = parseFunctionCall(program, input);
 	if (functionCallExpr.ok)
 	{
 		return functionCallExpr;
 	}
 
-	auto varExpression = parseVarExpression(input);
+	auto indexExpr = parseIndex(program, input);
+	if (indexExpr.ok)
+	{
+		return indexExpr;
+	}
+
+	auto varExpression = parseVarExpression(program, input);
 	if (varExpression.ok)
 	{
 		return varExpression;
@@ -441,29 +769,37 @@ ParseResult<std::unique_ptr<Expression>> parseTerm(ParseInput const& input) // N
 	return parseNumberWithType(input);
 }
 
-BinaryOperator parseBinaryOperator(ParseInput const& input)
+ParseResult<BinaryOperator> parseBinaryOperator(ParseInput const& input)
 {
-	char opChar = input.current.at(0);
-	switch (opChar)
-	{
-	case '+':
-		return BinaryOperator::add;
-	case '-':
-		return BinaryOperator::subtract;
-	case '*':
-		return BinaryOperator::multiply;
-	case '/':
-		return BinaryOperator::divide;
-	case '%':
-		return BinaryOperator::modulo;
-	default:
-		unrecoverableError(fmt::format("Unknown binary operator: {}", opChar), input);
+	// Two character operators are listed first, so they are not mistaken for their one character prefix.
+	static constexpr std::array<std::pair<std::string_view, BinaryOperator>, 11> operators{ {
+		{ "==", BinaryOperator::equal },
+		{ "!=", BinaryOperator::notEqual },
+		{ "<=", BinaryOperator::lessEqual },
+		{ ">=", BinaryOperator::greaterEqual },
+		{ "<", BinaryOperator::less },
+		{ ">", BinaryOperator::greater },
+		{ "+", BinaryOperator::add },
+		{ "-", BinaryOperator::subtract },
+		{ "*", BinaryOperator::multiply },
+		{ "/", BinaryOperator::divide },
+		{ "%", BinaryOperator::modulo },
+	} };
+
+	for (auto const& [symbol, op] : operators)
+	{
+		auto opLiteral = parseLiteral(input, symbol);
+		if (opLiteral.ok)
+		{
+			return { true, opLiteral.remaining, op };
+		}
 	}
+	return {};
 }
 
-ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(ParseInput const& input) // NOLINT(misc-no-recursion)
+ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(Program& program, ParseInput const& input) // NOLINT(misc-no-recursion)
 {
-	auto firstTerm = parseTerm(input);
+	auto firstTerm = parseTerm(program, input);
 	if (!firstTerm.ok)
 	{
 		unrecoverableError("Expected an expression term", input);
@@ -471,23 +807,23 @@ ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(ParseInput const&
 	auto currentHead = std::move(firstTerm.result);
 	auto currentRemainingInput = skipWhitespace(firstTerm.remaining);
 
-	while (!currentRemainingInput.current.empty()
-		   && (currentRemainingInput.current[0] == '+' || currentRemainingInput.current[0] == '-'
-			   || currentRemainingInput.current[0] == '*' || currentRemainingInput.current[0] == '/'
-			   || currentRemainingInput.current[0] == '%'))
+	for (auto binaryOperator = parseBinaryOperator(currentRemainingInput); binaryOperator.ok;
+		 binaryOperator = parseBinaryOperator(currentRemainingInput))
 	{
-		BinaryOperator const binaryOperator = parseBinaryOperator(currentRemainingInput);
-
-		auto tail = skipWhitespace(currentRemainingInput.consume(1));
-		auto nextTerm = parseTerm(tail);
+		auto tail = skipWhitespace(binaryOperator.remaining);
+		auto nextTerm = parseTerm(program, tail);
 		if (!nextTerm.ok)
 		{
 			unrecoverableError("Expected a right-hand side term for binary operator", tail);
 		}
 
 		std::unique_ptr<Expression> binaryOpExpression = std::make_unique<Expression>();
-		binaryOpExpression->rep = trim(std::string_view(input.current.data(), nextTerm.remaining.current.data()));
-		binaryOpExpression->expr = BinaryOpExpression{ binaryOperator, std::move(currentHead), std::move(nextTerm.result) };
+		setSource(*binaryOpExpression,
+			trim(std::string_view(input.current.data(), nextTerm.remaining.current.data())),
+			input);
+		binaryOpExpression->expr = BinaryOpExpression{
+			binaryOperator.result, std::move(currentHead), std::move(nextTerm.result), program.binaryOperatorCount++
+		};
 
 		std::swap(currentHead, binaryOpExpression);
 		currentRemainingInput = skipWhitespace(nextTerm.remaining);
@@ -496,7 +832,7 @@ ParseResult<std::unique_ptr<Expression>> parseExpressionTerms(ParseInput const&
 	return { true, currentRemainingInput, std::move(currentHead) };
 }
 
-ParseResult<Expression> parseExpression(ParseInput const& input)
+ParseResult<Expression> parseExpression(Program& program, ParseInput const& input)
 {
 	auto varIdentifier = parseIdentifier(input);
 	if (!varIdentifier.ok)
@@ -511,7 +847,7 @@ ParseResult<Expression> parseExpression(ParseInput const& input)
 	}
 	auto assignmentWRemInput = skipWhitespace(identifierWRemInput.consume(1));
 
-	auto valueExpr = parseExpressionTerms(assignmentWRemInput);
+	auto valueExpr = parseExpressionTerms(program, assignmentWRemInput);
 	if (!valueExpr.ok)
 	{
 		unrecoverableError("Failed to parse expression terms", assignmentWRemInput);
@@ -527,7 +863,7 @@ ParseResult<Expression> parseExpression(ParseInput const& input)
 	initAssignment.value = std::move(valueExpr.result);
 
 	Expression expr;
-	expr.rep = trim(std::string_view(input.current.data(), leftOver.current.data()));
+	setSource(expr, trim(std::string_view(input.current.data(), leftOver.current.data())), input);
 	expr.expr = std::move(initAssignment);
 
 	return { true, skipWhitespace(leftOver), std::move(expr) };
@@ -565,6 +901,38 @@ ParseResult<std::shared_ptr<Type>> parseType(// NOLINT(misc-no-recursion)
 	Program& program,
 	ParseInput const& input)
 {
+	auto arrayStart = parseLiteral(input, "[");
+	if (arrayStart.ok)
+	{
+		std::size_t length = 0;
+		auto lengthInput = skipWhitespace(arrayStart.remaining);
+		auto [ptr, ec] = std::from_chars(
+			lengthInput.current.data(), lengthInput.current.data() + lengthInput.current.size(), length);
+		if (ec != std::errc() || length == 0 || length > maxArrayLength)
+		{
+			unrecoverableError(fmt::format("Expected an array length between 1 and {}", maxArrayLength), lengthInput);
+		}
+
+		auto arrayEnd = parseLiteral(skipWhitespace(lengthInput.consume(ptr - lengthInput.current.data())), "]");
+		if (!arrayEnd.ok)
+		{
+			unrecoverableError("Expected ']' after array length", lengthInput);
+		}
+
+		auto elementType = parseType(program, arrayEnd.remaining);
+		if (!std::holds_alternative<BuiltInType>(elementType.result->t))
+		{
+			unrecoverableError("Only arrays of i32 are implemented", arrayEnd.remaining);
+		}
+
+		Type maybeNewType;
+		maybeNewType.rep = trim(std::string_view(input.current.data(), elementType.remaining.current.data()));
+		maybeNewType.t = ArrayType{ length, elementType.result };
+
+		std::shared_ptr<Type> const& type = findOrAddType(program, std::move(maybeNewType));
+		return { true, elementType.remaining, type };
+	}
+
 	auto funcType = parseFuncType(program, input);
 	if (funcType.ok)
 	{
@@ -579,7 +947,7 @@ ParseResult<std::shared_ptr<Type>> parseType(// NOLINT(misc-no-recursion)
 	auto plainType = parseIdentifier(input);
 	if (plainType.ok)
 	{
-		if (plainType.result == "i32")
+		if (plainType.result == "i32" || plainType.result == "i64")
 		{
 			Type maybeNewType;
 			maybeNewType.rep = plainType.result;
@@ -597,7 +965,7 @@ ParseResult<std::shared_ptr<Type>> parseType(// NOLINT(misc-no-recursion)
 	unrecoverableError("Expected type", input);
 }
 
-ParseResult<Expression> parseFunctionBody(ParseInput const& input)
+ParseResult<Expression> parseFunctionBody(Program& program, ParseInput const& input)
 {
 	if (!input.current.starts_with('{'))
 	{
@@ -608,7 +976,7 @@ ParseResult<Expression> parseFunctionBody(ParseInput const& input)
 	auto remainingInput = skipWhitespace(input.consume(1));
 	while (!remainingInput.current.empty() && !remainingInput.current.starts_with('}'))
 	{
-		auto expression = parseExpression(remainingInput);
+		auto expression = parseExpression(program, remainingInput);
 		if (!expression.ok)
 		{
 			unrecoverableError("Expected an expression in function body", remainingInput);
@@ -640,6 +1008,121 @@ ParseResult<Expression> parseFunctionBody(ParseInput const& input)
 	}
 }
 
+template<typename T>
+std::int64_t foldOperator(BinaryOperator op, T lhs, T rhs, ParseInput const& input)
+{
+	using Unsigned = std::make_unsigned_t<T>;
+	auto const wrap = [](Unsigned value) { return static_cast<std::int64_t>(static_cast<T>(value)); };
+	switch (op)
+	{
+	case BinaryOperator::add:
+		return wrap(static_cast<Unsigned>(static_cast<Unsigned>(lhs) + static_cast<Unsigned>(rhs)));
+	case BinaryOperator::subtract:
+		return wrap(static_cast<Unsigned>(static_cast<Unsigned>(lhs) - static_cast<Unsigned>(rhs)));
+	case BinaryOperator::multiply:
+		return wrap(static_cast<Unsigned>(static_cast<Unsigned>(lhs) * static_cast<Unsigned>(rhs)));
+	case BinaryOperator::divide:
+	case BinaryOperator::modulo:
+		if (rhs == 0)
+		{
+			unrecoverableError("Integer division by zero in constant", input);
+		}
+		if (rhs == -1)
+		{
+			if (op == BinaryOperator::modulo)
+			{
+				return 0;
+			}
+			if (lhs == std::numeric_limits<T>::min())
+			{
+				unrecoverableError("Integer overflow in division in constant", input);
+			}
+		}
+		return op == BinaryOperator::divide ? lhs / rhs : lhs % rhs;
+	case BinaryOperator::equal:
+		return lhs == rhs ? 1 : 0;
+	case BinaryOperator::notEqual:
+		return lhs != rhs ? 1 : 0;
+	case BinaryOperator::less:
+		return lhs < rhs ? 1 : 0;
+	case BinaryOperator::lessEqual:
+		return lhs <= rhs ? 1 : 0;
+	case BinaryOperator::greater:
+		return lhs > rhs ? 1 : 0;
+	case BinaryOperator::greaterEqual:
+		return lhs >= rhs ? 1 : 0;
+	default:
+		unrecoverableError("Operator not supported in constant", input);
+	}
+}
+
+// Constant definitions may only use literals, operators, conditionals and earlier constants, which have already been
+// replaced by literals. The arithmetic wraps like the generated code does.
+Literal foldConstant(Expression const& expression, ParseInput const& input)// NOLINT(misc-no-recursion)
+{
+	if (auto const* literal = std::get_if<Literal>(&expression.expr))
+	{
+		return *literal;
+	}
+	if (auto const* conditional = std::get_if<ConditionalExpression>(&expression.expr))
+	{
+		Literal const condition = foldConstant(*conditional->condition, input);
+		Literal const whenTrue = foldConstant(*conditional->whenTrue, input);
+		Literal const whenFalse = foldConstant(*conditional->whenFalse, input);
+		if (condition.type != ValueType::i32 || whenTrue.type != whenFalse.type)
+		{
+			unrecoverableError("Conditions must be i32 and both arms must have the same type", input);
+		}
+		return condition.value != 0 ? whenTrue : whenFalse;
+	}
+	if (auto const* varExpression = std::get_if<VarExpression>(&expression.expr))
+	{
+		unrecoverableError(
+			fmt::format("\"{}\" is not a constant defined before this definition", varExpression->varName), input);
+	}
+	auto const* binaryOp = std::get_if<BinaryOpExpression>(&expression.expr);
+	if (binaryOp == nullptr)
+	{
+		unrecoverableError("Constant definitions can only use literals, operators and conditionals", input);
+	}
+
+	Literal const lhs = foldConstant(*binaryOp->lhs, input);
+	Literal const rhs = foldConstant(*binaryOp->rhs, input);
+	if (lhs.type != rhs.type)
+	{
+		unrecoverableError(
+			fmt::format("Operands have different types: {} and {}", toString(lhs.type), toString(rhs.type)), input);
+	}
+
+	ValueType const resultType = isComparison(binaryOp->op) ? ValueType::i32 : lhs.type;
+	if (lhs.type == ValueType::i64)
+	{
+		return { foldOperator<std::int64_t>(binaryOp->op, lhs.value, rhs.value, input), resultType };
+	}
+	return { foldOperator<std::int32_t>(
+				 binaryOp->op, static_cast<std::int32_t>(lhs.value), static_cast<std::int32_t>(rhs.value), input),
+		resultType };
+}
+
+// def <name> = <expr>;
+ParseInput parseConstantDefinition(Program& program, std::string_view name, ParseInput const& input)
+{
+	auto value = parseExpressionTerms(program, input);
+	if (!value.ok)
+	{
+		unrecoverableError("Expected constant expression", input);
+	}
+	if (!value.remaining.current.starts_with(';'))
+	{
+		unrecoverableError("Invalid def end", value.remaining);
+	}
+
+	program.constants.emplace(name, foldConstant(*value.result, input));
+	++foldedConstants;
+	return skipWhitespace(value.remaining.consume(1));
+}
+
+// Parses a function or constant definition. Constants are only recorded in the program, so the result is null for them.
 ParseResult<std::shared_ptr<Function>> parseDefinition(Program& program, ParseInput const& input)
 {
 	auto lineWRemInput = skipWhitespace(input);
@@ -664,13 +1147,27 @@ ParseResult<std::shared_ptr<Function>> parseDefinition(Program& program, ParseIn
 	}
 	auto assignmentWRemInput = skipWhitespace(assignmentLiteral.remaining);
 
+	auto const functionIt = std::ranges::find(program.functions,
+		defIdentifier.result,
+		[](std::shared_ptr<Function> const& function) -> std::string const& { return function->name; });
+	if (program.constants.contains(defIdentifier.result) || program.findHostFunction(defIdentifier.result) != nullptr
+		|| functionIt != program.functions.end())
+	{
+		unrecoverableError(fmt::format("\"{}\" is already defined", defIdentifier.result), defWhitespace.remaining);
+	}
+
+	if (auto typeKeyword = parseIdentifier(assignmentWRemInput); !typeKeyword.ok || typeKeyword.result != "fun")
+	{
+		return { true, parseConstantDefinition(program, defIdentifier.result, assignmentWRemInput), nullptr };
+	}
+
 	auto type = parseType(program, assignmentWRemInput);
 	if (!type.ok)
 	{
 		unrecoverableError("Unable to parse type", assignmentWRemInput);
 	}
 
-	auto functionBody = parseFunctionBody(type.remaining);
+	auto functionBody = parseFunctionBody(program, type.remaining);
 	if (!functionBody.ok)
 	{
 		unrecoverableError("Failed to parse function body", type.remaining);
@@ -707,9 +1204,62 @@ ParseResult<std::shared_ptr<Function>> parseDefinition(Program& program, ParseIn
 	return { true, remainingInput, mainFunc };
 }
 
+HostFunction parseHostFunction(Program& program, HostFunctionDeclaration const& declaration)
+{
+	ParseInput const input{ declaration.signature, declaration.signature, declaration.name };
+	auto type = parseType(program, input);
+	if (!type.ok || !std::holds_alternative<FuncType>(type.result->t) || !skipWhitespace(type.remaining).current.empty())
+	{
+		unrecoverableError("Expected a function type", input);
+	}
+	if (program.findHostFunction(declaration.name) != nullptr)
+	{
+		unrecoverableError(fmt::format("\"{}\" is already defined", declaration.name), input);
+	}
+
+	std::size_t inCount = 0;
+	std::size_t outCount = 0;
+	for (auto const& parameter : std::get<FuncType>(type.result->t).parameters)
+	{
+		if (valueTypeOf(*parameter.type) == ValueType::none)
+		{
+			unrecoverableError("Host function parameters must be i32 or i64", input);
+		}
+		switch (parameter.direction)
+		{
+		case ParameterDirection::in:
+			++inCount;
+			break;
+		case ParameterDirection::out:
+			++outCount;
+			break;
+		default:
+			unrecoverableError("Host functions only take in and out parameters", input);
+		}
+	}
+	if (inCount > maxHostArguments || outCount > 1)
+	{
+		unrecoverableError(
+			fmt::format("Host functions take at most {} in parameters and one out parameter", maxHostArguments), input);
+	}
+
+	return { declaration.name, declaration.module, type.result, declaration.callback, declaration.userData };
+}
+
 Program parse(std::string_view input, std::string_view name)
+{
+	return parse(input, name, {});
+}
+
+Program parse(std::string_view input, std::string_view name, std::span<HostFunctionDeclaration const> hostFunctions)
 {
 	Program program;
+	program.sourceName = name;
+	program.lines = LineIndex(input);
+	for (auto const& declaration : hostFunctions)
+	{
+		program.hostFunctions.push_back(parseHostFunction(program, declaration));
+	}
 
 	ParseInput remainingInput{ input, input, name };
 	while (!remainingInput.current.empty())
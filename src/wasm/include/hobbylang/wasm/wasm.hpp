@@ -2,12 +2,50 @@
 // Copyright © 2023 Sebastian Larsson
 #pragma once
 
+#include <hobbylang/analysis/profile.hpp>
 #include <hobbylang/ast/ast.hpp>
 
+#include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <ostream>
+#include <string>
+#include <vector>
 
 namespace jereq
 {
+class Tracer;
+
+struct CompileOptions
+{
+	/// Execution profile used to order functions and to inline hot call sites.
+	Profile const* profile = nullptr;
+	/// A call site is hot if it accounts for at least this fraction of all profiled calls.
+	double hotCallSiteFraction = 0.01;
+	/// Maximum number of expression nodes in a function inlined at a hot call site.
+	std::size_t inlineSizeLimit = 32;
+	/// Functions exported from the module under their own name, in addition to _start.
+	std::vector<std::string> exportedFunctions;
+	/// Also export batch_<name>(inPointer, outPointer, count) for each exported function with only i32 parameters and
+	/// exactly one out parameter. It reads count rows of the function's in-parameters from linear memory and writes one
+	/// result per row. Where possible four rows are computed at a time with SIMD instructions.
+	bool batchEntryPoints = false;
+	/// Functions that get an exported map_<name>(inPointer, outPointer, count) loop with the same memory layout as the
+	/// batch entry points, so a whole array is processed with a single call from the host.
+	std::vector<std::string> mappedFunctions;
+	/// Linear memory limits, in 64 KiB pages. Memory is omitted unless array wrappers or let-bound arrays use it, or a
+	/// limit is given. The initial size defaults to one page for either use, and without a maximum the memory may grow
+	/// freely. Let-bound arrays are kept on a stack that grows down from the end of the initial memory.
+	std::optional<std::uint32_t> initialMemoryPages;
+	std::optional<std::uint32_t> maximumMemoryPages;
+	/// Emit a DWARF line table in .debug_line, with the compile unit referring to it in .debug_info and .debug_abbrev,
+	/// mapping code offsets to the line and column of each expression in the source. Following the convention for
+	/// DWARF in wasm, addresses are offsets from the start of the code section contents.
+	bool debugLines = false;
+	/// When set, the analysis and emission phases, and the code of each function, are recorded as spans.
+	Tracer* tracer = nullptr;
+};
+
 bool compile(Program const& program, std::ostream& out);
+bool compile(Program const& program, std::ostream& out, CompileOptions const& options);
 }
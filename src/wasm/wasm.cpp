@@ -2,18 +2,41 @@
 // Copyright © 2022-2023 Sebastian Larsson
 #include <hobbylang/wasm/wasm.hpp>
 
+#include <hobbylang/analysis/cost_model.hpp>
+#include <hobbylang/analysis/division.hpp>
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/analysis/range_analysis.hpp>
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/trace.hpp>
+#include <hobbylang/analysis/type_check.hpp>
 #include <hobbylang/ast/ast.hpp>
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <map>
+#include <memory>
+#include <optional>
 #include <ostream>
 #include <span>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
 
 namespace
 {
+jereq::Statistic inlinedCalls("wasm", "Calls inlined");
+jereq::Statistic emittedFunctions("wasm", "Functions emitted");
+jereq::Statistic codeSectionBytes("wasm", "Bytes emitted in the code section");
+
 std::ostream& writeByte(std::ostream& out, std::byte value)
 {
 	return out.put(static_cast<char>(value));
@@ -79,6 +102,22 @@ void writeSLEB128(std::ostream& out, std::int32_t value)
 	writeByte(out, std::byte((unsignedValue ^ flipper) & ~firstBit));
 }
 
+void writeSLEB128(std::ostream& out, std::int64_t value)
+{
+	static constexpr std::uint64_t _6_BITS = 6;
+	static constexpr std::uint64_t _7_BITS = 7;
+	static constexpr std::uint64_t firstBit = 1U << _7_BITS;
+	std::uint64_t const flipper = value < 0 ? ~0ULL : 0;
+
+	auto unsignedValue = std::bit_cast<std::uint64_t>(value) ^ flipper;
+	while (unsignedValue >= 1U << _6_BITS)
+	{
+		writeByte(out, std::byte((unsignedValue ^ flipper) | firstBit));
+		unsignedValue >>= _7_BITS;
+	}
+	writeByte(out, std::byte((unsignedValue ^ flipper) & ~firstBit));
+}
+
 void writeVector(std::ostream& out, std::span<std::byte const> vector)
 {
 	writeULEB128(out, static_cast<std::uint32_t>(vector.size()));
@@ -101,6 +140,17 @@ void writeSection(std::ostream& out, std::uint8_t sectionNumber, std::span<std::
 	writeVector(out, contents);
 }
 
+std::byte valueTypeByte(jereq::ValueType type)
+{
+	return type == jereq::ValueType::i64 ? std::byte{ 0x7E } : std::byte{ 0x7F };
+}
+
+// Block type of a structured instruction leaving a value of the given type, or nothing.
+std::byte blockType(jereq::ValueType type)
+{
+	return type == jereq::ValueType::none ? std::byte{ 0x40 } : valueTypeByte(type);
+}
+
 struct WasmFuncType
 {
 	std::vector<std::byte> inParameters;
@@ -124,9 +174,9 @@ WasmFuncType translateFuncType(jereq::FuncType const& funcType)
 		if (std::holds_alternative<jereq::BuiltInType>(parameter.type->t))
 		{
 			auto const& builtInType = std::get<jereq::BuiltInType>(parameter.type->t);
-			if (builtInType.name == "i32")
+			if (builtInType.name == "i32" || builtInType.name == "i64")
 			{
-				parameterList.push_back(std::byte{ 0x7F });
+				parameterList.push_back(valueTypeByte(jereq::valueTypeOf(*parameter.type)));
 			}
 			else
 			{
@@ -252,23 +302,91 @@ void writeFunctionSection(std::ostream& out,
 	writeSection(out, 3, asBytes(funcVecOutStr));
 }
 
-void writeLimits(std::ostream& out)
+struct MemoryLimits
 {
-	writeByte(out, std::byte{ 0x01 });
-	writeULEB128(out, 0);
-	writeULEB128(out, 1024);
+	std::uint32_t minimum = 0;
+	std::optional<std::uint32_t> maximum;
+};
+
+// Memory is only declared when something uses it: the array wrappers read and write it, let expressions keep their
+// arrays on a stack in it, and explicit limits request it for the host. Both uses need at least one page by default.
+std::optional<MemoryLimits> planMemory(jereq::CompileOptions const& options, bool hasArrayWrappers, bool usesArrayStack)
+{
+	bool const needsMemory = hasArrayWrappers || usesArrayStack;
+	if (!needsMemory && !options.initialMemoryPages && !options.maximumMemoryPages)
+	{
+		return std::nullopt;
+	}
+
+	MemoryLimits limits{ options.initialMemoryPages.value_or(needsMemory ? 1 : 0), options.maximumMemoryPages };
+	if (limits.maximum && *limits.maximum < limits.minimum)
+	{
+		throw std::runtime_error("Maximum memory pages must not be less than the initial memory pages");
+	}
+	if (usesArrayStack && limits.minimum == 0)
+	{
+		throw std::runtime_error("Arrays need at least one initial memory page");
+	}
+	return limits;
+}
+
+// The array stack grows down from the end of the initial memory, leaving the low addresses to the host.
+constexpr std::uint32_t stackPointerGlobal = 0;
+constexpr std::uint32_t pageSize = 65536;
+
+void writeGlobalSection(std::ostream& out, std::optional<MemoryLimits> const& memory, bool usesArrayStack)
+{
+	if (!usesArrayStack)
+	{
+		return;
+	}
+
+	std::ostringstream globalVecOut;
+	writeULEB128(globalVecOut, 1);
+	writeByte(globalVecOut, std::byte{ 0x7F });
+	writeByte(globalVecOut, std::byte{ 0x01 });
+	// The end of a full 4 GiB memory is past the largest address, so there the stack starts one word lower. Addresses
+	// of 2 GiB and up are written as negative constants, and the stack pointer is only ever compared unsigned.
+	std::uint64_t const top = std::min<std::uint64_t>(
+		std::uint64_t{ memory->minimum } * pageSize, std::numeric_limits<std::uint32_t>::max() - 3);
+	writeByte(globalVecOut, std::byte{ 0x41 });
+	writeSLEB128(globalVecOut, static_cast<std::int32_t>(static_cast<std::uint32_t>(top)));
+	writeByte(globalVecOut, std::byte{ 0x0B });
+
+	std::string const& globalVecOutStr = globalVecOut.str();
+	writeSection(out, 6, asBytes(globalVecOutStr));
+}
+
+void writeLimits(std::ostream& out, MemoryLimits const& limits)
+{
+	if (limits.maximum)
+	{
+		writeByte(out, std::byte{ 0x01 });
+		writeULEB128(out, limits.minimum);
+		writeULEB128(out, *limits.maximum);
+	}
+	else
+	{
+		writeByte(out, std::byte{ 0x00 });
+		writeULEB128(out, limits.minimum);
+	}
 }
 
-void writeMemory(std::ostream& out)
+void writeMemory(std::ostream& out, MemoryLimits const& limits)
 {
-	writeLimits(out);
+	writeLimits(out, limits);
 }
 
-void writeMemorySection(std::ostream& out)
+void writeMemorySection(std::ostream& out, std::optional<MemoryLimits> const& memory)
 {
+	if (!memory)
+	{
+		return;
+	}
+
 	std::ostringstream memoryVecOut;
 	writeULEB128(memoryVecOut, 1);
-	writeMemory(memoryVecOut);
+	writeMemory(memoryVecOut, *memory);
 
 	std::string const& memoryVecOutStr = memoryVecOut.str();
 	writeSection(out, 5, asBytes(memoryVecOutStr));
@@ -288,9 +406,17 @@ void writeExportMemory(std::ostream& out)
 	writeByte(out, std::byte{ 0x00 });
 }
 
+struct HostImport
+{
+	std::uint32_t index = 0;
+	jereq::Type const* type = nullptr;
+};
+
 struct Index
 {
 	std::map<jereq::Function const*, std::uint32_t> functions;
+	std::map<std::string, jereq::Function const*, std::less<>> functionsByName;
+	std::map<std::string, HostImport, std::less<>> hostFunctions;
 };
 
 struct ExportFunctionInformation
@@ -301,184 +427,1815 @@ struct ExportFunctionInformation
 
 void writeExportSection(std::ostream& out,
 	std::vector<ExportFunctionInformation> const& exportFunctionInfo,
-	Index const& index)
+	Index const& index,
+	bool exportMemory)
 {
 	std::ostringstream exportVecOut;
-	writeULEB128(exportVecOut, exportFunctionInfo.size() + 1);
+	writeULEB128(exportVecOut, exportFunctionInfo.size() + (exportMemory ? 1 : 0));
 	for (auto const& info : exportFunctionInfo)
 	{
 		writeExportFunction(exportVecOut, info.exportName, index.functions.at(info.function));
 	}
-	writeExportMemory(exportVecOut);
+	if (exportMemory)
+	{
+		writeExportMemory(exportVecOut);
+	}
 
 	std::string const& exportVecOutStr = exportVecOut.str();
 	writeSection(out, 7, asBytes(exportVecOutStr));
 }
 
-void writeLocals(std::ostream& out)
+struct Locals
 {
-	writeVector(out, {});
-}
+	std::uint32_t firstScratch = 0;
+	/// Value type of every scratch local, in declaration order.
+	std::vector<std::byte> scratchTypes;
+	/// Scratch locals currently in use, released in reverse order of acquisition.
+	std::vector<std::uint32_t> inUse;
+
+	/// Reuses a free scratch local of the same type before declaring a new one.
+	std::uint32_t acquireScratch(std::byte type = std::byte{ 0x7F })
+	{
+		std::uint32_t scratch = 0;
+		while (scratch < scratchTypes.size()
+			   && (scratchTypes[scratch] != type || std::ranges::find(inUse, scratch) != inUse.end()))
+		{
+			++scratch;
+		}
+		if (scratch == scratchTypes.size())
+		{
+			scratchTypes.push_back(type);
+		}
+		inUse.push_back(scratch);
+		return firstScratch + scratch;
+	}
+
+	void releaseScratch() { inUse.pop_back(); }
+};
 
-void writeExpression(std::ostream& out, jereq::Expression const& expression, Index const& index)
+struct Binding
 {
-	if (expression.rep.empty())
+	std::uint32_t local = 0;
+	std::optional<std::int32_t> constant;
+	/// Non-zero for arrays, where the local holds the address of the first element.
+	std::uint32_t arrayLength = 0;
+};
+
+// Maps variable names to wasm locals, or to constants inside specialized inlined bodies.
+struct Scope
+{
+	std::map<std::string, Binding, std::less<>> bindings;
+	std::uint32_t inlineDepth = 0;
+};
+
+struct InlineDecision
+{
+	jereq::Function const* callee = nullptr;
+	std::map<std::string, std::int32_t, std::less<>> constantArguments;
+};
+
+using InliningPlan = std::map<jereq::FunctionCall const*, InlineDecision>;
+
+// Entry point that applies a function to every row of a row-major i32 array in linear memory.
+struct BatchFunction
+{
+	jereq::Function const* function = nullptr;
+	std::uint32_t rowWidth = 0;
+	bool vectorized = false;
+};
+
+using BatchFunctions = std::map<jereq::Function const*, BatchFunction>;
+
+/// A code offset where the source location changes, see CompileOptions::debugLines.
+struct LineRow
+{
+	std::uint32_t address;
+	std::size_t sourceOffset;
+};
+
+/// The rows of one function, at offsets from the start of the code section contents.
+struct LineSequence
+{
+	std::uint32_t start;
+	std::uint32_t end;
+	std::vector<LineRow> rows;
+};
+
+struct LineTable
+{
+	std::vector<LineSequence> sequences;
+	/// Rows of the function being written, at offsets from the start of its body.
+	std::vector<LineRow> rows;
+	/// Source offsets of the expressions being written, innermost last.
+	std::vector<std::size_t> enclosing;
+	std::uint32_t codeSize = 0;
+
+	void enter(std::uint32_t address, std::size_t sourceOffset)
+	{
+		enclosing.push_back(sourceOffset);
+		mark(address, sourceOffset);
+	}
+
+	void leave(std::uint32_t address)
 	{
-		for (auto const& [func, idx] : index.functions)
+		enclosing.pop_back();
+		if (!enclosing.empty())
 		{
-			if (func->name == "main")
-			{
-				writeByte(out, std::byte{ 0x10 });
-				writeULEB128(out, idx);
-				writeByte(out, std::byte{ 0x10 });
-				writeByte(out, std::byte{ 0x00 });
-				return;
-			}
+			mark(address, enclosing.back());
 		}
-
-		throw std::runtime_error("Expected to find main in index");
 	}
-	else
+
+	void mark(std::uint32_t address, std::size_t sourceOffset)
 	{
-		if (std::holds_alternative<jereq::Literal>(expression.expr))
+		if (!rows.empty() && rows.back().address == address)
 		{
-			auto const& literal = std::get<jereq::Literal>(expression.expr);
-			writeByte(out, std::byte{ 0x41 });
-			writeSLEB128(out, literal.value);
+			rows.back().sourceOffset = sourceOffset;
 		}
-		else if (std::holds_alternative<jereq::InitAssignment>(expression.expr))
+		else if (rows.empty() || rows.back().sourceOffset != sourceOffset)
 		{
-			auto const& initAssignment = std::get<jereq::InitAssignment>(expression.expr);
-			writeExpression(out, *initAssignment.value, index);
-			// TODO: Verify variable has not been assigned before
-			// TODO: Figure out locals and return values
-			// TODO: Type checks
+			rows.push_back({ address, sourceOffset });
 		}
-		else if (std::holds_alternative<jereq::BinaryOpExpression>(expression.expr))
+	}
+
+	void finishFunction(std::uint32_t bodyStart, std::uint32_t end)
+	{
+		if (rows.empty())
 		{
-			// TODO: type checks
-			auto const& binExpr = std::get<jereq::BinaryOpExpression>(expression.expr);
-			writeExpression(out, *binExpr.lhs, index);
-			writeExpression(out, *binExpr.rhs, index);
-			switch (binExpr.op)
-			{
-			case jereq::BinaryOperator::add:
-				writeByte(out, std::byte{ 0x6A });
-				break;
-			case jereq::BinaryOperator::subtract:
-				writeByte(out, std::byte{ 0x6B });
-				break;
-			case jereq::BinaryOperator::multiply:
-				writeByte(out, std::byte{ 0x6C });
-				break;
-			case jereq::BinaryOperator::divide:
-				// TODO: signed/unsigned
-				writeByte(out, std::byte{ 0x6D });
-				break;
-			case jereq::BinaryOperator::modulo:
-				// TODO: signed/unsigned
-				writeByte(out, std::byte{ 0x6F });
-				break;
-			default:
-				throw std::runtime_error("Operator not supported");
-			}
+			return;
 		}
-		else
+		for (LineRow& row : rows)
 		{
-			throw std::runtime_error("Unexpected expression alternative");
+			row.address += bodyStart;
 		}
+		sequences.push_back({ bodyStart, end, std::move(rows) });
+		rows.clear();
 	}
-}
+};
 
-void writeCode(std::ostream& out, jereq::Function const& function, Index const& index)
+struct CodeContext
 {
-	std::ostringstream codeOut;
-	writeLocals(codeOut);
-	writeExpression(codeOut, function.expression, index);
-	writeByte(codeOut, std::byte{ 0x0B });
+	Index const& index;
+	jereq::RangeAnalysis const& ranges;
+	jereq::TypeInfo const& types;
+	InliningPlan const& inlining;
+	BatchFunctions const& batches;
+	/// Only set when line tables are emitted.
+	LineTable* lines;
+	jereq::Tracer* tracer;
+};
 
-	std::string const& codeOutStr = codeOut.str();
-	writeVector(out, asBytes(codeOutStr));
-}
+/// Attributes the code written for an expression to its source, and the code that follows to the enclosing expression.
+/// Expressions without a source offset leave their code to the enclosing expression.
+class LineMark
+{
+public:
+	LineMark(std::ostream& code, jereq::Expression const& expression, CodeContext const& context)
+		: out(code)
+		, lines(expression.sourceOffset ? context.lines : nullptr)
+	{
+		if (lines != nullptr)
+		{
+			lines->enter(address(), *expression.sourceOffset);
+		}
+	}
+	LineMark(LineMark const&) = delete;
+	LineMark(LineMark&&) = delete;
+	LineMark& operator=(LineMark const&) = delete;
+	LineMark& operator=(LineMark&&) = delete;
+	~LineMark()
+	{
+		if (lines != nullptr)
+		{
+			lines->leave(address());
+		}
+	}
 
-void writeCodeSection(std::ostream& out,
-	std::vector<std::shared_ptr<jereq::Function>> const& functions,
-	Index const& index)
+private:
+	std::ostream& out;
+	LineTable* lines;
+
+	[[nodiscard]] std::uint32_t address() const { return static_cast<std::uint32_t>(out.tellp()); }
+};
+
+// Consecutive scratch locals of the same type are declared as one group.
+void writeLocals(std::ostream& out, Locals const& locals)
 {
-	std::ostringstream codeVecOut;
-	writeULEB128(codeVecOut, functions.size());
-	for (auto const& function : functions)
+	std::vector<std::pair<std::uint32_t, std::byte>> groups;
+	for (std::byte const type : locals.scratchTypes)
 	{
-		writeCode(codeVecOut, *function, index);
+		if (groups.empty() || groups.back().second != type)
+		{
+			groups.emplace_back(0, type);
+		}
+		++groups.back().first;
 	}
 
-	std::string const& codeVecOutStr = codeVecOut.str();
-	writeSection(out, 10, asBytes(codeVecOutStr));
+	writeULEB128(out, static_cast<std::uint32_t>(groups.size()));
+	for (auto const& [count, type] : groups)
+	{
+		writeULEB128(out, count);
+		writeByte(out, type);
+	}
 }
 
-void injectFunctions(std::vector<std::shared_ptr<jereq::Type>>& types,
-	std::vector<std::shared_ptr<jereq::Function>>& functions,
-	std::vector<ImportFunctionInformation>& importFunctionInfo,
-	std::vector<ExportFunctionInformation>& exportFunctionInfo)
+void writeLocalInstruction(std::ostream& out, std::byte opcode, std::uint32_t localIdx)
 {
-	auto& startType = types.emplace_back(std::make_shared<jereq::Type>());
-	startType->t = jereq::FuncType{ "", {} };
+	writeByte(out, opcode);
+	writeULEB128(out, localIdx);
+}
 
-	std::shared_ptr<jereq::Function> const& startFunc = functions.emplace_back(std::make_shared<jereq::Function>());
-	startFunc->name = "_start";
-	startFunc->sourceFile = "generated";
-	startFunc->type = startType;
-	startFunc->expression = {};
+constexpr std::uint32_t i32Alignment = 2;
 
-	exportFunctionInfo.push_back(ExportFunctionInformation{ "_start", startFunc.get() });
+void writeMemoryInstruction(std::ostream& out, std::byte opcode, std::uint32_t offset)
+{
+	writeByte(out, opcode);
+	writeULEB128(out, i32Alignment);
+	writeULEB128(out, offset);
+}
 
-	std::shared_ptr<jereq::Type> const& i32 = std::make_shared<jereq::Type>();
-	i32->t = jereq::BuiltInType{ "i32" };
-	jereq::FuncParameter const exitCode{ "exitCode", jereq::ParameterDirection::in, i32 };
+void writeI32Const(std::ostream& out, std::int32_t value)
+{
+	writeByte(out, std::byte{ 0x41 });
+	writeSLEB128(out, value);
+}
 
-	auto& procExitType = types.emplace_back(std::make_shared<jereq::Type>());
-	procExitType->t = jereq::FuncType{ "", { exitCode } };
-	importFunctionInfo.push_back(
-		ImportFunctionInformation{ "wasi_snapshot_preview1", "proc_exit", procExitType.get() });
+void writeI64Const(std::ostream& out, std::int64_t value)
+{
+	writeByte(out, std::byte{ 0x42 });
+	writeSLEB128(out, value);
 }
 
-Index createIndex(std::uint32_t numImportFunctions, std::vector<std::shared_ptr<jereq::Function>> const& functions)
+void writePowerOfTwoBias(std::ostream& out, std::uint32_t dividendLocal, std::uint32_t shift)
 {
-	Index result;
+	writeLocalInstruction(out, std::byte{ 0x20 }, dividendLocal);
+	writeI32Const(out, 31);
+	writeByte(out, std::byte{ 0x75 });
+	writeI32Const(out, static_cast<std::int32_t>(32 - shift));
+	writeByte(out, std::byte{ 0x76 });
+}
 
-	std::uint32_t nextIndex = numImportFunctions;
-	for (auto const& function : functions)
+// Expects the dividend on the stack and leaves the quotient. The rounding correction is only needed when the quotient
+// may be negative.
+void writeMultiplyHighQuotient(std::ostream& out,
+	jereq::SignedDivisor const& divisor,
+	bool nonNegativeQuotient,
+	Locals& locals)
+{
+	writeByte(out, std::byte{ 0xAC });
+	writeByte(out, std::byte{ 0x42 });
+	writeSLEB128(out, divisor.wideMultiplier);
+	writeByte(out, std::byte{ 0x7E });
+	writeByte(out, std::byte{ 0x42 });
+	writeSLEB128(out, static_cast<std::int64_t>(divisor.shift));
+	writeByte(out, std::byte{ 0x87 });
+	writeByte(out, std::byte{ 0xA7 });
+	if (nonNegativeQuotient)
 	{
-		result.functions.try_emplace(function.get(), nextIndex);
-		++nextIndex;
+		return;
 	}
 
-	return result;
+	std::uint32_t const quotientLocal = locals.acquireScratch();
+	writeLocalInstruction(out, std::byte{ 0x22 }, quotientLocal);
+	writeLocalInstruction(out, std::byte{ 0x20 }, quotientLocal);
+	writeI32Const(out, 31);
+	writeByte(out, std::byte{ 0x76 });
+	writeByte(out, std::byte{ 0x6A });
+	locals.releaseScratch();
+}
+
+// Expects the dividend on the stack. Mirrors divideByConstant/remainderByConstant in the interpreter.
+void writeDivisionByConstant(std::ostream& out,
+	jereq::BinaryOperator op,
+	jereq::SignedDivisor const& divisor,
+	bool nonNegativeDividend,
+	Locals& locals)
+{
+	bool const isDivide = op == jereq::BinaryOperator::divide;
+	bool const nonNegativeQuotient = nonNegativeDividend && divisor.divisor > 0;
+	switch (divisor.strategy)
+	{
+	case jereq::DivisionStrategy::identity:
+		if (!isDivide)
+		{
+			writeByte(out, std::byte{ 0x1A });
+			writeI32Const(out, 0);
+		}
+		break;
+	case jereq::DivisionStrategy::powerOfTwo:
+	{
+		if (nonNegativeDividend && divisor.divisor > 0)
+		{
+			writeI32Const(out, isDivide ? static_cast<std::int32_t>(divisor.shift) : divisor.divisor - 1);
+			writeByte(out, isDivide ? std::byte{ 0x76 } : std::byte{ 0x71 });
+			break;
+		}
+
+		std::uint32_t const dividendLocal = locals.acquireScratch();
+		writeLocalInstruction(out, std::byte{ 0x21 }, dividendLocal);
+		if (isDivide)
+		{
+			if (divisor.divisor < 0)
+			{
+				writeI32Const(out, 0);
+			}
+			writeLocalInstruction(out, std::byte{ 0x20 }, dividendLocal);
+			writePowerOfTwoBias(out, dividendLocal, divisor.shift);
+			writeByte(out, std::byte{ 0x6A });
+			writeI32Const(out, static_cast<std::int32_t>(divisor.shift));
+			writeByte(out, std::byte{ 0x75 });
+			if (divisor.divisor < 0)
+			{
+				writeByte(out, std::byte{ 0x6B });
+			}
+		}
+		else
+		{
+			writeLocalInstruction(out, std::byte{ 0x20 }, dividendLocal);
+			writeLocalInstruction(out, std::byte{ 0x20 }, dividendLocal);
+			writePowerOfTwoBias(out, dividendLocal, divisor.shift);
+			writeByte(out, std::byte{ 0x6A });
+			writeI32Const(out, static_cast<std::int32_t>(~((1U << divisor.shift) - 1U)));
+			writeByte(out, std::byte{ 0x71 });
+			writeByte(out, std::byte{ 0x6B });
+		}
+		locals.releaseScratch();
+		break;
+	}
+	case jereq::DivisionStrategy::multiplyHigh:
+		if (isDivide)
+		{
+			writeMultiplyHighQuotient(out, divisor, nonNegativeQuotient, locals);
+		}
+		else
+		{
+			std::uint32_t const dividendLocal = locals.acquireScratch();
+			writeLocalInstruction(out, std::byte{ 0x22 }, dividendLocal);
+			writeLocalInstruction(out, std::byte{ 0x20 }, dividendLocal);
+			writeMultiplyHighQuotient(out, divisor, nonNegativeQuotient, locals);
+			writeI32Const(out, divisor.divisor);
+			writeByte(out, std::byte{ 0x6C });
+			writeByte(out, std::byte{ 0x6B });
+			locals.releaseScratch();
+		}
+		break;
+	case jereq::DivisionStrategy::hardware:
+	default:
+		writeI32Const(out, divisor.divisor);
+		writeByte(out, isDivide ? std::byte{ 0x6D } : std::byte{ 0x6F });
+		break;
+	}
+}
+
+std::optional<std::int32_t> constantValue(jereq::Expression const& expression, Scope const& scope)
+{
+	if (auto const* literal = std::get_if<jereq::Literal>(&expression.expr))
+	{
+		if (literal->type != jereq::ValueType::i32)
+		{
+			return std::nullopt;
+		}
+		return static_cast<std::int32_t>(literal->value);
+	}
+	if (auto const* varExpression = std::get_if<jereq::VarExpression>(&expression.expr))
+	{
+		auto bindingIt = scope.bindings.find(varExpression->varName);
+		if (bindingIt != scope.bindings.end())
+		{
+			return bindingIt->second.constant;
+		}
+	}
+	return std::nullopt;
 }
+
+jereq::Function const& findFunction(Index const& index, std::string_view name)
+{
+	auto functionIt = index.functionsByName.find(name);
+	if (functionIt == index.functionsByName.end())
+	{
+		throw std::runtime_error("Couldn't find function " + std::string(name));
+	}
+	return *functionIt->second;
 }
 
-namespace jereq
+jereq::FuncArgument const& findArgument(jereq::FunctionCall const& functionCall, std::string_view name)
 {
-bool compile(Program const& program, std::ostream& out)
+	auto argumentIt = std::ranges::find(functionCall.arguments, name, &jereq::FuncArgument::name);
+	if (argumentIt == functionCall.arguments.end())
+	{
+		throw std::runtime_error("No arg provided for param " + std::string(name));
+	}
+	return *argumentIt;
+}
+
+void writeExpression(std::ostream& out,
+	jereq::Expression const& expression,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals);
+
+void writeInlinedBody(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::Function const& callee,
+	CodeContext const& context,
+	Scope const& calleeScope,
+	Locals& locals)
 {
-	std::vector<std::shared_ptr<Type>> types = program.types;
-	std::vector<std::shared_ptr<Function>> functions = program.functions;
+	writeExpression(out, callee.expression, context, calleeScope, locals);
+}
 
-	std::vector<ImportFunctionInformation> importFunctionInformation;
-	std::vector<ExportFunctionInformation> exportFunctionInformation;
-	injectFunctions(types, functions, importFunctionInformation, exportFunctionInformation);
+// Arguments are stored in fresh locals that the callee body reads instead of its parameters. If the profile saw a
+// constant argument, a copy of the body specialized for that value is guarded by a comparison.
+void writeInlinedCall(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::FunctionCall const& functionCall,
+	InlineDecision const& decision,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	++inlinedCalls;
+	jereq::Function const& callee = *decision.callee;
+	Scope calleeScope{ {}, scope.inlineDepth + 1 };
 
-	WasmFuncTypeTranslation const& typeTranslation = translateFuncTypes(types);
-	Index const index = createIndex(static_cast<std::uint32_t>(importFunctionInformation.size()), functions);
+	std::uint32_t argumentLocals = 0;
+	std::optional<std::pair<std::uint32_t, std::int32_t>> specialization;
+	for (auto const& parameter : std::get<jereq::FuncType>(callee.type->t).parameters)
+	{
+		if (parameter.direction != jereq::ParameterDirection::in)
+		{
+			continue;
+		}
 
-	writeMagic(out);
-	writeVersion(out);
-	writeTypeSection(out, typeTranslation);
-	writeImportSection(out, importFunctionInformation, typeTranslation);
-	writeFunctionSection(out, functions, typeTranslation);
-	writeMemorySection(out);
-	writeExportSection(out, exportFunctionInformation, index);
-	writeCodeSection(out, functions, index);
+		jereq::FuncArgument const& argument = findArgument(functionCall, parameter.name);
+		if (auto constant = constantValue(argument.expr, scope))
+		{
+			calleeScope.bindings[parameter.name] = Binding{ 0, constant, 0 };
+			continue;
+		}
+
+		writeExpression(out, argument.expr, context, scope, locals);
+		jereq::ValueType const argumentType = jereq::valueTypeOf(*parameter.type);
+		std::uint32_t const argumentLocal = locals.acquireScratch(valueTypeByte(argumentType));
+		++argumentLocals;
+		writeLocalInstruction(out, std::byte{ 0x21 }, argumentLocal);
+		calleeScope.bindings[parameter.name] = Binding{ argumentLocal, std::nullopt, 0 };
+
+		auto observedIt = decision.constantArguments.find(parameter.name);
+		if (!specialization && observedIt != decision.constantArguments.end() && argumentType == jereq::ValueType::i32)
+		{
+			specialization.emplace(argumentLocal, observedIt->second);
+		}
+	}
+
+	if (specialization)
+	{
+		auto const [guardLocal, observedValue] = *specialization;
+		writeLocalInstruction(out, std::byte{ 0x20 }, guardLocal);
+		writeI32Const(out, observedValue);
+		writeByte(out, std::byte{ 0x46 });
+		writeByte(out, std::byte{ 0x04 });
+		auto const& parameters = std::get<jereq::FuncType>(callee.type->t).parameters;
+		auto outIt = std::ranges::find(parameters, jereq::ParameterDirection::out, &jereq::FuncParameter::direction);
+		writeByte(out, outIt != parameters.end() ? valueTypeByte(jereq::valueTypeOf(*outIt->type)) : std::byte{ 0x40 });
+
+		Scope specializedScope = calleeScope;
+		for (auto& [name, binding] : specializedScope.bindings)
+		{
+			if (!binding.constant && binding.local == guardLocal)
+			{
+				binding.constant = observedValue;
+			}
+		}
+		writeInlinedBody(out, callee, context, specializedScope, locals);
+
+		writeByte(out, std::byte{ 0x05 });
+		writeInlinedBody(out, callee, context, calleeScope, locals);
+		writeByte(out, std::byte{ 0x0B });
+	}
+	else
+	{
+		writeInlinedBody(out, callee, context, calleeScope, locals);
+	}
+
+	for (std::uint32_t i = 0; i < argumentLocals; ++i)
+	{
+		locals.releaseScratch();
+	}
+}
+
+void writeFunctionCall(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::FunctionCall const& functionCall,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	static constexpr std::uint32_t maxInlineDepth = 4;
+	auto decisionIt = context.inlining.find(&functionCall);
+	if (decisionIt != context.inlining.end() && scope.inlineDepth < maxInlineDepth)
+	{
+		writeInlinedCall(out, functionCall, decisionIt->second, context, scope, locals);
+		return;
+	}
+
+	// Host functions are imports, called like any other function.
+	HostImport callee;
+	if (auto hostIt = context.index.hostFunctions.find(functionCall.functionName);
+		hostIt != context.index.hostFunctions.end())
+	{
+		callee = hostIt->second;
+	}
+	else
+	{
+		jereq::Function const& function = findFunction(context.index, functionCall.functionName);
+		callee = { context.index.functions.at(&function), function.type.get() };
+	}
+
+	for (auto const& parameter : std::get<jereq::FuncType>(callee.type->t).parameters)
+	{
+		if (parameter.direction == jereq::ParameterDirection::in)
+		{
+			writeExpression(out, findArgument(functionCall, parameter.name).expr, context, scope, locals);
+		}
+	}
+	writeByte(out, std::byte{ 0x10 });
+	writeULEB128(out, callee.index);
+}
+
+// Lowered to a native block/loop pair, so iterating costs a compare and a branch instead of a call:
+//   block
+//     loop
+//       br_if 1 (counter >= end)
+//       accumulator = body; counter += 1
+//       br 0
+//     end
+//   end
+void writeLoop(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::LoopExpression const& loop,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	bool const isI64Counter = context.types.typeOf(*loop.from) == jereq::ValueType::i64;
+	std::byte const counterType = valueTypeByte(context.types.typeOf(*loop.from));
+	writeExpression(out, *loop.from, context, scope, locals);
+	std::uint32_t const counterLocal = locals.acquireScratch(counterType);
+	writeLocalInstruction(out, std::byte{ 0x21 }, counterLocal);
+	writeExpression(out, *loop.to, context, scope, locals);
+	std::uint32_t const endLocal = locals.acquireScratch(counterType);
+	writeLocalInstruction(out, std::byte{ 0x21 }, endLocal);
+	writeExpression(out, *loop.initial, context, scope, locals);
+	std::uint32_t const accumulatorLocal = locals.acquireScratch(valueTypeByte(context.types.typeOf(*loop.initial)));
+	writeLocalInstruction(out, std::byte{ 0x21 }, accumulatorLocal);
+
+	Scope bodyScope = scope;
+	bodyScope.bindings.insert_or_assign(loop.counter, Binding{ counterLocal, std::nullopt, 0 });
+	bodyScope.bindings.insert_or_assign(loop.accumulator, Binding{ accumulatorLocal, std::nullopt, 0 });
+
+	writeByte(out, std::byte{ 0x02 });
+	writeByte(out, std::byte{ 0x40 });
+	writeByte(out, std::byte{ 0x03 });
+	writeByte(out, std::byte{ 0x40 });
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, counterLocal);
+	writeLocalInstruction(out, std::byte{ 0x20 }, endLocal);
+	writeByte(out, isI64Counter ? std::byte{ 0x59 } : std::byte{ 0x4E });
+	writeByte(out, std::byte{ 0x0D });
+	writeULEB128(out, 1);
+
+	writeExpression(out, *loop.body, context, bodyScope, locals);
+	writeLocalInstruction(out, std::byte{ 0x21 }, accumulatorLocal);
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, counterLocal);
+	if (isI64Counter)
+	{
+		writeI64Const(out, 1);
+		writeByte(out, std::byte{ 0x7C });
+	}
+	else
+	{
+		writeI32Const(out, 1);
+		writeByte(out, std::byte{ 0x6A });
+	}
+	writeLocalInstruction(out, std::byte{ 0x21 }, counterLocal);
+	writeByte(out, std::byte{ 0x0C });
+	writeULEB128(out, 0);
+
+	writeByte(out, std::byte{ 0x0B });
+	writeByte(out, std::byte{ 0x0B });
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, accumulatorLocal);
+	locals.releaseScratch();
+	locals.releaseScratch();
+	locals.releaseScratch();
+}
+
+// Cheap arms that can not trap become a select, which needs no branch. Anything else only evaluates the chosen arm.
+void writeConditional(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::ConditionalExpression const& conditional,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	if (jereq::prefersSelect(conditional))
+	{
+		writeExpression(out, *conditional.whenTrue, context, scope, locals);
+		writeExpression(out, *conditional.whenFalse, context, scope, locals);
+		writeExpression(out, *conditional.condition, context, scope, locals);
+		writeByte(out, std::byte{ 0x1B });
+		return;
+	}
+
+	writeExpression(out, *conditional.condition, context, scope, locals);
+	writeByte(out, std::byte{ 0x04 });
+	writeByte(out, blockType(context.types.typeOf(*conditional.whenTrue)));
+	writeExpression(out, *conditional.whenTrue, context, scope, locals);
+	writeByte(out, std::byte{ 0x05 });
+	writeExpression(out, *conditional.whenFalse, context, scope, locals);
+	writeByte(out, std::byte{ 0x0B });
+}
+
+void writeTrapUnless(std::ostream& out, std::byte failedComparison)
+{
+	writeByte(out, failedComparison);
+	writeByte(out, std::byte{ 0x04 });
+	writeByte(out, std::byte{ 0x40 });
+	writeByte(out, std::byte{ 0x00 });
+	writeByte(out, std::byte{ 0x0B });
+}
+
+// Arrays live on a stack in linear memory that grows down from the stack pointer global. The let reserves its frame,
+// traps if that wraps around past the start of memory, and pops the frame again once the body has been evaluated.
+void writeLet(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::LetExpression const& let,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	auto const length = static_cast<std::uint32_t>(std::get<jereq::ArrayType>(let.type->t).length);
+	auto const frameSize = static_cast<std::int32_t>(length * sizeof(std::int32_t));
+
+	std::uint32_t const baseLocal = locals.acquireScratch();
+	writeByte(out, std::byte{ 0x23 });
+	writeULEB128(out, stackPointerGlobal);
+	writeI32Const(out, frameSize);
+	writeByte(out, std::byte{ 0x6B });
+	writeLocalInstruction(out, std::byte{ 0x22 }, baseLocal);
+	writeByte(out, std::byte{ 0x23 });
+	writeULEB128(out, stackPointerGlobal);
+	writeTrapUnless(out, std::byte{ 0x4B });
+	writeLocalInstruction(out, std::byte{ 0x20 }, baseLocal);
+	writeByte(out, std::byte{ 0x24 });
+	writeULEB128(out, stackPointerGlobal);
+
+	if (let.generator)
+	{
+		std::uint32_t const indexLocal = locals.acquireScratch();
+		Scope generatorScope = scope;
+		generatorScope.bindings.insert_or_assign(let.generatorIndex, Binding{ indexLocal, std::nullopt, 0 });
+
+		writeI32Const(out, 0);
+		writeLocalInstruction(out, std::byte{ 0x21 }, indexLocal);
+		writeByte(out, std::byte{ 0x03 });
+		writeByte(out, std::byte{ 0x40 });
+
+		writeLocalInstruction(out, std::byte{ 0x20 }, baseLocal);
+		writeLocalInstruction(out, std::byte{ 0x20 }, indexLocal);
+		writeI32Const(out, 2);
+		writeByte(out, std::byte{ 0x74 });
+		writeByte(out, std::byte{ 0x6A });
+		writeExpression(out, *let.generator, context, generatorScope, locals);
+		writeMemoryInstruction(out, std::byte{ 0x36 }, 0);
+
+		writeLocalInstruction(out, std::byte{ 0x20 }, indexLocal);
+		writeI32Const(out, 1);
+		writeByte(out, std::byte{ 0x6A });
+		writeLocalInstruction(out, std::byte{ 0x22 }, indexLocal);
+		writeI32Const(out, static_cast<std::int32_t>(length));
+		writeByte(out, std::byte{ 0x48 });
+		writeByte(out, std::byte{ 0x0D });
+		writeULEB128(out, 0);
+		writeByte(out, std::byte{ 0x0B });
+		locals.releaseScratch();
+	}
+	else
+	{
+		std::uint32_t offset = 0;
+		for (auto const& element : let.elements)
+		{
+			writeLocalInstruction(out, std::byte{ 0x20 }, baseLocal);
+			writeExpression(out, *element, context, scope, locals);
+			writeMemoryInstruction(out, std::byte{ 0x36 }, offset);
+			offset += sizeof(std::int32_t);
+		}
+	}
+
+	Scope bodyScope = scope;
+	bodyScope.bindings.insert_or_assign(let.name, Binding{ baseLocal, std::nullopt, length });
+	writeExpression(out, *let.body, context, bodyScope, locals);
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, baseLocal);
+	writeI32Const(out, frameSize);
+	writeByte(out, std::byte{ 0x6A });
+	writeByte(out, std::byte{ 0x24 });
+	writeULEB128(out, stackPointerGlobal);
+	locals.releaseScratch();
+}
+
+// Constant indices fold into the load offset. Other indices are only checked when range analysis could not prove them
+// in bounds, and the unsigned comparison also catches negative indices.
+void writeIndex(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::IndexExpression const& indexExpression,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	auto bindingIt = scope.bindings.find(indexExpression.arrayName);
+	if (bindingIt == scope.bindings.end() || bindingIt->second.arrayLength == 0)
+	{
+		throw std::runtime_error("Array \"" + indexExpression.arrayName + "\" not found");
+	}
+	Binding const& array = bindingIt->second;
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, array.local);
+	if (auto constant = constantValue(*indexExpression.index, scope);
+		constant && *constant >= 0 && static_cast<std::uint32_t>(*constant) < array.arrayLength)
+	{
+		writeMemoryInstruction(out, std::byte{ 0x28 }, static_cast<std::uint32_t>(*constant) * sizeof(std::int32_t));
+		return;
+	}
+
+	writeExpression(out, *indexExpression.index, context, scope, locals);
+	if (context.ranges.needsBoundsCheck(indexExpression))
+	{
+		std::uint32_t const indexLocal = locals.acquireScratch();
+		writeLocalInstruction(out, std::byte{ 0x22 }, indexLocal);
+		writeI32Const(out, static_cast<std::int32_t>(array.arrayLength));
+		writeTrapUnless(out, std::byte{ 0x4F });
+		writeLocalInstruction(out, std::byte{ 0x20 }, indexLocal);
+		locals.releaseScratch();
+	}
+	writeI32Const(out, 2);
+	writeByte(out, std::byte{ 0x74 });
+	writeByte(out, std::byte{ 0x6A });
+	writeMemoryInstruction(out, std::byte{ 0x28 }, 0);
+}
+
+void writeExpression(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::Expression const& expression,
+	CodeContext const& context,
+	Scope const& scope,
+	Locals& locals)
+{
+	LineMark const lineMark(out, expression, context);
+	if (expression.rep.empty())
+	{
+		for (auto const& [func, idx] : context.index.functions)
+		{
+			if (func->name == "main")
+			{
+				writeByte(out, std::byte{ 0x10 });
+				writeULEB128(out, idx);
+				writeByte(out, std::byte{ 0x10 });
+				writeByte(out, std::byte{ 0x00 });
+				return;
+			}
+		}
+
+		throw std::runtime_error("Expected to find main in index");
+	}
+	else
+	{
+		jereq::RangeAnalysis const& ranges = context.ranges;
+		if (std::holds_alternative<jereq::Literal>(expression.expr))
+		{
+			auto const& literal = std::get<jereq::Literal>(expression.expr);
+			if (literal.type == jereq::ValueType::i64)
+			{
+				writeI64Const(out, literal.value);
+			}
+			else
+			{
+				writeI32Const(out, static_cast<std::int32_t>(literal.value));
+			}
+		}
+		else if (std::holds_alternative<jereq::InitAssignment>(expression.expr))
+		{
+			auto const& initAssignment = std::get<jereq::InitAssignment>(expression.expr);
+			writeExpression(out, *initAssignment.value, context, scope, locals);
+			// TODO: Verify variable has not been assigned before
+			// TODO: Figure out locals and return values
+			// TODO: Type checks
+		}
+		else if (std::holds_alternative<jereq::BinaryOpExpression>(expression.expr))
+		{
+			// TODO: type checks
+			auto const& binExpr = std::get<jereq::BinaryOpExpression>(expression.expr);
+			writeExpression(out, *binExpr.lhs, context, scope, locals);
+
+			// Division strategies and range facts only cover i32, so i64 operators always use the plain instructions.
+			bool const isI64 = context.types.typeOf(*binExpr.lhs) == jereq::ValueType::i64;
+			bool const isDivision
+				= binExpr.op == jereq::BinaryOperator::divide || binExpr.op == jereq::BinaryOperator::modulo;
+			bool const nonNegativeDividend = isDivision && !isI64 && ranges.rangeOf(*binExpr.lhs).min >= 0;
+			if (auto constantDivisor = constantValue(*binExpr.rhs, scope); isDivision && !isI64 && constantDivisor)
+			{
+				auto const& divisor = jereq::analyzeDivisor(*constantDivisor);
+				writeDivisionByConstant(out, binExpr.op, divisor, nonNegativeDividend, locals);
+				return;
+			}
+
+			writeExpression(out, *binExpr.rhs, context, scope, locals);
+			if (nonNegativeDividend && ranges.rangeOf(*binExpr.rhs).min > 0)
+			{
+				// Both sides are known to be positive, so the cheaper unsigned forms give the same result.
+				writeByte(out, binExpr.op == jereq::BinaryOperator::divide ? std::byte{ 0x6E } : std::byte{ 0x70 });
+				return;
+			}
+			switch (binExpr.op)
+			{
+			case jereq::BinaryOperator::add:
+				writeByte(out, isI64 ? std::byte{ 0x7C } : std::byte{ 0x6A });
+				break;
+			case jereq::BinaryOperator::subtract:
+				writeByte(out, isI64 ? std::byte{ 0x7D } : std::byte{ 0x6B });
+				break;
+			case jereq::BinaryOperator::multiply:
+				writeByte(out, isI64 ? std::byte{ 0x7E } : std::byte{ 0x6C });
+				break;
+			case jereq::BinaryOperator::divide:
+				// TODO: signed/unsigned
+				writeByte(out, isI64 ? std::byte{ 0x7F } : std::byte{ 0x6D });
+				break;
+			case jereq::BinaryOperator::modulo:
+				// TODO: signed/unsigned
+				writeByte(out, isI64 ? std::byte{ 0x81 } : std::byte{ 0x6F });
+				break;
+			case jereq::BinaryOperator::equal:
+				writeByte(out, isI64 ? std::byte{ 0x51 } : std::byte{ 0x46 });
+				break;
+			case jereq::BinaryOperator::notEqual:
+				writeByte(out, isI64 ? std::byte{ 0x52 } : std::byte{ 0x47 });
+				break;
+			case jereq::BinaryOperator::less:
+				writeByte(out, isI64 ? std::byte{ 0x53 } : std::byte{ 0x48 });
+				break;
+			case jereq::BinaryOperator::greater:
+				writeByte(out, isI64 ? std::byte{ 0x55 } : std::byte{ 0x4A });
+				break;
+			case jereq::BinaryOperator::lessEqual:
+				writeByte(out, isI64 ? std::byte{ 0x57 } : std::byte{ 0x4C });
+				break;
+			case jereq::BinaryOperator::greaterEqual:
+				writeByte(out, isI64 ? std::byte{ 0x59 } : std::byte{ 0x4E });
+				break;
+			default:
+				throw std::runtime_error("Operator not supported");
+			}
+		}
+		else if (std::holds_alternative<jereq::FunctionCall>(expression.expr))
+		{
+			writeFunctionCall(out, std::get<jereq::FunctionCall>(expression.expr), context, scope, locals);
+		}
+		else if (std::holds_alternative<jereq::VarExpression>(expression.expr))
+		{
+			auto const& varExpression = std::get<jereq::VarExpression>(expression.expr);
+			auto bindingIt = scope.bindings.find(varExpression.varName);
+			if (bindingIt == scope.bindings.end())
+			{
+				throw std::runtime_error("Local \"" + varExpression.varName + "\" not found");
+			}
+			if (bindingIt->second.arrayLength != 0)
+			{
+				throw std::runtime_error("Array \"" + varExpression.varName + "\" can only be indexed");
+			}
+
+			if (bindingIt->second.constant)
+			{
+				writeI32Const(out, *bindingIt->second.constant);
+			}
+			else
+			{
+				writeLocalInstruction(out, std::byte{ 0x20 }, bindingIt->second.local);
+			}
+		}
+		else if (auto const* loop = std::get_if<jereq::LoopExpression>(&expression.expr))
+		{
+			writeLoop(out, *loop, context, scope, locals);
+		}
+		else if (auto const* conditional = std::get_if<jereq::ConditionalExpression>(&expression.expr))
+		{
+			writeConditional(out, *conditional, context, scope, locals);
+		}
+		else if (auto const* let = std::get_if<jereq::LetExpression>(&expression.expr))
+		{
+			writeLet(out, *let, context, scope, locals);
+		}
+		else if (auto const* indexExpression = std::get_if<jereq::IndexExpression>(&expression.expr))
+		{
+			writeIndex(out, *indexExpression, context, scope, locals);
+		}
+		else
+		{
+			throw std::runtime_error("Unexpected expression alternative");
+		}
+	}
+}
+
+Scope createFunctionScope(jereq::Function const& function)
+{
+	Scope scope;
+	std::uint32_t nextLocal = 0;
+	for (auto const& parameter : std::get<jereq::FuncType>(function.type->t).parameters)
+	{
+		if (parameter.direction == jereq::ParameterDirection::in)
+		{
+			scope.bindings[parameter.name] = Binding{ nextLocal, std::nullopt, 0 };
+			++nextLocal;
+		}
+	}
+	return scope;
+}
+
+constexpr std::byte simdPrefix{ 0xFD };
+constexpr std::byte v128ValueType{ 0x7B };
+constexpr std::uint32_t vectorLanes = 4;
+
+void writeSimdInstruction(std::ostream& out, std::uint32_t opcode)
+{
+	writeByte(out, simdPrefix);
+	writeULEB128(out, opcode);
+}
+
+void writeSimdMemoryInstruction(std::ostream& out, std::uint32_t opcode, std::uint32_t offset)
+{
+	writeSimdInstruction(out, opcode);
+	writeULEB128(out, i32Alignment);
+	writeULEB128(out, offset);
+}
+
+void writeLaneInstruction(std::ostream& out, std::uint32_t opcode, std::uint32_t lane)
+{
+	writeSimdInstruction(out, opcode);
+	writeByte(out, static_cast<std::byte>(lane));
+}
+
+std::uint32_t vectorComparisonOpcode(jereq::BinaryOperator op)
+{
+	switch (op)
+	{
+	case jereq::BinaryOperator::equal:
+		return 0x37;
+	case jereq::BinaryOperator::notEqual:
+		return 0x38;
+	case jereq::BinaryOperator::less:
+		return 0x39;
+	case jereq::BinaryOperator::greater:
+		return 0x3B;
+	case jereq::BinaryOperator::lessEqual:
+		return 0x3D;
+	case jereq::BinaryOperator::greaterEqual:
+		return 0x3F;
+	default:
+		throw std::runtime_error("Operator not supported");
+	}
+}
+
+// Only i32 arithmetic on the in-parameters can be evaluated four rows at a time. Conditionals must be selects, since
+// the lanes may disagree on the condition.
+bool isVectorizable(jereq::Expression const& expression, Scope const& scope)// NOLINT(misc-no-recursion)
+{
+	if (auto const* literal = std::get_if<jereq::Literal>(&expression.expr))
+	{
+		return literal->type == jereq::ValueType::i32;
+	}
+	if (auto const* varExpression = std::get_if<jereq::VarExpression>(&expression.expr))
+	{
+		return scope.bindings.contains(varExpression->varName);
+	}
+	if (auto const* binaryOp = std::get_if<jereq::BinaryOpExpression>(&expression.expr))
+	{
+		return isVectorizable(*binaryOp->lhs, scope) && isVectorizable(*binaryOp->rhs, scope);
+	}
+	if (auto const* conditional = std::get_if<jereq::ConditionalExpression>(&expression.expr))
+	{
+		return jereq::prefersSelect(*conditional) && isVectorizable(*conditional->condition, scope)
+			&& isVectorizable(*conditional->whenTrue, scope) && isVectorizable(*conditional->whenFalse, scope);
+	}
+	return false;
+}
+
+void writeVectorExpression(std::ostream& out,// NOLINT(misc-no-recursion)
+	jereq::Expression const& expression,
+	Scope const& lanes,
+	Locals& vectorLocals)
+{
+	if (auto const* literal = std::get_if<jereq::Literal>(&expression.expr))
+	{
+		writeI32Const(out, static_cast<std::int32_t>(literal->value));
+		writeSimdInstruction(out, 0x11);
+		return;
+	}
+	if (auto const* varExpression = std::get_if<jereq::VarExpression>(&expression.expr))
+	{
+		writeLocalInstruction(out, std::byte{ 0x20 }, lanes.bindings.at(varExpression->varName).local);
+		return;
+	}
+
+	if (auto const* conditional = std::get_if<jereq::ConditionalExpression>(&expression.expr))
+	{
+		// v128.bitselect takes lanes from the first operand where the mask is set.
+		writeVectorExpression(out, *conditional->whenTrue, lanes, vectorLocals);
+		writeVectorExpression(out, *conditional->whenFalse, lanes, vectorLocals);
+		writeVectorExpression(out, *conditional->condition, lanes, vectorLocals);
+		writeI32Const(out, 0);
+		writeSimdInstruction(out, 0x11);
+		writeSimdInstruction(out, 0x38);
+		writeSimdInstruction(out, 0x52);
+		return;
+	}
+
+	auto const& binaryOp = std::get<jereq::BinaryOpExpression>(expression.expr);
+	if (binaryOp.op != jereq::BinaryOperator::divide && binaryOp.op != jereq::BinaryOperator::modulo)
+	{
+		writeVectorExpression(out, *binaryOp.lhs, lanes, vectorLocals);
+		writeVectorExpression(out, *binaryOp.rhs, lanes, vectorLocals);
+		switch (binaryOp.op)
+		{
+		case jereq::BinaryOperator::add:
+			writeSimdInstruction(out, 0xAE);
+			break;
+		case jereq::BinaryOperator::subtract:
+			writeSimdInstruction(out, 0xB1);
+			break;
+		case jereq::BinaryOperator::multiply:
+			writeSimdInstruction(out, 0xB5);
+			break;
+		default:
+			// Vector comparisons set all bits of a lane, which negates to the scalar result of 1.
+			writeSimdInstruction(out, vectorComparisonOpcode(binaryOp.op));
+			writeSimdInstruction(out, 0xA1);
+			break;
+		}
+		return;
+	}
+
+	// There is no SIMD division, so each lane is divided with the scalar instruction and put back in place.
+	writeVectorExpression(out, *binaryOp.lhs, lanes, vectorLocals);
+	std::uint32_t const lhsLocal = vectorLocals.acquireScratch(v128ValueType);
+	writeLocalInstruction(out, std::byte{ 0x21 }, lhsLocal);
+	writeVectorExpression(out, *binaryOp.rhs, lanes, vectorLocals);
+	std::uint32_t const rhsLocal = vectorLocals.acquireScratch(v128ValueType);
+	writeLocalInstruction(out, std::byte{ 0x21 }, rhsLocal);
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, lhsLocal);
+	for (std::uint32_t lane = 0; lane < vectorLanes; ++lane)
+	{
+		writeLocalInstruction(out, std::byte{ 0x20 }, lhsLocal);
+		writeLaneInstruction(out, 0x1B, lane);
+		writeLocalInstruction(out, std::byte{ 0x20 }, rhsLocal);
+		writeLaneInstruction(out, 0x1B, lane);
+		writeByte(out, binaryOp.op == jereq::BinaryOperator::divide ? std::byte{ 0x6D } : std::byte{ 0x6F });
+		writeLaneInstruction(out, 0x1C, lane);
+	}
+
+	vectorLocals.releaseScratch();
+	vectorLocals.releaseScratch();
+}
+
+std::optional<BatchFunction> planBatchFunction(jereq::Function const& function)
+{
+	auto const& parameters = std::get<jereq::FuncType>(function.type->t).parameters;
+	auto const outCount = std::ranges::count(parameters, jereq::ParameterDirection::out, &jereq::FuncParameter::direction);
+	bool const allI32 = std::ranges::all_of(parameters, [](jereq::FuncParameter const& parameter) {
+		return jereq::valueTypeOf(*parameter.type) == jereq::ValueType::i32;
+	});
+	if (outCount != 1 || !allI32)
+	{
+		return std::nullopt;
+	}
+
+	BatchFunction batch{ &function, static_cast<std::uint32_t>(parameters.size() - 1), false };
+	auto const* initAssignment = std::get_if<jereq::InitAssignment>(&function.expression.expr);
+	auto const outIt = std::ranges::find(parameters, jereq::ParameterDirection::out, &jereq::FuncParameter::direction);
+	if (initAssignment != nullptr && initAssignment->var == outIt->name)
+	{
+		batch.vectorized = isVectorizable(*initAssignment->value, createFunctionScope(function));
+	}
+	return batch;
+}
+
+// Leaves the address of the first input of the current row in rowBase.
+void writeRowBase(std::ostream& out, std::uint32_t rowWidth)
+{
+	constexpr std::uint32_t inPointer = 0;
+	constexpr std::uint32_t row = 3;
+	constexpr std::uint32_t rowBase = 4;
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, inPointer);
+	writeLocalInstruction(out, std::byte{ 0x20 }, row);
+	writeI32Const(out, static_cast<std::int32_t>(rowWidth * sizeof(std::int32_t)));
+	writeByte(out, std::byte{ 0x6C });
+	writeByte(out, std::byte{ 0x6A });
+	writeLocalInstruction(out, std::byte{ 0x21 }, rowBase);
+}
+
+void writeOutputAddress(std::ostream& out)
+{
+	constexpr std::uint32_t outPointer = 1;
+	constexpr std::uint32_t row = 3;
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, outPointer);
+	writeLocalInstruction(out, std::byte{ 0x20 }, row);
+	writeI32Const(out, 2);
+	writeByte(out, std::byte{ 0x74 });
+	writeByte(out, std::byte{ 0x6A });
+}
+
+void writeAdvanceRow(std::ostream& out, std::int32_t rows)
+{
+	constexpr std::uint32_t row = 3;
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, row);
+	writeI32Const(out, rows);
+	writeByte(out, std::byte{ 0x6A });
+	writeLocalInstruction(out, std::byte{ 0x21 }, row);
+}
+
+// Processes four rows per iteration while at least four remain. Inputs are gathered lane by lane unless each row is a
+// single value, in which case four rows are one contiguous load.
+void writeVectorLoop(std::ostream& out, BatchFunction const& batch, Locals& vectorLocals)
+{
+	constexpr std::uint32_t count = 2;
+	constexpr std::uint32_t row = 3;
+	constexpr std::uint32_t rowBase = 4;
+
+	writeByte(out, std::byte{ 0x02 });
+	writeByte(out, std::byte{ 0x40 });
+	writeByte(out, std::byte{ 0x03 });
+	writeByte(out, std::byte{ 0x40 });
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, count);
+	writeLocalInstruction(out, std::byte{ 0x20 }, row);
+	writeByte(out, std::byte{ 0x6B });
+	writeI32Const(out, static_cast<std::int32_t>(vectorLanes));
+	writeByte(out, std::byte{ 0x48 });
+	writeByte(out, std::byte{ 0x0D });
+	writeULEB128(out, 1);
+
+	writeRowBase(out, batch.rowWidth);
+	Scope lanes;
+	std::uint32_t column = 0;
+	for (auto const& parameter : std::get<jereq::FuncType>(batch.function->type->t).parameters)
+	{
+		if (parameter.direction != jereq::ParameterDirection::in)
+		{
+			continue;
+		}
+
+		if (batch.rowWidth == 1)
+		{
+			writeLocalInstruction(out, std::byte{ 0x20 }, rowBase);
+			writeSimdMemoryInstruction(out, 0x00, 0);
+		}
+		else
+		{
+			for (std::uint32_t lane = 0; lane < vectorLanes; ++lane)
+			{
+				writeLocalInstruction(out, std::byte{ 0x20 }, rowBase);
+				writeMemoryInstruction(
+					out, std::byte{ 0x28 }, (lane * batch.rowWidth + column) * sizeof(std::int32_t));
+				if (lane == 0)
+				{
+					writeSimdInstruction(out, 0x11);
+				}
+				else
+				{
+					writeLaneInstruction(out, 0x1C, lane);
+				}
+			}
+		}
+
+		std::uint32_t const laneLocal = vectorLocals.acquireScratch(v128ValueType);
+		writeLocalInstruction(out, std::byte{ 0x21 }, laneLocal);
+		lanes.bindings[parameter.name] = Binding{ laneLocal, std::nullopt, 0 };
+		++column;
+	}
+
+	writeOutputAddress(out);
+	auto const& initAssignment = std::get<jereq::InitAssignment>(batch.function->expression.expr);
+	writeVectorExpression(out, *initAssignment.value, lanes, vectorLocals);
+	writeSimdMemoryInstruction(out, 0x0B, 0);
+
+	writeAdvanceRow(out, static_cast<std::int32_t>(vectorLanes));
+	writeByte(out, std::byte{ 0x0C });
+	writeULEB128(out, 0);
+	writeByte(out, std::byte{ 0x0B });
+	writeByte(out, std::byte{ 0x0B });
+}
+
+// Calls the scalar function for each remaining row.
+void writeScalarLoop(std::ostream& out, BatchFunction const& batch, CodeContext const& context)
+{
+	constexpr std::uint32_t count = 2;
+	constexpr std::uint32_t row = 3;
+	constexpr std::uint32_t rowBase = 4;
+
+	writeByte(out, std::byte{ 0x02 });
+	writeByte(out, std::byte{ 0x40 });
+	writeByte(out, std::byte{ 0x03 });
+	writeByte(out, std::byte{ 0x40 });
+
+	writeLocalInstruction(out, std::byte{ 0x20 }, row);
+	writeLocalInstruction(out, std::byte{ 0x20 }, count);
+	writeByte(out, std::byte{ 0x4E });
+	writeByte(out, std::byte{ 0x0D });
+	writeULEB128(out, 1);
+
+	writeOutputAddress(out);
+	writeRowBase(out, batch.rowWidth);
+	for (std::uint32_t column = 0; column < batch.rowWidth; ++column)
+	{
+		writeLocalInstruction(out, std::byte{ 0x20 }, rowBase);
+		writeMemoryInstruction(out, std::byte{ 0x28 }, column * sizeof(std::int32_t));
+	}
+	writeByte(out, std::byte{ 0x10 });
+	writeULEB128(out, context.index.functions.at(batch.function));
+	writeMemoryInstruction(out, std::byte{ 0x36 }, 0);
+
+	writeAdvanceRow(out, 1);
+	writeByte(out, std::byte{ 0x0C });
+	writeULEB128(out, 0);
+	writeByte(out, std::byte{ 0x0B });
+	writeByte(out, std::byte{ 0x0B });
+}
+
+// Writes the entry of a function in the code section, its locals and body as one sized vector.
+void writeCodeEntry(std::ostream& out, Locals const& locals, std::string const& body, CodeContext const& context)
+{
+	std::ostringstream codeOut;
+	writeLocals(codeOut, locals);
+	codeOut << body;
+
+	std::string const& codeOutStr = codeOut.str();
+	writeVector(out, asBytes(codeOutStr));
+	if (context.lines != nullptr)
+	{
+		auto const end = static_cast<std::uint32_t>(out.tellp());
+		context.lines->finishFunction(end - static_cast<std::uint32_t>(body.size()), end);
+	}
+}
+
+void writeBatchCode(std::ostream& out, BatchFunction const& batch, CodeContext const& context)
+{
+	// Parameters are (inPointer, outPointer, count), followed by the row counter and the row base address.
+	Locals vectorLocals;
+	vectorLocals.firstScratch = 3;
+	vectorLocals.acquireScratch();
+	vectorLocals.acquireScratch();
+
+	std::ostringstream bodyOut;
+	if (batch.vectorized)
+	{
+		writeVectorLoop(bodyOut, batch, vectorLocals);
+	}
+	writeScalarLoop(bodyOut, batch, context);
+	writeByte(bodyOut, std::byte{ 0x0B });
+
+	writeCodeEntry(out, vectorLocals, bodyOut.str(), context);
+}
+
+void writeCode(std::ostream& out, jereq::Function const& function, CodeContext const& context)
+{
+	if (auto batchIt = context.batches.find(&function); batchIt != context.batches.end())
+	{
+		writeBatchCode(out, batchIt->second, context);
+		return;
+	}
+
+	Scope const scope = createFunctionScope(function);
+	Locals locals;
+	locals.firstScratch = static_cast<std::uint32_t>(scope.bindings.size());
+
+	std::ostringstream bodyOut;
+	writeExpression(bodyOut, function.expression, context, scope, locals);
+	writeByte(bodyOut, std::byte{ 0x0B });
+
+	writeCodeEntry(out, locals, bodyOut.str(), context);
+}
+
+void writeCodeSection(std::ostream& out,
+	std::vector<std::shared_ptr<jereq::Function>> const& functions,
+	CodeContext const& context)
+{
+	std::ostringstream codeVecOut;
+	writeULEB128(codeVecOut, functions.size());
+	for (auto const& function : functions)
+	{
+		jereq::Tracer::Span const span(context.tracer, "codegen", function->name);
+		writeCode(codeVecOut, *function, context);
+		++emittedFunctions;
+	}
+
+	std::string const& codeVecOutStr = codeVecOut.str();
+	writeSection(out, 10, asBytes(codeVecOutStr));
+	codeSectionBytes += codeVecOutStr.size();
+	if (context.lines != nullptr)
+	{
+		context.lines->codeSize = static_cast<std::uint32_t>(codeVecOutStr.size());
+	}
+}
+
+void writeUInt16(std::ostream& out, std::uint16_t value)
+{
+	writeByte(out, static_cast<std::byte>(value & 0xFFU));
+	writeByte(out, static_cast<std::byte>(value >> 8U));
+}
+
+void writeUInt32(std::ostream& out, std::uint32_t value)
+{
+	for (std::uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		writeByte(out, static_cast<std::byte>((value >> shift) & 0xFFU));
+	}
+}
+
+void writeCString(std::ostream& out, std::string_view str)
+{
+	writeBytes(out, asBytes(str));
+	writeByte(out, std::byte{ 0x00 });
+}
+
+void writeCustomSection(std::ostream& out, std::string_view name, std::string const& contents)
+{
+	std::ostringstream sectionOut;
+	writeName(sectionOut, name);
+	sectionOut << contents;
+
+	std::string const& sectionOutStr = sectionOut.str();
+	writeSection(out, 0, asBytes(sectionOutStr));
+}
+
+// Prefixes a DWARF unit with its 32-bit length.
+std::string withUnitLength(std::string const& unit)
+{
+	std::ostringstream out;
+	writeUInt32(out, static_cast<std::uint32_t>(unit.size()));
+	out << unit;
+	return out.str();
+}
+
+void writeExtendedLineOpcode(std::ostream& out, std::byte opcode, std::string const& operands)
+{
+	writeByte(out, std::byte{ 0x00 });
+	writeULEB128(out, static_cast<std::uint32_t>(operands.size() + 1));
+	writeByte(out, opcode);
+	out << operands;
+}
+
+// A DWARF 4 line number program with one sequence per function, using only standard opcodes.
+std::string createDebugLine(jereq::Program const& program, LineTable const& lines)
+{
+	std::ostringstream headerOut;
+	writeByte(headerOut, std::byte{ 1 });// minimum_instruction_length
+	writeByte(headerOut, std::byte{ 1 });// maximum_operations_per_instruction
+	writeByte(headerOut, std::byte{ 1 });// default_is_stmt
+	writeByte(headerOut, static_cast<std::byte>(-5));// line_base
+	writeByte(headerOut, std::byte{ 14 });// line_range
+	writeByte(headerOut, std::byte{ 13 });// opcode_base
+	for (std::uint8_t const length : { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 })
+	{
+		writeByte(headerOut, static_cast<std::byte>(length));
+	}
+	writeByte(headerOut, std::byte{ 0x00 });// No include directories
+	writeCString(headerOut, program.sourceName);
+	writeULEB128(headerOut, 0);// Directory
+	writeULEB128(headerOut, 0);// Modification time
+	writeULEB128(headerOut, 0);// Length
+	writeByte(headerOut, std::byte{ 0x00 });
+
+	std::ostringstream programOut;
+	for (LineSequence const& sequence : lines.sequences)
+	{
+		std::ostringstream addressOut;
+		writeUInt32(addressOut, sequence.start);
+		writeExtendedLineOpcode(programOut, std::byte{ 0x02 }, addressOut.str());// DW_LNE_set_address
+
+		std::uint32_t address = sequence.start;
+		std::size_t line = 1;
+		for (LineRow const& row : sequence.rows)
+		{
+			auto const [rowLine, rowColumn] = program.lines.locate(row.sourceOffset);
+			writeByte(programOut, std::byte{ 0x02 });// DW_LNS_advance_pc
+			writeULEB128(programOut, row.address - address);
+			writeByte(programOut, std::byte{ 0x03 });// DW_LNS_advance_line
+			writeSLEB128(programOut, static_cast<std::int32_t>(rowLine) - static_cast<std::int32_t>(line));
+			writeByte(programOut, std::byte{ 0x05 });// DW_LNS_set_column
+			writeULEB128(programOut, static_cast<std::uint32_t>(rowColumn));
+			writeByte(programOut, std::byte{ 0x01 });// DW_LNS_copy
+			address = row.address;
+			line = rowLine;
+		}
+
+		writeByte(programOut, std::byte{ 0x02 });
+		writeULEB128(programOut, sequence.end - address);
+		writeExtendedLineOpcode(programOut, std::byte{ 0x01 }, {});// DW_LNE_end_sequence
+	}
+
+	std::string const& header = headerOut.str();
+	std::ostringstream unitOut;
+	writeUInt16(unitOut, 4);
+	writeUInt32(unitOut, static_cast<std::uint32_t>(header.size()));
+	unitOut << header << programOut.str();
+	return withUnitLength(unitOut.str());
+}
+
+// Tools only find a line table through the compile unit that refers to it, so a minimal one is emitted alongside.
+void writeDebugSections(std::ostream& out, jereq::Program const& program, LineTable const& lines)
+{
+	std::ostringstream abbrevOut;
+	writeULEB128(abbrevOut, 1);// Abbreviation code
+	writeULEB128(abbrevOut, 0x11);// DW_TAG_compile_unit
+	writeByte(abbrevOut, std::byte{ 0x00 });// DW_CHILDREN_no
+	for (std::uint32_t const attribute : { 0x03U, 0x08U, 0x10U, 0x17U, 0x11U, 0x01U, 0x12U, 0x06U, 0x00U, 0x00U })
+	{
+		// DW_AT_name as a string, DW_AT_stmt_list as a section offset, DW_AT_low_pc as an address and DW_AT_high_pc as
+		// a length, followed by the terminating pair.
+		writeULEB128(abbrevOut, attribute);
+	}
+	writeByte(abbrevOut, std::byte{ 0x00 });
+
+	std::ostringstream infoOut;
+	writeUInt16(infoOut, 4);
+	writeUInt32(infoOut, 0);// Offset in .debug_abbrev
+	writeByte(infoOut, std::byte{ 4 });// Address size
+	writeULEB128(infoOut, 1);
+	writeCString(infoOut, program.sourceName);
+	writeUInt32(infoOut, 0);// Offset in .debug_line
+	writeUInt32(infoOut, 0);
+	writeUInt32(infoOut, lines.codeSize);
+
+	writeCustomSection(out, ".debug_info", withUnitLength(infoOut.str()));
+	writeCustomSection(out, ".debug_abbrev", abbrevOut.str());
+	writeCustomSection(out, ".debug_line", createDebugLine(program, lines));
+}
+
+std::size_t countExpressionNodes(jereq::Expression const& expression)// NOLINT(misc-no-recursion)
+{
+	if (auto const* initAssignment = std::get_if<jereq::InitAssignment>(&expression.expr))
+	{
+		return 1 + countExpressionNodes(*initAssignment->value);
+	}
+	if (auto const* binaryOp = std::get_if<jereq::BinaryOpExpression>(&expression.expr))
+	{
+		return 1 + countExpressionNodes(*binaryOp->lhs) + countExpressionNodes(*binaryOp->rhs);
+	}
+	if (auto const* functionCall = std::get_if<jereq::FunctionCall>(&expression.expr))
+	{
+		std::size_t count = 1;
+		for (auto const& argument : functionCall->arguments)
+		{
+			count += countExpressionNodes(argument.expr);
+		}
+		return count;
+	}
+	if (auto const* loop = std::get_if<jereq::LoopExpression>(&expression.expr))
+	{
+		return 1 + countExpressionNodes(*loop->from) + countExpressionNodes(*loop->to)
+			 + countExpressionNodes(*loop->initial) + countExpressionNodes(*loop->body);
+	}
+	if (auto const* conditional = std::get_if<jereq::ConditionalExpression>(&expression.expr))
+	{
+		return 1 + countExpressionNodes(*conditional->condition) + countExpressionNodes(*conditional->whenTrue)
+			 + countExpressionNodes(*conditional->whenFalse);
+	}
+	if (auto const* let = std::get_if<jereq::LetExpression>(&expression.expr))
+	{
+		std::size_t count = 1 + countExpressionNodes(*let->body);
+		for (auto const& element : let->elements)
+		{
+			count += countExpressionNodes(*element);
+		}
+		return let->generator ? count + countExpressionNodes(*let->generator) : count;
+	}
+	if (auto const* indexExpression = std::get_if<jereq::IndexExpression>(&expression.expr))
+	{
+		return 1 + countExpressionNodes(*indexExpression->index);
+	}
+	return 1;
+}
+
+bool usesArrayStack(jereq::Expression const& expression)// NOLINT(misc-no-recursion)
+{
+	if (std::holds_alternative<jereq::LetExpression>(expression.expr))
+	{
+		return true;
+	}
+	if (auto const* initAssignment = std::get_if<jereq::InitAssignment>(&expression.expr))
+	{
+		return usesArrayStack(*initAssignment->value);
+	}
+	if (auto const* binaryOp = std::get_if<jereq::BinaryOpExpression>(&expression.expr))
+	{
+		return usesArrayStack(*binaryOp->lhs) || usesArrayStack(*binaryOp->rhs);
+	}
+	if (auto const* functionCall = std::get_if<jereq::FunctionCall>(&expression.expr))
+	{
+		return std::ranges::any_of(
+			functionCall->arguments, [](jereq::FuncArgument const& argument) { return usesArrayStack(argument.expr); });
+	}
+	if (auto const* loop = std::get_if<jereq::LoopExpression>(&expression.expr))
+	{
+		return usesArrayStack(*loop->from) || usesArrayStack(*loop->to) || usesArrayStack(*loop->initial)
+			|| usesArrayStack(*loop->body);
+	}
+	if (auto const* conditional = std::get_if<jereq::ConditionalExpression>(&expression.expr))
+	{
+		return usesArrayStack(*conditional->condition) || usesArrayStack(*conditional->whenTrue)
+			|| usesArrayStack(*conditional->whenFalse);
+	}
+	if (auto const* indexExpression = std::get_if<jereq::IndexExpression>(&expression.expr))
+	{
+		return usesArrayStack(*indexExpression->index);
+	}
+	return false;
+}
+
+bool reachesFunction(Index const& index,// NOLINT(misc-no-recursion)
+	jereq::Function const& from,
+	jereq::Function const& target,
+	std::vector<jereq::Function const*>& visited)
+{
+	for (jereq::FunctionCall const* callSite : jereq::collectCallSites(from))
+	{
+		auto calleeIt = index.functionsByName.find(callSite->functionName);
+		if (calleeIt == index.functionsByName.end())
+		{
+			continue;
+		}
+		if (calleeIt->second == &target)
+		{
+			return true;
+		}
+		if (std::ranges::find(visited, calleeIt->second) == visited.end())
+		{
+			visited.push_back(calleeIt->second);
+			if (reachesFunction(index, *calleeIt->second, target, visited))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Hot call sites to small, non-recursive functions are inlined. Without a profile nothing is inlined.
+InliningPlan planInlining(jereq::Program const& program, Index const& index, jereq::CompileOptions const& options)
+{
+	InliningPlan plan;
+	if (options.profile == nullptr)
+	{
+		return plan;
+	}
+
+	jereq::Profile const& profile = *options.profile;
+	auto const hotThreshold = std::max<std::uint64_t>(1,
+		static_cast<std::uint64_t>(static_cast<double>(profile.totalCalls()) * options.hotCallSiteFraction));
+
+	for (auto const& caller : program.functions)
+	{
+		std::vector<jereq::FunctionCall const*> const callSites = jereq::collectCallSites(*caller);
+		for (std::uint32_t callSiteIndex = 0; callSiteIndex < callSites.size(); ++callSiteIndex)
+		{
+			jereq::CallSiteProfile const* callSiteProfile = profile.findCallSite(caller->name, callSiteIndex);
+			if (callSiteProfile == nullptr || callSiteProfile->count < hotThreshold)
+			{
+				continue;
+			}
+
+			auto calleeIt = index.functionsByName.find(callSites[callSiteIndex]->functionName);
+			if (calleeIt == index.functionsByName.end()
+				|| countExpressionNodes(calleeIt->second->expression) > options.inlineSizeLimit)
+			{
+				continue;
+			}
+
+			jereq::Function const& callee = *calleeIt->second;
+			std::vector<jereq::Function const*> visited;
+			if (reachesFunction(index, callee, callee, visited))
+			{
+				continue;
+			}
+
+			InlineDecision decision{ &callee, {} };
+			for (auto const& [name, argument] : callSiteProfile->arguments)
+			{
+				if (argument.constant)
+				{
+					decision.constantArguments.try_emplace(name, argument.firstValue);
+				}
+			}
+			plan.try_emplace(callSites[callSiteIndex], std::move(decision));
+		}
+	}
+	return plan;
+}
+
+void injectFunctions(std::vector<std::shared_ptr<jereq::Type>>& types,
+	std::vector<std::shared_ptr<jereq::Function>>& functions,
+	std::vector<jereq::HostFunction> const& hostFunctions,
+	std::vector<ImportFunctionInformation>& importFunctionInfo,
+	std::vector<ExportFunctionInformation>& exportFunctionInfo)
+{
+	auto& startType = types.emplace_back(std::make_shared<jereq::Type>());
+	startType->t = jereq::FuncType{ "", {} };
+
+	std::shared_ptr<jereq::Function> const& startFunc = functions.emplace_back(std::make_shared<jereq::Function>());
+	startFunc->name = "_start";
+	startFunc->sourceFile = "generated";
+	startFunc->type = startType;
+	startFunc->expression = {};
+
+	exportFunctionInfo.push_back(ExportFunctionInformation{ "_start", startFunc.get() });
+
+	std::shared_ptr<jereq::Type> const& i32 = std::make_shared<jereq::Type>();
+	i32->t = jereq::BuiltInType{ "i32" };
+	jereq::FuncParameter const exitCode{ "exitCode", jereq::ParameterDirection::in, i32 };
+
+	auto& procExitType = types.emplace_back(std::make_shared<jereq::Type>());
+	procExitType->t = jereq::FuncType{ "", { exitCode } };
+	importFunctionInfo.push_back(
+		ImportFunctionInformation{ "wasi_snapshot_preview1", "proc_exit", procExitType.get() });
+
+	// _start calls proc_exit as import 0, so the host functions follow it.
+	for (auto const& hostFunction : hostFunctions)
+	{
+		importFunctionInfo.push_back(ImportFunctionInformation{ hostFunction.module, hostFunction.name, hostFunction.type.get() });
+	}
+}
+
+jereq::Function const& findExportedFunction(std::vector<std::shared_ptr<jereq::Function>> const& functions,
+	std::string const& name)
+{
+	auto functionIt = std::ranges::find(functions, name, &jereq::Function::name);
+	if (functionIt == functions.end())
+	{
+		throw std::runtime_error("Couldn't find exported function " + name);
+	}
+	return **functionIt;
+}
+
+// Exports the requested functions, plus loop wrappers taking (inPointer, outPointer, count): batch_<name> for exported
+// functions that fit the row layout when batch entry points are enabled, and map_<name> for each mapped function.
+BatchFunctions injectExports(jereq::CompileOptions const& options,
+	std::vector<std::shared_ptr<jereq::Type>>& types,
+	std::vector<std::shared_ptr<jereq::Function>>& functions,
+	std::vector<ExportFunctionInformation>& exportFunctionInfo)
+{
+	BatchFunctions batches;
+	std::shared_ptr<jereq::Type> batchType;
+	auto addLoopWrapper = [&](std::string const& prefix, BatchFunction const& batch) {
+		if (!batchType)
+		{
+			std::shared_ptr<jereq::Type> const& i32 = std::make_shared<jereq::Type>();
+			i32->t = jereq::BuiltInType{ "i32" };
+			batchType = types.emplace_back(std::make_shared<jereq::Type>());
+			batchType->t = jereq::FuncType{ "",
+				{ { "inPointer", jereq::ParameterDirection::in, i32 },
+					{ "outPointer", jereq::ParameterDirection::in, i32 },
+					{ "count", jereq::ParameterDirection::in, i32 } } };
+		}
+
+		std::shared_ptr<jereq::Function> const& batchFunc
+			= functions.emplace_back(std::make_shared<jereq::Function>());
+		batchFunc->name = prefix + batch.function->name;
+		batchFunc->sourceFile = "generated";
+		batchFunc->type = batchType;
+		batchFunc->expression = {};
+
+		exportFunctionInfo.push_back(ExportFunctionInformation{ batchFunc->name, batchFunc.get() });
+		batches.try_emplace(batchFunc.get(), batch);
+	};
+
+	for (std::string const& exportName : options.exportedFunctions)
+	{
+		jereq::Function const& function = findExportedFunction(functions, exportName);
+		exportFunctionInfo.push_back(ExportFunctionInformation{ exportName, &function });
+		if (!options.batchEntryPoints)
+		{
+			continue;
+		}
+		// Batch entry points are a convenience for whatever is exported, so functions not taking rows are left out.
+		if (std::optional<BatchFunction> const batch = planBatchFunction(function))
+		{
+			addLoopWrapper("batch_", *batch);
+		}
+	}
+	for (std::string const& mappedName : options.mappedFunctions)
+	{
+		jereq::Function const& function = findExportedFunction(functions, mappedName);
+		std::optional<BatchFunction> batch = planBatchFunction(function);
+		if (!batch)
+		{
+			throw std::runtime_error(
+				"Array entry points need i32 parameters and exactly one out parameter: " + function.name);
+		}
+		batch->vectorized = false;
+		addLoopWrapper("map_", *batch);
+	}
+	return batches;
+}
+
+Index createIndex(std::vector<ImportFunctionInformation> const& imports,
+	std::vector<jereq::HostFunction> const& hostFunctions,
+	std::vector<std::shared_ptr<jereq::Function>> const& functions)
+{
+	Index result;
+
+	for (std::uint32_t importIndex = 0; importIndex < imports.size(); ++importIndex)
+	{
+		ImportFunctionInformation const& import = imports[importIndex];
+		if (std::ranges::any_of(hostFunctions, [&](jereq::HostFunction const& hostFunction) {
+				return hostFunction.name == import.name && hostFunction.module == import.module;
+			}))
+		{
+			result.hostFunctions.try_emplace(import.name, HostImport{ importIndex, import.type });
+		}
+	}
+
+	auto nextIndex = static_cast<std::uint32_t>(imports.size());
+	for (auto const& function : functions)
+	{
+		result.functions.try_emplace(function.get(), nextIndex);
+		result.functionsByName.try_emplace(function->name, function.get());
+		++nextIndex;
+	}
+
+	return result;
+}
+}
+
+namespace jereq
+{
+bool compile(Program const& program, std::ostream& out)
+{
+	return compile(program, out, {});
+}
+
+bool compile(Program const& program, std::ostream& out, CompileOptions const& options)
+{
+	// Each phase ends where the next one starts.
+	std::optional<Tracer::Span> phase;
+	phase.emplace(options.tracer, "compile", "analyze");
+
+	std::vector<std::shared_ptr<Type>> types = program.types;
+	std::vector<std::shared_ptr<Function>> functions = program.functions;
+	if (options.profile != nullptr)
+	{
+		// Keep the hot functions together at the start of the code section.
+		std::ranges::stable_sort(functions, std::ranges::greater(), [&](std::shared_ptr<Function> const& function) {
+			return options.profile->callCount(function->name);
+		});
+	}
+
+	std::vector<ImportFunctionInformation> importFunctionInformation;
+	std::vector<ExportFunctionInformation> exportFunctionInformation;
+	injectFunctions(types, functions, program.hostFunctions, importFunctionInformation, exportFunctionInformation);
+	BatchFunctions const batches = injectExports(options, types, functions, exportFunctionInformation);
+
+	// Exported functions, and the functions behind loop wrappers, can be called by the host with any arguments.
+	std::vector<Function const*> entryPoints{ program.mainFunction.get() };
+	for (auto const& exportInformation : exportFunctionInformation)
+	{
+		auto batchIt = batches.find(exportInformation.function);
+		entryPoints.push_back(batchIt != batches.end() ? batchIt->second.function : exportInformation.function);
+	}
+
+	WasmFuncTypeTranslation const& typeTranslation = translateFuncTypes(types);
+	Index const index = createIndex(importFunctionInformation, program.hostFunctions, functions);
+	RangeAnalysis const ranges = analyzeRanges(program, entryPoints);
+	TypeInfo const valueTypes = checkTypes(program);
+	InliningPlan const inlining = planInlining(program, index, options);
+	LineTable lines;
+	CodeContext const context{
+		index, ranges, valueTypes, inlining, batches, options.debugLines ? &lines : nullptr, options.tracer
+	};
+	bool const hasArrays = std::ranges::any_of(
+		functions, [](std::shared_ptr<Function> const& function) { return usesArrayStack(function->expression); });
+	std::optional<MemoryLimits> const memory = planMemory(options, !batches.empty(), hasArrays);
+
+	phase.emplace(options.tracer, "compile", "emit");
+	writeMagic(out);
+	writeVersion(out);
+	writeTypeSection(out, typeTranslation);
+	writeImportSection(out, importFunctionInformation, typeTranslation);
+	writeFunctionSection(out, functions, typeTranslation);
+	writeMemorySection(out, memory);
+	writeGlobalSection(out, memory, hasArrays);
+	writeExportSection(out, exportFunctionInformation, index, memory.has_value());
+	writeCodeSection(out, functions, context);
+	if (options.debugLines)
+	{
+		phase.emplace(options.tracer, "compile", "debug sections");
+		writeDebugSections(out, program, lines);
+	}
 	return static_cast<bool>(out);
 }
 }
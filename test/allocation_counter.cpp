@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<std::uint64_t> allocations = 0;
+
+void* allocate(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size == 0 ? 1 : size))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void* allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	auto const align = static_cast<std::size_t>(alignment);
+	// aligned_alloc requires the size to be a multiple of the alignment.
+	if (void* memory = std::aligned_alloc(align, (size + align - 1) / align * align))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+}
+
+namespace jereq::testing
+{
+std::uint64_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+AllocationScope::AllocationScope()
+	: start(allocationCount())
+{
+}
+
+std::uint64_t AllocationScope::allocations() const
+{
+	return allocationCount() - start;
+}
+}
+
+// The array and nothrow forms of the library forward to these, but are replaced too in case a library does not.
+// NOLINTBEGIN(cppcoreguidelines-no-malloc, hicpp-no-malloc)
+void* operator new(std::size_t size)
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return allocate(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const& /*unused*/) noexcept
+{
+	try
+	{
+		return allocate(size);
+	}
+	catch (std::bad_alloc const&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const& /*unused*/) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return allocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return allocateAligned(size, alignment);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t /*size*/) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t /*alignment*/) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t /*alignment*/) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/, std::align_val_t /*alignment*/) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t /*size*/, std::align_val_t /*alignment*/) noexcept
+{
+	std::free(memory);
+}
+// NOLINTEND(cppcoreguidelines-no-malloc, hicpp-no-malloc)
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <cstdint>
+
+namespace jereq::testing
+{
+/// Allocations made by any thread since the program started, through the global operator new that the binary
+/// linking allocation_counter.cpp replaces.
+std::uint64_t allocationCount();
+
+/// Counts the allocations made by any thread while in scope.
+class AllocationScope
+{
+public:
+	AllocationScope();
+
+	/// Allocations made since the scope started.
+	[[nodiscard]] std::uint64_t allocations() const;
+
+private:
+	std::uint64_t start;
+};
+}
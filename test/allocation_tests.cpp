@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "allocation_counter.hpp"
+
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/parser/parser.hpp>
+#include <hobbylang/wasm/wasm.hpp>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace
+{
+/// Main calls the last of a chain of functions from a loop, where each function but the first calls the previous one.
+std::string chainSource(int length, int iterations)
+{
+	std::string source = "def main = fun(out exitCode: i32)\n{\n    exitCode = loop i from 0i32 to "
+					   + std::to_string(iterations) + "i32 with sum = 0i32 { (sum + f" + std::to_string(length)
+					   + "(in x: i)) % 1000i32 };\n};\n\ndef f0 = fun(in x: i32, out result: i32)\n{\n"
+					   + "    result = (x * 5i32) + 1i32;\n};\n";
+	for (int index = 1; index <= length; ++index)
+	{
+		source += "\ndef f" + std::to_string(index) + " = fun(in x: i32, out result: i32)\n{\n    result = f"
+				+ std::to_string(index - 1) + "(in x: x + 1i32);\n};\n";
+	}
+	return source;
+}
+
+template<typename Body>
+std::uint64_t allocationsOf(Body&& body)
+{
+	jereq::testing::AllocationScope const scope;
+	body();
+	return scope.allocations();
+}
+}
+
+// Budgets are on the cost of one more function or call, so that fixed setup costs do not hide a regression.
+
+TEST_CASE("Parsing should allocate a bounded amount per function", "[allocations]")
+{
+	std::string const shortSource = chainSource(20, 1);
+	std::string const longSource = chainSource(40, 1);
+
+	std::uint64_t const shortCount = allocationsOf([&] { return jereq::parse(shortSource, "short"); });
+	std::uint64_t const longCount = allocationsOf([&] { return jereq::parse(longSource, "long"); });
+	REQUIRE(longCount > shortCount);
+	REQUIRE(longCount - shortCount <= 16 * 20);
+}
+
+TEST_CASE("Compiling should allocate a bounded amount per function", "[allocations]")
+{
+	jereq::Program const shortProgram = jereq::parse(chainSource(20, 1), "short");
+	jereq::Program const longProgram = jereq::parse(chainSource(40, 1), "long");
+
+	auto const compile = [](jereq::Program const& program) {
+		std::ostringstream out;
+		REQUIRE(jereq::compile(program, out));
+	};
+	std::uint64_t const shortCount = allocationsOf([&] { compile(shortProgram); });
+	std::uint64_t const longCount = allocationsOf([&] { compile(longProgram); });
+	REQUIRE(longCount > shortCount);
+	REQUIRE(longCount - shortCount <= 21 * 20);
+}
+
+TEST_CASE("Calls should not allocate in the closure engine", "[allocations]")
+{
+	jereq::Program const fewCalls = jereq::parse(chainSource(3, 100), "few calls");
+	jereq::Program const manyCalls = jereq::parse(chainSource(3, 200), "many calls");
+	jereq::ExecuteOptions closures;
+	closures.engine = jereq::InterpreterEngine::closures;
+	// Lets one-time setup, such as registering this thread's statistics, happen before counting.
+	jereq::execute(fewCalls, closures);
+
+	REQUIRE(allocationsOf([&] { jereq::execute(fewCalls, closures); })
+			== allocationsOf([&] { jereq::execute(manyCalls, closures); }));
+
+	jereq::CompiledProgram const compiled(jereq::parse(chainSource(3, 1), "compiled"));
+	std::size_t const function = compiled.findFunction("f3").value();
+	std::array<std::int64_t, 1> const inValues{ 1 };
+	std::array<std::int64_t, 1> outValues{};
+	REQUIRE(allocationsOf([&] {
+		for (int call = 0; call < 100; ++call)
+		{
+			compiled.call(function, inValues, outValues);
+		}
+	}) == 0);
+	REQUIRE(outValues[0] == 21);
+}
+
+TEST_CASE("Calls should allocate a bounded amount in the tree walker", "[allocations]")
+{
+	// Frames and argument lists are vectors of named values, allocated on every call.
+	jereq::Program const fewCalls = jereq::parse(chainSource(3, 100), "few calls");
+	jereq::Program const manyCalls = jereq::parse(chainSource(3, 200), "many calls");
+
+	std::uint64_t const fewCount = allocationsOf([&] { jereq::execute(fewCalls); });
+	std::uint64_t const manyCount = allocationsOf([&] { jereq::execute(manyCalls); });
+	REQUIRE(manyCount > fewCount);
+	std::uint64_t const callsPerIteration = 4;
+	REQUIRE(manyCount - fewCount <= 4 * 100 * callsPerIteration);
+}
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+
+#include <hobbylang/analysis/cost_model.hpp>
+#include <hobbylang/analysis/division.hpp>
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/analysis/range_analysis.hpp>
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/trace.hpp>
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/parser/parser.hpp>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+TEST_CASE("Division by constant matches truncating division", "[analysis]")
+{
+	constexpr std::int32_t min = std::numeric_limits<std::int32_t>::min();
+	constexpr std::int32_t max = std::numeric_limits<std::int32_t>::max();
+	constexpr std::array divisors{ 1, 2, 3, 5, 6, 7, 8, 10, 100, 641, 1 << 30, max, -2, -3, -7, -8, -1000, min };
+	constexpr std::array dividends{ 0, 1, -1, 2, -2, 3, 7, -7, 99, -99, 1000, -1000, 123456, -123456, max, max - 1,
+		min, min + 1 };
+
+	for (std::int32_t const divisor : divisors)
+	{
+		jereq::SignedDivisor const analyzed = jereq::analyzeDivisor(divisor);
+		REQUIRE(analyzed.strategy != jereq::DivisionStrategy::hardware);
+
+		for (std::int32_t const dividend : dividends)
+		{
+			CAPTURE(dividend, divisor);
+			REQUIRE(jereq::divideByConstant(dividend, analyzed) == dividend / divisor);
+			REQUIRE(jereq::remainderByConstant(dividend, analyzed) == dividend % divisor);
+		}
+	}
+}
+
+TEST_CASE("Division by zero and minus one is left to the hardware", "[analysis]")
+{
+	REQUIRE(jereq::analyzeDivisor(0).strategy == jereq::DivisionStrategy::hardware);
+	REQUIRE(jereq::analyzeDivisor(-1).strategy == jereq::DivisionStrategy::hardware);
+	REQUIRE(jereq::analyzeDivisor(1).strategy == jereq::DivisionStrategy::identity);
+	REQUIRE(jereq::analyzeDivisor(16).strategy == jereq::DivisionStrategy::powerOfTwo);
+	REQUIRE(jereq::analyzeDivisor(7).strategy == jereq::DivisionStrategy::multiplyHigh);
+}
+
+TEST_CASE("Range analysis proves divisors non-zero", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = scale(in x: 20i32);
+};
+
+def scale = fun(in x: i32, out result: i32)
+{
+    result = (1000i32 / ((x % 10i32) + 1i32)) + (x / (x - 20i32));
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::RangeAnalysis const ranges = jereq::analyzeRanges(program);
+
+	REQUIRE(ranges.divisionCount == 3);
+	REQUIRE(ranges.eliminatedDivisionChecks == 2);
+
+	auto const& scale = *program.functions.at(1);
+	auto const& assignment = std::get<jereq::InitAssignment>(scale.expression.expr);
+	auto const& sum = std::get<jereq::BinaryOpExpression>(assignment.value->expr);
+	auto const& safeDivision = std::get<jereq::BinaryOpExpression>(sum.lhs->expr);
+	auto const& unsafeDivision = std::get<jereq::BinaryOpExpression>(sum.rhs->expr);
+	REQUIRE(ranges.rangeOf(*safeDivision.rhs) == jereq::Interval{ 1, 10 });
+	REQUIRE_FALSE(ranges.needsDivisionChecks(safeDivision));
+	REQUIRE(ranges.needsDivisionChecks(unsafeDivision));
+}
+
+TEST_CASE("Range analysis treats entry point parameters as unknown", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = half(in x: 20i32);
+};
+
+def half = fun(in x: i32, out result: i32)
+{
+    result = 100i32 / x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::analyzeRanges(program).eliminatedDivisionChecks == 1);
+	REQUIRE(jereq::analyzeRanges(program, { program.functions.at(1).get() }).eliminatedDivisionChecks == 0);
+}
+
+TEST_CASE("Profiles survive a round trip through text", "[analysis]")
+{
+	jereq::Profile profile;
+	profile.functionCalls["main"] = 1;
+	profile.functionCalls["square"] = 3;
+	jereq::CallSiteProfile& callSite = profile.callSites[jereq::CallSiteId{ "main", 0 }];
+	callSite.callee = "square";
+	callSite.count = 3;
+	callSite.recordArgument("x", 4);
+	callSite.recordArgument("x", 4);
+	callSite.recordArgument("y", 1);
+	callSite.recordArgument("y", 2);
+
+	std::stringstream text;
+	jereq::writeProfile(text, profile);
+	jereq::Profile const readBack = jereq::readProfile(text);
+
+	REQUIRE(readBack.callCount("square") == 3);
+	REQUIRE(readBack.totalCalls() == 4);
+	jereq::CallSiteProfile const* readCallSite = readBack.findCallSite("main", 0);
+	REQUIRE(readCallSite != nullptr);
+	REQUIRE(readCallSite->callee == "square");
+	REQUIRE(readCallSite->arguments.at("x").constant);
+	REQUIRE(readCallSite->arguments.at("x").firstValue == 4);
+	REQUIRE_FALSE(readCallSite->arguments.at("y").constant);
+}
+
+TEST_CASE("Malformed argument values in profiles are reported", "[analysis]")
+{
+	for (std::string_view const value : { "abc", "4x", "99999999999", "" })
+	{
+		std::stringstream text;
+		text << "hobby-profile 1\ncallsite main 0 square 3 x=" << value << '\n';
+		REQUIRE_THROWS_AS(jereq::readProfile(text), std::runtime_error);
+	}
+}
+
+TEST_CASE("Cost model adds callee costs and flags recursion", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = square(in x: 3i32) + countdown(in n: 3i32);
+};
+
+def square = fun(in x: i32, out result: i32)
+{
+    result = x * x;
+};
+
+def countdown = fun(in n: i32, out result: i32)
+{
+    result = countdown(in n: n - 1i32);
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::CostModel const costs = jereq::estimateCosts(program);
+
+	jereq::FunctionCost const* square = costs.find("square");
+	REQUIRE(square != nullptr);
+	REQUIRE_FALSE(square->recursive);
+	REQUIRE_FALSE(square->inclusive.unbounded);
+	REQUIRE(square->inclusive == square->self);
+	REQUIRE(square->self.instructions > 0);
+
+	jereq::FunctionCost const* countdown = costs.find("countdown");
+	REQUIRE(countdown->recursive);
+	REQUIRE(countdown->inclusive.unbounded);
+	REQUIRE_FALSE(countdown->self.unbounded);
+
+	jereq::FunctionCost const* main = costs.find("main");
+	REQUIRE_FALSE(main->recursive);
+	REQUIRE(main->inclusive.unbounded);
+	REQUIRE(main->inclusive.instructions > main->self.instructions + square->inclusive.instructions);
+}
+
+TEST_CASE("Cost model saturates the trip count of loops with extreme bounds", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = if (loop i from -9223372036854775807i64 to 9223372036854775807i64 with n = 0i64 { n + 1i64 }) > 0i64
+        then 1i32 else 0i32;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::CostModel const costs = jereq::estimateCosts(program);
+
+	jereq::FunctionCost const* main = costs.find("main");
+	REQUIRE(main != nullptr);
+	REQUIRE_FALSE(main->self.unbounded);
+	REQUIRE(main->self.instructions == std::numeric_limits<std::uint64_t>::max());
+}
+
+TEST_CASE("Range analysis bounds loop counters", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 1i32 to 10i32 with sum = 0i32 { sum + (100i32 / i) };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::RangeAnalysis const ranges = jereq::analyzeRanges(program);
+
+	REQUIRE(ranges.divisionCount == 1);
+	REQUIRE(ranges.eliminatedDivisionChecks == 1);
+
+	jereq::CostModel const costs = jereq::estimateCosts(program);
+	REQUIRE_FALSE(costs.find("main")->inclusive.unbounded);
+}
+
+TEST_CASE("Range analysis narrows variables compared in conditions", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = safeDivide(in d: 0i32 - 3i32) + safeDivide(in d: 4i32);
+};
+
+def safeDivide = fun(in d: i32, out result: i32)
+{
+    result = if d > 0i32 then 100i32 / d else 0i32;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::RangeAnalysis const ranges = jereq::analyzeRanges(program);
+
+	REQUIRE(ranges.divisionCount == 1);
+	REQUIRE(ranges.eliminatedDivisionChecks == 1);
+
+	auto const& safeDivide = *program.functions.at(1);
+	auto const& assignment = std::get<jereq::InitAssignment>(safeDivide.expression.expr);
+	auto const& conditional = std::get<jereq::ConditionalExpression>(assignment.value->expr);
+	REQUIRE(ranges.rangeOf(*conditional.condition) == jereq::Interval{ 0, 1 });
+	REQUIRE(ranges.rangeOf(*conditional.whenTrue) == jereq::Interval{ 25, 100 });
+	REQUIRE_FALSE(jereq::prefersSelect(conditional));
+}
+
+TEST_CASE("Range analysis removes bounds checks for indices in range", "[analysis]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = pick(in n: 2i32);
+};
+
+def pick = fun(in n: i32, out result: i32)
+{
+    result = let a: [4]i32 = [for i: i * 3i32] in a[n] + loop i from 0i32 to 4i32 with sum = 0i32 { sum + a[i] };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	jereq::RangeAnalysis const ranges = jereq::analyzeRanges(program);
+
+	REQUIRE(ranges.indexCount == 2);
+	REQUIRE(ranges.inBoundsIndices.size() == 2);
+	REQUIRE(jereq::analyzeRanges(program, { program.functions.at(1).get() }).inBoundsIndices.size() == 1);
+}
+
+TEST_CASE("Tracer records spans of each thread as trace events", "[analysis]")
+{
+	jereq::Tracer tracer;
+	{
+		jereq::Tracer::Span const outer(&tracer, "phase", "outer \"quoted\"");
+		std::thread([&] { jereq::Tracer::Span const worker(&tracer, "phase", "worker"); }).join();
+		jereq::Tracer::Span const untraced(nullptr, "phase", "untraced");
+	}
+
+	std::ostringstream out;
+	tracer.writeTraceEvents(out);
+	std::string const trace = out.str();
+	REQUIRE(trace.starts_with("{\"traceEvents\":["));
+	REQUIRE(trace.find(R"("tid":1,"cat":"phase","name":"outer \"quoted\"")") != std::string::npos);
+	REQUIRE(trace.find(R"("tid":2,"cat":"phase","name":"worker")") != std::string::npos);
+	REQUIRE(trace.find("untraced") == std::string::npos);
+}
+
+namespace
+{
+jereq::Statistic testEvents("test", "Events counted by tests");
+
+std::uint64_t statisticValue(std::string_view pass, std::string_view description)
+{
+	std::vector<jereq::StatisticValue> const statistics = jereq::collectStatistics();
+	auto const it = std::ranges::find_if(statistics, [&](jereq::StatisticValue const& statistic) {
+		return statistic.pass == pass && statistic.description == description;
+	});
+	REQUIRE(it != statistics.end());
+	return it->value;
+}
+}
+
+TEST_CASE("Statistics are summed over threads", "[analysis]")
+{
+	std::uint64_t const eventsBefore = statisticValue("test", "Events counted by tests");
+	std::uint64_t const foldedBefore = statisticValue("parser", "Constant definitions folded");
+
+	++testEvents;
+	std::thread([] { testEvents += 2; }).join();
+	jereq::parse(R"(
+def answer = 6i32 * 7i32;
+def main = fun(out exitCode: i32) { exitCode = answer; };)",
+		"test name");
+
+	REQUIRE(statisticValue("test", "Events counted by tests") == eventsBefore + 3);
+	REQUIRE(statisticValue("parser", "Constant definitions folded") == foldedBefore + 1);
+}
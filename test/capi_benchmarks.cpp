@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/capi/hobby.h>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/parser/parser.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+TEST_CASE("C API call overhead", "[!benchmark]")
+{
+	std::string_view const source = R"(
+def main = fun(out exitCode: i32) { exitCode = increment(in x: 1i32); };
+def increment = fun(in x: i32, out result: i32) { result = x + 1i32; };)";
+
+	hobby_program* program = nullptr;
+	REQUIRE(hobby_compile(source.data(), source.size(), &program) == HOBBY_OK);
+	std::uint32_t increment = 0;
+	REQUIRE(hobby_find_function(program, "increment", &increment, nullptr, nullptr) == HOBBY_OK);
+
+	std::array<std::int64_t, 1> inValues{ 1 };
+	std::array<std::int64_t, 1> outValues{};
+
+	// Preparing the program dominates a one-shot execute, which hobby_call only pays once per program.
+	jereq::Program const parsed = jereq::parse(source, "benchmark");
+	jereq::ExecuteOptions closures;
+	closures.engine = jereq::InterpreterEngine::closures;
+	BENCHMARK("execute")
+	{
+		return jereq::execute(parsed, closures);
+	};
+	BENCHMARK("hobby_call")
+	{
+		++inValues[0];
+		hobby_call(program, increment, inValues.data(), inValues.size(), outValues.data(), outValues.size());
+		return outValues[0];
+	};
+
+	hobby_release(program);
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+
+#include <hobbylang/capi/hobby.h>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace
+{
+int64_t addOffset(void* userData, int64_t const* arguments)
+{
+	return *static_cast<int64_t const*>(userData) + arguments[0];// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+}
+
+TEST_CASE("C API should call functions through caller-owned buffers", "[capi]")
+{
+	std::string_view const source = R"(
+def main = fun(out exitCode: i32) { exitCode = 0i32; };
+def divide = fun(in x: i32, in y: i64, out quotient: i64) { quotient = y / 7i64; };
+def check = fun(in x: i32, out result: i32) { result = 100i32 / x; };)";
+
+	hobby_program* program = nullptr;
+	REQUIRE(hobby_compile(source.data(), source.size(), &program) == HOBBY_OK);
+
+	std::uint32_t divide = 0;
+	std::size_t inCount = 0;
+	std::size_t outCount = 0;
+	REQUIRE(hobby_find_function(program, "divide", &divide, &inCount, &outCount) == HOBBY_OK);
+	REQUIRE(inCount == 2);
+	REQUIRE(outCount == 1);
+
+	std::array<std::int64_t, 2> const inValues{ 1, 7'000'000'000 };
+	std::array<std::int64_t, 1> outValues{};
+	REQUIRE(hobby_call(program, divide, inValues.data(), inValues.size(), outValues.data(), outValues.size()) == HOBBY_OK);
+	REQUIRE(outValues[0] == 1'000'000'000);
+
+	REQUIRE(hobby_call(program, divide, inValues.data(), 1, outValues.data(), outValues.size()) == HOBBY_INVALID_ARGUMENT);
+	REQUIRE(hobby_find_function(program, "missing", nullptr, nullptr, nullptr) == HOBBY_UNKNOWN_FUNCTION);
+
+	// Every function is an entry point, so the division keeps its zero check even though no caller passes zero.
+	std::uint32_t check = 0;
+	REQUIRE(hobby_find_function(program, "check", &check, nullptr, nullptr) == HOBBY_OK);
+	std::int64_t const zero = 0;
+	REQUIRE(hobby_call(program, check, &zero, 1, outValues.data(), 1) == HOBBY_RUNTIME_ERROR);
+	REQUIRE(std::string_view(hobby_last_error()) == "Integer division by zero");
+
+	hobby_release(program);
+
+	std::string_view const broken = "def main = fun(out exitCode: i32) { exitCode = 1i64; };";
+	REQUIRE(hobby_compile(broken.data(), broken.size(), &program) == HOBBY_COMPILE_ERROR);
+	REQUIRE(program == nullptr);
+}
+
+TEST_CASE("C API should call host functions", "[capi]")
+{
+	std::string_view const source = R"(
+def main = fun(out exitCode: i32) { exitCode = 0i32; };
+def shifted = fun(in x: i64, out result: i64) { result = offset(in value: x * 2i64); };)";
+	std::int64_t offset = 5'000'000'000;
+	hobby_host_function const hostFunction{ "offset", "fun(in value: i64, out result: i64)", &addOffset, &offset };
+
+	hobby_program* program = nullptr;
+	REQUIRE(hobby_compile_with_host_functions(source.data(), source.size(), &hostFunction, 1, &program) == HOBBY_OK);
+	std::uint32_t shifted = 0;
+	REQUIRE(hobby_find_function(program, "shifted", &shifted, nullptr, nullptr) == HOBBY_OK);
+
+	std::int64_t const x = 21;
+	std::int64_t result = 0;
+	REQUIRE(hobby_call(program, shifted, &x, 1, &result, 1) == HOBBY_OK);
+	REQUIRE(result == 5'000'000'042);
+	hobby_release(program);
+}
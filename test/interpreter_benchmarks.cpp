@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "perf_counters.hpp"
+
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/execution_trace.hpp>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/interpreter/sampling_profiler.hpp>
+#include <hobbylang/parser/parser.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+
+namespace
+{
+/// A binary tree of calls, 2^depth leaf calls deep, mixing arithmetic, locals and division.
+std::string callTreeSource(int depth)
+{
+	std::string source = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = f)" + std::to_string(depth)
+					   + R"((in x: 7i32) % 256i32;
+};
+
+def f0 = fun(in x: i32, out result: i32)
+{
+    result = ((x * 3i32) + (x / 7i32)) - (x % 5i32);
+};
+)";
+	for (int level = 1; level <= depth; ++level)
+	{
+		std::string const callee = "f" + std::to_string(level - 1);
+		source += "\ndef f" + std::to_string(level) + " = fun(in x: i32, out result: i32)\n{\n    result = " + callee
+				+ "(in x: x) + " + callee + "(in x: x + 1i32);\n};\n";
+	}
+	return source;
+}
+}
+
+TEST_CASE("Interpreter engines", "[!benchmark]")
+{
+	jereq::Program const program = jereq::parse(callTreeSource(12), "benchmark");
+
+	jereq::ExecuteOptions treeWalker;
+	jereq::ExecuteOptions closures;
+	closures.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, treeWalker) == jereq::execute(program, closures));
+
+	BENCHMARK("tree walker")
+	{
+		return jereq::execute(program, treeWalker);
+	};
+	jereq::benchmarks::measureCounters("tree walker", [&] { return jereq::execute(program, treeWalker); });
+	BENCHMARK("closures")
+	{
+		return jereq::execute(program, closures);
+	};
+	jereq::benchmarks::measureCounters("closures", [&] { return jereq::execute(program, closures); });
+}
+
+TEST_CASE("Binary operator kernels", "[!benchmark]")
+{
+	jereq::Program const program = jereq::parse(callTreeSource(12), "benchmark");
+	// Without numbered operators, the tree walker switches on the operator of every evaluation instead.
+	jereq::Program switched = jereq::parse(callTreeSource(12), "benchmark");
+	switched.binaryOperatorCount = 0;
+	REQUIRE(jereq::execute(program) == jereq::execute(switched));
+
+	BENCHMARK("kernels")
+	{
+		return jereq::execute(program);
+	};
+	jereq::benchmarks::measureCounters("kernels", [&] { return jereq::execute(program); });
+	BENCHMARK("switch")
+	{
+		return jereq::execute(switched);
+	};
+	jereq::benchmarks::measureCounters("switch", [&] { return jereq::execute(switched); });
+}
+
+TEST_CASE("Sampling profiler overhead", "[!benchmark]")
+{
+	jereq::Program const program = jereq::parse(callTreeSource(12), "benchmark");
+
+	jereq::SamplingProfiler sampler;
+	jereq::ExecuteOptions treeWalker;
+	jereq::ExecuteOptions sampledTreeWalker;
+	sampledTreeWalker.sampler = &sampler;
+	jereq::ExecuteOptions closures;
+	closures.engine = jereq::InterpreterEngine::closures;
+	jereq::ExecuteOptions sampledClosures = closures;
+	sampledClosures.sampler = &sampler;
+
+	BENCHMARK("tree walker")
+	{
+		return jereq::execute(program, treeWalker);
+	};
+	BENCHMARK("tree walker, sampled")
+	{
+		return jereq::execute(program, sampledTreeWalker);
+	};
+	BENCHMARK("closures")
+	{
+		return jereq::execute(program, closures);
+	};
+	BENCHMARK("closures, sampled")
+	{
+		return jereq::execute(program, sampledClosures);
+	};
+}
+
+TEST_CASE("Execution trace overhead", "[!benchmark]")
+{
+	jereq::Program const program = jereq::parse(callTreeSource(12), "benchmark");
+
+	jereq::ExecutionTrace trace;
+	jereq::ExecuteOptions treeWalker;
+	jereq::ExecuteOptions tracedTreeWalker;
+	tracedTreeWalker.trace = &trace;
+	jereq::ExecuteOptions closures;
+	closures.engine = jereq::InterpreterEngine::closures;
+	jereq::ExecuteOptions tracedClosures = closures;
+	tracedClosures.trace = &trace;
+
+	BENCHMARK("tree walker")
+	{
+		return jereq::execute(program, treeWalker);
+	};
+	BENCHMARK("tree walker, traced")
+	{
+		return jereq::execute(program, tracedTreeWalker);
+	};
+	BENCHMARK("closures")
+	{
+		return jereq::execute(program, closures);
+	};
+	BENCHMARK("closures, traced")
+	{
+		return jereq::execute(program, tracedClosures);
+	};
+}
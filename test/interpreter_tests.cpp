@@ -1,12 +1,84 @@
 // SPDX-License-Identifier: MIT
 // Copyright © 2022 Sebastian Larsson
 
+#include <hobbylang/analysis/statistics.hpp>
+#include <hobbylang/analysis/trace.hpp>
 #include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/execution_trace.hpp>
 #include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/interpreter/sampling_profiler.hpp>
+#include <hobbylang/parser/parser.hpp>
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+std::int64_t lookupScaled(void* userData, std::int64_t const* arguments)
+{
+	auto const& table = *static_cast<std::array<std::int64_t, 4> const*>(userData);
+	return table.at(static_cast<std::size_t>(arguments[0])) * arguments[1];// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+struct CallingThreads
+{
+	std::mutex mutex;
+	std::vector<std::thread::id> ids;
+};
+
+std::int64_t recordThread(void* userData, std::int64_t const* arguments)
+{
+	auto& threads = *static_cast<CallingThreads*>(userData);
+	std::scoped_lock const lock(threads.mutex);
+	threads.ids.push_back(std::this_thread::get_id());
+	return arguments[0];// NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+std::uint64_t statisticValue(std::string_view pass, std::string_view description)
+{
+	std::vector<jereq::StatisticValue> const statistics = jereq::collectStatistics();
+	auto const it = std::ranges::find_if(statistics, [&](jereq::StatisticValue const& statistic) {
+		return statistic.pass == pass && statistic.description == description;
+	});
+	REQUIRE(it != statistics.end());
+	return it->value;
+}
+
+struct OperatorCase
+{
+	std::string_view symbol;
+	std::int64_t (*apply)(std::int64_t lhs, std::int64_t rhs);
+	bool comparison = false;
+};
+
+/// Writes an operand of each kind the kernels specialize on: a literal, a local or a subexpression.
+std::string operandSource(std::size_t kind, std::string_view local, std::int64_t value, std::string_view type)
+{
+	switch (kind)
+	{
+	case 0:
+		return std::to_string(value) + std::string(type);
+	case 1:
+		return std::string(local);
+	default:
+		return "(" + std::string(local) + " * 1" + std::string(type) + ")";
+	}
+}
+}
 
 TEST_CASE("Interpreter should execute minimal AST", "[interpreter]")
 {
@@ -34,3 +106,622 @@ TEST_CASE("Interpreter should execute minimal AST", "[interpreter]")
 
 	REQUIRE(jereq::execute(program) == 0);
 }
+
+TEST_CASE("Interpreter should divide by constants with truncation", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = check(in x: -7i32);
+};
+
+def check = fun(in x: i32, out result: i32)
+{
+    result = ((x / 7i32) * 1000000i32) + ((x % 7i32) * 10000i32) + ((x / -4i32) * 100i32) + (x % 3i32);
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == (-7 / 7) * 1000000 + (-7 % 7) * 10000 + (-7 / -4) * 100 + -7 % 3);
+}
+
+TEST_CASE("Interpreter should report division by zero", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = divide(in x: 0i32);
+};
+
+def divide = fun(in x: i32, out result: i32)
+{
+    result = 10i32 / x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE_THROWS_AS(jereq::execute(program), std::runtime_error);
+}
+
+TEST_CASE("Interpreter should record a profile", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = square(in x: 3i32);
+};
+
+def square = fun(in x: i32, out result: i32)
+{
+    result = x * x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::Profile profile;
+	REQUIRE(jereq::execute(program, { &profile }) == 9);
+	REQUIRE(profile.callCount("main") == 1);
+	REQUIRE(profile.callCount("square") == 1);
+
+	jereq::CallSiteProfile const* callSite = profile.findCallSite("main", 0);
+	REQUIRE(callSite != nullptr);
+	REQUIRE(callSite->count == 1);
+	REQUIRE(callSite->arguments.at("x").firstValue == 3);
+}
+
+TEST_CASE("Interpreter should evaluate expensive calls in parallel", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = (square(in x: 3i32) + square(in x: 4i32)) - (square(in x: 2i32) * square(in x: 1i32));
+};
+
+def square = fun(in x: i32, out result: i32)
+{
+    result = x * x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::ExecuteOptions options;
+	options.parallelWorkers = 2;
+	options.parallelCostThreshold = 0;
+	REQUIRE(jereq::execute(program, options) == 21);
+}
+
+TEST_CASE("Interpreter should evaluate calls with loops in their indices serially", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let a: [3]i32 = [1i32, 2i32, 3i32] in
+        (square(in x: a[1i32]) + square(in x: a[2i32]))
+        - (cube(in x: a[0i32]) + cube(in x: a[loop i from 0i32 to 2i32 with n = 0i32 { n + 1i32 }]));
+};
+
+def square = fun(in x: i32, out result: i32)
+{
+    result = x * x;
+};
+
+def cube = fun(in x: i32, out result: i32)
+{
+    result = (x * x) * x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	// The loop pushes locals onto the caller's frame, so its operand pair must not be split across workers. Only
+	// operands evaluated by a worker get a span named after the callee.
+	jereq::Tracer tracer;
+	jereq::ExecuteOptions options;
+	options.parallelWorkers = 2;
+	options.parallelCostThreshold = 0;
+	options.tracer = &tracer;
+	REQUIRE(jereq::execute(program, options) == -15);
+
+	std::ostringstream out;
+	tracer.writeTraceEvents(out);
+	REQUIRE(out.str().find(R"("name":"square")") != std::string::npos);
+	REQUIRE(out.str().find(R"("name":"cube")") == std::string::npos);
+}
+
+TEST_CASE("Interpreter should report the first error of parallel calls", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = divide(in x: 0i32) + overflow(in x: -1i32);
+};
+
+def divide = fun(in x: i32, out result: i32)
+{
+    result = 10i32 / x;
+};
+
+def overflow = fun(in x: i32, out result: i32)
+{
+    result = (-2147483647i32 - 1i32) / x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::ExecuteOptions options;
+	options.parallelWorkers = 2;
+	options.parallelCostThreshold = 0;
+	for (int i = 0; i < 20; ++i)
+	{
+		REQUIRE_THROWS_WITH(jereq::execute(program, options), "Integer division by zero");
+	}
+}
+
+TEST_CASE("Interpreter should call host functions from the calling thread only", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = direct(in x: 1i32) + indirect(in x: 2i32);
+};
+
+def direct = fun(in x: i32, out result: i32)
+{
+    result = record(in x: x * 3i32);
+};
+
+def indirect = fun(in x: i32, out result: i32)
+{
+    result = direct(in x: x) + 1i32;
+};)";
+	CallingThreads threads;
+	std::array<jereq::HostFunctionDeclaration, 1> const hostFunctions{ jereq::HostFunctionDeclaration{
+		"record", "fun(in x: i32, out result: i32)", &recordThread, &threads } };
+	jereq::Program const program = jereq::parse(input, "test name", hostFunctions);
+
+	jereq::ExecuteOptions options;
+	options.parallelWorkers = 2;
+	options.parallelCostThreshold = 0;
+	REQUIRE(jereq::execute(program, options) == 10);
+	REQUIRE(threads.ids.size() == 2);
+	REQUIRE(std::ranges::all_of(threads.ids, [](std::thread::id id) { return id == std::this_thread::get_id(); }));
+}
+
+TEST_CASE("Closure engine should match the tree walker", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = (square(in x: 7i32) - (halve(in x: -9i32) * 3i32)) % 23i32;
+};
+
+def square = fun(in x: i32, out result: i32)
+{
+    result = x * x;
+};
+
+def halve = fun(in x: i32, out result: i32)
+{
+    result = (x / 2i32) + (x % 2i32);
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == jereq::execute(program));
+	REQUIRE(jereq::execute(program, options) == 18);
+}
+
+TEST_CASE("Closure engine should report division by zero", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = divide(in x: 0i32);
+};
+
+def divide = fun(in x: i32, out result: i32)
+{
+    result = 10i32 / x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE_THROWS_WITH(jereq::execute(program, options), "Integer division by zero");
+}
+
+TEST_CASE("Interpreter should run counted loops", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = factorial(in n: 5i32) + loop i from 0i32 to 4i32 with sum = 100i32 { sum + (i * i) };
+};
+
+def factorial = fun(in n: i32, out result: i32)
+{
+    result = loop i from 1i32 to (n + 1i32) with product = 1i32 { product * i };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == 120 + 100 + 0 + 1 + 4 + 9);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 120 + 100 + 0 + 1 + 4 + 9);
+}
+
+TEST_CASE("Interpreter should evaluate comparisons and conditionals", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = (factorial(in n: 5i32) * 100i32) + clamp(in x: -42i32) + ((3i32 <= 3i32) * 1000000i32);
+};
+
+def factorial = fun(in n: i32, out result: i32)
+{
+    result = if n <= 1i32 then 1i32 else n * factorial(in n: n - 1i32);
+};
+
+def clamp = fun(in x: i32, out result: i32)
+{
+    result = if x < 0i32 then 0i32 - x else if x > 50i32 then 50i32 else x;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == 1000000 + 12000 + 42);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 1000000 + 12000 + 42);
+}
+
+TEST_CASE("Interpreter should index fixed-size arrays", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let primes: [4]i32 = [2i32, 3i32, 5i32, 7i32] in (primes[3i32] * 1000i32) + sumOfSquares(in n: 5i32);
+};
+
+def sumOfSquares = fun(in n: i32, out result: i32)
+{
+    result = let squares: [5]i32 = [for i: i * i] in loop i from 0i32 to n with sum = 0i32 { sum + squares[i] };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == 7000 + 0 + 1 + 4 + 9 + 16);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 7000 + 0 + 1 + 4 + 9 + 16);
+}
+
+TEST_CASE("Interpreter should report array indices out of bounds", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let a: [3]i32 = [1i32, 2i32, 3i32] in a[(a[2i32] + 1i32)];
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE_THROWS_WITH(jereq::execute(program), "Index 4 out of bounds for array \"a\"");
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE_THROWS_WITH(jereq::execute(program, options), "Index 4 out of bounds for array \"a\"");
+}
+
+TEST_CASE("Interpreter should compute with i64 values", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = if sumOfSquares(in n: 100000i64) == 333328333350000i64 then 1i32 else 0i32;
+};
+
+def sumOfSquares = fun(in n: i64, out result: i64)
+{
+    result = loop i from 0i64 to n with sum = 0i64 { sum + (i * i) };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == 1);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 1);
+
+	REQUIRE_THROWS_WITH(
+		jereq::execute(jereq::parse("def main = fun(out exitCode: i32) { exitCode = 1i64 + 2i32; };", "test name")),
+		"Type mismatch in \"1i64 + 2i32\": i64 and i32");
+}
+
+TEST_CASE("Binary operator kernels should match the generic path for every operand kind", "[interpreter]")
+{
+	std::array const operators{
+		OperatorCase{ "+", [](std::int64_t lhs, std::int64_t rhs) { return lhs + rhs; } },
+		OperatorCase{ "-", [](std::int64_t lhs, std::int64_t rhs) { return lhs - rhs; } },
+		OperatorCase{ "*", [](std::int64_t lhs, std::int64_t rhs) { return lhs * rhs; } },
+		OperatorCase{ "/", [](std::int64_t lhs, std::int64_t rhs) { return lhs / rhs; } },
+		OperatorCase{ "%", [](std::int64_t lhs, std::int64_t rhs) { return lhs % rhs; } },
+		OperatorCase{ "==", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs == rhs; }, true },
+		OperatorCase{ "!=", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs != rhs; }, true },
+		OperatorCase{ "<", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs < rhs; }, true },
+		OperatorCase{ "<=", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs <= rhs; }, true },
+		OperatorCase{ ">", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs > rhs; }, true },
+		OperatorCase{ ">=", [](std::int64_t lhs, std::int64_t rhs) -> std::int64_t { return lhs >= rhs; }, true },
+	};
+	struct Operands
+	{
+		std::string_view type;
+		std::int64_t lhs;
+		std::int64_t rhs;
+	};
+
+	for (auto const& [type, lhs, rhs] : { Operands{ "i32", -17, 5 }, Operands{ "i64", -17'000'000'003, 5 } })
+	{
+		for (OperatorCase const& op : operators)
+		{
+			std::string_view const resultType = op.comparison ? "i32" : type;
+			for (std::size_t lhsKind = 0; lhsKind < 3; ++lhsKind)
+			{
+				for (std::size_t rhsKind = 0; rhsKind < 3; ++rhsKind)
+				{
+					std::string const source = "def main = fun(out exitCode: i32) { exitCode = if "
+											 + std::to_string(op.apply(lhs, rhs)) + std::string(resultType)
+											 + " == compute(in x: " + std::to_string(lhs) + std::string(type)
+											 + ", in y: " + std::to_string(rhs) + std::string(type)
+											 + ") then 1i32 else 0i32; };\n"
+											 + "def compute = fun(in x: " + std::string(type) + ", in y: "
+											 + std::string(type) + ", out result: " + std::string(resultType)
+											 + ") { result = " + operandSource(lhsKind, "x", lhs, type) + " "
+											 + std::string(op.symbol) + " " + operandSource(rhsKind, "y", rhs, type)
+											 + "; };";
+					CAPTURE(source);
+
+					jereq::Program const program = jereq::parse(source, "test name");
+					REQUIRE(jereq::execute(program) == 1);
+
+					// Without numbered operators, every operator takes the generic path.
+					jereq::Program unnumbered = jereq::parse(source, "test name");
+					unnumbered.binaryOperatorCount = 0;
+					REQUIRE(jereq::execute(unnumbered) == 1);
+
+					jereq::ExecuteOptions options;
+					options.engine = jereq::InterpreterEngine::closures;
+					REQUIRE(jereq::execute(program, options) == 1);
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("Binary operator kernels should count and trace the operands they read", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = increment(in x: 41i32);
+};
+
+def increment = fun(in x: i32, out result: i32)
+{
+    result = x + 1i32;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	auto const& assignment = std::get<jereq::InitAssignment>(program.functions[1]->expression.expr);
+	auto const& sum = std::get<jereq::BinaryOpExpression>(assignment.value->expr);
+
+	std::uint64_t const evaluatedBefore = statisticValue("interpreter", "Expressions evaluated by the tree walker");
+	jereq::ExecutionTrace trace(64);
+	jereq::ExecuteOptions options;
+	options.trace = &trace;
+	REQUIRE(jereq::execute(program, options) == 42);
+
+	std::vector<jereq::ExecutionTrace::Event> evaluations = trace.recentEvents();
+	std::erase_if(evaluations, [](jereq::ExecutionTrace::Event const& event) {
+		return event.kind != jereq::ExecutionTrace::EventKind::evaluation;
+	});
+	REQUIRE(statisticValue("interpreter", "Expressions evaluated by the tree walker")
+			== evaluatedBefore + evaluations.size());
+
+	auto const lhsIt = std::ranges::find(evaluations, sum.lhs.get(), &jereq::ExecutionTrace::Event::expression);
+	REQUIRE(lhsIt != evaluations.end());
+	REQUIRE(lhsIt->value == 41);
+	REQUIRE((lhsIt + 1)->expression == sum.rhs.get());
+	REQUIRE((lhsIt + 1)->value == 1);
+	REQUIRE((lhsIt + 2)->expression == assignment.value.get());
+	REQUIRE((lhsIt + 2)->value == 42);
+}
+
+TEST_CASE("Interpreter should wrap around on overflow", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = (increment(in x: 2147483647i32) == (-2147483647i32 - 1i32))
+        + ((square(in x: 4294967296i64) == 0i64) * 10i32)
+        + ((decrement(in x: -9223372036854775807i64 - 1i64) == 9223372036854775807i64) * 100i32);
+};
+
+def increment = fun(in x: i32, out result: i32)
+{
+    result = x + 1i32;
+};
+
+def square = fun(in x: i64, out result: i64)
+{
+    result = x * x;
+};
+
+def decrement = fun(in x: i64, out result: i64)
+{
+    result = x - 1i64;
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	REQUIRE(jereq::execute(program) == 111);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 111);
+}
+
+TEST_CASE("Interpreter should call host functions", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to 4i32 with sum = 0i32 { sum + lookup(in scale: 10i32, in key: i) };
+};)";
+	std::array<std::int64_t, 4> table{ 1, 2, 3, 4 };
+	std::array<jereq::HostFunctionDeclaration, 1> const hostFunctions{ jereq::HostFunctionDeclaration{
+		"lookup", "fun(in key: i32, in scale: i32, out value: i32)", &lookupScaled, &table } };
+	jereq::Program const program = jereq::parse(input, "test name", hostFunctions);
+
+	REQUIRE(jereq::execute(program) == 100);
+
+	jereq::ExecuteOptions options;
+	options.engine = jereq::InterpreterEngine::closures;
+	REQUIRE(jereq::execute(program, options) == 100);
+
+	REQUIRE_THROWS_WITH(jereq::execute(jereq::parse(
+							"def main = fun(out exitCode: i32) { exitCode = lookup(in key: 1i32); };", "test name", hostFunctions)),
+		"No arg provided for param  \"scale\"");
+	REQUIRE_THROWS_AS(jereq::parse("def lookup = fun(out exitCode: i32) { exitCode = 0i32; };", "test name", hostFunctions),
+		std::runtime_error);
+}
+
+TEST_CASE("Scheduler should interleave executions", "[interpreter]")
+{
+	jereq::Program const slow = jereq::parse(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to 100000i32 with sum = 0i32 { (sum + triple(in x: i)) % 1000i32 };
+};
+
+def triple = fun(in x: i32, out result: i32)
+{
+    result = x * 3i32;
+};)",
+		"slow");
+	jereq::Program const quick = jereq::parse(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let a: [4]i32 = [for i: triple(in x: i)] in if a[3i32] > 5i32 then a[2i32] else 0i32;
+};
+
+def triple = fun(in x: i32, out result: i32)
+{
+    result = x * 3i32;
+};)",
+		"quick");
+	jereq::Program const failing = jereq::parse(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let a: [3]i32 = [1i32, 2i32, 3i32] in a[loop i from 0i32 to 3i32 with n = 1i32 { n + 1i32 }];
+};)",
+		"failing");
+
+	jereq::Scheduler scheduler(100);
+	std::size_t const slowExecution = scheduler.submit(slow);
+	std::size_t const quickExecution = scheduler.submit(quick);
+	std::size_t const failingExecution = scheduler.submit(failing);
+	REQUIRE_THROWS_WITH(scheduler.result(quickExecution), "Execution 1 has not finished");
+
+	while (!scheduler.finished(quickExecution))
+	{
+		REQUIRE(scheduler.step());
+	}
+	REQUIRE_FALSE(scheduler.finished(slowExecution));
+	REQUIRE(scheduler.result(quickExecution) == jereq::execute(quick));
+
+	scheduler.run();
+	REQUIRE_FALSE(scheduler.step());
+	REQUIRE(scheduler.result(slowExecution) == jereq::execute(slow));
+	REQUIRE_THROWS_WITH(scheduler.result(failingExecution), "Index 4 out of bounds for array \"a\"");
+
+	jereq::Scheduler singleUnit(1);
+	std::size_t const again = singleUnit.submit(quick);
+	singleUnit.run();
+	REQUIRE(singleUnit.result(again) == jereq::execute(quick));
+}
+
+TEST_CASE("Sampling profiler should record folded call stacks", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to 200i32 with sum = 0i32 { (sum + work(in x: i)) % 1000i32 };
+};
+
+def work = fun(in x: i32, out result: i32)
+{
+    result = loop j from 0i32 to 50i32 with acc = x { ((acc * 3i32) + j) % 1009i32 };
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+	std::int32_t const expected = jereq::execute(program);
+
+	for (auto const engine : { jereq::InterpreterEngine::treeWalker, jereq::InterpreterEngine::closures })
+	{
+		jereq::SamplingProfiler sampler(std::chrono::microseconds(50));
+		jereq::ExecuteOptions options;
+		options.engine = engine;
+		options.sampler = &sampler;
+		while (sampler.sampleCount() < 20)
+		{
+			REQUIRE(jereq::execute(program, options) == expected);
+		}
+
+		std::ostringstream folded;
+		sampler.writeFoldedStacks(folded);
+		REQUIRE(folded.str().find("main;work ") != std::string::npos);
+		std::istringstream lines(folded.str());
+		for (std::string line; std::getline(lines, line);)
+		{
+			REQUIRE((line.starts_with("main ") || line.starts_with("main;work ")));
+		}
+	}
+}
+
+TEST_CASE("Execution trace should keep the events leading up to an error", "[interpreter]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to 10i32 with sum = 0i32 { sum + ratio(in x: i) };
+};
+
+def ratio = fun(in x: i32, out result: i32)
+{
+    result = 100i32 / (x - 7i32);
+};)";
+	jereq::Program const program = jereq::parse(input, "test name");
+
+	jereq::ExecutionTrace treeWalkerTrace(16);
+	jereq::ExecuteOptions options;
+	options.trace = &treeWalkerTrace;
+	REQUIRE_THROWS_AS(jereq::execute(program, options), std::runtime_error);
+
+	REQUIRE(treeWalkerTrace.recordedCount() > 16);
+	std::vector<jereq::ExecutionTrace::Event> const events = treeWalkerTrace.recentEvents();
+	REQUIRE(events.size() == 16);
+	jereq::ExecutionTrace::Event const& divisor = events.back();
+	REQUIRE(divisor.kind == jereq::ExecutionTrace::EventKind::evaluation);
+	REQUIRE(divisor.function->name == "ratio");
+	REQUIRE(divisor.value == 0);
+	REQUIRE(program.lines.locate(divisor.expression->sourceOffset.value()) == std::pair<std::size_t, std::size_t>{ 9, 24 });
+
+	std::ostringstream written;
+	treeWalkerTrace.write(written, program);
+	REQUIRE(written.str().ends_with("evaluate in ratio = 0 at test name:9:24\n"));
+
+	// The closure engine records calls and returns.
+	jereq::ExecutionTrace closureTrace(4);
+	options.engine = jereq::InterpreterEngine::closures;
+	options.trace = &closureTrace;
+	REQUIRE_THROWS_AS(jereq::execute(program, options), std::runtime_error);
+	std::vector<jereq::ExecutionTrace::Event> const calls = closureTrace.recentEvents();
+	REQUIRE(calls.size() == 4);
+	REQUIRE(calls.back().kind == jereq::ExecutionTrace::EventKind::call);
+	REQUIRE(calls.back().function->name == "ratio");
+	REQUIRE(calls.back().value == 7);
+	REQUIRE(calls[2].kind == jereq::ExecutionTrace::EventKind::ret);
+}
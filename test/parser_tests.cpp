@@ -6,6 +6,11 @@
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <variant>
+
 #include <string_view>
 
 TEST_CASE("Parser should handle minimal program", "[parser]")
@@ -18,3 +23,59 @@ TEST_CASE("Parser should handle minimal program", "[parser]")
 	REQUIRE(program.mainFunction == program.functions.at(0));
 	REQUIRE(program.mainFunction->name == "main");
 }
+
+TEST_CASE("Parser should fold constant definitions", "[parser]")
+{
+	std::string_view const input = R"(
+def width = 16i32;
+def area = if width > 8i32 then width * width else 0i32;
+def main = fun(out exitCode: i32) { exitCode = area - 1i32; };)";
+	jereq::Program program = jereq::parse(input, "test name");
+
+	REQUIRE(program.functions.size() == 1);
+	REQUIRE(program.constants.at("width").value == 16);
+	REQUIRE(program.constants.at("area").value == 256);
+
+	auto const& assignment = std::get<jereq::InitAssignment>(program.mainFunction->expression.expr);
+	auto const& difference = std::get<jereq::BinaryOpExpression>(assignment.value->expr);
+	REQUIRE(std::get<jereq::Literal>(difference.lhs->expr).value == 256);
+
+	REQUIRE_THROWS_AS(jereq::parse("def zero = 0i32; def bad = 1i32 / zero;", "test name"), std::runtime_error);
+	REQUIRE_THROWS_AS(jereq::parse("def n = 1i32; def main = fun(out exitCode: i32) { exitCode = loop n from 0i32 to 2i32 "
+									"with s = 0i32 { s }; };",
+						  "test name"),
+		std::runtime_error);
+}
+
+TEST_CASE("Parser should read i64 literals", "[parser]")
+{
+	std::string_view const input = R"(
+def big = 3000000000i64 * 2i64;
+def main = fun(out exitCode: i32) { exitCode = 0i32; };)";
+	jereq::Program program = jereq::parse(input, "test name");
+
+	REQUIRE(program.constants.at("big").type == jereq::ValueType::i64);
+	REQUIRE(program.constants.at("big").value == 6000000000);
+
+	REQUIRE_THROWS_AS(jereq::parse("def big = 3000000000i32;", "test name"), std::runtime_error);
+	REQUIRE_THROWS_AS(jereq::parse("def mixed = 1i64 + 2i32;", "test name"), std::runtime_error);
+}
+
+TEST_CASE("Parser should record where expressions start", "[parser]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = 1i32 +
+        2i32;
+};)";
+	jereq::Program program = jereq::parse(input, "test name");
+
+	REQUIRE(program.sourceName == "test name");
+	auto const& assignment = std::get<jereq::InitAssignment>(program.mainFunction->expression.expr);
+	auto const& sum = std::get<jereq::BinaryOpExpression>(assignment.value->expr);
+	using Position = std::pair<std::size_t, std::size_t>;
+	REQUIRE(program.lines.locate(program.mainFunction->expression.sourceOffset.value()) == Position{ 4, 5 });
+	REQUIRE(program.lines.locate(assignment.value->sourceOffset.value()) == Position{ 4, 16 });
+	REQUIRE(program.lines.locate(sum.rhs->sourceOffset.value()) == Position{ 5, 9 });
+}
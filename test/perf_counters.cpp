@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "perf_counters.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace jereq::benchmarks
+{
+namespace
+{
+constexpr std::array<std::string_view, PerfCounters::eventCount> eventNames{
+	"cycles",
+	"instructions",
+	"branch misses",
+	"cache misses",
+};
+
+#ifdef __linux__
+constexpr std::array<std::uint64_t, PerfCounters::eventCount> eventConfigs{
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+// Opens a disabled counter of user space on the calling thread, or returns -1 if the event is not available.
+int openCounter(std::uint64_t config)
+{
+	perf_event_attr attributes{};
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = config;
+	attributes.disabled = 1;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+
+// Reads a counter, scaling the count by how long it was enabled relative to how long it was counting.
+std::optional<std::uint64_t> readCounter(int descriptor)
+{
+	struct
+	{
+		std::uint64_t value;
+		std::uint64_t timeEnabled;
+		std::uint64_t timeRunning;
+	} data{};
+	if (read(descriptor, &data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data.timeRunning == 0)
+	{
+		return std::nullopt;
+	}
+	if (data.timeRunning == data.timeEnabled)
+	{
+		return data.value;
+	}
+	return static_cast<std::uint64_t>(static_cast<double>(data.value) * static_cast<double>(data.timeEnabled)
+									  / static_cast<double>(data.timeRunning));
+}
+#endif
+}
+
+PerfCounters::PerfCounters()
+{
+	descriptors.fill(-1);
+#ifdef __linux__
+	for (std::size_t event = 0; event < eventCount; ++event)
+	{
+		descriptors[event] = openCounter(eventConfigs[event]);
+	}
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+	for (int const descriptor : descriptors)
+	{
+		if (descriptor >= 0)
+		{
+			close(descriptor);
+		}
+	}
+#endif
+}
+
+bool PerfCounters::available() const
+{
+	return std::ranges::any_of(descriptors, [](int descriptor) { return descriptor >= 0; });
+}
+
+void PerfCounters::start()
+{
+#ifdef __linux__
+	for (int const descriptor : descriptors)
+	{
+		if (descriptor >= 0)
+		{
+			ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+			ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+PerfCounters::Counts PerfCounters::stop()
+{
+	Counts counts;
+#ifdef __linux__
+	for (int const descriptor : descriptors)
+	{
+		if (descriptor >= 0)
+		{
+			ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (std::size_t event = 0; event < eventCount; ++event)
+	{
+		if (descriptors[event] >= 0)
+		{
+			counts[event] = readCounter(descriptors[event]);
+		}
+	}
+#endif
+	return counts;
+}
+
+bool PerfCounters::requested()
+{
+	return std::getenv("HOBBY_BENCHMARK_COUNTERS") != nullptr; // NOLINT(concurrency-mt-unsafe)
+}
+
+void reportCounters(std::string_view name, PerfCounters::Counts const& counts, std::uint64_t iterations)
+{
+	std::string line = fmt::format("{} counters per iteration:", name);
+	for (std::size_t event = 0; event < PerfCounters::eventCount; ++event)
+	{
+		if (counts[event])
+		{
+			line += fmt::format(" {} {},", *counts[event] / iterations, eventNames[event]);
+		}
+		else
+		{
+			line += fmt::format(" {} unavailable,", eventNames[event]);
+		}
+	}
+	line.pop_back();
+	fmt::print("{}\n", line);
+}
+}
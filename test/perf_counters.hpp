@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace jereq::benchmarks
+{
+/// Hardware counters of the calling thread, read through perf_event_open on Linux. Counters the kernel or hardware
+/// does not provide, as is common in containers and virtual machines, are left out instead of failing the benchmarks.
+class PerfCounters
+{
+public:
+	enum struct Event : std::size_t
+	{
+		cycles,
+		instructions,
+		branchMisses,
+		cacheMisses,
+	};
+	static constexpr std::size_t eventCount = 4;
+
+	/// Counts of one measurement, scaled up for the time a counter was not scheduled when the kernel multiplexes them.
+	using Counts = std::array<std::optional<std::uint64_t>, eventCount>;
+
+	PerfCounters();
+	PerfCounters(PerfCounters const&) = delete;
+	PerfCounters(PerfCounters&&) = delete;
+	PerfCounters& operator=(PerfCounters const&) = delete;
+	PerfCounters& operator=(PerfCounters&&) = delete;
+	~PerfCounters();
+
+	/// Whether any counter could be opened.
+	[[nodiscard]] bool available() const;
+
+	/// Resets and enables the counters.
+	void start();
+	/// Disables the counters and reads them.
+	Counts stop();
+
+	/// Whether the benchmarks should collect counters, which they do when HOBBY_BENCHMARK_COUNTERS is set.
+	static bool requested();
+
+private:
+	std::array<int, eventCount> descriptors{};
+};
+
+/// Writes counts divided by the number of iterations they were collected over, next to the name of the benchmark.
+void reportCounters(std::string_view name, PerfCounters::Counts const& counts, std::uint64_t iterations);
+
+/// Runs a benchmark body under the counters if they were requested and are available, reporting the average counts.
+/// Meant to sit next to the BENCHMARK of the same body, which reports the timings.
+template<typename Body>
+void measureCounters(std::string_view name, Body&& body, std::uint64_t iterations = 100)
+{
+	if (!PerfCounters::requested())
+	{
+		return;
+	}
+	PerfCounters counters;
+	if (!counters.available())
+	{
+		reportCounters(name, {}, iterations);
+		return;
+	}
+	body(); // Warm up caches and branch predictors like the timed runs do.
+	counters.start();
+	for (std::uint64_t iteration = 0; iteration < iterations; ++iteration)
+	{
+		[[maybe_unused]] auto volatile result = body();
+	}
+	reportCounters(name, counters.stop(), iterations);
+}
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include "perf_counters.hpp"
+
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/parser/parser.hpp>
+#include <hobbylang/wasm/wasm.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sstream>
+#include <string>
+
+namespace
+{
+/// A chain of functions, each calling the previous one from a loop, 4^length calls deep.
+std::string functionChainSource(int length)
+{
+	std::string source = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = f)" + std::to_string(length)
+					   + R"((in x: 3i32) % 256i32;
+};
+
+def f0 = fun(in x: i32, out result: i32)
+{
+    result = (x * 5i32) + 1i32;
+};
+)";
+	for (int index = 1; index <= length; ++index)
+	{
+		std::string const callee = "f" + std::to_string(index - 1);
+		source += "\ndef f" + std::to_string(index) + " = fun(in x: i32, out result: i32)\n{\n"
+				+ "    result = loop i from 0i32 to 4i32 with sum = x { (sum + " + callee + "(in x: i)) % 1000i32 };\n};\n";
+	}
+	return source;
+}
+}
+
+// Set HOBBY_BENCHMARK_COUNTERS to also report hardware counters for each stage.
+TEST_CASE("Pipeline stages", "[!benchmark]")
+{
+	std::string const source = functionChainSource(5);
+	jereq::Program const program = jereq::parse(source, "benchmark");
+	auto const parse = [&] { return jereq::parse(source, "benchmark").functions.size(); };
+	auto const execute = [&] { return jereq::execute(program); };
+	auto const compile = [&] {
+		std::ostringstream out;
+		return jereq::compile(program, out);
+	};
+	REQUIRE(compile());
+
+	BENCHMARK("parse")
+	{
+		return parse();
+	};
+	jereq::benchmarks::measureCounters("parse", parse);
+	BENCHMARK("execute")
+	{
+		return execute();
+	};
+	jereq::benchmarks::measureCounters("execute", execute);
+	BENCHMARK("compile")
+	{
+		return compile();
+	};
+	jereq::benchmarks::measureCounters("compile", compile);
+}
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/interpreter/interpreter.hpp>
+#include <hobbylang/parser/parser.hpp>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+std::string loopSource(int iterations)
+{
+	return R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to )"
+		   + std::to_string(iterations) + R"(i32 with sum = 0i32 { (sum + step(in x: i)) % 1000i32 };
+};
+
+def step = fun(in x: i32, out result: i32)
+{
+    result = (x * 3i32) + 1i32;
+};
+)";
+}
+
+/// Submits a burst of evaluations where every hundredth one is slow, and reports the latency of the rest from the start
+/// of the burst, so that a slow evaluation ahead of them in the queue shows in the tail.
+struct Burst
+{
+	jereq::Program quick = jereq::parse(loopSource(20), "quick");
+	jereq::Program slow = jereq::parse(loopSource(20'000), "slow");
+	std::size_t size = 1'000;
+
+	[[nodiscard]] bool isSlow(std::size_t index) const { return index % 100 == 0; }
+	[[nodiscard]] jereq::Program const& program(std::size_t index) const { return isSlow(index) ? slow : quick; }
+};
+
+void reportPercentiles(std::string const& name, std::vector<Clock::duration> latencies)
+{
+	std::ranges::sort(latencies);
+	auto const percentile = [&](std::size_t percent) {
+		std::size_t const index = std::min(latencies.size() - 1, latencies.size() * percent / 100);
+		return std::chrono::duration_cast<std::chrono::microseconds>(latencies[index]).count();
+	};
+	fmt::print("{}: p50 {} us, p90 {} us, p99 {} us, max {} us\n",
+		name,
+		percentile(50),
+		percentile(90),
+		percentile(99),
+		percentile(100));
+}
+}
+
+TEST_CASE("Scheduler latency", "[!benchmark]")
+{
+	Burst const burst;
+
+	// Run to completion one at a time, in submission order.
+	std::vector<Clock::duration> sequential;
+	Clock::time_point const sequentialStart = Clock::now();
+	for (std::size_t index = 0; index < burst.size; ++index)
+	{
+		REQUIRE(jereq::execute(burst.program(index)) >= 0);
+		if (!burst.isSlow(index))
+		{
+			sequential.push_back(Clock::now() - sequentialStart);
+		}
+	}
+	reportPercentiles("sequential", sequential);
+
+	for (std::uint64_t const fuelPerSlice : { 100U, 1'000U, 10'000U })
+	{
+		jereq::Scheduler scheduler(fuelPerSlice);
+		Clock::time_point const start = Clock::now();
+		for (std::size_t index = 0; index < burst.size; ++index)
+		{
+			scheduler.submit(burst.program(index));
+		}
+
+		std::vector<Clock::duration> scheduled;
+		while (std::optional<std::size_t> const execution = scheduler.step())
+		{
+			if (scheduler.finished(*execution) && !burst.isSlow(*execution))
+			{
+				scheduled.push_back(Clock::now() - start);
+			}
+		}
+		reportPercentiles(fmt::format("scheduled, {} fuel per slice", fuelPerSlice), scheduled);
+	}
+
+	BENCHMARK("slow evaluation, execute")
+	{
+		return jereq::execute(burst.slow);
+	};
+	BENCHMARK("slow evaluation, scheduled")
+	{
+		jereq::Scheduler scheduler;
+		std::size_t const execution = scheduler.submit(burst.slow);
+		scheduler.run();
+		return scheduler.result(execution);
+	};
+}
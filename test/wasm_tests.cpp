@@ -0,0 +1,864 @@
+// SPDX-License-Identifier: MIT
+// Copyright © 2023 Sebastian Larsson
+
+#include <hobbylang/analysis/profile.hpp>
+#include <hobbylang/ast/ast.hpp>
+#include <hobbylang/parser/parser.hpp>
+#include <hobbylang/wasm/wasm.hpp>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace
+{
+std::string compileSource(std::string_view source, jereq::CompileOptions const& options = {})
+{
+	jereq::Program const program = jereq::parse(source, "test name");
+	std::ostringstream out;
+	REQUIRE(jereq::compile(program, out, options));
+	return out.str();
+}
+
+std::uint32_t readULEB128(std::string_view bytes, std::size_t& offset)
+{
+	std::uint32_t value = 0;
+	for (std::uint32_t shift = 0;; shift += 7)
+	{
+		auto const byte = static_cast<std::uint8_t>(bytes.at(offset++));
+		value |= static_cast<std::uint32_t>(byte & 0x7FU) << shift;
+		if ((byte & 0x80U) == 0)
+		{
+			return value;
+		}
+	}
+}
+
+/// Contents of the sections of a module, by id, and of its custom sections, by name.
+struct Sections
+{
+	std::map<std::uint8_t, std::string_view> standard;
+	std::map<std::string_view, std::string_view, std::less<>> custom;
+};
+
+Sections readSections(std::string_view module)
+{
+	REQUIRE(module.substr(0, 8) == std::string_view("\0asm\1\0\0\0", 8));
+
+	Sections sections;
+	std::size_t offset = 8;
+	while (offset < module.size())
+	{
+		auto const id = static_cast<std::uint8_t>(module[offset++]);
+		std::uint32_t const size = readULEB128(module, offset);
+		std::string_view const contents = module.substr(offset, size);
+		REQUIRE(contents.size() == size);
+		offset += size;
+
+		if (id == 0)
+		{
+			std::size_t nameOffset = 0;
+			std::uint32_t const nameLength = readULEB128(contents, nameOffset);
+			sections.custom.emplace(contents.substr(nameOffset, nameLength), contents.substr(nameOffset + nameLength));
+		}
+		else
+		{
+			sections.standard.emplace(id, contents);
+		}
+	}
+	return sections;
+}
+
+/// Function indices of the exports in an export section, by name.
+std::map<std::string_view, std::uint32_t, std::less<>> readFunctionExports(std::string_view exports)
+{
+	std::map<std::string_view, std::uint32_t, std::less<>> functions;
+	std::size_t offset = 0;
+	std::uint32_t const count = readULEB128(exports, offset);
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		std::uint32_t const nameLength = readULEB128(exports, offset);
+		std::string_view const name = exports.substr(offset, nameLength);
+		offset += nameLength;
+		auto const kind = static_cast<std::uint8_t>(exports.at(offset++));
+		std::uint32_t const index = readULEB128(exports, offset);
+		if (kind == 0)
+		{
+			functions.emplace(name, index);
+		}
+	}
+	return functions;
+}
+
+std::int32_t readSLEB128(std::string_view bytes, std::size_t& offset)
+{
+	std::int32_t value = 0;
+	for (std::uint32_t shift = 0;; shift += 7)
+	{
+		auto const byte = static_cast<std::uint8_t>(bytes.at(offset++));
+		value |= static_cast<std::int32_t>(static_cast<std::uint32_t>(byte & 0x7FU) << shift);
+		if ((byte & 0x80U) == 0)
+		{
+			if (shift + 7 < 32 && (byte & 0x40U) != 0)
+			{
+				value |= static_cast<std::int32_t>(~0U << (shift + 7));
+			}
+			return value;
+		}
+	}
+}
+
+std::uint32_t readUInt(std::string_view bytes, std::size_t& offset, std::size_t size)
+{
+	std::uint32_t value = 0;
+	for (std::size_t byte = 0; byte < size; ++byte)
+	{
+		value |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(bytes.at(offset++))) << (8 * byte);
+	}
+	return value;
+}
+
+struct LineTableRow
+{
+	std::uint32_t address;
+	std::size_t line;
+	std::size_t column;
+};
+
+/// Runs the DWARF line number program of a .debug_line section, for the opcodes the backend emits, and returns the rows
+/// of all sequences in order.
+std::vector<LineTableRow> decodeDebugLine(std::string_view debugLine)
+{
+	std::size_t offset = 0;
+	std::uint32_t const unitLength = readUInt(debugLine, offset, 4);
+	REQUIRE(unitLength + 4 == debugLine.size());
+	REQUIRE(readUInt(debugLine, offset, 2) == 4);
+	std::uint32_t const headerLength = readUInt(debugLine, offset, 4);
+	offset += headerLength;
+
+	std::vector<LineTableRow> rows;
+	LineTableRow state{ 0, 1, 0 };
+	while (offset < debugLine.size())
+	{
+		auto const opcode = static_cast<std::uint8_t>(debugLine[offset++]);
+		switch (opcode)
+		{
+		case 0x00:
+		{
+			std::uint32_t const length = readULEB128(debugLine, offset);
+			auto const extendedOpcode = static_cast<std::uint8_t>(debugLine.at(offset));
+			if (extendedOpcode == 0x02)
+			{
+				std::size_t addressOffset = offset + 1;
+				state.address = readUInt(debugLine, addressOffset, 4);
+			}
+			else
+			{
+				REQUIRE(extendedOpcode == 0x01);
+				state = { 0, 1, 0 };
+			}
+			offset += length;
+			break;
+		}
+		case 0x01:
+			rows.push_back(state);
+			break;
+		case 0x02:
+			state.address += readULEB128(debugLine, offset);
+			break;
+		case 0x03:
+			state.line = static_cast<std::size_t>(static_cast<std::int64_t>(state.line) + readSLEB128(debugLine, offset));
+			break;
+		case 0x05:
+			state.column = readULEB128(debugLine, offset);
+			break;
+		default:
+			FAIL("Unexpected line number opcode " << static_cast<int>(opcode));
+		}
+	}
+	return rows;
+}
+
+/// The row covering a code address, which is the last one starting at or before it.
+LineTableRow rowAt(std::vector<LineTableRow> const& rows, std::uint32_t address)
+{
+	LineTableRow const* covering = nullptr;
+	for (LineTableRow const& row : rows)
+	{
+		if (row.address <= address && (covering == nullptr || row.address >= covering->address))
+		{
+			covering = &row;
+		}
+	}
+	REQUIRE(covering != nullptr);
+	return *covering;
+}
+
+bool containsBytes(std::string_view haystack, std::initializer_list<std::uint8_t> needle)
+{
+	std::string bytes;
+	for (std::uint8_t const byte : needle)
+	{
+		bytes.push_back(static_cast<char>(byte));
+	}
+	return haystack.find(bytes) != std::string_view::npos;
+}
+
+// Validates the module and compiles it to `wasmModule`. Scripts call instantiate(imports) for the exports and a start
+// function returning the exit code of _start, and expect(condition, message) to fail.
+constexpr std::string_view nodePrelude = R"(
+const bytes = require('fs').readFileSync(process.argv[2]);
+if (!WebAssembly.validate(bytes)) {
+    console.error('Invalid module');
+    process.exit(2);
+}
+const wasmModule = new WebAssembly.Module(bytes);
+const exited = Symbol('exited');
+function instantiate(imports = {}) {
+    let exitCode = null;
+    const procExit = (code) => {
+        exitCode = code;
+        throw exited;
+    };
+    const wasi = { proc_exit: procExit };
+    const instance = new WebAssembly.Instance(wasmModule, { wasi_snapshot_preview1: wasi, ...imports });
+    const start = () => {
+        try {
+            instance.exports._start();
+        } catch (e) {
+            if (e !== exited) {
+                throw e;
+            }
+        }
+        return exitCode;
+    };
+    return { exports: instance.exports, start };
+}
+function expect(condition, message) {
+    if (!condition) {
+        console.error(message);
+        process.exit(1);
+    }
+}
+)";
+
+/// Runs a script against the module with node. Returns whether the module was valid and the script succeeded, or
+/// nothing when node was not found while configuring the build.
+std::optional<bool> runInNode(std::string const& module, std::string_view script)
+{
+#ifdef HOBBY_NODE_EXECUTABLE
+	std::filesystem::path const directory = std::filesystem::temp_directory_path();
+	std::string const name = "hobby_wasm_test_" + std::to_string(std::random_device{}());
+	std::filesystem::path const modulePath = directory / (name + ".wasm");
+	std::filesystem::path const scriptPath = directory / (name + ".cjs");
+	std::ofstream(modulePath, std::ios::binary) << module;
+	std::ofstream(scriptPath) << nodePrelude << script;
+
+	std::string const command
+		= std::string(HOBBY_NODE_EXECUTABLE) + " \"" + scriptPath.string() + "\" \"" + modulePath.string() + "\"";
+	bool const succeeded = std::system(command.c_str()) == 0;// NOLINT(cert-env33-c,concurrency-mt-unsafe)
+	std::filesystem::remove(modulePath);
+	std::filesystem::remove(scriptPath);
+	return succeeded;
+#else
+	static_cast<void>(module);
+	static_cast<void>(script);
+	return std::nullopt;
+#endif
+}
+
+void requireValid(std::string const& module)
+{
+	if (std::optional<bool> const valid = runInNode(module, ""))
+	{
+		REQUIRE(*valid);
+	}
+}
+
+void requireRuns(std::string const& module, std::string_view script)
+{
+	if (std::optional<bool> const succeeded = runInNode(module, script))
+	{
+		REQUIRE(*succeeded);
+	}
+}
+}
+
+TEST_CASE("Batch entry points compute four rows at a time", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = 0i32;
+};
+
+def scale = fun(in x: i32, in y: i32, out result: i32)
+{
+    result = (x * 3i32) + y;
+};)";
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "scale" };
+	options.batchEntryPoints = true;
+	std::string const module = compileSource(input, options);
+
+	Sections const sections = readSections(module);
+	REQUIRE(sections.standard.at(7).find("batch_scale") != std::string_view::npos);
+	REQUIRE(sections.standard.at(7).find("memory") != std::string_view::npos);
+	// i32x4.mul and i32x4.add, behind the SIMD prefix.
+	REQUIRE(containsBytes(sections.standard.at(10), { 0xFD, 0xB5, 0x01 }));
+	REQUIRE(containsBytes(sections.standard.at(10), { 0xFD, 0xAE, 0x01 }));
+
+	// Six rows cover one vector iteration and two scalar ones.
+	requireRuns(module, R"(
+const { exports: wasm } = instantiate();
+const memory = new Int32Array(wasm.memory.buffer);
+memory.set([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, -11, 12], 0);
+wasm.batch_scale(0, 64, 6);
+expect(memory.slice(16, 22).join() === [5, 13, 21, 29, 37, -21].join(), memory.slice(16, 22).join());
+)");
+}
+
+TEST_CASE("Mapped functions get an array loop export", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = 0i32;
+};
+
+def blend = fun(in a: i32, in b: i32, out result: i32)
+{
+    result = (a * 2i32) - b;
+};)";
+	jereq::CompileOptions options;
+	options.mappedFunctions = { "blend" };
+	std::string const module = compileSource(input, options);
+
+	Sections const sections = readSections(module);
+	REQUIRE(sections.standard.at(7).find("map_blend") != std::string_view::npos);
+	REQUIRE(sections.standard.at(7).find("memory") != std::string_view::npos);
+	// The rows are computed one at a time by calling the function.
+	REQUIRE_FALSE(containsBytes(sections.standard.at(10), { 0xFD }));
+
+	requireRuns(module, R"(
+const { exports: wasm } = instantiate();
+const memory = new Int32Array(wasm.memory.buffer);
+memory.set([1, 2, 3, 4, -5, 6], 0);
+wasm.map_blend(0, 64, 3);
+expect(memory.slice(16, 19).join() === [0, 2, -16].join(), memory.slice(16, 19).join());
+)");
+
+	// Unknown names are reported.
+	options.mappedFunctions = { "missing" };
+	jereq::Program const program = jereq::parse(input, "test name");
+	std::ostringstream out;
+	REQUIRE_THROWS_WITH(jereq::compile(program, out, options), "Couldn't find exported function missing");
+}
+
+TEST_CASE("Linear memory is sized from its users and the limits", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = twice(in x: 21i32);
+};
+
+def twice = fun(in x: i32, out result: i32)
+{
+    result = x * 2i32;
+};)";
+
+	std::string const unused = compileSource(input);
+	Sections const unusedSections = readSections(unused);
+	REQUIRE_FALSE(unusedSections.standard.contains(5));
+	REQUIRE(unusedSections.standard.at(7).find("memory") == std::string_view::npos);
+	requireRuns(unused, "expect(instantiate().start() === 42, 'Wrong exit code');");
+
+	// One page without a maximum by default, for one vector of limits.
+	jereq::CompileOptions options;
+	options.mappedFunctions = { "twice" };
+	REQUIRE(readSections(compileSource(input, options)).standard.at(5) == std::string_view("\x01\x00\x01", 3));
+
+	options.initialMemoryPages = 3;
+	options.maximumMemoryPages = 10;
+	std::string const limited = compileSource(input, options);
+	REQUIRE(readSections(limited).standard.at(5) == std::string_view("\x01\x01\x03\x0A", 4));
+	requireRuns(limited, R"(
+const { exports: wasm } = instantiate();
+expect(wasm.memory.buffer.byteLength === 3 * 65536, 'Wrong initial size');
+expect(wasm.memory.grow(7) === 3, 'Could not grow to the maximum');
+let grewPastMaximum = true;
+try {
+    wasm.memory.grow(1);
+} catch (e) {
+    grewPastMaximum = false;
+}
+expect(!grewPastMaximum, 'Grew past the maximum');
+)");
+
+	// Limits alone are enough to get a memory.
+	jereq::CompileOptions limitsOnly;
+	limitsOnly.initialMemoryPages = 2;
+	REQUIRE(readSections(compileSource(input, limitsOnly)).standard.at(5) == std::string_view("\x01\x00\x02", 3));
+
+	options.maximumMemoryPages = 2;
+	jereq::Program const program = jereq::parse(input, "test name");
+	std::ostringstream out;
+	REQUIRE_THROWS_WITH(jereq::compile(program, out, options),
+		"Maximum memory pages must not be less than the initial memory pages");
+}
+
+TEST_CASE("Counted loops become native loops", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = factorial(in n: 5i32) + loop i from 4i32 to 0i32 with sum = 100i32 { sum + i };
+};
+
+def factorial = fun(in n: i32, out result: i32)
+{
+    result = loop i from 1i32 to (n + 1i32) with product = 1i32 { product * i };
+};)";
+	std::string const module = compileSource(input);
+
+	std::string_view const code = readSections(module).standard.at(10);
+	// block, loop, an exit once the counter reaches the end, and a branch back to the loop.
+	REQUIRE(containsBytes(code, { 0x02, 0x40, 0x03, 0x40 }));
+	REQUIRE(containsBytes(code, { 0x4E, 0x0D, 0x01 }));
+	REQUIRE(containsBytes(code, { 0x0C, 0x00, 0x0B, 0x0B }));
+
+	// An empty range leaves the initial accumulator.
+	requireRuns(module, "expect(instantiate().start() === 120 + 100, 'Wrong exit code');");
+}
+
+TEST_CASE("Conditionals with cheap arms become selects", "[wasm]")
+{
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "pick" };
+
+	std::string const cheap = compileSource(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = pick(in x: -42i32);
+};
+
+def pick = fun(in x: i32, out result: i32)
+{
+    result = if x < 0i32 then 0i32 - x else x + 1i32;
+};)",
+		options);
+	std::string_view const cheapCode = readSections(cheap).standard.at(10);
+	REQUIRE(containsBytes(cheapCode, { 0x48, 0x1B }));
+	REQUIRE_FALSE(containsBytes(cheapCode, { 0x04, 0x7F }));
+	requireRuns(cheap, R"(
+const { exports: wasm, start } = instantiate();
+expect(start() === 42, 'Wrong exit code');
+expect(wasm.pick(7) === 8, 'Wrong result for 7');
+)");
+
+	// Arms that may trap are only evaluated when chosen, so they need a branch.
+	std::string const trapping = compileSource(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = pick(in x: 0i32);
+};
+
+def pick = fun(in x: i32, out result: i32)
+{
+    result = if x != 0i32 then 100i32 / x else 0i32;
+};)",
+		options);
+	std::string_view const trappingCode = readSections(trapping).standard.at(10);
+	REQUIRE(containsBytes(trappingCode, { 0x47, 0x04, 0x7F }));
+	REQUIRE(containsBytes(trappingCode, { 0x05 }));
+	REQUIRE_FALSE(containsBytes(trappingCode, { 0x1B }));
+	requireRuns(trapping, R"(
+const { exports: wasm, start } = instantiate();
+expect(start() === 0, 'Wrong exit code');
+expect(wasm.pick(7) === 14, 'Wrong result for 7');
+)");
+}
+
+TEST_CASE("Arrays live on a stack in linear memory", "[wasm]")
+{
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "pick" };
+	std::string const module = compileSource(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = pick(in i: 2i32);
+};
+
+def pick = fun(in i: i32, out result: i32)
+{
+    result = let primes: [3]i32 = [2i32, 3i32, 5i32] in primes[i];
+};)",
+		options);
+
+	Sections const sections = readSections(module);
+	REQUIRE(sections.standard.at(5) == std::string_view("\x01\x00\x01", 3));
+	// A mutable i32 stack pointer, starting at the end of the single page.
+	REQUIRE(sections.standard.at(6) == std::string_view("\x01\x7F\x01\x41\x80\x80\x04\x0B", 8));
+	// The frame traps if it wraps around past the start of memory, and the unknown index traps if out of bounds.
+	REQUIRE(containsBytes(sections.standard.at(10), { 0x4B, 0x04, 0x40, 0x00, 0x0B }));
+	REQUIRE(containsBytes(sections.standard.at(10), { 0x4F, 0x04, 0x40, 0x00, 0x0B }));
+
+	// Many calls in a row only fit if each pops its frame again.
+	requireRuns(module, R"(
+const { exports: wasm, start } = instantiate();
+expect(start() === 5, 'Wrong exit code');
+for (let call = 0; call < 100000; ++call) {
+    expect(wasm.pick(call % 3) === [2, 3, 5][call % 3], `Wrong element in call ${call}`);
+}
+for (const index of [3, -1]) {
+    let trapped = false;
+    try {
+        wasm.pick(index);
+    } catch (e) {
+        trapped = e instanceof WebAssembly.RuntimeError;
+    }
+    expect(trapped, `Index ${index} did not trap`);
+}
+)");
+
+	// Indices proven in bounds are not checked.
+	std::string const proven = compileSource(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let primes: [3]i32 = [2i32, 3i32, 5i32] in loop i from 0i32 to 3i32 with sum = 0i32 { sum + primes[i] };
+};)");
+	REQUIRE_FALSE(containsBytes(readSections(proven).standard.at(10), { 0x4F, 0x04, 0x40, 0x00, 0x0B }));
+	requireRuns(proven, "expect(instantiate().start() === 10, 'Wrong exit code');");
+}
+
+TEST_CASE("The array stack starts at the end of memories of 2 GiB and more", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = let primes: [3]i32 = [2i32, 3i32, 5i32] in primes[2i32];
+};)";
+	jereq::CompileOptions options;
+	// 2 GiB is written as the most negative i32 constant.
+	options.initialMemoryPages = 32768;
+	std::string const twoGiB = compileSource(input, options);
+	REQUIRE(readSections(twoGiB).standard.at(6) == std::string_view("\x01\x7F\x01\x41\x80\x80\x80\x80\x78\x0B", 10));
+	requireRuns(twoGiB, "expect(instantiate().start() === 5, 'Wrong exit code');");
+
+	// The end of 4 GiB is past the largest address, so the stack starts one word lower.
+	options.initialMemoryPages = 65536;
+	std::string const fourGiB = compileSource(input, options);
+	REQUIRE(readSections(fourGiB).standard.at(6) == std::string_view("\x01\x7F\x01\x41\x7C\x0B", 6));
+	requireRuns(fourGiB, "expect(instantiate().start() === 5, 'Wrong exit code');");
+}
+
+TEST_CASE("Batch entry points skip functions that do not take rows", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = scale(in x: 1i32);
+};
+
+def scale = fun(in x: i32, out result: i32)
+{
+    result = x * 3i32;
+};
+
+def widen = fun(in x: i64, out result: i64)
+{
+    result = x * 3i64;
+};)";
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "scale", "widen" };
+	options.batchEntryPoints = true;
+	std::string const module = compileSource(input, options);
+
+	std::string_view const exports = readSections(module).standard.at(7);
+	REQUIRE(exports.find("batch_scale") != std::string_view::npos);
+	REQUIRE(exports.find("batch_widen") == std::string_view::npos);
+	requireValid(module);
+
+	// Explicitly mapped functions must fit the row layout.
+	jereq::CompileOptions mapOptions;
+	mapOptions.mappedFunctions = { "widen" };
+	jereq::Program const program = jereq::parse(input, "test name");
+	std::ostringstream out;
+	REQUIRE_THROWS_WITH(jereq::compile(program, out, mapOptions),
+		"Array entry points need i32 parameters and exactly one out parameter: widen");
+}
+
+TEST_CASE("Batch entry points keep i64 literals out of vector code", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = gate(in x: 1i32);
+};
+
+def gate = fun(in x: i32, out result: i32)
+{
+    result = (4294967296i64 > 1i64) * x;
+};)";
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "gate" };
+	options.batchEntryPoints = true;
+	std::string const module = compileSource(input, options);
+
+	// The literal would be truncated to 0 in an i32 lane, so the rows are computed by the scalar function.
+	REQUIRE_FALSE(containsBytes(readSections(module).standard.at(10), { 0xFD, 0xB5, 0x01 }));
+	requireRuns(module, R"(
+const { exports: wasm } = instantiate();
+const memory = new Int32Array(wasm.memory.buffer);
+memory.set([5, 6, 7, 8, 9], 0);
+wasm.batch_gate(0, 64, 5);
+expect(memory.slice(16, 21).join() === [5, 6, 7, 8, 9].join(), memory.slice(16, 21).join());
+)");
+}
+
+TEST_CASE("i64 values use the i64 instructions", "[wasm]")
+{
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "mix" };
+	std::string const module = compileSource(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = if mix(in x: 5000000000i64) > 0i64 then 1i32 else 0i32;
+};
+
+def mix = fun(in x: i64, out result: i64)
+{
+    result = ((x * 3i64) + (x / 7i64)) - (x % 5i64);
+};)",
+		options);
+
+	Sections const sections = readSections(module);
+	// (i64) -> i64
+	REQUIRE(containsBytes(sections.standard.at(1), { 0x60, 0x01, 0x7E, 0x01, 0x7E }));
+	std::string_view const code = sections.standard.at(10);
+	REQUIRE(containsBytes(code, { 0x42, 0x03, 0x7E }));
+	REQUIRE(containsBytes(code, { 0x42, 0x07, 0x7F }));
+	REQUIRE(containsBytes(code, { 0x42, 0x05, 0x81 }));
+	REQUIRE(containsBytes(code, { 0x7C }));
+	REQUIRE(containsBytes(code, { 0x7D }));
+	REQUIRE(containsBytes(code, { 0x42, 0x00, 0x55 }));
+	// 5000000000 as a signed LEB128 i64 constant.
+	REQUIRE(containsBytes(code, { 0x42, 0x80, 0xE4, 0x97, 0xD0, 0x12 }));
+
+	requireRuns(module, R"(
+const { exports: wasm, start } = instantiate();
+expect(start() === 1, 'Wrong exit code');
+expect(wasm.mix(5000000000n) === 15714285714n, `mix(5000000000) = ${wasm.mix(5000000000n)}`);
+expect(wasm.mix(-9n) === -24n, `mix(-9) = ${wasm.mix(-9n)}`);
+)");
+}
+
+TEST_CASE("Host functions are imported", "[wasm]")
+{
+	std::array<jereq::HostFunctionDeclaration, 2> const hostFunctions{
+		jereq::HostFunctionDeclaration{ "lookup", "fun(in key: i32, in scale: i32, out value: i32)" },
+		jereq::HostFunctionDeclaration{ "triple", "fun(in x: i32, out value: i32)", nullptr, nullptr, "math" },
+	};
+	jereq::Program const program = jereq::parse(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = loop i from 0i32 to 4i32 with sum = triple(in x: 5i32) { sum + lookup(in scale: 10i32, in key: i) };
+};)",
+		"test name",
+		hostFunctions);
+	std::ostringstream out;
+	REQUIRE(jereq::compile(program, out));
+	std::string const module = out.str();
+
+	// proc_exit comes first, then the host functions in declaration order.
+	std::string_view const imports = readSections(module).standard.at(2);
+	REQUIRE(imports.starts_with("\x03\x16wasi_snapshot_preview1\x09proc_exit\x00"));
+	REQUIRE(imports.find(std::string_view("\x03" "env\x06lookup\x00", 12)) != std::string_view::npos);
+	REQUIRE(imports.find(std::string_view("\x04math\x06triple\x00", 13)) != std::string_view::npos);
+
+	// Arguments are passed in declaration order, whatever the order of the call.
+	requireRuns(module, R"(
+const lookup = (key, scale) => [1, 2, 3, 4][key] * scale;
+const { start } = instantiate({ env: { lookup }, math: { triple: (x) => x * 3 } });
+expect(start() === 115, 'Wrong exit code');
+)");
+}
+
+TEST_CASE("Division by constants is strength-reduced", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = divide(in x: 100i32);
+};
+
+def divide = fun(in x: i32, out result: i32)
+{
+    result = ((x / 7i32) + (x % 8i32)) + (x / -4i32);
+};)";
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "divide" };
+	std::string const module = compileSource(input, options);
+
+	std::string_view const code = readSections(module).standard.at(10);
+	// Dividing by 7 multiplies by a magic number in 64 bits and keeps the high half.
+	REQUIRE(containsBytes(code, { 0xAC, 0x42 }));
+	REQUIRE(containsBytes(code, { 0x87, 0xA7 }));
+	// Powers of two shift, biased by the sign of the dividend.
+	REQUIRE(containsBytes(code, { 0x41, 0x1F, 0x75 }));
+	REQUIRE_FALSE(containsBytes(code, { 0x41, 0x07, 0x6D }));
+	REQUIRE_FALSE(containsBytes(code, { 0x41, 0x08, 0x6F }));
+	REQUIRE_FALSE(containsBytes(code, { 0x41, 0x7C, 0x6D }));
+
+	requireRuns(module, R"(
+const { exports: wasm } = instantiate();
+for (const x of [0, 1, -1, 6, 7, -7, 8, -9, 100, -100, 2147483647, -2147483648]) {
+    const expected = (Math.trunc(x / 7) + (x % 8) + Math.trunc(x / -4)) | 0;
+    expect(wasm.divide(x) === expected, `divide(${x}) = ${wasm.divide(x)}, expected ${expected}`);
+}
+)");
+}
+
+TEST_CASE("Divisions of non-negative values by positive ranges are unsigned", "[wasm]")
+{
+	auto const source = [](std::string_view from, std::string_view to) {
+		return "def main = fun(out exitCode: i32) { exitCode = loop i from " + std::string(from) + " to "
+			 + std::string(to) + " with sum = 0i32 { (sum + (100i32 / i)) + (100i32 % i) }; };";
+	};
+
+	std::string const positive = compileSource(source("1i32", "10i32"));
+	std::string_view const positiveCode = readSections(positive).standard.at(10);
+	REQUIRE(containsBytes(positiveCode, { 0x6E }));
+	REQUIRE(containsBytes(positiveCode, { 0x70 }));
+	REQUIRE_FALSE(containsBytes(positiveCode, { 0x6D }));
+	REQUIRE_FALSE(containsBytes(positiveCode, { 0x6F }));
+	requireRuns(positive, "expect(instantiate().start() === 281 + 12, 'Wrong exit code');");
+
+	// Negative divisors keep the signed forms.
+	std::string const negative = compileSource(source("-9i32", "0i32"));
+	std::string_view const negativeCode = readSections(negative).standard.at(10);
+	REQUIRE(containsBytes(negativeCode, { 0x6D }));
+	REQUIRE(containsBytes(negativeCode, { 0x6F }));
+	REQUIRE_FALSE(containsBytes(negativeCode, { 0x6E }));
+	REQUIRE_FALSE(containsBytes(negativeCode, { 0x70 }));
+	requireRuns(negative, "expect(instantiate().start() === -281 + 12, 'Wrong exit code');");
+}
+
+TEST_CASE("Line tables attribute code to the innermost expression", "[wasm]")
+{
+	jereq::Program const program = jereq::parse(R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = twice(in x: 20i32);
+};
+
+def twice = fun(in x: i32, out result: i32)
+{
+    result = 1i32 + (x * 2i32);
+};)",
+		"test name");
+	jereq::CompileOptions options;
+	options.debugLines = true;
+	std::ostringstream out;
+	REQUIRE(jereq::compile(program, out, options));
+	std::string const module = out.str();
+
+	Sections const sections = readSections(module);
+	REQUIRE(sections.custom.contains(".debug_info"));
+	REQUIRE(sections.custom.contains(".debug_abbrev"));
+	std::vector<LineTableRow> const rows = decodeDebugLine(sections.custom.at(".debug_line"));
+
+	auto const& assignment = std::get<jereq::InitAssignment>(program.functions[1]->expression.expr);
+	auto const& sum = std::get<jereq::BinaryOpExpression>(assignment.value->expr);
+	auto const location = [&](jereq::Expression const& expression) {
+		return program.lines.locate(expression.sourceOffset.value());
+	};
+
+	// i32.mul follows its second operand, and i32.add the whole product, but both belong to their own operator.
+	std::string_view const code = sections.standard.at(10);
+	std::size_t const multiply = code.find(std::string_view("\x41\x02\x6C", 3));
+	std::size_t const add = code.find(std::string_view("\x6C\x6A", 2));
+	REQUIRE(multiply != std::string_view::npos);
+	REQUIRE(add != std::string_view::npos);
+
+	LineTableRow const multiplyRow = rowAt(rows, static_cast<std::uint32_t>(multiply + 2));
+	REQUIRE(std::pair{ multiplyRow.line, multiplyRow.column } == location(*sum.rhs));
+	LineTableRow const addRow = rowAt(rows, static_cast<std::uint32_t>(add + 1));
+	REQUIRE(std::pair{ addRow.line, addRow.column } == location(*assignment.value));
+	REQUIRE(location(*assignment.value) != location(*sum.rhs));
+
+	LineTableRow const literalRow = rowAt(rows, static_cast<std::uint32_t>(multiply));
+	REQUIRE(std::pair{ literalRow.line, literalRow.column } == std::pair<std::size_t, std::size_t>{ 9, 26 });
+	requireValid(module);
+}
+
+TEST_CASE("Profiles inline hot call sites behind a guard and order hot functions first", "[wasm]")
+{
+	std::string_view const input = R"(
+def main = fun(out exitCode: i32)
+{
+    exitCode = apply(in x: 3i32);
+};
+
+def apply = fun(in x: i32, out result: i32)
+{
+    result = scale(in factor: x, in value: x + 4i32);
+};
+
+def scale = fun(in factor: i32, in value: i32, out result: i32)
+{
+    result = (value * factor) + factor;
+};)";
+	jereq::Profile profile;
+	profile.functionCalls = { { "main", 1 }, { "apply", 10 }, { "scale", 100 } };
+	profile.callSites[{ "apply", 0 }] = jereq::CallSiteProfile{ "scale", 100, { { "factor", { 3, true } } } };
+
+	jereq::CompileOptions options;
+	options.exportedFunctions = { "apply", "scale" };
+	std::string const unprofiled = compileSource(input, options);
+	options.profile = &profile;
+	std::string const profiled = compileSource(input, options);
+
+	// Without a profile the functions keep their order and apply calls scale.
+	Sections const unprofiledSections = readSections(unprofiled);
+	auto const unprofiledExports = readFunctionExports(unprofiledSections.standard.at(7));
+	REQUIRE(unprofiledExports.at("apply") < unprofiledExports.at("scale"));
+	REQUIRE_FALSE(containsBytes(unprofiledSections.standard.at(10), { 0x41, 0x03, 0x46, 0x04, 0x7F }));
+
+	// The hottest function comes first, and the call is inlined with a copy specialized for factor 3 guarded by
+	// i32.eq and an if typed i32, falling back to the general body in the else.
+	Sections const profiledSections = readSections(profiled);
+	auto const profiledExports = readFunctionExports(profiledSections.standard.at(7));
+	REQUIRE(profiledExports.at("scale") < profiledExports.at("apply"));
+	std::string_view const code = profiledSections.standard.at(10);
+	REQUIRE(containsBytes(code, { 0x41, 0x03, 0x46, 0x04, 0x7F }));
+
+	// Both the guarded copy and the fallback compute what the call would.
+	std::string_view const script = R"(
+const { exports: wasm, start } = instantiate();
+expect(start() === 24, 'Wrong exit code');
+for (const x of [3, 5, -2, 0]) {
+    const expected = (x + 4) * x + x;
+    expect(wasm.apply(x) === expected, `apply(${x}) = ${wasm.apply(x)}, expected ${expected}`);
+}
+)";
+	requireRuns(unprofiled, script);
+	requireRuns(profiled, script);
+}